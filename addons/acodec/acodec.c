@@ -29,6 +29,7 @@ bool al_init_acodec_addon(void)
    ret &= al_register_sample_loader_f(".wav", _al_load_wav_f);
    ret &= al_register_sample_saver_f(".wav", _al_save_wav_f);
    ret &= al_register_audio_stream_loader_f(".wav", _al_load_wav_audio_stream_f);
+   ret &= _al_register_sample_decoder(".wav", &_al_wav_decoder);
 
    /* buil-in VOC loader */
    ret &= al_register_sample_loader(".voc", _al_load_voc);
@@ -39,6 +40,7 @@ bool al_init_acodec_addon(void)
    ret &= al_register_audio_stream_loader(".flac", _al_load_flac_audio_stream);
    ret &= al_register_sample_loader_f(".flac", _al_load_flac_f);
    ret &= al_register_audio_stream_loader_f(".flac", _al_load_flac_audio_stream_f);
+   ret &= _al_register_sample_decoder(".flac", &_al_flac_decoder);
 #endif
 
 #ifdef ALLEGRO_CFG_ACODEC_MODAUDIO
@@ -50,6 +52,7 @@ bool al_init_acodec_addon(void)
    ret &= al_register_audio_stream_loader(".ogg", _al_load_ogg_vorbis_audio_stream);
    ret &= al_register_sample_loader_f(".ogg", _al_load_ogg_vorbis_f);
    ret &= al_register_audio_stream_loader_f(".ogg", _al_load_ogg_vorbis_audio_stream_f);
+   ret &= _al_register_sample_decoder(".ogg", &_al_ogg_vorbis_decoder);
 #endif
 
 #ifdef ALLEGRO_CFG_ACODEC_OPUS
@@ -57,6 +60,7 @@ bool al_init_acodec_addon(void)
    ret &= al_register_audio_stream_loader(".opus", _al_load_ogg_opus_audio_stream);
    ret &= al_register_sample_loader_f(".opus", _al_load_ogg_opus_f);
    ret &= al_register_audio_stream_loader_f(".opus", _al_load_ogg_opus_audio_stream_f);
+   ret &= _al_register_sample_decoder(".opus", &_al_ogg_opus_decoder);
 #endif
 
 #ifdef ALLEGRO_CFG_ACODEC_MP3
@@ -64,6 +68,7 @@ bool al_init_acodec_addon(void)
    ret &= al_register_audio_stream_loader(".mp3", _al_load_mp3_audio_stream);
    ret &= al_register_sample_loader_f(".mp3", _al_load_mp3_f);
    ret &= al_register_audio_stream_loader_f(".mp3", _al_load_mp3_audio_stream_f);
+   ret &= _al_register_sample_decoder(".mp3", &_al_mp3_decoder);
 #endif
 
    acodec_inited = ret;
@@ -2,6 +2,7 @@
 #define __al_included_acodec_acodec_h
 
 #include "allegro5/internal/aintern_acodec_cfg.h"
+#include "allegro5/internal/aintern_audio.h"
 
 ALLEGRO_SAMPLE *_al_load_wav(const char *filename);
 ALLEGRO_SAMPLE *_al_load_wav_f(ALLEGRO_FILE *fp);
@@ -11,6 +12,7 @@ ALLEGRO_AUDIO_STREAM *_al_load_wav_audio_stream_f(ALLEGRO_FILE* f,
    size_t buffer_count, unsigned int samples);
 bool _al_save_wav(const char *filename, ALLEGRO_SAMPLE *spl);
 bool _al_save_wav_f(ALLEGRO_FILE *pf, ALLEGRO_SAMPLE *spl);
+extern const _AL_SAMPLE_DECODER_INTERFACE _al_wav_decoder;
 
 /*
  * Built-in Port of A4 Creative Voice file (.voc) Loader.
@@ -28,6 +30,7 @@ ALLEGRO_AUDIO_STREAM *_al_load_flac_audio_stream(const char *filename,
    size_t buffer_count, unsigned int samples);
 ALLEGRO_AUDIO_STREAM *_al_load_flac_audio_stream_f(ALLEGRO_FILE* f,
    size_t buffer_count, unsigned int samples);
+extern const _AL_SAMPLE_DECODER_INTERFACE _al_flac_decoder;
 #endif
 
 #ifdef ALLEGRO_CFG_ACODEC_MODAUDIO
@@ -41,6 +44,7 @@ ALLEGRO_AUDIO_STREAM *_al_load_ogg_vorbis_audio_stream(const char *filename,
    size_t buffer_count, unsigned int samples);
 ALLEGRO_AUDIO_STREAM *_al_load_ogg_vorbis_audio_stream_f(ALLEGRO_FILE* file,
    size_t buffer_count, unsigned int samples);
+extern const _AL_SAMPLE_DECODER_INTERFACE _al_ogg_vorbis_decoder;
 #endif
 
 #ifdef ALLEGRO_CFG_ACODEC_OPUS
@@ -50,6 +54,7 @@ ALLEGRO_AUDIO_STREAM *_al_load_ogg_opus_audio_stream(const char *filename,
    size_t buffer_count, unsigned int samples);
 ALLEGRO_AUDIO_STREAM *_al_load_ogg_opus_audio_stream_f(ALLEGRO_FILE* file,
    size_t buffer_count, unsigned int samples);
+extern const _AL_SAMPLE_DECODER_INTERFACE _al_ogg_opus_decoder;
 #endif
 
 #ifdef ALLEGRO_CFG_ACODEC_MP3
@@ -59,6 +64,7 @@ ALLEGRO_AUDIO_STREAM *_al_load_mp3_audio_stream(const char *filename,
    size_t buffer_count, unsigned int samples);
 ALLEGRO_AUDIO_STREAM *_al_load_mp3_audio_stream_f(ALLEGRO_FILE* f,
    size_t buffer_count, unsigned int samples);
+extern const _AL_SAMPLE_DECODER_INTERFACE _al_mp3_decoder;
 #endif
 
 #endif
@@ -21,6 +21,7 @@
 
 #include <FLAC/stream_decoder.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 ALLEGRO_DEBUG_CHANNEL("acodec")
 
@@ -360,29 +361,16 @@ static double flac_stream_get_position(ALLEGRO_AUDIO_STREAM *stream)
 }
 
 
-/*
- *  Updates 'stream' with the next chunk of data.
- *  Returns the actual number of bytes written.
+/* flac_read:
+ *  Decodes up to wanted_samples samples into data.
+ *  Returns the number of samples written.
  */
-static size_t flac_stream_update(ALLEGRO_AUDIO_STREAM *stream, void *data,
-   size_t buf_size)
+static uint64_t flac_read(FLACFILE *ff, void *data, uint64_t wanted_samples)
 {
-   int bytes_per_sample;
-   uint64_t wanted_samples;
+   int bytes_per_sample = ff->sample_size * ff->channels;
    uint64_t read_samples;
-   size_t written_bytes = 0;
+   uint64_t written_samples = 0;
    size_t read_bytes;
-   FLACFILE *ff = (FLACFILE *)stream->extra;
-
-   bytes_per_sample = ff->sample_size * ff->channels;
-   wanted_samples = buf_size / bytes_per_sample;
-
-   if (ff->streamed_samples + wanted_samples > ff->loop_end) {
-      if (ff->loop_end > ff->streamed_samples)
-         wanted_samples = ff->loop_end - ff->streamed_samples;
-      else
-         return 0;
-   }
 
    while (wanted_samples > 0) {
       read_samples = ff->decoded_samples - ff->streamed_samples;
@@ -404,16 +392,42 @@ static size_t flac_stream_update(ALLEGRO_AUDIO_STREAM *stream, void *data,
       ff->streamed_samples += read_samples;
       wanted_samples -= read_samples;
       read_bytes = read_samples * bytes_per_sample;
-      /* Copy data from the FLAC file buffer to the stream buffer. */
-      memcpy((uint8_t *)data + written_bytes, ff->buffer, read_bytes);
+      /* Copy data from the FLAC file buffer to the output buffer. */
+      memcpy((uint8_t *)data + written_samples * bytes_per_sample,
+         ff->buffer, read_bytes);
       /* Make room in the FLACFILE buffer. */
       memmove(ff->buffer, ff->buffer + read_bytes,
          ff->buffer_pos - read_bytes);
       ff->buffer_pos -= read_bytes;
-      written_bytes += read_bytes;
+      written_samples += read_samples;
+   }
+
+   return written_samples;
+}
+
+
+/*
+ *  Updates 'stream' with the next chunk of data.
+ *  Returns the actual number of bytes written.
+ */
+static size_t flac_stream_update(ALLEGRO_AUDIO_STREAM *stream, void *data,
+   size_t buf_size)
+{
+   int bytes_per_sample;
+   uint64_t wanted_samples;
+   FLACFILE *ff = (FLACFILE *)stream->extra;
+
+   bytes_per_sample = ff->sample_size * ff->channels;
+   wanted_samples = buf_size / bytes_per_sample;
+
+   if (ff->streamed_samples + wanted_samples > ff->loop_end) {
+      if (ff->loop_end > ff->streamed_samples)
+         wanted_samples = ff->loop_end - ff->streamed_samples;
+      else
+         return 0;
    }
 
-   return written_bytes;
+   return flac_read(ff, data, wanted_samples) * bytes_per_sample;
 }
 
 /* Called from al_destroy_audio_stream. */
@@ -533,6 +547,212 @@ error:
    return NULL;
 }
 
+/* Decoding a compressed sample from a FLAC file in memory. */
+static void flac_decoder_close(void *decoder)
+{
+   FLACFILE *ff = decoder;
+   ALLEGRO_FILE *fh = ff->fh;
+
+   al_free(ff->buffer);
+   flac_close(ff);
+   al_fclose(fh);
+}
+
+static void *flac_decoder_open(const void *data, size_t size,
+   ALLEGRO_SAMPLE *info)
+{
+   ALLEGRO_FILE *f = _al_acodec_open_memory(data, size);
+   FLACFILE *ff;
+
+   if (!f)
+      return NULL;
+
+   ff = flac_open(f);
+   if (!ff) {
+      al_fclose(f);
+      return NULL;
+   }
+
+   info->depth = _al_word_size_to_depth_conf(ff->sample_size);
+   info->chan_conf = _al_count_to_channel_conf(ff->channels);
+   info->frequency = ff->sample_rate;
+   info->len = ff->total_samples;
+
+   return ff;
+}
+
+static unsigned int flac_decoder_read(void *decoder, void *buf,
+   unsigned int samples)
+{
+   return flac_read(decoder, buf, samples);
+}
+
+static bool flac_decoder_seek(void *decoder, unsigned int pos)
+{
+   FLACFILE *ff = decoder;
+
+   /* The decoder may already deliver the samples from pos on while it
+    * seeks, so reset the buffer first.
+    */
+   lib.FLAC__stream_decoder_flush(ff->decoder);
+   ff->buffer_pos = 0;
+   ff->streamed_samples = pos;
+   ff->decoded_samples = pos;
+
+   return lib.FLAC__stream_decoder_seek_absolute(ff->decoder, pos);
+}
+
+const _AL_SAMPLE_DECODER_INTERFACE _al_flac_decoder =
+{
+   flac_decoder_open,
+   flac_decoder_read,
+   flac_decoder_seek,
+   flac_decoder_close,
+   NULL
+};
+
+
+/* Long files are decoded on several threads, each decoding at least this
+ * many samples.
+ */
+#define MIN_SAMPLES_PER_THREAD  (1 << 18)
+#define MAX_DECODE_THREADS      8
+
+typedef struct FLAC_DECODE_JOB {
+   const void *data;
+   size_t size;
+   uint64_t start;
+   uint64_t count;
+   char *dest;
+   bool ok;
+} FLAC_DECODE_JOB;
+
+/* decode_range:
+ *  Decode the samples of a job with a decoder of its own, which copies them
+ *  from its frame buffer into the job's part of the sample buffer.  FLAC
+ *  frames are independent, so after seeking to the start of the range,
+ *  which uses the seektable if there is one, the result is the same as when
+ *  decoding the whole file in one go.
+ */
+static void *decode_range(ALLEGRO_THREAD *thread, void *arg)
+{
+   FLAC_DECODE_JOB *job = arg;
+   ALLEGRO_SAMPLE info;
+   FLACFILE *ff;
+
+   (void)thread;
+
+   ff = flac_decoder_open(job->data, job->size, &info);
+   if (!ff)
+      return NULL;
+
+   if (job->start == 0 || flac_decoder_seek(ff, job->start))
+      job->ok = (flac_read(ff, job->dest, job->count) == job->count);
+
+   flac_decoder_close(ff);
+   return NULL;
+}
+
+/* max_decode_threads:
+ *  The flac_decode_threads setting, or the CPU count.
+ */
+static int max_decode_threads(void)
+{
+   const char *value = al_get_config_value(al_get_system_config(), "audio",
+      "flac_decode_threads");
+   int n;
+
+   if (value && value[0] != '\0')
+      n = strtol(value, NULL, 10);
+   else
+      n = al_get_cpu_count();
+   /* The CPU count is negative if it could not be determined. */
+   return _ALLEGRO_CLAMP(1, n, MAX_DECODE_THREADS);
+}
+
+/* decode_parallel:
+ *  Decode all of a long file into ff->buffer on several threads.  The file
+ *  is read into memory from data_pos on, where the FLAC stream starts.
+ *  Returns false if the file is too short or anything fails, after which
+ *  the caller still has to decode it from the current file position.
+ */
+static bool decode_parallel(FLACFILE *ff, ALLEGRO_FILE *f, int64_t data_pos)
+{
+   FLAC_DECODE_JOB jobs[MAX_DECODE_THREADS];
+   ALLEGRO_THREAD *threads[MAX_DECODE_THREADS];
+   int bytes_per_sample = ff->sample_size * ff->channels;
+   int64_t fsize = al_fsize(f);
+   int64_t pos = al_ftell(f);
+   uint64_t num_jobs;
+   size_t size;
+   char *data;
+   bool ok = true;
+   int i;
+
+   num_jobs = _ALLEGRO_MIN(ff->total_samples / MIN_SAMPLES_PER_THREAD,
+      (uint64_t)max_decode_threads());
+   ASSERT(num_jobs <= MAX_DECODE_THREADS);
+   if (num_jobs < 2 || !ff->buffer || data_pos < 0 || fsize <= data_pos ||
+         pos < 0)
+      return false;
+
+   size = fsize - data_pos;
+   data = al_malloc(size);
+   if (!data)
+      return false;
+   if (!al_fseek(f, data_pos, ALLEGRO_SEEK_SET) ||
+         al_fread(f, data, size) != size) {
+      /* Let the caller's decoder go on where it stopped reading. */
+      al_fseek(f, pos, ALLEGRO_SEEK_SET);
+      al_free(data);
+      return false;
+   }
+
+   for (i = 0; i < (int)num_jobs; i++) {
+      FLAC_DECODE_JOB *job = &jobs[i];
+      job->data = data;
+      job->size = size;
+      job->start = ff->total_samples * i / num_jobs;
+      job->count = ff->total_samples * (i + 1) / num_jobs - job->start;
+      job->dest = ff->buffer + job->start * bytes_per_sample;
+      job->ok = false;
+   }
+
+   /* This thread decodes the last range itself. */
+   for (i = 0; i < (int)num_jobs - 1; i++) {
+      threads[i] = al_create_thread(decode_range, &jobs[i]);
+      if (threads[i])
+         al_start_thread(threads[i]);
+   }
+   decode_range(NULL, &jobs[num_jobs - 1]);
+   for (i = 0; i < (int)num_jobs - 1; i++) {
+      if (threads[i]) {
+         al_join_thread(threads[i], NULL);
+         al_destroy_thread(threads[i]);
+      }
+      else {
+         decode_range(NULL, &jobs[i]);
+      }
+   }
+
+   for (i = 0; i < (int)num_jobs; i++)
+      ok = ok && jobs[i].ok;
+
+   if (!ok) {
+      ALLEGRO_WARN("Parallel FLAC decoding failed, decoding serially\n");
+      jobs[0].start = 0;
+      jobs[0].count = ff->total_samples;
+      jobs[0].dest = ff->buffer;
+      jobs[0].ok = false;
+      decode_range(NULL, &jobs[0]);
+      ok = jobs[0].ok;
+   }
+
+   al_free(data);
+   return ok;
+}
+
+
 ALLEGRO_SAMPLE *_al_load_flac(const char *filename)
 {
    ALLEGRO_FILE *f;
@@ -556,6 +776,7 @@ ALLEGRO_SAMPLE *_al_load_flac_f(ALLEGRO_FILE *f)
 {
    ALLEGRO_SAMPLE *sample;
    FLACFILE *ff;
+   int64_t data_pos = al_ftell(f);
 
    ff = flac_open(f);
    if (!ff) {
@@ -565,7 +786,9 @@ ALLEGRO_SAMPLE *_al_load_flac_f(ALLEGRO_FILE *f)
    ff->buffer_size = ff->total_samples * ff->channels * ff->sample_size;
    ff->buffer = al_malloc(ff->buffer_size);
 
-   lib.FLAC__stream_decoder_process_until_end_of_stream(ff->decoder);
+   if (!decode_parallel(ff, f, data_pos)) {
+      lib.FLAC__stream_decoder_process_until_end_of_stream(ff->decoder);
+   }
 
    sample = al_create_sample(ff->buffer, ff->total_samples, ff->sample_rate,
       _al_word_size_to_depth_conf(ff->sample_size),
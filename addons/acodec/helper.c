@@ -1,3 +1,6 @@
+#include <stdio.h>
+#include <string.h>
+
 #include "allegro5/allegro.h"
 #include "allegro5/allegro_audio.h"
 #include "allegro5/internal/aintern.h"
@@ -34,3 +37,150 @@ void _al_acodec_stop_feed_thread(ALLEGRO_AUDIO_STREAM *stream)
 
    stream->feed_thread = NULL;
 }
+
+
+/* A read-only file in memory, for decoding compressed samples. */
+typedef struct MEMORY_FILE
+{
+   const char *data;
+   int64_t size;
+   int64_t pos;
+   bool eof;
+} MEMORY_FILE;
+
+static bool memory_fclose(ALLEGRO_FILE *f)
+{
+   al_free(al_get_file_userdata(f));
+   return true;
+}
+
+static size_t memory_fread(ALLEGRO_FILE *f, void *ptr, size_t size)
+{
+   MEMORY_FILE *mf = al_get_file_userdata(f);
+   size_t n = size;
+
+   if ((int64_t)n > mf->size - mf->pos) {
+      n = mf->size - mf->pos;
+      mf->eof = true;
+   }
+   memcpy(ptr, mf->data + mf->pos, n);
+   mf->pos += n;
+
+   return n;
+}
+
+static size_t memory_fwrite(ALLEGRO_FILE *f, const void *ptr, size_t size)
+{
+   (void)f;
+   (void)ptr;
+   (void)size;
+   return 0;
+}
+
+static bool memory_fflush(ALLEGRO_FILE *f)
+{
+   (void)f;
+   return true;
+}
+
+static int64_t memory_ftell(ALLEGRO_FILE *f)
+{
+   MEMORY_FILE *mf = al_get_file_userdata(f);
+   return mf->pos;
+}
+
+static bool memory_fseek(ALLEGRO_FILE *f, int64_t offset, int whence)
+{
+   MEMORY_FILE *mf = al_get_file_userdata(f);
+   int64_t pos;
+
+   switch (whence) {
+      case ALLEGRO_SEEK_SET: pos = offset; break;
+      case ALLEGRO_SEEK_CUR: pos = mf->pos + offset; break;
+      case ALLEGRO_SEEK_END: pos = mf->size + offset; break;
+      default: return false;
+   }
+   if (pos < 0 || pos > mf->size)
+      return false;
+
+   mf->pos = pos;
+   mf->eof = false;
+   return true;
+}
+
+static bool memory_feof(ALLEGRO_FILE *f)
+{
+   MEMORY_FILE *mf = al_get_file_userdata(f);
+   return mf->eof;
+}
+
+static int memory_ferror(ALLEGRO_FILE *f)
+{
+   (void)f;
+   return 0;
+}
+
+static const char *memory_ferrmsg(ALLEGRO_FILE *f)
+{
+   (void)f;
+   return "";
+}
+
+static void memory_fclearerr(ALLEGRO_FILE *f)
+{
+   MEMORY_FILE *mf = al_get_file_userdata(f);
+   mf->eof = false;
+}
+
+static int memory_fungetc(ALLEGRO_FILE *f, int c)
+{
+   MEMORY_FILE *mf = al_get_file_userdata(f);
+
+   if (mf->pos == 0)
+      return EOF;
+   mf->pos--;
+   mf->eof = false;
+   return c;
+}
+
+static off_t memory_fsize(ALLEGRO_FILE *f)
+{
+   MEMORY_FILE *mf = al_get_file_userdata(f);
+   return mf->size;
+}
+
+static const ALLEGRO_FILE_INTERFACE memory_vtable =
+{
+   NULL,
+   memory_fclose,
+   memory_fread,
+   memory_fwrite,
+   memory_fflush,
+   memory_ftell,
+   memory_fseek,
+   memory_feof,
+   memory_ferror,
+   memory_ferrmsg,
+   memory_fclearerr,
+   memory_fungetc,
+   memory_fsize
+};
+
+/* _al_acodec_open_memory:
+ *  Open size bytes at data as a read-only file.  The data is not copied.
+ */
+ALLEGRO_FILE *_al_acodec_open_memory(const void *data, size_t size)
+{
+   MEMORY_FILE *mf = al_calloc(1, sizeof(*mf));
+   ALLEGRO_FILE *f;
+
+   if (!mf)
+      return NULL;
+   mf->data = data;
+   mf->size = size;
+
+   f = al_create_file_handle(&memory_vtable, mf);
+   if (!f)
+      al_free(mf);
+   return f;
+}
@@ -3,5 +3,6 @@
 
 void _al_acodec_start_feed_thread(ALLEGRO_AUDIO_STREAM *stream);
 void _al_acodec_stop_feed_thread(ALLEGRO_AUDIO_STREAM *stream);
+ALLEGRO_FILE *_al_acodec_open_memory(const void *data, size_t size);
 
 #endif
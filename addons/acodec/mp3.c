@@ -5,6 +5,9 @@
  */
 
 
+#include <float.h>
+#include <limits.h>
+
 #include "allegro5/allegro.h"
 #include "allegro5/allegro_acodec.h"
 #include "allegro5/allegro_audio.h"
@@ -39,8 +42,15 @@ typedef struct MP3FILE
 
    int* frame_offsets;        /* in bytes */
    int num_frames;
+   int frame_offset_capacity;
    int frame_samples;         /* in samples, same across all frames */
 
+   mp3dec_t scan_dec;         /* finds the frames to add to frame_offsets */
+   int scan_offset;           /* first byte not indexed yet */
+   bool scan_done;            /* frame_offsets covers the whole file */
+   bool shared_index;         /* frame_offsets belongs to another decoder */
+   ALLEGRO_THREAD *index_thread; /* indexes the whole file of a stream */
+
    int freq;
    ALLEGRO_CHANNEL_CONF chan_conf;
 } MP3FILE;
@@ -126,18 +136,83 @@ ALLEGRO_AUDIO_STREAM *_al_load_mp3_audio_stream(const char *filename, size_t buf
 }
 #include <stdio.h>
 
-static bool mp3_stream_seek(ALLEGRO_AUDIO_STREAM * stream, double time)
+/* mp3_scan_frames:
+ *  Goes through the frames of the file buffer to extend the offset table
+ *  until it has at least num_frames entries, or covers the whole file.
+ *  The table is built as seeking needs it, so that opening a long file does
+ *  not have to go through all of it.  file_samples is only the length of the
+ *  whole file once scan_done is set.  Streams have the whole file indexed on
+ *  a thread of their own instead, see mp3_index_thread_func.
+ */
+static bool mp3_scan_frames(MP3FILE *mp3file, int num_frames)
+{
+   while (!mp3file->scan_done && mp3file->num_frames < num_frames) {
+      if (mp3file->num_frames + 1 > mp3file->frame_offset_capacity) {
+         int capacity = mp3file->num_frames * 3 / 2 + 64;
+         int *offsets = al_realloc(mp3file->frame_offsets,
+            sizeof(int) * capacity);
+         if (!offsets) {
+            ALLEGRO_WARN("Out of memory indexing frames.\n");
+            return false;
+         }
+         mp3file->frame_offsets = offsets;
+         mp3file->frame_offset_capacity = capacity;
+      }
+
+      mp3dec_frame_info_t frame_info;
+      int frame_samples = mp3dec_decode_frame(&mp3file->scan_dec,
+         mp3file->file_buffer + mp3file->scan_offset,
+         mp3file->file_size - mp3file->scan_offset, NULL, &frame_info);
+      if (frame_samples == 0) {
+         if (mp3file->num_frames == 0) {
+            ALLEGRO_WARN("Could not decode the first frame.\n");
+            return false;
+         }
+         else {
+            ALLEGRO_DEBUG("Indexed %d frames\n", mp3file->num_frames);
+            mp3file->scan_done = true;
+            break;
+         }
+      }
+      /* Grab the file information from the first frame. */
+      if (mp3file->num_frames == 0) {
+         ALLEGRO_DEBUG("Channels %d, frequency %d\n", frame_info.channels, frame_info.hz);
+         mp3file->chan_conf = _al_count_to_channel_conf(frame_info.channels);
+         mp3file->freq = frame_info.hz;
+         mp3file->frame_samples = frame_samples;
+      }
+
+      mp3file->frame_offsets[mp3file->num_frames] = mp3file->scan_offset;
+      mp3file->num_frames += 1;
+      mp3file->scan_offset += frame_info.frame_bytes;
+      mp3file->file_samples += frame_samples;
+   }
+   return true;
+}
+
+
+/* mp3_index_open:
+ *  Starts the offset table with the first frame, which tells the format.
+ */
+static bool mp3_index_open(MP3FILE *mp3file)
+{
+   mp3dec_init(&mp3file->scan_dec);
+   return mp3_scan_frames(mp3file, 1);
+}
+
+/* mp3_seek:
+ *  Moves to file_pos, in samples, decoding the frame it is in.
+ */
+static bool mp3_seek(MP3FILE *mp3file, int file_pos)
 {
-   MP3FILE *mp3file = (MP3FILE *) stream->extra;
-   int file_pos = time * mp3file->freq;
    int frame = file_pos / mp3file->frame_samples;
    /* It is necessary to start decoding a little earlier than where we are
     * seeking to, because frames will reuse decoder state from previous frames.
     * minimp3 assures us that 10 frames is sufficient. */
    int sync_frame = _ALLEGRO_MAX(0, frame - 10);
    int frame_pos = file_pos - frame * mp3file->frame_samples;
-   if (frame < 0 || frame > mp3file->num_frames) {
-      ALLEGRO_WARN("Seeking outside the stream bounds: %f\n", time);
+   if (file_pos < 0 || !mp3_scan_frames(mp3file, frame + 1) ||
+         frame >= mp3file->num_frames) {
       return false;
    }
    int frame_offset = mp3file->frame_offsets[frame];
@@ -159,6 +234,78 @@ static bool mp3_stream_seek(ALLEGRO_AUDIO_STREAM * stream, double time)
    return true;
 }
 
+/* mp3_index_thread_func:
+ *  Indexes the whole file of a stream into a table of its own.  The stream
+ *  callbacks run with the stream locked, which is the mixer's mutex once the
+ *  stream is attached, so they must not do this themselves.
+ */
+static void *mp3_index_thread_func(ALLEGRO_THREAD *thread, void *arg)
+{
+   const MP3FILE *mp3file = arg;
+   MP3FILE *index;
+   (void)thread;
+
+   index = al_calloc(1, sizeof(MP3FILE));
+   if (!index)
+      return NULL;
+
+   /* The file buffer is not changed while the stream exists. */
+   index->file_buffer = mp3file->file_buffer;
+   index->file_size = mp3file->file_size;
+
+   if (!mp3_index_open(index) || !mp3_scan_frames(index, INT_MAX)) {
+      al_free(index->frame_offsets);
+      al_free(index);
+      return NULL;
+   }
+
+   return index;
+}
+
+/* mp3_wait_for_index:
+ *  Takes over the table of the index thread, waiting for it if it has not
+ *  finished yet.  If it failed, the table is still built as seeking needs
+ *  it.
+ */
+static void mp3_wait_for_index(MP3FILE *mp3file)
+{
+   MP3FILE *index = NULL;
+
+   if (!mp3file->index_thread)
+      return;
+
+   al_join_thread(mp3file->index_thread, (void **)&index);
+   al_destroy_thread(mp3file->index_thread);
+   mp3file->index_thread = NULL;
+
+   if (!index)
+      return;
+
+   al_free(mp3file->frame_offsets);
+   mp3file->frame_offsets = index->frame_offsets;
+   mp3file->num_frames = index->num_frames;
+   mp3file->frame_offset_capacity = index->frame_offset_capacity;
+   mp3file->file_samples = index->file_samples;
+   mp3file->scan_offset = index->scan_offset;
+   mp3file->scan_done = true;
+   al_free(index);
+}
+
+static bool mp3_stream_seek(ALLEGRO_AUDIO_STREAM * stream, double time)
+{
+   MP3FILE *mp3file = (MP3FILE *) stream->extra;
+   int file_pos = time * mp3file->freq;
+
+   if (file_pos / mp3file->frame_samples >= mp3file->num_frames)
+      mp3_wait_for_index(mp3file);
+
+   if (!mp3_seek(mp3file, file_pos)) {
+      ALLEGRO_WARN("Seeking outside the stream bounds: %f\n", time);
+      return false;
+   }
+   return true;
+}
+
 static bool mp3_stream_rewind(ALLEGRO_AUDIO_STREAM *stream)
 {
    MP3FILE *mp3file = (MP3FILE *) stream->extra;
@@ -177,6 +324,8 @@ static double mp3_stream_get_length(ALLEGRO_AUDIO_STREAM * stream)
 {
    MP3FILE *mp3file = (MP3FILE *) stream->extra;
 
+   mp3_wait_for_index(mp3file);
+   mp3_scan_frames(mp3file, INT_MAX);
    return (double)mp3file->file_samples / mp3file->freq;
 }
 
@@ -242,11 +391,125 @@ static size_t mp3_stream_update(ALLEGRO_AUDIO_STREAM *stream, void *data,
    return samples_read * sample_size;
 }
 
+/* Decoding a compressed sample from an MP3 file in memory. */
+static void mp3_decoder_close(void *decoder)
+{
+   MP3FILE *mp3file = decoder;
+
+   /* The file buffer belongs to the sample. */
+   if (!mp3file->shared_index)
+      al_free(mp3file->frame_offsets);
+   al_free(mp3file);
+}
+
+static void *mp3_decoder_open(const void *data, size_t size,
+   ALLEGRO_SAMPLE *info)
+{
+   MP3FILE *mp3file = al_calloc(sizeof(MP3FILE), 1);
+   if (!mp3file)
+      return NULL;
+
+   mp3dec_init(&mp3file->dec);
+   mp3file->file_buffer = (uint8_t *)data;
+   mp3file->file_size = size;
+
+   if (!mp3_index_open(mp3file) || !mp3_scan_frames(mp3file, INT_MAX) ||
+         !mp3_seek(mp3file, 0)) {
+      mp3_decoder_close(mp3file);
+      return NULL;
+   }
+
+   info->depth = _al_word_size_to_depth_conf(sizeof(mp3d_sample_t));
+   info->chan_conf = mp3file->chan_conf;
+   info->frequency = mp3file->freq;
+   info->len = mp3file->file_samples;
+
+   return mp3file;
+}
+
+/* The whole file was indexed when the decoder was opened, so a clone can
+ * share the index, which is never changed again.
+ */
+static void *mp3_decoder_clone(const void *decoder)
+{
+   const MP3FILE *orig = decoder;
+   MP3FILE *mp3file;
+
+   ASSERT(orig->scan_done);
+
+   mp3file = al_malloc(sizeof(MP3FILE));
+   if (!mp3file)
+      return NULL;
+
+   *mp3file = *orig;
+   mp3file->shared_index = true;
+   mp3dec_init(&mp3file->dec);
+
+   if (!mp3_seek(mp3file, 0)) {
+      mp3_decoder_close(mp3file);
+      return NULL;
+   }
+
+   return mp3file;
+}
+
+static unsigned int mp3_decoder_read(void *decoder, void *buf,
+   unsigned int samples)
+{
+   MP3FILE *mp3file = decoder;
+   int channels = al_get_channel_count(mp3file->chan_conf);
+   mp3d_sample_t *out = buf;
+   unsigned int samples_read = 0;
+
+   while (samples_read < samples) {
+      int samples_from_this_frame = _ALLEGRO_MIN(
+         mp3file->frame_samples - mp3file->frame_pos,
+         (int)(samples - samples_read)
+      );
+      memcpy(out + samples_read * channels,
+         mp3file->frame_buffer + mp3file->frame_pos * channels,
+         samples_from_this_frame * channels * sizeof(mp3d_sample_t));
+
+      mp3file->frame_pos += samples_from_this_frame;
+      mp3file->file_pos += samples_from_this_frame;
+      samples_read += samples_from_this_frame;
+
+      if (mp3file->frame_pos >= mp3file->frame_samples) {
+         mp3dec_frame_info_t frame_info;
+         int frame_samples = mp3dec_decode_frame(&mp3file->dec,
+            mp3file->file_buffer + mp3file->next_frame_offset,
+            mp3file->file_size - mp3file->next_frame_offset,
+            mp3file->frame_buffer, &frame_info);
+         if (frame_samples == 0)
+            break;
+         mp3file->frame_pos = 0;
+         mp3file->next_frame_offset += frame_info.frame_bytes;
+      }
+   }
+
+   return samples_read;
+}
+
+static bool mp3_decoder_seek(void *decoder, unsigned int pos)
+{
+   return mp3_seek(decoder, pos);
+}
+
+const _AL_SAMPLE_DECODER_INTERFACE _al_mp3_decoder =
+{
+   mp3_decoder_open,
+   mp3_decoder_read,
+   mp3_decoder_seek,
+   mp3_decoder_close,
+   mp3_decoder_clone
+};
+
 static void mp3_stream_close(ALLEGRO_AUDIO_STREAM *stream)
 {
    MP3FILE *mp3file = (MP3FILE *) stream->extra;
 
    _al_acodec_stop_feed_thread(stream);
+   mp3_wait_for_index(mp3file);
 
    al_free(mp3file->frame_offsets);
    al_free(mp3file->file_buffer);
@@ -276,43 +539,10 @@ ALLEGRO_AUDIO_STREAM *_al_load_mp3_audio_stream_f(ALLEGRO_FILE* f, size_t buffer
    }
    al_fclose(f);
 
-   /* Go through all the frames, to build the offset table. */
-   int frame_offset_capacity = 0;
-   int offset_so_far = 0;
-   while (true) {
-      if (mp3file->num_frames + 1 > frame_offset_capacity) {
-         frame_offset_capacity = mp3file->num_frames * 3 / 2  + 1;
-         mp3file->frame_offsets = al_realloc(mp3file->frame_offsets,
-            sizeof(int) * frame_offset_capacity);
-      }
-
-      mp3dec_frame_info_t frame_info;
-      int frame_samples = mp3dec_decode_frame(&mp3file->dec,
-         mp3file->file_buffer + offset_so_far,
-         mp3file->file_size - offset_so_far, NULL, &frame_info);
-      if (frame_samples == 0) {
-         if (mp3file->num_frames == 0) {
-            ALLEGRO_WARN("Could not decode the first frame.\n");
-            goto failure;
-         }
-         else {
-            break;
-         }
-      }
-      /* Grab the file information from the first frame. */
-      if (offset_so_far == 0) {
-         ALLEGRO_DEBUG("Channels %d, frequency %d\n", frame_info.channels, frame_info.hz);
-         mp3file->chan_conf = _al_count_to_channel_conf(frame_info.channels);
-         mp3file->freq = frame_info.hz;
-         mp3file->frame_samples = frame_samples;
-      }
-
-      mp3file->frame_offsets[mp3file->num_frames] = offset_so_far;
-      mp3file->num_frames += 1;
-      offset_so_far += frame_info.frame_bytes;
-      mp3file->file_samples += frame_samples;
-   }
-   mp3file->loop_end = (double)mp3file->file_samples * mp3file->freq;
+   if (!mp3_index_open(mp3file))
+      goto failure;
+   /* The length is only known once all frames are indexed. */
+   mp3file->loop_end = DBL_MAX;
 
    ALLEGRO_AUDIO_STREAM *stream = al_create_audio_stream(
       buffer_count, samples, mp3file->freq,
@@ -334,13 +564,16 @@ ALLEGRO_AUDIO_STREAM *_al_load_mp3_audio_stream_f(ALLEGRO_FILE* f, size_t buffer
 
    mp3_stream_rewind(stream);
 
+   mp3file->index_thread = al_create_thread(mp3_index_thread_func, mp3file);
+   if (mp3file->index_thread)
+      al_start_thread(mp3file->index_thread);
+
    _al_acodec_start_feed_thread(stream);
 
    return stream;
 failure:
    al_free(mp3file->frame_offsets);
    al_free(mp3file->file_buffer);
-   al_free(mp3file->frame_buffer);
    al_free(mp3file);
    return NULL;
 }
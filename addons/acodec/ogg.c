@@ -50,6 +50,7 @@ static struct
 {
    int (*ov_clear)(OggVorbis_File *);
    ogg_int64_t (*ov_pcm_total)(OggVorbis_File *, int);
+   int (*ov_pcm_seek)(OggVorbis_File *, ogg_int64_t);
    vorbis_info *(*ov_info)(OggVorbis_File *, int);
 #ifndef TREMOR
    int (*ov_open_callbacks)(void *, OggVorbis_File *, const char *, long, ov_callbacks);
@@ -118,6 +119,7 @@ static bool init_dynlib(void)
    INITSYM(ov_clear);
    INITSYM(ov_open_callbacks);
    INITSYM(ov_pcm_total);
+   INITSYM(ov_pcm_seek);
    INITSYM(ov_info);
 #ifndef TREMOR
    INITSYM(ov_time_total);
@@ -306,6 +308,109 @@ ALLEGRO_SAMPLE *_al_load_ogg_vorbis_f(ALLEGRO_FILE *file)
 }
 
 
+/* Decoding a compressed sample from an Ogg Vorbis file in memory. */
+typedef struct OGG_DECODER
+{
+   OggVorbis_File vf;
+   AL_OV_DATA ov;
+   int channels;
+} OGG_DECODER;
+
+static void *ogg_decoder_open(const void *data, size_t size,
+   ALLEGRO_SAMPLE *info)
+{
+   OGG_DECODER *od;
+   vorbis_info *vi;
+
+   if (!init_dynlib()) {
+      return NULL;
+   }
+
+   od = al_calloc(1, sizeof(*od));
+   if (!od)
+      return NULL;
+
+   od->ov.file = _al_acodec_open_memory(data, size);
+   if (!od->ov.file) {
+      al_free(od);
+      return NULL;
+   }
+
+   if (lib.ov_open_callbacks(&od->ov, &od->vf, NULL, 0, callbacks) < 0) {
+      ALLEGRO_ERROR("Audio file does not appear to be an Ogg bitstream.\n");
+      al_fclose(od->ov.file);
+      al_free(od);
+      return NULL;
+   }
+
+   vi = lib.ov_info(&od->vf, -1);
+   od->channels = vi->channels;
+
+   info->depth = _al_word_size_to_depth_conf(2);
+   info->chan_conf = _al_count_to_channel_conf(vi->channels);
+   info->frequency = vi->rate;
+   info->len = lib.ov_pcm_total(&od->vf, -1);
+
+   return od;
+}
+
+static unsigned int ogg_decoder_read(void *decoder, void *buf,
+   unsigned int samples)
+{
+#ifdef ALLEGRO_LITTLE_ENDIAN
+   const int endian = 0; /* 0 for Little-Endian, 1 for Big-Endian */
+#else
+   const int endian = 1; /* 0 for Little-Endian, 1 for Big-Endian */
+#endif
+   OGG_DECODER *od = decoder;
+   const int frame_size = od->channels * 2;
+   long total_size = (long)samples * frame_size;
+   long pos = 0;
+   int bitstream = -1;
+
+   while (pos < total_size) {
+      long read;
+#ifndef TREMOR
+      read = lib.ov_read(&od->vf, (char *)buf + pos, total_size - pos,
+         endian, 2, 1, &bitstream);
+#else
+      (void)endian;
+      read = lib.ov_read(&od->vf, (char *)buf + pos, total_size - pos,
+         &bitstream);
+#endif
+      if (read <= 0)
+         break;
+      pos += read;
+   }
+
+   return pos / frame_size;
+}
+
+static bool ogg_decoder_seek(void *decoder, unsigned int pos)
+{
+   OGG_DECODER *od = decoder;
+   return lib.ov_pcm_seek(&od->vf, pos) == 0;
+}
+
+static void ogg_decoder_close(void *decoder)
+{
+   OGG_DECODER *od = decoder;
+
+   lib.ov_clear(&od->vf);
+   al_fclose(od->ov.file);
+   al_free(od);
+}
+
+const _AL_SAMPLE_DECODER_INTERFACE _al_ogg_vorbis_decoder =
+{
+   ogg_decoder_open,
+   ogg_decoder_read,
+   ogg_decoder_seek,
+   ogg_decoder_close,
+   NULL
+};
+
+
 static bool ogg_stream_seek(ALLEGRO_AUDIO_STREAM *stream, double time)
 {
    AL_OV_DATA *extra = (AL_OV_DATA *) stream->extra;
@@ -267,6 +267,94 @@ ALLEGRO_SAMPLE *_al_load_ogg_opus_f(ALLEGRO_FILE *file)
 }
 
 
+/* Decoding a compressed sample from an Ogg Opus file in memory. */
+typedef struct OPUS_DECODER
+{
+   OggOpusFile *of;
+   AL_OP_DATA op;
+   int channels;
+} OPUS_DECODER;
+
+static void *opus_decoder_open(const void *data, size_t size,
+   ALLEGRO_SAMPLE *info)
+{
+   OPUS_DECODER *od;
+
+   if (!init_dynlib()) {
+      return NULL;
+   }
+
+   od = al_calloc(1, sizeof(*od));
+   if (!od)
+      return NULL;
+
+   od->op.file = _al_acodec_open_memory(data, size);
+   if (!od->op.file) {
+      al_free(od);
+      return NULL;
+   }
+
+   od->of = lib.op_open_callbacks(&od->op, &callbacks, NULL, 0, NULL);
+   if (!od->of) {
+      ALLEGRO_ERROR("Audio file does not appear to be an Ogg bitstream.\n");
+      al_fclose(od->op.file);
+      al_free(od);
+      return NULL;
+   }
+
+   od->channels = lib.op_channel_count(od->of, -1);
+
+   info->depth = _al_word_size_to_depth_conf(2);
+   info->chan_conf = _al_count_to_channel_conf(od->channels);
+   info->frequency = 48000;
+   info->len = lib.op_pcm_total(od->of, -1);
+
+   return od;
+}
+
+static unsigned int opus_decoder_read(void *decoder, void *buf,
+   unsigned int samples)
+{
+   OPUS_DECODER *od = decoder;
+   opus_int16 *pcm = buf;
+   unsigned int pos = 0;
+
+   while (pos < samples) {
+      int read = lib.op_read(od->of, pcm + pos * od->channels,
+         (samples - pos) * od->channels, NULL);
+      if (read <= 0)
+         break;
+      pos += read;
+   }
+
+   return pos;
+}
+
+static bool opus_decoder_seek(void *decoder, unsigned int pos)
+{
+   OPUS_DECODER *od = decoder;
+   return lib.op_pcm_seek(od->of, pos) == 0;
+}
+
+static void opus_decoder_close(void *decoder)
+{
+   OPUS_DECODER *od = decoder;
+
+   lib.op_free(od->of);
+   al_fclose(od->op.file);
+   al_free(od);
+}
+
+const _AL_SAMPLE_DECODER_INTERFACE _al_ogg_opus_decoder =
+{
+   opus_decoder_open,
+   opus_decoder_read,
+   opus_decoder_seek,
+   opus_decoder_close,
+   NULL
+};
+
+
 static bool ogg_stream_seek(ALLEGRO_AUDIO_STREAM *stream, double time)
 {
    AL_OP_DATA *extra = (AL_OP_DATA *) stream->extra;
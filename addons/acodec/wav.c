@@ -4,14 +4,19 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "allegro5/allegro_audio.h"
+#include "allegro5/internal/aintern.h"
 #include "allegro5/internal/aintern_audio.h"
 #include "acodec.h"
 #include "helper.h"
 
 ALLEGRO_DEBUG_CHANNEL("wav")
 
+/* Streams of PCM data up to this size are read into memory when loaded. */
+#define DEFAULT_WAV_STREAM_PRELOAD  (16 << 20)
+
 
 typedef struct WAVFILE
 {
@@ -24,6 +29,8 @@ typedef struct WAVFILE
    int samples;     /* # of samples. size = samples * sample_size */
    double loop_start;
    double loop_end;
+   char *data;      /* the whole data chunk if preloaded, or NULL */
+   int64_t data_pos; /* byte position in data */
 } WAVFILE;
 
 
@@ -50,6 +57,8 @@ static WAVFILE *wav_open(ALLEGRO_FILE *f)
    wavfile->freq = 22050;
    wavfile->bits = 8;
    wavfile->channels = 1;
+   wavfile->data = NULL;
+   wavfile->data_pos = 0;
 
    /* check the header */
    if (al_fread(f, buffer, 12) != 12) {
@@ -153,6 +162,33 @@ wav_open_error:
    return NULL;
 }
 
+/* wav_tell:
+ *  Returns the byte position from the start of the data chunk.
+ */
+static int64_t wav_tell(WAVFILE *wavfile)
+{
+   if (wavfile->data)
+      return wavfile->data_pos;
+   return al_ftell(wavfile->f) - wavfile->dpos;
+}
+
+
+/* wav_seek:
+ *  Seeks to a byte position from the start of the data chunk.
+ */
+static bool wav_seek(WAVFILE *wavfile, int64_t pos)
+{
+   if (wavfile->data) {
+      int64_t size = (int64_t)wavfile->samples * wavfile->sample_size;
+      if (pos < 0)
+         return false;
+      wavfile->data_pos = _ALLEGRO_MIN(pos, size);
+      return true;
+   }
+   return al_fseek(wavfile->f, wavfile->dpos + pos, ALLEGRO_SEEK_SET);
+}
+
+
 /* wav_read:
  *  Reads up to 'samples' number of samples from the wav ALLEGRO_FILE into 'data'.
  *  Returns the actual number of samples written to 'data'.
@@ -164,10 +200,20 @@ static size_t wav_read(WAVFILE *wavfile, void *data, size_t samples)
 
    ASSERT(wavfile);
 
-   cur_samples = (al_ftell(wavfile->f) - wavfile->dpos) / wavfile->sample_size;
+   cur_samples = wav_tell(wavfile) / wavfile->sample_size;
+   if (cur_samples >= (size_t)wavfile->samples)
+      return 0;
    if (cur_samples + samples > (size_t)wavfile->samples)
       samples = wavfile->samples - cur_samples;
 
+   /* A preloaded data chunk is already in native byte order. */
+   if (wavfile->data) {
+      bytes_read = samples * wavfile->sample_size;
+      memcpy(data, wavfile->data + wavfile->data_pos, bytes_read);
+      wavfile->data_pos += bytes_read;
+      return samples;
+   }
+
    bytes_read = al_fread(wavfile->f, data, samples * wavfile->sample_size);
 
    /* PCM data in RIFF WAV files is little endian.
@@ -197,10 +243,46 @@ static void wav_close(WAVFILE *wavfile)
 {
    ASSERT(wavfile);
 
+   al_free(wavfile->data);
    al_free(wavfile);
 }
 
 
+/* wav_preload:
+ *  Reads the whole data chunk into memory if it is no larger than the
+ *  configured limit, so that the stream can be fed without reading the file.
+ *  Returns true if it was read.
+ */
+static bool wav_preload(WAVFILE *wavfile)
+{
+   const char *value = al_get_config_value(al_get_system_config(), "audio",
+      "wav_stream_preload");
+   size_t limit = DEFAULT_WAV_STREAM_PRELOAD;
+   size_t size = (size_t)wavfile->samples * wavfile->sample_size;
+   char *data;
+
+   if (value && value[0] != '\0')
+      limit = strtoul(value, NULL, 10);
+   if (size > limit)
+      return false;
+
+   data = al_malloc(size);
+   if (!data)
+      return false;
+
+   if (wav_read(wavfile, data, wavfile->samples) != (size_t)wavfile->samples) {
+      ALLEGRO_WARN("Short data chunk, streaming from the file instead.\n");
+      al_free(data);
+      al_fseek(wavfile->f, wavfile->dpos, ALLEGRO_SEEK_SET);
+      return false;
+   }
+
+   wavfile->data = data;
+   wavfile->data_pos = 0;
+   return true;
+}
+
+
 static bool wav_stream_seek(ALLEGRO_AUDIO_STREAM * stream, double time)
 {
    WAVFILE *wavfile = (WAVFILE *) stream->extra;
@@ -209,7 +291,7 @@ static bool wav_stream_seek(ALLEGRO_AUDIO_STREAM * stream, double time)
    if (time >= wavfile->loop_end)
       return false;
    cpos += cpos % align;
-   return al_fseek(wavfile->f, wavfile->dpos + cpos, ALLEGRO_SEEK_SET);
+   return wav_seek(wavfile, cpos);
 }
 
 
@@ -228,7 +310,7 @@ static double wav_stream_get_position(ALLEGRO_AUDIO_STREAM * stream)
 {
    WAVFILE *wavfile = (WAVFILE *) stream->extra;
    double samples_per = (double)((wavfile->bits / 8) * wavfile->channels) * (double)(wavfile->freq);
-   return ((double)(al_ftell(wavfile->f) - wavfile->dpos) / samples_per);
+   return ((double)wav_tell(wavfile) / samples_per);
 }
 
 
@@ -286,7 +368,8 @@ static void wav_stream_close(ALLEGRO_AUDIO_STREAM *stream)
 {
    WAVFILE *wavfile = (WAVFILE *) stream->extra;
 
-   _al_acodec_stop_feed_thread(stream);
+   if (stream->feed_thread)
+      _al_acodec_stop_feed_thread(stream);
    
    al_fclose(wavfile->f);
    wav_close(wavfile);
@@ -347,6 +430,74 @@ ALLEGRO_SAMPLE *_al_load_wav_f(ALLEGRO_FILE *fp)
 }
 
 
+/* Decoding a compressed sample from a WAV file in memory. */
+typedef struct WAV_DECODER
+{
+   ALLEGRO_FILE *f;
+   WAVFILE *wavfile;
+} WAV_DECODER;
+
+static void wav_decoder_close(void *decoder)
+{
+   WAV_DECODER *wd = decoder;
+
+   if (wd->wavfile)
+      wav_close(wd->wavfile);
+   if (wd->f)
+      al_fclose(wd->f);
+   al_free(wd);
+}
+
+static void *wav_decoder_open(const void *data, size_t size,
+   ALLEGRO_SAMPLE *info)
+{
+   WAV_DECODER *wd = al_calloc(1, sizeof(*wd));
+
+   if (!wd)
+      return NULL;
+
+   wd->f = _al_acodec_open_memory(data, size);
+   if (wd->f)
+      wd->wavfile = wav_open(wd->f);
+   if (!wd->wavfile) {
+      wav_decoder_close(wd);
+      return NULL;
+   }
+
+   info->depth = _al_word_size_to_depth_conf(wd->wavfile->bits / 8);
+   info->chan_conf = _al_count_to_channel_conf(wd->wavfile->channels);
+   info->frequency = wd->wavfile->freq;
+   info->len = wd->wavfile->samples;
+
+   return wd;
+}
+
+static unsigned int wav_decoder_read(void *decoder, void *buf,
+   unsigned int samples)
+{
+   WAV_DECODER *wd = decoder;
+   return wav_read(wd->wavfile, buf, samples);
+}
+
+static bool wav_decoder_seek(void *decoder, unsigned int pos)
+{
+   WAV_DECODER *wd = decoder;
+   WAVFILE *wavfile = wd->wavfile;
+
+   return al_fseek(wd->f, wavfile->dpos + (int64_t)pos * wavfile->sample_size,
+      ALLEGRO_SEEK_SET);
+}
+
+const _AL_SAMPLE_DECODER_INTERFACE _al_wav_decoder =
+{
+   wav_decoder_open,
+   wav_decoder_read,
+   wav_decoder_seek,
+   wav_decoder_close,
+   NULL
+};
+
+
 /* _al_load_wav_audio_stream:
 */
 ALLEGRO_AUDIO_STREAM *_al_load_wav_audio_stream(const char *filename,
@@ -401,7 +552,20 @@ ALLEGRO_AUDIO_STREAM *_al_load_wav_audio_stream_f(ALLEGRO_FILE* f,
       stream->get_feeder_position = wav_stream_get_position;
       stream->get_feeder_length = wav_stream_get_length;
       stream->set_feeder_loop = wav_stream_set_loop;
-      _al_acodec_start_feed_thread(stream);
+
+      /* Copying preloaded PCM data into a fragment is cheap enough for the
+       * mixer to do itself.  Fill the fragments now so that the start of
+       * the stream plays as soon as it is attached.
+       */
+      if (wav_preload(wavfile)) {
+         ALLEGRO_DEBUG("Preloaded %d samples, feeding directly.\n",
+            wavfile->samples);
+         stream->feed_directly = true;
+         _al_kcm_emit_stream_events(stream);
+      }
+      else {
+         _al_acodec_start_feed_thread(stream);
+      }
    }
    else {
       ALLEGRO_ERROR("Failed to load wav stream.\n");
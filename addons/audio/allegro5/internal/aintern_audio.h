@@ -6,6 +6,7 @@
 #define AINTERN_AUDIO_H
 
 #include "allegro5/allegro.h"
+#include "allegro5/internal/aintern_atomicops.h"
 #include "allegro5/internal/aintern_list.h"
 #include "allegro5/internal/aintern_vector.h"
 #include "../allegro_audio.h"
@@ -140,6 +141,54 @@ typedef union {
    void     *ptr;
 } any_buffer_t;
 
+/* Decodes the encoded bytes of a compressed sample, see
+ * al_load_sample_compressed.  The codec addon registers one per file type
+ * with _al_register_sample_decoder.  Every sample instance playing such a
+ * sample has a decoder of its own.
+ */
+typedef struct _AL_SAMPLE_DECODER_INTERFACE {
+   void *(*open)(const void *data, size_t size, ALLEGRO_SAMPLE *info);
+                        /* Returns a decoder positioned at the first sample
+                         * value, and fills in the depth, channel
+                         * configuration, frequency and length of info.
+                         * The data stays valid until close is called.
+                         */
+   unsigned int (*read)(void *decoder, void *buf, unsigned int samples);
+                        /* Returns the number of sample values decoded. */
+   bool (*seek)(void *decoder, unsigned int pos);
+   void (*close)(void *decoder);
+   void *(*clone)(const void *decoder);
+                        /* Optional.  Returns a new decoder positioned at the
+                         * first sample value, which shares what the given
+                         * one found out about the file, e.g. where its
+                         * frames are.  The given decoder must stay open as
+                         * long as the new one.
+                         */
+} _AL_SAMPLE_DECODER_INTERFACE;
+
+typedef struct _AL_COMPRESSED_SAMPLE {
+   const _AL_SAMPLE_DECODER_INTERFACE *codec;
+   void                 *data;
+   size_t               size;
+                        /* The encoded file, owned by the sample. */
+   void                 *prototype;
+                        /* The decoder opened when the sample was created,
+                         * kept for cloning if the codec can do that.
+                         */
+   int                  plays;
+   void                 *decoded;
+                        /* The whole sample decoded, which instances share
+                         * once it has been played often or its data was
+                         * asked for.  NULL before that.
+                         */
+   ALLEGRO_THREAD       *decode_thread;
+                        /* Decodes the whole sample in the background once
+                         * it has been played often.  This, plays and
+                         * decoded are protected by the compressed sample
+                         * mutex of kcm_compressed.c.
+                         */
+} _AL_COMPRESSED_SAMPLE;
+
 struct ALLEGRO_SAMPLE {
    ALLEGRO_AUDIO_DEPTH  depth;
    ALLEGRO_CHANNEL_CONF chan_conf;
@@ -150,6 +199,10 @@ struct ALLEGRO_SAMPLE {
                         /* Whether `buffer' needs to be freed when the sample
                          * is destroyed, or when `buffer' changes.
                          */
+   _AL_COMPRESSED_SAMPLE *compressed;
+                        /* Non-NULL for compressed samples, which have no
+                         * buffer.
+                         */
    _AL_LIST_ITEM        *dtor_item;
 };
 
@@ -175,6 +228,32 @@ struct ALLEGRO_SAMPLE {
 typedef void (*stream_reader_t)(void *source, void **vbuf,
    unsigned int *samples, ALLEGRO_AUDIO_DEPTH buffer_depth, size_t dest_maxc);
 
+/* The part of a compressed sample that a sample instance is currently
+ * playing, decoded.  The mixer plays the instance from here, see
+ * read_windowed.
+ */
+#define _AL_KCM_WINDOW_SIZE   4096
+
+typedef struct _AL_SAMPLE_WINDOW {
+   const _AL_SAMPLE_DECODER_INTERFACE *codec;
+   void                 *decoder;
+   int                  next;
+                        /* The position the decoder will decode next. */
+   char                 *buffer;
+                        /* _AL_KCM_WINDOW_SIZE + 2 sample values.  The ones
+                         * from `start' to `end' are held from index 1 on,
+                         * the first and last are free for the mixer.
+                         */
+   int                  start;
+   int                  end;
+   int                  frame_pos[2];
+   char                 *frames;
+                        /* Single sample values elsewhere in the sample,
+                         * i.e. at the loop points, kept so that looping
+                         * does not need to decode them again.
+                         */
+} _AL_SAMPLE_WINDOW;
+
 typedef struct {
    union {
       ALLEGRO_MIXER     *mixer;
@@ -236,10 +315,46 @@ struct ALLEGRO_SAMPLE_INSTANCE {
    sample_parent_t      parent;
                         /* The object that this sample is attached to, if any.
                          */
+
+   int                  priority;
+   bool                 is_virtual;
+                        /* A virtual sample is playing but not mixed, only
+                         * its position advances.  The mixer decides this
+                         * for every block, see select_real_instances.
+                         */
+
+   _AL_SAMPLE_WINDOW    *window;
+                        /* Only for instances playing a compressed sample
+                         * which has not been decoded as a whole.
+                         */
+
+#ifdef _AL_HAVE_ATOMIC_CAS
+   _AL_ATOMIC           pending_updates;
+                        /* _AL_KCM_UPDATE_* flags of changes waiting in the
+                         * parent mixer's update ring.  Non-zero exactly while
+                         * the sample is in the ring.
+                         */
+#endif
+
    _AL_LIST_ITEM        *dtor_item;
 };
 
 void _al_kcm_destroy_sample(ALLEGRO_SAMPLE_INSTANCE *sample, bool unregister);
+
+ALLEGRO_KCM_AUDIO_FUNC(ALLEGRO_SAMPLE *, _al_kcm_create_compressed_sample,
+   (const _AL_SAMPLE_DECODER_INTERFACE *codec, void *data, size_t size));
+void _al_kcm_destroy_compressed_sample(ALLEGRO_SAMPLE *spl);
+void _al_kcm_init_compressed_samples(void);
+void _al_kcm_shutdown_compressed_samples(void);
+void *_al_kcm_decode_compressed_sample(_AL_COMPRESSED_SAMPLE *compressed,
+   const ALLEGRO_SAMPLE *spl);
+bool _al_kcm_set_instance_sample(ALLEGRO_SAMPLE_INSTANCE *spl,
+   ALLEGRO_SAMPLE *data);
+void _al_kcm_free_sample_window(ALLEGRO_SAMPLE_INSTANCE *spl);
+void _al_kcm_fill_sample_window(ALLEGRO_SAMPLE_INSTANCE *spl, int start,
+   int end, bool backward);
+void _al_kcm_get_sample_window_frame(ALLEGRO_SAMPLE_INSTANCE *spl, int pos,
+   int index);
 void _al_kcm_stream_set_mutex(ALLEGRO_SAMPLE_INSTANCE *stream, ALLEGRO_MUTEX *mutex);
 void _al_kcm_detach_from_parent(ALLEGRO_SAMPLE_INSTANCE *spl);
 
@@ -313,6 +428,13 @@ struct ALLEGRO_AUDIO_STREAM {
                           * streams don't need to be fed by the user.
                           */
 
+   bool                  feed_directly;
+                         /* If true, 'feeder' only copies from memory and
+                          * never blocks, so the stream is refilled by the
+                          * mixer as it uses up fragments, with no feeder
+                          * thread.
+                          */
+
    _AL_LIST_ITEM        *dtor_item;
 
    void                  *extra;
@@ -325,6 +447,34 @@ bool _al_kcm_refill_stream(ALLEGRO_AUDIO_STREAM *stream);
 typedef void (*postprocess_callback_t)(void *buf, unsigned int samples,
    void *userdata);
 
+/* What _al_kcm_mixer_update_sample has to recompute. */
+enum {
+   _AL_KCM_UPDATE_MATRIX   = 1 << 0,   /* gain or pan changed */
+   _AL_KCM_UPDATE_STEP     = 1 << 1    /* speed changed */
+};
+
+enum {
+   _AL_KCM_NOT_PREMIXED = 0,
+   _AL_KCM_PREMIXED,
+   _AL_KCM_PREMIXED_SILENT
+};
+
+typedef struct _AL_KCM_CULL_CANDIDATE {
+   ALLEGRO_SAMPLE_INSTANCE *spl;
+   float                   audibility;
+   int                     index;
+} _AL_KCM_CULL_CANDIDATE;
+
+#ifdef _AL_HAVE_ATOMIC_CAS
+/* Size of the update ring of a mixer, must be a power of two. */
+#define _AL_KCM_MIXER_UPDATES 1024
+
+typedef struct _AL_KCM_MIXER_UPDATE {
+   _AL_ATOMIC              sequence;
+   ALLEGRO_SAMPLE_INSTANCE *spl;
+} _AL_KCM_MIXER_UPDATE;
+#endif
+
 /* ALLEGRO_MIXER is derived from ALLEGRO_SAMPLE_INSTANCE. Certain internal functions and
  * pointers may take either object type, and such things are explicitly noted.
  * This is never exposed to the user, though.  The sample object's read method
@@ -344,11 +494,53 @@ struct ALLEGRO_MIXER {
                            /* Vector of ALLEGRO_SAMPLE_INSTANCE*.  Holds the list of
                             * streams being mixed together.
                             */
+
+   int                     max_real_instances;
+   float                   audibility_threshold;
+                           /* Sample instances beyond max_real_instances
+                            * (0 for no limit) or quieter than the threshold
+                            * are made virtual.
+                            */
+   int                     real_instances;
+   int                     virtual_instances;
+                           /* Counted during the last block. */
+   _AL_KCM_CULL_CANDIDATE  *candidates;
+   int                     candidates_size;
+                           /* Scratch space for select_real_instances. */
+
+   bool                    parallel;
+                           /* Mix attached sub-mixers on the worker threads. */
+   int                     premixed;
+                           /* _AL_KCM_*PREMIXED, set if the parent mixer has
+                            * already mixed this mixer's buffer in parallel.
+                            */
+   ALLEGRO_MIXER           **submixers;
+   int                     submixers_size;
+                           /* Scratch space for premix_submixers. */
+
+#ifdef _AL_HAVE_ATOMIC_CAS
+   _AL_KCM_MIXER_UPDATE    updates[_AL_KCM_MIXER_UPDATES];
+   _AL_ATOMIC              updates_head;
+   _AL_ATOMIC              updates_tail;
+                           /* Bounded lock-free ring of attached samples whose
+                            * parameters changed, applied by the mixer at the
+                            * start of the next block.  See kcm_mixer.c.
+                            */
+#endif
+
    _AL_LIST_ITEM           *dtor_item;
 };
 
 extern void _al_kcm_mixer_rejig_sample_matrix(ALLEGRO_MIXER *mixer,
    ALLEGRO_SAMPLE_INSTANCE *spl);
+extern void _al_kcm_mixer_update_sample(ALLEGRO_MIXER *mixer,
+   ALLEGRO_SAMPLE_INSTANCE *spl, int what);
+extern void _al_kcm_mixer_apply_updates(ALLEGRO_MIXER *mixer);
+
+void _al_kcm_init_mixer_pool(void);
+void _al_kcm_shutdown_mixer_pool(void);
+bool _al_kcm_run_mixer_jobs(void (*job)(void *data, int index), void *data,
+   int count);
 extern void _al_kcm_mixer_read(void *source, void **buf, unsigned int *samples,
    ALLEGRO_AUDIO_DEPTH buffer_depth, size_t dest_maxc);
 
@@ -384,6 +576,9 @@ ALLEGRO_KCM_AUDIO_FUNC(ALLEGRO_AUDIO_DEPTH, _al_word_size_to_depth_conf, (int wo
 
 ALLEGRO_KCM_AUDIO_FUNC(void, _al_emit_audio_event, (int event_type));
 
+ALLEGRO_KCM_AUDIO_FUNC(bool, _al_register_sample_decoder, (const char *ext,
+   const _AL_SAMPLE_DECODER_INTERFACE *decoder));
+
 #endif
 
 /* vim: set sts=3 sw=3 et: */
@@ -386,6 +386,8 @@ bool al_install_audio(void)
     * because the user may still create samples.
     */
    _al_kcm_init_destructors();
+   _al_kcm_init_mixer_pool();
+   _al_kcm_init_compressed_samples();
    _al_add_exit_func(al_uninstall_audio, "al_uninstall_audio");
 
    ret = do_install_audio(ALLEGRO_AUDIO_DRIVER_AUTODETECT);
@@ -405,6 +407,8 @@ void al_uninstall_audio(void)
    else {
       _al_kcm_shutdown_destructors();
    }
+   _al_kcm_shutdown_mixer_pool();
+   _al_kcm_shutdown_compressed_samples();
 }
 
 /* Function: al_is_audio_installed
@@ -27,6 +27,8 @@ struct ACODEC_TABLE
    bool              (*fs_saver)(ALLEGRO_FILE *fp, ALLEGRO_SAMPLE *spl);
    ALLEGRO_AUDIO_STREAM *(*fs_stream_loader)(ALLEGRO_FILE *fp,
                         size_t buffer_count, unsigned int samples);
+
+   const _AL_SAMPLE_DECODER_INTERFACE *decoder;
 };
 
 
@@ -79,6 +81,8 @@ static ACODEC_TABLE *add_acodec_table_entry(const char *ext)
    ent->fs_saver = NULL;
    ent->fs_stream_loader = NULL;
 
+   ent->decoder = NULL;
+
    return ent;
 }
 
@@ -247,6 +251,35 @@ bool al_register_audio_stream_loader_f(const char *ext,
 }
 
 
+/* _al_register_sample_decoder:
+ *  Register the decoder used by al_load_sample_compressed for files with
+ *  the given extension, or remove it if decoder is NULL.
+ */
+bool _al_register_sample_decoder(const char *ext,
+   const _AL_SAMPLE_DECODER_INTERFACE *decoder)
+{
+   ACODEC_TABLE *ent;
+
+   if (strlen(ext) + 1 >= MAX_EXTENSION_LENGTH) {
+      return false;
+   }
+
+   ent = find_acodec_table_entry(ext);
+   if (!decoder) {
+      if (!ent || !ent->decoder) {
+         return false; /* Nothing to remove. */
+      }
+   }
+   else if (!ent) {
+      ent = add_acodec_table_entry(ext);
+   }
+
+   ent->decoder = decoder;
+
+   return true;
+}
+
+
 /* Function: al_load_sample
  */
 ALLEGRO_SAMPLE *al_load_sample(const char *filename)
@@ -295,6 +328,97 @@ ALLEGRO_SAMPLE *al_load_sample_f(ALLEGRO_FILE* fp, const char *ident)
 }
 
 
+/* read_whole_file:
+ *  Read everything left in fp into a new buffer.
+ */
+static void *read_whole_file(ALLEGRO_FILE *fp, size_t *size)
+{
+   int64_t fsize = al_fsize(fp);
+   size_t capacity = fsize > 0 ? (size_t)(fsize - al_ftell(fp)) + 1 : 65536;
+   size_t used = 0;
+   char *data = NULL;
+
+   for (;;) {
+      char *new_data = al_realloc(data, capacity);
+      if (!new_data) {
+         al_free(data);
+         return NULL;
+      }
+      data = new_data;
+
+      used += al_fread(fp, data + used, capacity - used);
+      if (used < capacity)
+         break;
+      capacity *= 2;
+   }
+
+   if (al_ferror(fp) || used == 0) {
+      al_free(data);
+      return NULL;
+   }
+
+   *size = used;
+   return data;
+}
+
+
+/* Function: al_load_sample_compressed
+ */
+ALLEGRO_SAMPLE *al_load_sample_compressed(const char *filename)
+{
+   const char *ext;
+   ALLEGRO_FILE *fp;
+   ALLEGRO_SAMPLE *spl;
+
+   ASSERT(filename);
+   ext = strrchr(filename, '.');
+   if (ext == NULL) {
+      ALLEGRO_ERROR("Unable to determine extension for %s.\n", filename);
+      return NULL;
+   }
+
+   fp = al_fopen(filename, "rb");
+   if (!fp) {
+      ALLEGRO_ERROR("Unable to open %s for reading.\n", filename);
+      return NULL;
+   }
+
+   spl = al_load_sample_compressed_f(fp, ext);
+   al_fclose(fp);
+
+   return spl;
+}
+
+
+/* Function: al_load_sample_compressed_f
+ */
+ALLEGRO_SAMPLE *al_load_sample_compressed_f(ALLEGRO_FILE* fp,
+   const char *ident)
+{
+   ACODEC_TABLE *ent;
+   void *data;
+   size_t size;
+
+   ASSERT(fp);
+   ASSERT(ident);
+
+   ent = find_acodec_table_entry(ident);
+   if (!ent || !ent->decoder) {
+      ALLEGRO_INFO("No decoder for audio file extension %s, "
+         "loading it uncompressed.\n", ident);
+      return al_load_sample_f(fp, ident);
+   }
+
+   data = read_whole_file(fp, &size);
+   if (!data) {
+      ALLEGRO_ERROR("Unable to read the audio file.\n");
+      return NULL;
+   }
+
+   return _al_kcm_create_compressed_sample(ent->decoder, data, size);
+}
+
+
 /* Function: al_load_audio_stream
  */
 ALLEGRO_AUDIO_STREAM *al_load_audio_stream(const char *filename,
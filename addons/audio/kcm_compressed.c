@@ -0,0 +1,617 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Compressed samples, decoded while they play.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "allegro5/allegro.h"
+#include "allegro5/allegro_audio.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_audio.h"
+
+ALLEGRO_DEBUG_CHANNEL("audio")
+
+
+/* Samples which take up no more than this once decoded are decoded when
+ * they are loaded, as keeping them compressed would save next to nothing.
+ */
+#define SHORT_SAMPLE_SIZE  (64 * 1024)
+
+/* A compressed sample is decoded as a whole, on a thread of its own, once
+ * it has been played this often, if the decoded sample cache has room for
+ * it.  Nothing is evicted from the cache: a decoded sample stays decoded
+ * until it is destroyed.  The thread is joined on the next play after it
+ * has finished, or if decoding failed, when the sample is destroyed.
+ */
+#define HOT_SAMPLE_PLAYS   4
+
+#define DEFAULT_DECODED_SAMPLE_CACHE   (16 * 1024 * 1024)
+
+/* Protects the cache and the plays, decoded and decode_thread fields of
+ * every compressed sample.
+ */
+static ALLEGRO_MUTEX *compressed_mutex = NULL;
+static size_t decoded_cache_size = DEFAULT_DECODED_SAMPLE_CACHE;
+static size_t decoded_cache_used = 0;   /* including samples being decoded */
+
+
+static size_t frame_size(const ALLEGRO_SAMPLE *spl)
+{
+   return al_get_channel_count(spl->chan_conf) *
+      al_get_audio_depth_size(spl->depth);
+}
+
+
+static void lock_compressed(void)
+{
+   if (compressed_mutex)
+      al_lock_mutex(compressed_mutex);
+}
+
+
+static void unlock_compressed(void)
+{
+   if (compressed_mutex)
+      al_unlock_mutex(compressed_mutex);
+}
+
+
+/* _al_kcm_init_compressed_samples:
+ *  Create the mutex and read the size of the decoded sample cache from the
+ *  system configuration.
+ */
+void _al_kcm_init_compressed_samples(void)
+{
+   const char *value = al_get_config_value(al_get_system_config(), "audio",
+      "decoded_sample_cache");
+
+   if (value && value[0] != '\0')
+      decoded_cache_size = strtoul(value, NULL, 10);
+   else
+      decoded_cache_size = DEFAULT_DECODED_SAMPLE_CACHE;
+
+   if (!compressed_mutex)
+      compressed_mutex = al_create_mutex();
+}
+
+
+/* _al_kcm_shutdown_compressed_samples:
+ *  Called once all samples have been destroyed.
+ */
+void _al_kcm_shutdown_compressed_samples(void)
+{
+   if (compressed_mutex) {
+      al_destroy_mutex(compressed_mutex);
+      compressed_mutex = NULL;
+   }
+}
+
+
+static void *open_decoder(const _AL_COMPRESSED_SAMPLE *compressed)
+{
+   ALLEGRO_SAMPLE info;
+
+   if (compressed->prototype)
+      return compressed->codec->clone(compressed->prototype);
+
+   return compressed->codec->open(compressed->data, compressed->size, &info);
+}
+
+
+/* decode_all:
+ *  Decode a whole compressed sample into a new buffer.  When called on a
+ *  decoding thread, returns NULL if the thread is asked to stop.
+ */
+static void *decode_all(const _AL_COMPRESSED_SAMPLE *compressed,
+   const ALLEGRO_SAMPLE *spl, ALLEGRO_THREAD *thread)
+{
+   void *decoder;
+   char *buf;
+   unsigned int done = 0;
+
+   buf = al_malloc(spl->len * frame_size(spl));
+   if (!buf) {
+      _al_set_error(ALLEGRO_GENERIC_ERROR,
+         "Out of memory allocating decoded sample");
+      return NULL;
+   }
+
+   decoder = open_decoder(compressed);
+   if (decoder) {
+      while (done < (unsigned int)spl->len) {
+         unsigned int n;
+
+         if (thread && al_get_thread_should_stop(thread)) {
+            compressed->codec->close(decoder);
+            al_free(buf);
+            return NULL;
+         }
+         n = compressed->codec->read(decoder,
+            buf + done * frame_size(spl), spl->len - done);
+         if (n == 0)
+            break;
+         done += n;
+      }
+      compressed->codec->close(decoder);
+   }
+
+   if (done < (unsigned int)spl->len) {
+      ALLEGRO_WARN("Decoded only %u of %d sample values\n", done, spl->len);
+      al_fill_silence(buf + done * frame_size(spl), spl->len - done,
+         spl->depth, spl->chan_conf);
+   }
+
+   return buf;
+}
+
+
+/* _al_kcm_create_compressed_sample:
+ *  Create a sample which keeps the encoded file in data, of the given size,
+ *  and decodes it with codec while playing.  The sample takes over data,
+ *  which must have been allocated with al_malloc, even on failure.
+ */
+ALLEGRO_SAMPLE *_al_kcm_create_compressed_sample(
+   const _AL_SAMPLE_DECODER_INTERFACE *codec, void *data, size_t size)
+{
+   _AL_COMPRESSED_SAMPLE *compressed;
+   ALLEGRO_SAMPLE info;
+   ALLEGRO_SAMPLE *spl;
+   void *d;
+
+   ASSERT(codec);
+   ASSERT(data);
+
+   /* The decoder opened here finds out the format and length.  If the
+    * codec can clone it, it is kept so that what it found out, e.g. where
+    * the frames of an MP3 file are, is shared by the decoders of all
+    * instances instead of being found out again for every play.
+    */
+   memset(&info, 0, sizeof(info));
+   d = codec->open(data, size, &info);
+   if (!d) {
+      ALLEGRO_ERROR("Could not decode the sample\n");
+      al_free(data);
+      return NULL;
+   }
+
+   if (info.len <= 0 || info.frequency == 0) {
+      _al_set_error(ALLEGRO_INVALID_PARAM, "Empty compressed sample");
+      codec->close(d);
+      al_free(data);
+      return NULL;
+   }
+
+   compressed = al_calloc(1, sizeof(*compressed));
+   if (!compressed) {
+      _al_set_error(ALLEGRO_GENERIC_ERROR,
+         "Out of memory allocating compressed sample");
+      codec->close(d);
+      al_free(data);
+      return NULL;
+   }
+   compressed->codec = codec;
+   compressed->data = data;
+   compressed->size = size;
+   if (codec->clone)
+      compressed->prototype = d;
+   else
+      codec->close(d);
+
+   if (info.len * frame_size(&info) <= SHORT_SAMPLE_SIZE) {
+      void *buf = decode_all(compressed, &info, NULL);
+
+      if (compressed->prototype)
+         codec->close(compressed->prototype);
+      al_free(data);
+      al_free(compressed);
+      if (!buf)
+         return NULL;
+
+      spl = al_create_sample(buf, info.len, info.frequency, info.depth,
+         info.chan_conf, true);
+      if (!spl)
+         al_free(buf);
+      return spl;
+   }
+
+   spl = al_calloc(1, sizeof(*spl));
+   if (!spl) {
+      _al_set_error(ALLEGRO_GENERIC_ERROR,
+         "Out of memory allocating sample data object");
+      if (compressed->prototype)
+         codec->close(compressed->prototype);
+      al_free(data);
+      al_free(compressed);
+      return NULL;
+   }
+
+   spl->depth = info.depth;
+   spl->chan_conf = info.chan_conf;
+   spl->frequency = info.frequency;
+   spl->len = info.len;
+   spl->compressed = compressed;
+
+   spl->dtor_item = _al_kcm_register_destructor("sample", spl,
+      (void (*)(void *)) al_destroy_sample);
+
+   return spl;
+}
+
+
+/* Stop the decoding thread of a sample, if it has one. */
+static void stop_decode_thread(_AL_COMPRESSED_SAMPLE *compressed)
+{
+   ALLEGRO_THREAD *thread;
+
+   lock_compressed();
+   thread = compressed->decode_thread;
+   compressed->decode_thread = NULL;
+   unlock_compressed();
+
+   if (thread) {
+      al_join_thread(thread, NULL);
+      al_destroy_thread(thread);
+   }
+}
+
+
+/* _al_kcm_destroy_compressed_sample:
+ *  Free the encoded and decoded data of a compressed sample.
+ */
+void _al_kcm_destroy_compressed_sample(ALLEGRO_SAMPLE *spl)
+{
+   _AL_COMPRESSED_SAMPLE *compressed = spl->compressed;
+
+   if (!compressed)
+      return;
+
+   stop_decode_thread(compressed);
+
+   if (compressed->decoded) {
+      lock_compressed();
+      decoded_cache_used -= spl->len * frame_size(spl);
+      unlock_compressed();
+      al_free(compressed->decoded);
+   }
+   if (compressed->prototype)
+      compressed->codec->close(compressed->prototype);
+   al_free(compressed->data);
+   al_free(compressed);
+   spl->compressed = NULL;
+}
+
+
+static void *decode_thread_func(ALLEGRO_THREAD *thread, void *arg)
+{
+   ALLEGRO_SAMPLE *spl = arg;
+   _AL_COMPRESSED_SAMPLE *compressed = spl->compressed;
+   void *buf = decode_all(compressed, spl, thread);
+
+   lock_compressed();
+   ASSERT(!compressed->decoded);
+   if (buf)
+      compressed->decoded = buf;
+   else
+      decoded_cache_used -= spl->len * frame_size(spl);
+   unlock_compressed();
+
+   return NULL;
+}
+
+
+/* Start decoding a sample in the background, if it has been played often
+ * and fits into the cache.  The mutex must be locked.
+ */
+static void maybe_start_decode_thread(ALLEGRO_SAMPLE *spl)
+{
+   _AL_COMPRESSED_SAMPLE *compressed = spl->compressed;
+   size_t size = spl->len * frame_size(spl);
+
+   if (compressed->decoded || compressed->decode_thread)
+      return;
+
+   if (++compressed->plays < HOT_SAMPLE_PLAYS ||
+         decoded_cache_used + size > decoded_cache_size)
+      return;
+
+   compressed->decode_thread = al_create_thread(decode_thread_func, spl);
+   if (!compressed->decode_thread)
+      return;
+
+   ALLEGRO_DEBUG("Decoding a sample played %d times\n", compressed->plays);
+   decoded_cache_used += size;
+   al_start_thread(compressed->decode_thread);
+}
+
+
+/* _al_kcm_decode_compressed_sample:
+ *  Decode a compressed sample as a whole, unless that has been done before.
+ *  Returns the decoded sample values, or NULL if out of memory.
+ */
+void *_al_kcm_decode_compressed_sample(_AL_COMPRESSED_SAMPLE *compressed,
+   const ALLEGRO_SAMPLE *spl)
+{
+   void *decoded;
+   void *buf;
+
+   /* A decoding thread may be half way, but is stopped rather than waited
+    * for, as this is rarely needed.
+    */
+   stop_decode_thread(compressed);
+
+   lock_compressed();
+   decoded = compressed->decoded;
+   unlock_compressed();
+   if (decoded)
+      return decoded;
+
+   buf = decode_all(compressed, spl, NULL);
+   if (!buf)
+      return NULL;
+
+   lock_compressed();
+   if (compressed->decoded) {
+      al_free(buf);
+   }
+   else {
+      compressed->decoded = buf;
+      decoded_cache_used += spl->len * frame_size(spl);
+   }
+   decoded = compressed->decoded;
+   unlock_compressed();
+
+   return decoded;
+}
+
+
+static void free_window(_AL_SAMPLE_WINDOW *window)
+{
+   if (!window)
+      return;
+
+   if (window->decoder)
+      window->codec->close(window->decoder);
+   al_free(window->buffer);
+   al_free(window->frames);
+   al_free(window);
+}
+
+
+static _AL_SAMPLE_WINDOW *create_window(const ALLEGRO_SAMPLE *spl)
+{
+   _AL_COMPRESSED_SAMPLE *compressed = spl->compressed;
+   _AL_SAMPLE_WINDOW *window;
+
+   window = al_calloc(1, sizeof(*window));
+   if (!window) {
+      _al_set_error(ALLEGRO_GENERIC_ERROR,
+         "Out of memory allocating sample window");
+      return NULL;
+   }
+
+   window->codec = compressed->codec;
+   window->buffer = al_malloc((_AL_KCM_WINDOW_SIZE + 2) * frame_size(spl));
+   window->frames = al_malloc(2 * frame_size(spl));
+   window->decoder = open_decoder(compressed);
+   if (!window->buffer || !window->frames || !window->decoder) {
+      _al_set_error(ALLEGRO_GENERIC_ERROR, "Could not start decoding sample");
+      free_window(window);
+      return NULL;
+   }
+
+   window->frame_pos[0] = -1;
+   window->frame_pos[1] = -1;
+
+   return window;
+}
+
+
+/* _al_kcm_set_instance_sample:
+ *  Make a sample instance use the sample data, which may be NULL.  For a
+ *  compressed sample this counts as a play, and the instance either shares
+ *  the decoded sample or gets a window to decode into.
+ */
+bool _al_kcm_set_instance_sample(ALLEGRO_SAMPLE_INSTANCE *spl,
+   ALLEGRO_SAMPLE *data)
+{
+   _AL_COMPRESSED_SAMPLE *compressed = data ? data->compressed : NULL;
+   _AL_SAMPLE_WINDOW *window = NULL;
+   _AL_SAMPLE_WINDOW *old_window;
+   void *decoded = NULL;
+
+   if (compressed) {
+      ALLEGRO_THREAD *finished = NULL;
+
+      lock_compressed();
+      decoded = compressed->decoded;
+      if (!decoded) {
+         maybe_start_decode_thread(data);
+      }
+      else if (compressed->decode_thread) {
+         /* The thread has finished, it set decoded. */
+         finished = compressed->decode_thread;
+         compressed->decode_thread = NULL;
+      }
+      unlock_compressed();
+
+      if (finished) {
+         al_join_thread(finished, NULL);
+         al_destroy_thread(finished);
+      }
+
+      if (!decoded) {
+         window = create_window(data);
+         if (!window)
+            return false;
+      }
+   }
+
+   if (spl->mutex)
+      al_lock_mutex(spl->mutex);
+
+   old_window = spl->window;
+
+   if (data) {
+      spl->spl_data = *data;
+      if (decoded)
+         spl->spl_data.buffer.ptr = decoded;
+   }
+   else {
+      spl->spl_data.buffer.ptr = NULL;
+      spl->spl_data.compressed = NULL;
+   }
+   spl->spl_data.free_buf = false;
+   spl->window = window;
+
+   if (spl->mutex)
+      al_unlock_mutex(spl->mutex);
+
+   free_window(old_window);
+
+   return true;
+}
+
+
+/* _al_kcm_free_sample_window:
+ *  Stop decoding for a sample instance which is being destroyed.
+ */
+void _al_kcm_free_sample_window(ALLEGRO_SAMPLE_INSTANCE *spl)
+{
+   free_window(spl->window);
+   spl->window = NULL;
+}
+
+
+/* decode:
+ *  Decode the sample values from start to end into dest, or silence where
+ *  that fails.
+ */
+static void decode(ALLEGRO_SAMPLE_INSTANCE *spl, int start, int end,
+   char *dest)
+{
+   _AL_SAMPLE_WINDOW *window = spl->window;
+   size_t size = frame_size(&spl->spl_data);
+   int pos = start;
+
+   if (window->next != start) {
+      if (window->codec->seek(window->decoder, start))
+         window->next = start;
+      else
+         window->next = -1;
+   }
+
+   if (window->next == start) {
+      while (pos < end) {
+         unsigned int n = window->codec->read(window->decoder,
+            dest + (pos - start) * size, end - pos);
+         if (n == 0)
+            break;
+         pos += n;
+      }
+      window->next = pos;
+   }
+
+   if (pos < end) {
+      al_fill_silence(dest + (pos - start) * size, end - pos,
+         spl->spl_data.depth, spl->spl_data.chan_conf);
+   }
+}
+
+
+/* _al_kcm_fill_sample_window:
+ *  Make the window of the sample instance hold the sample values from start
+ *  to end, at most _AL_KCM_WINDOW_SIZE of them.  As much more as fits is
+ *  decoded after them, or before them when playing backwards.
+ */
+void _al_kcm_fill_sample_window(ALLEGRO_SAMPLE_INSTANCE *spl, int start,
+   int end, bool backward)
+{
+   _AL_SAMPLE_WINDOW *window = spl->window;
+   size_t size = frame_size(&spl->spl_data);
+   char *held = window->buffer + size;
+   int new_start, new_end;
+
+   ASSERT(start >= 0 && start <= end);
+   ASSERT(end - start <= _AL_KCM_WINDOW_SIZE);
+
+   if (start >= window->start && end <= window->end)
+      return;
+
+   if (backward) {
+      new_end = end;
+      new_start = _ALLEGRO_MAX(end - _AL_KCM_WINDOW_SIZE, 0);
+   }
+   else {
+      new_start = start;
+      new_end = _ALLEGRO_MAX(end,
+         _ALLEGRO_MIN(start + _AL_KCM_WINDOW_SIZE, spl->spl_data.len));
+   }
+
+   /* Keep what has been decoded already. */
+   if (!backward && new_start >= window->start && new_start < window->end) {
+      memmove(held, held + (new_start - window->start) * size,
+         (window->end - new_start) * size);
+      decode(spl, window->end, new_end,
+         held + (window->end - new_start) * size);
+   }
+   else if (backward && new_end > window->start && new_end <= window->end) {
+      memmove(held + (window->start - new_start) * size, held,
+         (new_end - window->start) * size);
+      decode(spl, new_start, window->start, held);
+   }
+   else {
+      decode(spl, new_start, new_end, held);
+   }
+
+   window->start = new_start;
+   window->end = new_end;
+}
+
+
+/* _al_kcm_get_sample_window_frame:
+ *  Copy the sample value at pos to the given index of the window buffer.
+ */
+void _al_kcm_get_sample_window_frame(ALLEGRO_SAMPLE_INSTANCE *spl, int pos,
+   int index)
+{
+   _AL_SAMPLE_WINDOW *window = spl->window;
+   size_t size = frame_size(&spl->spl_data);
+   char *dest = window->buffer + index * size;
+   int i;
+
+   if (pos >= window->start && pos < window->end) {
+      memmove(dest, window->buffer + (1 + pos - window->start) * size, size);
+      return;
+   }
+
+   for (i = 0; i < 2; i++) {
+      if (window->frame_pos[i] == pos) {
+         memcpy(dest, window->frames + i * size, size);
+         return;
+      }
+   }
+
+   /* Replace the older of the two. */
+   window->frame_pos[0] = window->frame_pos[1];
+   memcpy(window->frames, window->frames + size, size);
+
+   decode(spl, pos, pos + 1, window->frames + size);
+   window->frame_pos[1] = pos;
+   memcpy(dest, window->frames + size, size);
+}
+
+
+/* vim: set sts=3 sw=3 et: */
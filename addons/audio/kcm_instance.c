@@ -88,6 +88,8 @@ static void stream_free(ALLEGRO_SAMPLE_INSTANCE *spl)
          }
 
          _al_vector_free(&mixer->streams);
+         al_free(mixer->candidates);
+         al_free(mixer->submixers);
 
          if (spl->spl_data.buffer.ptr) {
             ASSERT(spl->spl_data.free_buf);
@@ -97,6 +99,8 @@ static void stream_free(ALLEGRO_SAMPLE_INSTANCE *spl)
          spl->spl_data.free_buf = false;
       }
 
+      _al_kcm_free_sample_window(spl);
+
       ASSERT(! spl->spl_data.free_buf);
 
       al_free(spl);
@@ -130,8 +134,11 @@ void _al_kcm_detach_from_parent(ALLEGRO_SAMPLE_INSTANCE *spl)
       if (*slot == spl) {
          maybe_lock_mutex(mixer->ss.mutex);
 
+         /* The update ring must not refer to the sample anymore. */
+         _al_kcm_mixer_apply_updates(mixer);
          _al_vector_delete_at(&mixer->streams, i);
          spl->parent.u.mixer = NULL;
+         spl->is_virtual = false;
          _al_kcm_stream_set_mutex(spl, NULL);
 
          spl->spl_read = NULL;
@@ -160,10 +167,10 @@ ALLEGRO_SAMPLE_INSTANCE *al_create_sample_instance(ALLEGRO_SAMPLE *sample_data)
       return NULL;
    }
 
-   if (sample_data) {
-      spl->spl_data = *sample_data;
+   if (!_al_kcm_set_instance_sample(spl, sample_data)) {
+      al_free(spl);
+      return NULL;
    }
-   spl->spl_data.free_buf = false;
 
    spl->loop = ALLEGRO_PLAYMODE_ONCE;
    spl->speed = 1.0f;
@@ -426,21 +433,8 @@ bool al_set_sample_instance_speed(ALLEGRO_SAMPLE_INSTANCE *spl, float val)
 
    spl->speed = val;
    if (spl->parent.u.mixer) {
-      ALLEGRO_MIXER *mixer = spl->parent.u.mixer;
-
-      maybe_lock_mutex(spl->mutex);
-
-      spl->step = (spl->spl_data.frequency) * spl->speed;
-      spl->step_denom = mixer->ss.spl_data.frequency;
-      /* Don't wanna be trapped with a step value of 0 */
-      if (spl->step == 0) {
-         if (spl->speed > 0.0f)
-            spl->step = 1;
-         else
-            spl->step = -1;
-      }
-
-      maybe_unlock_mutex(spl->mutex);
+      _al_kcm_mixer_update_sample(spl->parent.u.mixer, spl,
+         _AL_KCM_UPDATE_STEP);
    }
 
    return true;
@@ -466,11 +460,8 @@ bool al_set_sample_instance_gain(ALLEGRO_SAMPLE_INSTANCE *spl, float val)
        * matrix to take into account the gain.
        */
       if (spl->parent.u.mixer) {
-         ALLEGRO_MIXER *mixer = spl->parent.u.mixer;
-
-         maybe_lock_mutex(spl->mutex);
-         _al_kcm_mixer_rejig_sample_matrix(mixer, spl);
-         maybe_unlock_mutex(spl->mutex);
+         _al_kcm_mixer_update_sample(spl->parent.u.mixer, spl,
+            _AL_KCM_UPDATE_MATRIX);
       }
    }
 
@@ -501,11 +492,8 @@ bool al_set_sample_instance_pan(ALLEGRO_SAMPLE_INSTANCE *spl, float val)
        * matrix to take into account the panning.
        */
       if (spl->parent.u.mixer) {
-         ALLEGRO_MIXER *mixer = spl->parent.u.mixer;
-
-         maybe_lock_mutex(spl->mutex);
-         _al_kcm_mixer_rejig_sample_matrix(mixer, spl);
-         maybe_unlock_mutex(spl->mutex);
+         _al_kcm_mixer_update_sample(spl->parent.u.mixer, spl,
+            _AL_KCM_UPDATE_MATRIX);
       }
    }
 
@@ -548,7 +536,7 @@ bool al_set_sample_instance_playing(ALLEGRO_SAMPLE_INSTANCE *spl, bool val)
 {
    ASSERT(spl);
 
-   if (!spl->parent.u.ptr || !spl->spl_data.buffer.ptr) {
+   if (!spl->parent.u.ptr || (!spl->spl_data.buffer.ptr && !spl->window)) {
       spl->is_playing = val;
       return true;
    }
@@ -604,7 +592,7 @@ bool al_set_sample(ALLEGRO_SAMPLE_INSTANCE *spl, ALLEGRO_SAMPLE *data)
       if (spl->parent.u.ptr) {
          _al_kcm_detach_from_parent(spl);
       }
-      spl->spl_data.buffer.ptr = NULL;
+      _al_kcm_set_instance_sample(spl, NULL);
       return true;
    }
 
@@ -621,8 +609,8 @@ bool al_set_sample(ALLEGRO_SAMPLE_INSTANCE *spl, ALLEGRO_SAMPLE *data)
       }
    }
 
-   spl->spl_data = *data;
-   spl->spl_data.free_buf = false;
+   if (!_al_kcm_set_instance_sample(spl, data))
+      return false;
    spl->pos = 0;
    spl->loop_start = 0;
    spl->loop_end = data->len;
@@ -631,13 +619,13 @@ bool al_set_sample(ALLEGRO_SAMPLE_INSTANCE *spl, ALLEGRO_SAMPLE *data)
    if (need_reattach) {
       if (old_parent.is_voice) {
          if (!al_attach_sample_instance_to_voice(spl, old_parent.u.voice)) {
-            spl->spl_data.buffer.ptr = NULL;
+            _al_kcm_set_instance_sample(spl, NULL);
             return false;
          }
       }
       else {
          if (!al_attach_sample_instance_to_mixer(spl, old_parent.u.mixer)) {
-            spl->spl_data.buffer.ptr = NULL;
+            _al_kcm_set_instance_sample(spl, NULL);
             return false;
          }
       }
@@ -678,6 +666,8 @@ bool al_set_sample_instance_channel_matrix(ALLEGRO_SAMPLE_INSTANCE *spl, const f
 
       maybe_lock_mutex(spl->mutex);
 
+      /* Don't let a pending gain or pan change overwrite the matrix. */
+      _al_kcm_mixer_apply_updates(mixer);
       memcpy(spl->matrix, matrix, dst_chans * src_chans * sizeof(float));
 
       maybe_unlock_mutex(spl->mutex);
@@ -687,4 +677,36 @@ bool al_set_sample_instance_channel_matrix(ALLEGRO_SAMPLE_INSTANCE *spl, const f
 }
 
 
+/* Function: al_get_sample_instance_priority
+ */
+int al_get_sample_instance_priority(const ALLEGRO_SAMPLE_INSTANCE *spl)
+{
+   ASSERT(spl);
+
+   return spl->priority;
+}
+
+
+/* Function: al_set_sample_instance_priority
+ */
+bool al_set_sample_instance_priority(ALLEGRO_SAMPLE_INSTANCE *spl,
+   int priority)
+{
+   ASSERT(spl);
+
+   spl->priority = priority;
+   return true;
+}
+
+
+/* Function: al_get_sample_instance_virtual
+ */
+bool al_get_sample_instance_virtual(const ALLEGRO_SAMPLE_INSTANCE *spl)
+{
+   ASSERT(spl);
+
+   return spl->is_virtual;
+}
+
+
 /* vim: set sts=3 sw=3 et: */
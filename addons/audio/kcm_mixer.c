@@ -10,6 +10,7 @@
 
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "allegro5/allegro_audio.h"
 #include "allegro5/internal/aintern.h"
@@ -44,23 +45,22 @@ static void maybe_unlock_mutex(ALLEGRO_MUTEX *mutex)
 
 
 /* _al_rechannel_matrix:
- *  This function provides a (temporary!) matrix that can be used to convert
- *  one channel configuration into another.
+ *  This function fills in a matrix that can be used to convert one channel
+ *  configuration into another.  Sub-mixers may be mixed on several threads
+ *  at once, so the caller provides the storage.
  *
- *  Returns a pointer to a statically allocated array.
+ *  Returns a pointer to the first element of the matrix.
  */
 static float *_al_rechannel_matrix(ALLEGRO_CHANNEL_CONF orig,
-   ALLEGRO_CHANNEL_CONF target, float gain, float pan)
+   ALLEGRO_CHANNEL_CONF target, float gain, float pan,
+   float mat[ALLEGRO_MAX_CHANNELS][ALLEGRO_MAX_CHANNELS])
 {
-   /* Max 7.1 (8 channels) for input and output */
-   static float mat[ALLEGRO_MAX_CHANNELS][ALLEGRO_MAX_CHANNELS];
-
    size_t dst_chans = al_get_channel_count(target);
    size_t src_chans = al_get_channel_count(orig);
    size_t i, j;
 
    /* Start with a simple identity matrix */
-   memset(mat, 0, sizeof(mat));
+   memset(mat, 0, sizeof(mat[0]) * ALLEGRO_MAX_CHANNELS);
    for (i = 0; i < src_chans && i < dst_chans; i++) {
       mat[i][i] = 1.0;
    }
@@ -140,13 +140,15 @@ static float *_al_rechannel_matrix(ALLEGRO_CHANNEL_CONF orig,
 void _al_kcm_mixer_rejig_sample_matrix(ALLEGRO_MIXER *mixer,
    ALLEGRO_SAMPLE_INSTANCE *spl)
 {
+   /* Max 7.1 (8 channels) for input and output */
+   float storage[ALLEGRO_MAX_CHANNELS][ALLEGRO_MAX_CHANNELS];
    float *mat;
    size_t dst_chans;
    size_t src_chans;
    size_t i, j;
 
    mat = _al_rechannel_matrix(spl->spl_data.chan_conf,
-      mixer->ss.spl_data.chan_conf, spl->gain, spl->pan);
+      mixer->ss.spl_data.chan_conf, spl->gain, spl->pan, storage);
 
    dst_chans = al_get_channel_count(mixer->ss.spl_data.chan_conf);
    src_chans = al_get_channel_count(spl->spl_data.chan_conf);
@@ -162,6 +164,200 @@ void _al_kcm_mixer_rejig_sample_matrix(ALLEGRO_MIXER *mixer,
 }
 
 
+/* update_sample_step:
+ *  Recompute the step of a sample attached to a mixer from its speed.
+ */
+static void update_sample_step(ALLEGRO_MIXER *mixer,
+   ALLEGRO_SAMPLE_INSTANCE *spl)
+{
+   spl->step = (spl->spl_data.frequency) * spl->speed;
+   spl->step_denom = mixer->ss.spl_data.frequency;
+   /* Don't want to be trapped with a step value of 0. */
+   if (spl->step == 0) {
+      if (spl->speed > 0.0f)
+         spl->step = 1;
+      else
+         spl->step = -1;
+   }
+}
+
+
+static void apply_update(ALLEGRO_MIXER *mixer, ALLEGRO_SAMPLE_INSTANCE *spl,
+   int what)
+{
+   if (what & _AL_KCM_UPDATE_STEP)
+      update_sample_step(mixer, spl);
+   if (what & _AL_KCM_UPDATE_MATRIX)
+      _al_kcm_mixer_rejig_sample_matrix(mixer, spl);
+}
+
+
+/* Changing the gain, pan or speed of an attached sample used to take the
+ * mixer mutex, which the voice thread holds while it mixes a whole block,
+ * so the user's thread could stall for a full mix period.  Instead the
+ * setters now record what changed in the sample's pending_updates and put
+ * the sample into a bounded lock-free ring in its mixer (the same queue
+ * event queues use, so several setting threads are still safe).  The mixer
+ * applies the updates at the start of the next block.
+ *
+ * A sample is in the ring at most once, however often it changes.  The
+ * ring is only emptied with the mixer mutex held, and detaching a sample
+ * empties it first, so it never refers to a detached sample.  If the ring
+ * is full, or there are no atomic operations, the setter takes the mutex
+ * like before.
+ */
+#ifdef _AL_HAVE_ATOMIC_CAS
+
+/* The ring positions wrap around, so do the arithmetic unsigned. */
+#define UPDATE_ADD(pos, n)    ((_AL_ATOMIC)((unsigned int)(pos) + (n)))
+#define UPDATE_DIFF(a, b)     ((int)((unsigned int)(a) - (unsigned int)(b)))
+#define UPDATE_CELL(mixer, pos) \
+   (&(mixer)->updates[(unsigned int)(pos) & (_AL_KCM_MIXER_UPDATES - 1)])
+
+static void init_updates(ALLEGRO_MIXER *mixer)
+{
+   int i;
+
+   for (i = 0; i < _AL_KCM_MIXER_UPDATES; i++) {
+      mixer->updates[i].sequence = i;
+   }
+   mixer->updates_head = 0;
+   mixer->updates_tail = 0;
+}
+
+
+static bool push_update(ALLEGRO_MIXER *mixer, ALLEGRO_SAMPLE_INSTANCE *spl)
+{
+   _AL_KCM_MIXER_UPDATE *cell;
+   _AL_ATOMIC pos;
+
+   pos = _al_atomic_load(&mixer->updates_head);
+   for (;;) {
+      int dif;
+      cell = UPDATE_CELL(mixer, pos);
+      dif = UPDATE_DIFF(_al_atomic_load(&cell->sequence), pos);
+      if (dif == 0) {
+         if (_al_compare_and_swap(&mixer->updates_head, pos, UPDATE_ADD(pos, 1)))
+            break;
+      }
+      else if (dif < 0) {
+         /* The ring is full. */
+         return false;
+      }
+      pos = _al_atomic_load(&mixer->updates_head);
+   }
+
+   cell->spl = spl;
+   _al_atomic_store(&cell->sequence, UPDATE_ADD(pos, 1));
+   return true;
+}
+
+
+/* Only called with the mixer mutex held, so there is a single consumer. */
+static ALLEGRO_SAMPLE_INSTANCE *pop_update(ALLEGRO_MIXER *mixer)
+{
+   _AL_KCM_MIXER_UPDATE *cell;
+   ALLEGRO_SAMPLE_INSTANCE *spl;
+   _AL_ATOMIC pos;
+
+   pos = _al_atomic_load(&mixer->updates_tail);
+   cell = UPDATE_CELL(mixer, pos);
+   if (UPDATE_DIFF(_al_atomic_load(&cell->sequence), UPDATE_ADD(pos, 1)) < 0) {
+      /* The ring is empty, or a push has not finished yet. */
+      return NULL;
+   }
+
+   spl = cell->spl;
+   _al_atomic_store(&mixer->updates_tail, UPDATE_ADD(pos, 1));
+   _al_atomic_store(&cell->sequence, UPDATE_ADD(pos, _AL_KCM_MIXER_UPDATES));
+   return spl;
+}
+
+
+/* Atomically sets the flags in what, returning the previous flags. */
+static int add_pending_updates(ALLEGRO_SAMPLE_INSTANCE *spl, int what)
+{
+   _AL_ATOMIC old;
+
+   do {
+      old = _al_atomic_load(&spl->pending_updates);
+   } while ((old & what) != what &&
+      !_al_compare_and_swap(&spl->pending_updates, old, old | what));
+
+   return old;
+}
+
+
+static int take_pending_updates(ALLEGRO_SAMPLE_INSTANCE *spl)
+{
+   _AL_ATOMIC old;
+
+   do {
+      old = _al_atomic_load(&spl->pending_updates);
+   } while (old && !_al_compare_and_swap(&spl->pending_updates, old, 0));
+
+   return old;
+}
+
+#endif
+
+
+/* _al_kcm_mixer_update_sample:
+ *  Tell the mixer that the gain, pan or speed of an attached sample has
+ *  changed (see the _AL_KCM_UPDATE_* flags).  Does not block on the mixer
+ *  mutex unless the update ring is full.
+ */
+void _al_kcm_mixer_update_sample(ALLEGRO_MIXER *mixer,
+   ALLEGRO_SAMPLE_INSTANCE *spl, int what)
+{
+   ASSERT(spl->parent.u.mixer == mixer && !spl->parent.is_voice);
+
+#ifdef _AL_HAVE_ATOMIC_CAS
+   /* Without a mutex nothing is mixing, so just apply it. */
+   if (spl->mutex) {
+      int old = add_pending_updates(spl, what);
+
+      /* Either the sample is already waiting in the ring and the mixer will
+       * see the new flags, or we put it there.
+       */
+      if (old != 0 || push_update(mixer, spl))
+         return;
+   }
+#endif
+
+   maybe_lock_mutex(spl->mutex);
+   /* Apply what is in the ring first so no update overtakes another. */
+   _al_kcm_mixer_apply_updates(mixer);
+#ifdef _AL_HAVE_ATOMIC_CAS
+   what |= take_pending_updates(spl);
+#endif
+   apply_update(mixer, spl, what);
+   maybe_unlock_mutex(spl->mutex);
+}
+
+
+/* _al_kcm_mixer_apply_updates:
+ *  Apply the updates waiting in the ring of the mixer.
+ *  The caller must be holding the mixer mutex.
+ */
+void _al_kcm_mixer_apply_updates(ALLEGRO_MIXER *mixer)
+{
+#ifdef _AL_HAVE_ATOMIC_CAS
+   ALLEGRO_SAMPLE_INSTANCE *spl;
+
+   while ((spl = pop_update(mixer))) {
+      /* Clear the flags before applying them, so that a change made from
+       * now on queues the sample again.
+       */
+      int what = take_pending_updates(spl);
+      apply_update(mixer, spl, what);
+   }
+#else
+   (void)mixer;
+#endif
+}
+
+
 /* fix_looped_position:
  *  When a stream loops, this will fix up the position and anything else to
  *  allow it to safely continue playing as expected. Returns false if it
@@ -351,22 +547,483 @@ MAKE_MIXER(read_to_mixer_linear_int16_t_16, linear_spl16, int16_t)
 #undef MAKE_MIXER
 
 
-/* _al_kcm_mixer_read:
- *  Mixes the streams attached to the mixer and writes additively to the
- *  specified buffer (or if *buf is NULL, indicating a voice, convert it and
- *  set it to the buffer pointer).
+/* Mix n sample values from the current position on into a mixer buffer,
+ * stepping forwards by exactly one sample value each.  Nothing needs to be
+ * interpolated then, and the caller makes sure that no loop point is
+ * crossed, so this gives the same result as any of the mixers above.
  */
-void _al_kcm_mixer_read(void *source, void **buf, unsigned int *samples,
-   ALLEGRO_AUDIO_DEPTH buffer_depth, size_t dest_maxc)
+#define MAKE_UNIT_STEP_MIXER(NAME, NEXT_SAMPLE_VALUE, TYPE)                   \
+static void NAME(ALLEGRO_SAMPLE_INSTANCE *spl, void *vbuf, unsigned int n,    \
+   size_t dest_maxc)                                                          \
+{                                                                             \
+   TYPE *buf = vbuf;                                                          \
+   size_t maxc = al_get_channel_count(spl->spl_data.chan_conf);               \
+   size_t c;                                                                  \
+   SAMP_BUF samp_buf;                                                         \
+                                                                              \
+   while (n > 0) {                                                            \
+      const TYPE *s = (TYPE *) NEXT_SAMPLE_VALUE(&samp_buf, spl, maxc);       \
+                                                                              \
+      for (c = 0; c < dest_maxc; c++) {                                       \
+         switch (maxc) {                                                      \
+            case 8: *buf += s[7] * spl->matrix[c*maxc + 7];                   \
+            /* fall through */                                                \
+            case 7: *buf += s[6] * spl->matrix[c*maxc + 6];                   \
+            /* fall through */                                                \
+            case 6: *buf += s[5] * spl->matrix[c*maxc + 5];                   \
+            /* fall through */                                                \
+            case 5: *buf += s[4] * spl->matrix[c*maxc + 4];                   \
+            /* fall through */                                                \
+            case 4: *buf += s[3] * spl->matrix[c*maxc + 3];                   \
+            /* fall through */                                                \
+            case 3: *buf += s[2] * spl->matrix[c*maxc + 2];                   \
+            /* fall through */                                                \
+            case 2: *buf += s[1] * spl->matrix[c*maxc + 1];                   \
+            /* fall through */                                                \
+            case 1: *buf += s[0] * spl->matrix[c*maxc + 0];                   \
+            /* fall through */                                                \
+            default: break;                                                   \
+         }                                                                    \
+         buf++;                                                               \
+      }                                                                       \
+                                                                              \
+      spl->pos++;                                                             \
+      n--;                                                                    \
+   }                                                                          \
+}
+
+MAKE_UNIT_STEP_MIXER(unit_step_to_mixer_float_32, point_spl32, float)
+MAKE_UNIT_STEP_MIXER(unit_step_to_mixer_int16_t_16, point_spl16, int16_t)
+
+#undef MAKE_UNIT_STEP_MIXER
+
+
+/* Streams and mixers are always mixed. */
+static bool can_be_virtual(const ALLEGRO_SAMPLE_INSTANCE *spl)
+{
+   return !spl->is_mixer &&
+      spl->loop != _ALLEGRO_PLAYMODE_STREAM_ONCE &&
+      spl->loop != _ALLEGRO_PLAYMODE_STREAM_ONEDIR;
+}
+
+
+/* The largest factor any channel of the sample is mixed with, which takes
+ * gain, pan and custom channel matrices into account.
+ */
+static float instance_audibility(const ALLEGRO_MIXER *mixer,
+   const ALLEGRO_SAMPLE_INSTANCE *spl)
+{
+   size_t n = al_get_channel_count(mixer->ss.spl_data.chan_conf) *
+      al_get_channel_count(spl->spl_data.chan_conf);
+   float audibility = 0.0f;
+   size_t i;
+
+   for (i = 0; i < n; i++) {
+      float a = fabsf(spl->matrix[i]);
+      if (a > audibility)
+         audibility = a;
+   }
+
+   return audibility;
+}
+
+
+/* Sorts the most important samples first: by priority, then by how loud
+ * they are.  Samples which are already real win ties so that samples of
+ * equal importance do not keep swapping.
+ */
+static int compare_candidates(const void *a, const void *b)
+{
+   const _AL_KCM_CULL_CANDIDATE *ca = a;
+   const _AL_KCM_CULL_CANDIDATE *cb = b;
+
+   if (ca->spl->priority != cb->spl->priority)
+      return ca->spl->priority > cb->spl->priority ? -1 : 1;
+   if (ca->audibility != cb->audibility)
+      return ca->audibility > cb->audibility ? -1 : 1;
+   if (ca->spl->is_virtual != cb->spl->is_virtual)
+      return ca->spl->is_virtual ? 1 : -1;
+   return ca->index - cb->index;
+}
+
+
+/* select_real_instances:
+ *  Decide which playing sample instances get mixed in this block.  Those
+ *  quieter than the audibility threshold become virtual, then if more than
+ *  max_real_instances remain, the least important ones do as well.  A
+ *  virtual sample becomes real again as soon as it is important enough.
+ */
+static void select_real_instances(ALLEGRO_MIXER *mixer)
+{
+   bool culling = mixer->max_real_instances > 0 ||
+      mixer->audibility_threshold > 0.0f;
+   int num_streams = _al_vector_size(&mixer->streams);
+   int num_candidates = 0;
+   int num_virtual = 0;
+   int i;
+
+   if (culling && mixer->candidates_size < num_streams) {
+      _AL_KCM_CULL_CANDIDATE *candidates = al_realloc(mixer->candidates,
+         num_streams * sizeof(*candidates));
+      if (candidates) {
+         mixer->candidates = candidates;
+         mixer->candidates_size = num_streams;
+      }
+      else {
+         culling = false;
+      }
+   }
+
+   for (i = 0; i < num_streams; i++) {
+      ALLEGRO_SAMPLE_INSTANCE **slot = _al_vector_ref(&mixer->streams, i);
+      ALLEGRO_SAMPLE_INSTANCE *spl = *slot;
+      _AL_KCM_CULL_CANDIDATE *candidate;
+      float audibility;
+
+      if (!can_be_virtual(spl) || !spl->is_playing) {
+         spl->is_virtual = false;
+         continue;
+      }
+
+      if (!culling) {
+         spl->is_virtual = false;
+         num_candidates++;
+         continue;
+      }
+
+      audibility = instance_audibility(mixer, spl);
+      if (audibility < mixer->audibility_threshold) {
+         spl->is_virtual = true;
+         num_virtual++;
+         continue;
+      }
+
+      candidate = &mixer->candidates[num_candidates++];
+      candidate->spl = spl;
+      candidate->audibility = audibility;
+      candidate->index = i;
+   }
+
+   if (culling) {
+      int max_real = mixer->max_real_instances;
+
+      if (max_real > 0 && num_candidates > max_real) {
+         qsort(mixer->candidates, num_candidates, sizeof(*mixer->candidates),
+            compare_candidates);
+      }
+      else {
+         max_real = num_candidates;
+      }
+
+      for (i = 0; i < num_candidates; i++) {
+         mixer->candidates[i].spl->is_virtual = (i >= max_real);
+      }
+      num_virtual += num_candidates - max_real;
+      num_candidates = max_real;
+   }
+
+   mixer->real_instances = num_candidates;
+   mixer->virtual_instances = num_virtual;
+}
+
+
+/* next_loop_bound:
+ *  The position at which fix_looped_position will next have to step in,
+ *  if there is one.
+ */
+static bool next_loop_bound(const ALLEGRO_SAMPLE_INSTANCE *spl, int *bound)
+{
+   switch (spl->loop) {
+      case ALLEGRO_PLAYMODE_ONCE:
+         *bound = spl->spl_data.len;
+         return spl->step > 0;
+
+      case ALLEGRO_PLAYMODE_LOOP:
+      case ALLEGRO_PLAYMODE_BIDIR:
+         *bound = spl->step > 0 ? spl->loop_end : spl->loop_start;
+         return spl->loop_end != spl->loop_start;
+
+      default:
+         return false;
+   }
+}
+
+
+/* samples_before:
+ *  The number of sample values, between 1 and max, which can be mixed
+ *  before the position reaches the bound in the direction it moves, from
+ *  pos + floor((n * step + error) / denom).
+ */
+static int64_t samples_before(const ALLEGRO_SAMPLE_INSTANCE *spl, int bound,
+   int64_t max)
+{
+   int64_t step = spl->step;
+   int64_t denom = spl->step_denom;
+   int64_t error = spl->pos_bresenham_error;
+   int64_t n;
+
+   if (step > 0)
+      n = ((bound - spl->pos) * denom - error + step - 1) / step;
+   else
+      n = (error - (bound - spl->pos) * denom) / -step + 1;
+
+   return _ALLEGRO_CLAMP(1, n, max);
+}
+
+
+/* position_after:
+ *  The position after n more sample values, and the Bresenham error there
+ *  if error is not NULL.
+ */
+static int position_after(const ALLEGRO_SAMPLE_INSTANCE *spl, int64_t n,
+   int *error)
+{
+   int64_t denom = spl->step_denom;
+   int64_t total = n * spl->step + spl->pos_bresenham_error;
+   int64_t delta = total / denom;
+
+   /* Round towards minus infinity, like BRESENHAM. */
+   if (total - delta * denom < 0)
+      delta--;
+
+   if (error)
+      *error = total - delta * denom;
+   return spl->pos + delta;
+}
+
+
+/* advance_virtual_instance:
+ *  Move a virtual sample exactly as far as mixing it would have, without
+ *  looking at the sample data.  Instead of stepping one sample value at a
+ *  time, it jumps straight to the next loop point.
+ */
+static void advance_virtual_instance(ALLEGRO_SAMPLE_INSTANCE *spl,
+   unsigned int samples)
+{
+   while (samples > 0) {
+      int64_t n = samples;
+      int bound;
+
+      if (!spl->is_playing || !fix_looped_position(spl))
+         return;
+
+      if (next_loop_bound(spl, &bound))
+         n = samples_before(spl, bound, n);
+
+      spl->pos = position_after(spl, n, &spl->pos_bresenham_error);
+      samples -= n;
+   }
+
+   fix_looped_position(spl);
+}
+
+
+/* set_up_window_view:
+ *  Decode the sample values from first to last, and around them, into the
+ *  window of a sample instance playing a compressed sample.  Then make view
+ *  a copy of the instance which reads exactly the same sample values from
+ *  the window as the instance would from the whole sample, as long as it
+ *  stays between first and last.
+ *
+ *  Interpolation reads up to one sample value before and two after the
+ *  position, except at the loop points: there it reads the sample value at
+ *  the other loop point instead.  When that one is not in the window as
+ *  well, it is put into a spare slot at either end of the window buffer,
+ *  and the loop points of the view are moved so that the same reads go to
+ *  that slot.
+ */
+static void set_up_window_view(ALLEGRO_SAMPLE_INSTANCE *spl, int first,
+   int last, ALLEGRO_SAMPLE_INSTANCE *view)
+{
+   _AL_SAMPLE_WINDOW *window = spl->window;
+   const int last_slot = _AL_KCM_WINDOW_SIZE + 1;
+   int start = _ALLEGRO_MAX(first - 1, 0);
+   int end = _ALLEGRO_MIN(last + 3, spl->spl_data.len);
+   int offset;
+
+   _al_kcm_fill_sample_window(spl, start, end, spl->step < 0);
+
+   /* The window holds the sample value at window->start at index 1. */
+   offset = 1 - window->start;
+
+   *view = *spl;
+   view->spl_data.buffer.ptr = window->buffer;
+   view->spl_data.len += offset;
+   view->pos += offset;
+   view->loop_start += offset;
+   view->loop_end += offset;
+
+   switch (spl->loop) {
+      case ALLEGRO_PLAYMODE_ONCE:
+         /* Cubic interpolation at position 0 reads from index 0. */
+         if (start == 0)
+            _al_kcm_get_sample_window_frame(spl, 0, 0);
+         break;
+
+      case ALLEGRO_PLAYMODE_LOOP:
+      case ALLEGRO_PLAYMODE_BIDIR:
+         if (start <= spl->loop_start && end >= spl->loop_end) {
+            /* Both loop points are in the window. */
+         }
+         else if (first - 1 >= spl->loop_start) {
+            /* Reads past the loop end go to the loop start. */
+            _al_kcm_get_sample_window_frame(spl, spl->loop_start, 0);
+            view->loop_start = 0;
+         }
+         else {
+            /* Reads before the loop start go to the sample value before
+             * the loop end.
+             */
+            ASSERT(last + 2 < spl->loop_end);
+            _al_kcm_get_sample_window_frame(spl, spl->loop_end - 1,
+               last_slot);
+            view->loop_end = last_slot + 1;
+            view->loop_start = _ALLEGRO_MIN(view->loop_start, last_slot);
+         }
+         break;
+
+      default:
+         ASSERT(false);
+         break;
+   }
+}
+
+
+/* read_windowed:
+ *  Mix a sample instance playing a compressed sample.  Every piece that fits
+ *  into the window is decoded there and mixed by the instance's usual
+ *  reader from a view, see set_up_window_view.  Pieces end at loop points,
+ *  so the view never has to loop.
+ */
+static void read_windowed(ALLEGRO_SAMPLE_INSTANCE *spl, void **vbuf,
+   unsigned int *samples, ALLEGRO_AUDIO_DEPTH buffer_depth, size_t dest_maxc)
+{
+   size_t dest_size = dest_maxc * al_get_audio_depth_size(buffer_depth);
+   unsigned int done = 0;
+
+   while (done < *samples) {
+      ALLEGRO_SAMPLE_INSTANCE view;
+      void *buf = (char *)*vbuf + done * dest_size;
+      unsigned int n;
+      int64_t max;
+      int bound, first, last;
+
+      if (!spl->is_playing || !fix_looped_position(spl))
+         return;
+
+      /* Only reachable by playing backwards without looping, which mixing
+       * the whole sample does not handle either.
+       */
+      if (spl->pos < 0 || spl->pos >= spl->spl_data.len) {
+         spl->pos = 0;
+         spl->is_playing = false;
+         return;
+      }
+
+      max = (int64_t)(_AL_KCM_WINDOW_SIZE - 8) * spl->step_denom /
+         abs(spl->step);
+      max = _ALLEGRO_CLAMP(1, max, (int64_t)(*samples - done));
+      if (next_loop_bound(spl, &bound))
+         max = samples_before(spl, bound, max);
+      max = samples_before(spl, spl->step > 0 ? spl->spl_data.len : 0, max);
+      n = max;
+
+      first = spl->pos;
+      last = position_after(spl, n - 1, NULL);
+      set_up_window_view(spl, _ALLEGRO_MIN(first, last),
+         _ALLEGRO_MAX(first, last), &view);
+
+      spl->spl_read(&view, &buf, &n, buffer_depth, dest_maxc);
+
+      spl->pos = position_after(spl, n, &spl->pos_bresenham_error);
+      done += n;
+   }
+
+   fix_looped_position(spl);
+}
+
+
+/* is_unit_step:
+ *  Whether a sample instance plays forwards at exactly the mixer frequency,
+ *  e.g. a sample converted with al_convert_sample at speed 1.0.
+ */
+static bool is_unit_step(const ALLEGRO_SAMPLE_INSTANCE *spl)
+{
+   return spl->step == spl->step_denom && spl->pos_bresenham_error == 0 &&
+      (spl->loop == ALLEGRO_PLAYMODE_ONCE ||
+       spl->loop == ALLEGRO_PLAYMODE_LOOP ||
+       spl->loop == ALLEGRO_PLAYMODE_BIDIR);
+}
+
+
+/* read_unit_step:
+ *  Mix a sample instance for which is_unit_step holds, in runs up to the
+ *  next loop point without interpolating.  Once it plays any other way, e.g.
+ *  backwards after reaching the end of a bidirectional loop, the rest is
+ *  left to the instance's usual reader.
+ */
+static void read_unit_step(ALLEGRO_SAMPLE_INSTANCE *spl, void **vbuf,
+   unsigned int *samples, ALLEGRO_AUDIO_DEPTH buffer_depth, size_t dest_maxc)
+{
+   size_t dest_size = dest_maxc * al_get_audio_depth_size(buffer_depth);
+   unsigned int done = 0;
+
+   while (done < *samples) {
+      void *buf = (char *)*vbuf + done * dest_size;
+      unsigned int n = *samples - done;
+      int bound;
+
+      if (!spl->is_playing || !fix_looped_position(spl))
+         return;
+
+      if (!next_loop_bound(spl, &bound))
+         bound = spl->spl_data.len;
+      if (spl->step != spl->step_denom || spl->pos < 0 || spl->pos >= bound) {
+         spl->spl_read(spl, &buf, &n, buffer_depth, dest_maxc);
+         return;
+      }
+      n = _ALLEGRO_MIN(n, (unsigned int)(bound - spl->pos));
+
+      switch (buffer_depth) {
+         case ALLEGRO_AUDIO_DEPTH_FLOAT32:
+            unit_step_to_mixer_float_32(spl, buf, n, dest_maxc);
+            break;
+
+         case ALLEGRO_AUDIO_DEPTH_INT16:
+            unit_step_to_mixer_int16_t_16(spl, buf, n, dest_maxc);
+            break;
+
+         default:
+            /* Unsupported mixer depths. */
+            ASSERT(false);
+            return;
+      }
+      done += n;
+   }
+
+   fix_looped_position(spl);
+}
+
+
+static void premix_submixers(ALLEGRO_MIXER *mixer, unsigned int *samples);
+
+
+/* mix_mixer_buffer:
+ *  Mix the streams attached to the mixer into its own buffer, then apply the
+ *  post-processing callback and the gain.  Returns false if there is nothing
+ *  to pass on.
+ */
+static bool mix_mixer_buffer(ALLEGRO_MIXER *m, unsigned int *samples)
 {
    const ALLEGRO_MIXER *mixer;
-   ALLEGRO_MIXER *m = (ALLEGRO_MIXER *)source;
    int maxc = al_get_channel_count(m->ss.spl_data.chan_conf);
    int samples_l = *samples;
    int i;
 
+   _al_kcm_mixer_apply_updates(m);
+
    if (!m->ss.is_playing)
-      return;
+      return false;
 
    /* Make sure the mixer buffer is big enough. */
    if (m->ss.spl_data.len*maxc < samples_l*maxc) {
@@ -376,7 +1033,7 @@ void _al_kcm_mixer_read(void *source, void **buf, unsigned int *samples,
          _al_set_error(ALLEGRO_GENERIC_ERROR,
             "Out of memory allocating mixer buffer");
          m->ss.spl_data.len = 0;
-         return;
+         return false;
       }
       m->ss.spl_data.len = samples_l;
    }
@@ -386,11 +1043,30 @@ void _al_kcm_mixer_read(void *source, void **buf, unsigned int *samples,
    /* Clear the buffer to silence. */
    memset(mixer->ss.spl_data.buffer.ptr, 0, samples_l * maxc * al_get_audio_depth_size(mixer->ss.spl_data.depth));
 
+   select_real_instances(m);
+
+   if (m->parallel)
+      premix_submixers(m, samples);
+
    /* Mix the streams into the mixer buffer. */
    for (i = _al_vector_size(&mixer->streams) - 1; i >= 0; i--) {
       ALLEGRO_SAMPLE_INSTANCE **slot = _al_vector_ref(&mixer->streams, i);
       ALLEGRO_SAMPLE_INSTANCE *spl = *slot;
       ASSERT(spl->spl_read);
+      if (spl->is_virtual) {
+         advance_virtual_instance(spl, *samples);
+         continue;
+      }
+      if (spl->window) {
+         read_windowed(spl, (void **) &mixer->ss.spl_data.buffer.ptr, samples,
+            m->ss.spl_data.depth, maxc);
+         continue;
+      }
+      if (is_unit_step(spl)) {
+         read_unit_step(spl, (void **) &mixer->ss.spl_data.buffer.ptr, samples,
+            m->ss.spl_data.depth, maxc);
+         continue;
+      }
       spl->spl_read(spl, (void **) &mixer->ss.spl_data.buffer.ptr, samples,
          m->ss.spl_data.depth, maxc);
    }
@@ -401,12 +1077,10 @@ void _al_kcm_mixer_read(void *source, void **buf, unsigned int *samples,
          *samples, mixer->pp_callback_userdata);
    }
 
-   samples_l *= maxc;
-
    /* Apply the gain if necessary. */
    if (mixer->ss.gain != 1.0f) {
       float mixer_gain = mixer->ss.gain;
-      unsigned long i = samples_l;
+      unsigned long i = samples_l * maxc;
 
       switch (m->ss.spl_data.depth) {
          case ALLEGRO_AUDIO_DEPTH_FLOAT32: {
@@ -436,6 +1110,99 @@ void _al_kcm_mixer_read(void *source, void **buf, unsigned int *samples,
       }
    }
 
+
+   return true;
+}
+
+
+/* Mixing a mixer comes in two halves: mix_mixer_buffer mixes into the
+ * mixer's own buffer, then _al_kcm_mixer_read adds that to the parent's
+ * buffer.  The first half of sibling sub-mixers touches nothing but their
+ * own subtrees, so premix_submixers may do it on the worker threads ahead
+ * of time.  The second half always runs in the usual order on the voice
+ * thread, so the sums, and with them the output, are exactly the same as
+ * when mixing serially.
+ */
+typedef struct PREMIX_JOBS {
+   ALLEGRO_MIXER **mixers;
+   unsigned int *samples;
+} PREMIX_JOBS;
+
+
+static void premix_submixer(void *data, int index)
+{
+   PREMIX_JOBS *jobs = data;
+   ALLEGRO_MIXER *mixer = jobs->mixers[index];
+
+   mixer->premixed = mix_mixer_buffer(mixer, jobs->samples)
+      ? _AL_KCM_PREMIXED : _AL_KCM_PREMIXED_SILENT;
+}
+
+
+static void premix_submixers(ALLEGRO_MIXER *mixer, unsigned int *samples)
+{
+   int num_streams = _al_vector_size(&mixer->streams);
+   int num_mixers = 0;
+   PREMIX_JOBS jobs;
+   int i;
+
+   for (i = 0; i < num_streams; i++) {
+      ALLEGRO_SAMPLE_INSTANCE **slot = _al_vector_ref(&mixer->streams, i);
+      if ((*slot)->is_mixer && (*slot)->is_playing)
+         num_mixers++;
+   }
+   if (num_mixers < 2)
+      return;
+
+   if (mixer->submixers_size < num_mixers) {
+      ALLEGRO_MIXER **submixers = al_realloc(mixer->submixers,
+         num_mixers * sizeof(*submixers));
+      if (!submixers)
+         return;
+      mixer->submixers = submixers;
+      mixer->submixers_size = num_mixers;
+   }
+
+   num_mixers = 0;
+   for (i = 0; i < num_streams; i++) {
+      ALLEGRO_SAMPLE_INSTANCE **slot = _al_vector_ref(&mixer->streams, i);
+      if ((*slot)->is_mixer && (*slot)->is_playing)
+         mixer->submixers[num_mixers++] = (ALLEGRO_MIXER *)*slot;
+   }
+
+   /* If the workers are not available, the sub-mixers are simply mixed
+    * when their turn comes.
+    */
+   jobs.mixers = mixer->submixers;
+   jobs.samples = samples;
+   _al_kcm_run_mixer_jobs(premix_submixer, &jobs, num_mixers);
+}
+
+
+/* _al_kcm_mixer_read:
+ *  Mixes the streams attached to the mixer and writes additively to the
+ *  specified buffer (or if *buf is NULL, indicating a voice, convert it and
+ *  set it to the buffer pointer).
+ */
+void _al_kcm_mixer_read(void *source, void **buf, unsigned int *samples,
+   ALLEGRO_AUDIO_DEPTH buffer_depth, size_t dest_maxc)
+{
+   const ALLEGRO_MIXER *mixer;
+   ALLEGRO_MIXER *m = (ALLEGRO_MIXER *)source;
+   int maxc = al_get_channel_count(m->ss.spl_data.chan_conf);
+   int samples_l = *samples;
+   int premixed = m->premixed;
+
+   /* premix_submixers may have done the mixing already. */
+   m->premixed = _AL_KCM_NOT_PREMIXED;
+   if (premixed == _AL_KCM_PREMIXED_SILENT)
+      return;
+   if (premixed == _AL_KCM_NOT_PREMIXED && !mix_mixer_buffer(m, samples))
+      return;
+
+   mixer = m;
+   samples_l *= maxc;
+
    /* Feeding to a non-voice.
     * Currently we only support mixers of the same audio depth doing this.
     */
@@ -673,6 +1440,10 @@ ALLEGRO_MIXER *al_create_mixer(unsigned int freq,
 
    _al_vector_init(&mixer->streams, sizeof(ALLEGRO_SAMPLE_INSTANCE *));
 
+#ifdef _AL_HAVE_ATOMIC_CAS
+   init_updates(mixer);
+#endif
+
    mixer->dtor_item = _al_kcm_register_destructor("mixer", mixer, (void (*)(void *)) al_destroy_mixer);
 
    return mixer;
@@ -723,15 +1494,7 @@ bool al_attach_sample_instance_to_mixer(ALLEGRO_SAMPLE_INSTANCE *spl,
    }
    (*slot) = spl;
 
-   spl->step = (spl->spl_data.frequency) * spl->speed;
-   spl->step_denom = mixer->ss.spl_data.frequency;
-   /* Don't want to be trapped with a step value of 0. */
-   if (spl->step == 0) {
-      if (spl->speed > 0.0f)
-         spl->step = 1;
-      else
-         spl->step = -1;
-   }
+   update_sample_step(mixer, spl);
 
    /* Set the proper sample stream reader. */
    ASSERT(spl->spl_read == NULL);
@@ -1015,4 +1778,102 @@ bool al_detach_mixer(ALLEGRO_MIXER *mixer)
 }
 
 
+/* Function: al_get_mixer_max_real_instances
+ */
+int al_get_mixer_max_real_instances(const ALLEGRO_MIXER *mixer)
+{
+   ASSERT(mixer);
+
+   return mixer->max_real_instances;
+}
+
+
+/* Function: al_set_mixer_max_real_instances
+ */
+bool al_set_mixer_max_real_instances(ALLEGRO_MIXER *mixer, int max_instances)
+{
+   ASSERT(mixer);
+
+   if (max_instances < 0) {
+      _al_set_error(ALLEGRO_INVALID_PARAM,
+         "Attempted to set a negative number of real instances");
+      return false;
+   }
+
+   maybe_lock_mutex(mixer->ss.mutex);
+   mixer->max_real_instances = max_instances;
+   maybe_unlock_mutex(mixer->ss.mutex);
+
+   return true;
+}
+
+
+/* Function: al_get_mixer_audibility_threshold
+ */
+float al_get_mixer_audibility_threshold(const ALLEGRO_MIXER *mixer)
+{
+   ASSERT(mixer);
+
+   return mixer->audibility_threshold;
+}
+
+
+/* Function: al_set_mixer_audibility_threshold
+ */
+bool al_set_mixer_audibility_threshold(ALLEGRO_MIXER *mixer, float gain)
+{
+   ASSERT(mixer);
+
+   if (gain < 0.0f) {
+      _al_set_error(ALLEGRO_INVALID_PARAM,
+         "Attempted to set a negative audibility threshold");
+      return false;
+   }
+
+   maybe_lock_mutex(mixer->ss.mutex);
+   mixer->audibility_threshold = gain;
+   maybe_unlock_mutex(mixer->ss.mutex);
+
+   return true;
+}
+
+
+/* Function: al_get_mixer_instance_counts
+ */
+void al_get_mixer_instance_counts(const ALLEGRO_MIXER *mixer,
+   int *real_instances, int *virtual_instances)
+{
+   ASSERT(mixer);
+
+   if (real_instances)
+      *real_instances = mixer->real_instances;
+   if (virtual_instances)
+      *virtual_instances = mixer->virtual_instances;
+}
+
+
+/* Function: al_get_mixer_parallel
+ */
+bool al_get_mixer_parallel(const ALLEGRO_MIXER *mixer)
+{
+   ASSERT(mixer);
+
+   return mixer->parallel;
+}
+
+
+/* Function: al_set_mixer_parallel
+ */
+bool al_set_mixer_parallel(ALLEGRO_MIXER *mixer, bool parallel)
+{
+   ASSERT(mixer);
+
+   maybe_lock_mutex(mixer->ss.mutex);
+   mixer->parallel = parallel;
+   maybe_unlock_mutex(mixer->ss.mutex);
+
+   return true;
+}
+
+
 /* vim: set sts=3 sw=3 et: */
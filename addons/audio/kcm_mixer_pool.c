@@ -0,0 +1,215 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Worker threads for mixing sub-mixers in parallel.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "allegro5/allegro.h"
+#include "allegro5/allegro_audio.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_audio.h"
+
+ALLEGRO_DEBUG_CHANNEL("audio")
+
+
+#define MAX_WORKERS  8
+
+/* One batch of jobs runs at a time.  The thread submitting it works on the
+ * jobs too, so a batch completes even if the workers are slow to wake up.
+ */
+typedef struct MIXER_POOL {
+   ALLEGRO_MUTEX  *mutex;
+   ALLEGRO_COND   *work_cond;
+   ALLEGRO_COND   *done_cond;
+   ALLEGRO_THREAD *threads[MAX_WORKERS];
+   int            num_threads;
+   bool           started;
+   bool           quit;
+
+   bool           busy;
+   void           (*job)(void *data, int index);
+   void           *data;
+   int            count;
+   int            next;
+   int            unfinished;
+} MIXER_POOL;
+
+static MIXER_POOL pool;
+
+
+/* Runs jobs of the current batch until none are left to start.
+ * The pool mutex must be locked.
+ */
+static void work(void)
+{
+   while (pool.busy && pool.next < pool.count) {
+      int index = pool.next++;
+
+      al_unlock_mutex(pool.mutex);
+      pool.job(pool.data, index);
+      al_lock_mutex(pool.mutex);
+
+      if (--pool.unfinished == 0)
+         al_broadcast_cond(pool.done_cond);
+   }
+}
+
+
+static void *worker_thread(ALLEGRO_THREAD *thread, void *arg)
+{
+   (void)thread;
+   (void)arg;
+
+   al_lock_mutex(pool.mutex);
+   while (!pool.quit) {
+      work();
+      if (!pool.quit)
+         al_wait_cond(pool.work_cond, pool.mutex);
+   }
+   al_unlock_mutex(pool.mutex);
+
+   return NULL;
+}
+
+
+static int configured_num_threads(void)
+{
+   const char *value = al_get_config_value(al_get_system_config(), "audio",
+      "mixer_threads");
+   int n;
+
+   if (value && value[0] != '\0')
+      n = atoi(value);
+   else
+      n = _ALLEGRO_MIN(al_get_cpu_count() - 1, 3);
+
+   return _ALLEGRO_CLAMP(0, n, MAX_WORKERS);
+}
+
+
+/* Starts the worker threads the first time they are needed.
+ * The pool mutex must be locked.
+ */
+static void start_workers(void)
+{
+   int n = configured_num_threads();
+   int i;
+
+   pool.started = true;
+
+   for (i = 0; i < n; i++) {
+      ALLEGRO_THREAD *thread = al_create_thread(worker_thread, NULL);
+      if (!thread)
+         break;
+      pool.threads[pool.num_threads++] = thread;
+      al_start_thread(thread);
+   }
+
+   ALLEGRO_INFO("Started %d mixer worker threads\n", pool.num_threads);
+}
+
+
+/* _al_kcm_init_mixer_pool:
+ *  Prepare the worker threads, which are only started when a mixer is
+ *  first mixed in parallel.
+ */
+void _al_kcm_init_mixer_pool(void)
+{
+   if (pool.mutex)
+      return;
+
+   pool.mutex = al_create_mutex();
+   pool.work_cond = al_create_cond();
+   pool.done_cond = al_create_cond();
+   if (!pool.mutex || !pool.work_cond || !pool.done_cond) {
+      ALLEGRO_WARN("Could not create the mixer worker pool\n");
+      _al_kcm_shutdown_mixer_pool();
+   }
+}
+
+
+/* _al_kcm_shutdown_mixer_pool:
+ *  Stop the worker threads.  Nothing may be mixing anymore.
+ */
+void _al_kcm_shutdown_mixer_pool(void)
+{
+   int i;
+
+   if (pool.mutex && pool.work_cond) {
+      al_lock_mutex(pool.mutex);
+      pool.quit = true;
+      al_broadcast_cond(pool.work_cond);
+      al_unlock_mutex(pool.mutex);
+   }
+
+   for (i = 0; i < pool.num_threads; i++) {
+      al_join_thread(pool.threads[i], NULL);
+      al_destroy_thread(pool.threads[i]);
+   }
+
+   if (pool.mutex)
+      al_destroy_mutex(pool.mutex);
+   if (pool.work_cond)
+      al_destroy_cond(pool.work_cond);
+   if (pool.done_cond)
+      al_destroy_cond(pool.done_cond);
+
+   memset(&pool, 0, sizeof(pool));
+}
+
+
+/* _al_kcm_run_mixer_jobs:
+ *  Call job(data, i) for every i from 0 to count - 1, spread over the worker
+ *  threads and the calling thread, and wait until all have returned.
+ *  Returns false without calling anything if there are no workers or they
+ *  are busy with another batch, e.g. one of a parent mixer.
+ */
+bool _al_kcm_run_mixer_jobs(void (*job)(void *data, int index), void *data,
+   int count)
+{
+   if (!pool.mutex)
+      return false;
+
+   al_lock_mutex(pool.mutex);
+
+   if (!pool.started)
+      start_workers();
+
+   if (pool.busy || pool.num_threads == 0) {
+      al_unlock_mutex(pool.mutex);
+      return false;
+   }
+
+   pool.busy = true;
+   pool.job = job;
+   pool.data = data;
+   pool.count = count;
+   pool.next = 0;
+   pool.unfinished = count;
+   al_broadcast_cond(pool.work_cond);
+
+   work();
+   while (pool.unfinished > 0)
+      al_wait_cond(pool.done_cond, pool.mutex);
+
+   pool.busy = false;
+   al_unlock_mutex(pool.mutex);
+
+   return true;
+}
+
+
+/* vim: set sts=3 sw=3 et: */
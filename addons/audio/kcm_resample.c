@@ -0,0 +1,347 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Converting samples to another frequency and depth ahead of time.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+
+#include <math.h>
+#include <string.h>
+
+#include "allegro5/allegro.h"
+#include "allegro5/allegro_audio.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_audio.h"
+
+ALLEGRO_DEBUG_CHANNEL("audio")
+
+
+/* The filter is a windowed sinc with this many zero crossings on each side
+ * when upsampling, and proportionally more when downsampling.
+ */
+#define ZERO_CROSSINGS  16
+
+/* Passband edge, relative to the lower of the two Nyquist frequencies. */
+#define PASSBAND        0.97
+
+/* Kaiser window parameter, for about 80 dB stopband attenuation. */
+#define KAISER_BETA     8.0
+
+/* The most filter phases computed.  With more, the position between two
+ * input sample values is rounded to the nearest of this many.
+ */
+#define MAX_PHASES      1024
+
+
+typedef struct RESAMPLER {
+   unsigned int up;        /* output frequency / gcd */
+   unsigned int down;      /* input frequency / gcd */
+   int num_phases;
+   int half_taps;
+   float *taps;            /* num_phases * 2 * half_taps */
+} RESAMPLER;
+
+
+static unsigned int gcd(unsigned int a, unsigned int b)
+{
+   while (b) {
+      unsigned int t = a % b;
+      a = b;
+      b = t;
+   }
+   return a;
+}
+
+
+/* Zeroth order modified Bessel function of the first kind. */
+static double bessel_i0(double x)
+{
+   double sum = 1.0;
+   double term = 1.0;
+   int k;
+
+   for (k = 1; k < 50; k++) {
+      term *= (x / (2.0 * k)) * (x / (2.0 * k));
+      sum += term;
+      if (term < sum * 1e-12)
+         break;
+   }
+
+   return sum;
+}
+
+
+/* init_resampler:
+ *  Compute the filter for every phase.  Tap j of phase p weights the input
+ *  sample value at floor(t) - half_taps + 1 + j for an output sample value
+ *  at input position t with fractional part p / num_phases.  The taps of
+ *  every phase are normalized so that they add up to one.
+ */
+static bool init_resampler(RESAMPLER *r, unsigned int in_freq,
+   unsigned int out_freq)
+{
+   unsigned int g = gcd(in_freq, out_freq);
+   double cutoff = PASSBAND * _ALLEGRO_MIN(1.0, (double)out_freq / in_freq);
+   double i0_beta = bessel_i0(KAISER_BETA);
+   int taps, p, j;
+
+   r->up = out_freq / g;
+   r->down = in_freq / g;
+   r->num_phases = _ALLEGRO_MIN(r->up, MAX_PHASES);
+   r->half_taps = (int)ceil(ZERO_CROSSINGS / cutoff);
+   taps = 2 * r->half_taps;
+
+   r->taps = al_malloc(r->num_phases * taps * sizeof(float));
+   if (!r->taps)
+      return false;
+
+   for (p = 0; p < r->num_phases; p++) {
+      float *phase = r->taps + p * taps;
+      double frac = (double)p / r->num_phases;
+      double sum = 0.0;
+
+      for (j = 0; j < taps; j++) {
+         double x = j - r->half_taps + 1 - frac;
+         double w = x / r->half_taps;
+         double h = 0.0;
+
+         if (fabs(w) < 1.0) {
+            double y = ALLEGRO_PI * cutoff * x;
+            h = (x == 0.0) ? cutoff : cutoff * sin(y) / y;
+            h *= bessel_i0(KAISER_BETA * sqrt(1.0 - w * w)) / i0_beta;
+         }
+
+         phase[j] = h;
+         sum += h;
+      }
+
+      for (j = 0; j < taps; j++)
+         phase[j] /= sum;
+   }
+
+   return true;
+}
+
+
+/* get_float_values:
+ *  Convert count sample values of the given depth to floats, scaled like
+ *  the mixer does.
+ */
+static void get_float_values(float *dest, const void *src, size_t count,
+   ALLEGRO_AUDIO_DEPTH depth)
+{
+   size_t i;
+
+   switch (depth) {
+      case ALLEGRO_AUDIO_DEPTH_FLOAT32:
+         memcpy(dest, src, count * sizeof(float));
+         break;
+
+      case ALLEGRO_AUDIO_DEPTH_INT24:
+         for (i = 0; i < count; i++)
+            dest[i] = (float)((const int32_t *)src)[i] / ((float)0x7FFFFF + 0.5f);
+         break;
+
+      case ALLEGRO_AUDIO_DEPTH_UINT24:
+         for (i = 0; i < count; i++)
+            dest[i] = (float)((const uint32_t *)src)[i] / ((float)0x7FFFFF + 0.5f) - 1.0f;
+         break;
+
+      case ALLEGRO_AUDIO_DEPTH_INT16:
+         for (i = 0; i < count; i++)
+            dest[i] = (float)((const int16_t *)src)[i] / ((float)0x7FFF + 0.5f);
+         break;
+
+      case ALLEGRO_AUDIO_DEPTH_UINT16:
+         for (i = 0; i < count; i++)
+            dest[i] = (float)((const uint16_t *)src)[i] / ((float)0x7FFF + 0.5f) - 1.0f;
+         break;
+
+      case ALLEGRO_AUDIO_DEPTH_INT8:
+         for (i = 0; i < count; i++)
+            dest[i] = (float)((const int8_t *)src)[i] / ((float)0x7F + 0.5f);
+         break;
+
+      case ALLEGRO_AUDIO_DEPTH_UINT8:
+         for (i = 0; i < count; i++)
+            dest[i] = (float)((const uint8_t *)src)[i] / ((float)0x7F + 0.5f) - 1.0f;
+         break;
+   }
+}
+
+
+static int32_t clamp_value(float value, float scale, int32_t max)
+{
+   float v = value * scale;
+
+   if (v > max)
+      return max;
+   if (v < -max - 1)
+      return -max - 1;
+   return (int32_t)v;
+}
+
+
+/* put_float_value:
+ *  Store a float as sample value i of the given depth, clamped like the
+ *  mixer does for voices.
+ */
+static void put_float_value(void *dest, size_t i, float value,
+   ALLEGRO_AUDIO_DEPTH depth)
+{
+   switch (depth) {
+      case ALLEGRO_AUDIO_DEPTH_FLOAT32:
+         ((float *)dest)[i] = value;
+         break;
+
+      case ALLEGRO_AUDIO_DEPTH_INT24:
+         ((int32_t *)dest)[i] = clamp_value(value, (float)0x7FFFFF + 0.5f, 0x7FFFFF);
+         break;
+
+      case ALLEGRO_AUDIO_DEPTH_UINT24:
+         ((uint32_t *)dest)[i] = clamp_value(value, (float)0x7FFFFF + 0.5f, 0x7FFFFF) + 0x800000;
+         break;
+
+      case ALLEGRO_AUDIO_DEPTH_INT16:
+         ((int16_t *)dest)[i] = clamp_value(value, (float)0x7FFF + 0.5f, 0x7FFF);
+         break;
+
+      case ALLEGRO_AUDIO_DEPTH_UINT16:
+         ((uint16_t *)dest)[i] = clamp_value(value, (float)0x7FFF + 0.5f, 0x7FFF) + 0x8000;
+         break;
+
+      case ALLEGRO_AUDIO_DEPTH_INT8:
+         ((int8_t *)dest)[i] = clamp_value(value, (float)0x7F + 0.5f, 0x7F);
+         break;
+
+      case ALLEGRO_AUDIO_DEPTH_UINT8:
+         ((uint8_t *)dest)[i] = clamp_value(value, (float)0x7F + 0.5f, 0x7F) + 0x80;
+         break;
+   }
+}
+
+
+/* resample:
+ *  Filter len sample values of maxc channels each from src into out_len
+ *  sample values of the given depth in dest.  The source is silent before
+ *  its start and after its end.
+ */
+static void resample(const RESAMPLER *r, const float *src, int len, int maxc,
+   void *dest, int out_len, ALLEGRO_AUDIO_DEPTH depth)
+{
+   const int taps = 2 * r->half_taps;
+   float acc[ALLEGRO_MAX_CHANNELS];
+   int n, j, c;
+
+   for (n = 0; n < out_len; n++) {
+      uint64_t t = (uint64_t)n * r->down;
+      int base = t / r->up;
+      int frac = t % r->up;
+      int p = (int)((uint64_t)frac * r->num_phases / r->up);
+      const float *phase = r->taps + p * taps;
+      int first = base - r->half_taps + 1;
+      int j0 = _ALLEGRO_MAX(0, -first);
+      int j1 = _ALLEGRO_MIN(taps, len - first);
+
+      for (c = 0; c < maxc; c++)
+         acc[c] = 0.0f;
+
+      for (j = j0; j < j1; j++) {
+         const float *s = src + (first + j) * maxc;
+         for (c = 0; c < maxc; c++)
+            acc[c] += phase[j] * s[c];
+      }
+
+      for (c = 0; c < maxc; c++)
+         put_float_value(dest, n * maxc + c, acc[c], depth);
+   }
+}
+
+
+/* Function: al_convert_sample
+ */
+ALLEGRO_SAMPLE *al_convert_sample(const ALLEGRO_SAMPLE *spl,
+   unsigned int frequency, ALLEGRO_AUDIO_DEPTH depth)
+{
+   const void *data;
+   int maxc;
+   int len;
+   int out_len;
+   size_t out_size;
+   float *values;
+   void *buf;
+   ALLEGRO_SAMPLE *out;
+
+   ASSERT(spl);
+
+   if (frequency == 0) {
+      _al_set_error(ALLEGRO_INVALID_PARAM, "Invalid sample frequency");
+      return NULL;
+   }
+
+   data = al_get_sample_data(spl);
+   if (!data) {
+      _al_set_error(ALLEGRO_INVALID_OBJECT, "Sample has no data");
+      return NULL;
+   }
+
+   maxc = al_get_channel_count(spl->chan_conf);
+   len = spl->len;
+   out_len = ((uint64_t)len * frequency + spl->frequency - 1) / spl->frequency;
+   out_size = (size_t)out_len * maxc * al_get_audio_depth_size(depth);
+
+   values = al_malloc((size_t)len * maxc * sizeof(float));
+   buf = al_malloc(out_size);
+   if (!values || !buf) {
+      _al_set_error(ALLEGRO_GENERIC_ERROR,
+         "Out of memory allocating sample data buffers");
+      al_free(values);
+      al_free(buf);
+      return NULL;
+   }
+
+   get_float_values(values, data, (size_t)len * maxc, spl->depth);
+
+   if (frequency == spl->frequency) {
+      size_t i;
+      for (i = 0; i < (size_t)len * maxc; i++)
+         put_float_value(buf, i, values[i], depth);
+   }
+   else {
+      RESAMPLER r;
+
+      if (!init_resampler(&r, spl->frequency, frequency)) {
+         _al_set_error(ALLEGRO_GENERIC_ERROR,
+            "Out of memory allocating the resampling filter");
+         al_free(values);
+         al_free(buf);
+         return NULL;
+      }
+
+      ALLEGRO_DEBUG("Resampling %d sample values from %u Hz to %u Hz "
+         "with %d phases of %d taps\n", len, spl->frequency, frequency,
+         r.num_phases, 2 * r.half_taps);
+      resample(&r, values, len, maxc, buf, out_len, depth);
+      al_free(r.taps);
+   }
+
+   al_free(values);
+
+   out = al_create_sample(buf, out_len, frequency, depth, spl->chan_conf, true);
+   if (!out)
+      al_free(buf);
+
+   return out;
+}
+
+
+/* vim: set sts=3 sw=3 et: */
@@ -172,10 +172,17 @@ static void stop_sample_instances_helper(void *object, void (*func)(void *),
    void *userdata)
 {
    ALLEGRO_SAMPLE_INSTANCE *splinst = object;
+   ALLEGRO_SAMPLE *spl = userdata;
+   bool uses_sample;
+
+   if (spl->compressed)
+      uses_sample = splinst->spl_data.compressed == spl->compressed;
+   else
+      uses_sample = splinst->spl_data.buffer.ptr == spl->buffer.ptr;
 
    /* This is ugly. */
    if (func == (void (*)(void *)) al_destroy_sample_instance
-      && al_get_sample_data(al_get_sample(splinst)) == userdata
+      && uses_sample
       && al_get_sample_instance_playing(splinst))
    {
       al_stop_sample_instance(splinst);
@@ -188,9 +195,9 @@ static void stop_sample_instances_helper(void *object, void (*func)(void *),
 void al_destroy_sample(ALLEGRO_SAMPLE *spl)
 {
    if (spl) {
-      _al_kcm_foreach_destructor(stop_sample_instances_helper,
-         al_get_sample_data(spl));
+      _al_kcm_foreach_destructor(stop_sample_instances_helper, spl);
       _al_kcm_unregister_destructor(spl->dtor_item);
+      _al_kcm_destroy_compressed_sample(spl);
 
       if (spl->free_buf && spl->buffer.ptr) {
          al_free(spl->buffer.ptr);
@@ -505,10 +512,23 @@ void *al_get_sample_data(const ALLEGRO_SAMPLE *spl)
 {
    ASSERT(spl);
 
+   if (!spl->buffer.ptr && spl->compressed)
+      return _al_kcm_decode_compressed_sample(spl->compressed, spl);
+
    return spl->buffer.ptr;
 }
 
 
+/* Function: al_is_sample_compressed
+ */
+bool al_is_sample_compressed(const ALLEGRO_SAMPLE *spl)
+{
+   ASSERT(spl);
+
+   return spl->compressed != NULL;
+}
+
+
 /* Destroy all sample instances, and frees the associated vectors. */
 static void free_sample_vector(void)
 {
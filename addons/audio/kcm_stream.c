@@ -145,12 +145,15 @@ ALLEGRO_AUDIO_STREAM *al_create_audio_stream(size_t fragment_count,
 void al_destroy_audio_stream(ALLEGRO_AUDIO_STREAM *stream)
 {
    if (stream) {
-      if (stream->feed_thread) {
+      /* Detach first so that a stream fed directly by the mixer is not fed
+       * while its feeder is unloaded.
+       */
+      _al_kcm_detach_from_parent(&stream->spl);
+      if (stream->unload_feeder) {
          stream->unload_feeder(stream);
       }
       /* See commented out call to _al_kcm_register_destructor. */
       /* _al_kcm_unregister_destructor(stream->dtor_item); */
-      _al_kcm_detach_from_parent(&stream->spl);
 
       al_destroy_user_event_source(&stream->spl.es);
       al_free(stream->main_buffer);
@@ -376,17 +379,8 @@ bool al_set_audio_stream_speed(ALLEGRO_AUDIO_STREAM *stream, float val)
 
    stream->spl.speed = val;
    if (stream->spl.parent.u.mixer) {
-      ALLEGRO_MIXER *mixer = stream->spl.parent.u.mixer;
-      ALLEGRO_MUTEX *stream_mutex = maybe_lock_mutex(stream->spl.mutex);
-
-      stream->spl.step = (stream->spl.spl_data.frequency) * stream->spl.speed;
-      stream->spl.step_denom = mixer->ss.spl_data.frequency;
-      /* Don't wanna be trapped with a step value of 0 */
-      if (stream->spl.step == 0) {
-         stream->spl.step = 1;
-      }
-
-      maybe_unlock_mutex(stream_mutex);
+      _al_kcm_mixer_update_sample(stream->spl.parent.u.mixer, &stream->spl,
+         _AL_KCM_UPDATE_STEP);
    }
 
    return true;
@@ -412,10 +406,8 @@ bool al_set_audio_stream_gain(ALLEGRO_AUDIO_STREAM *stream, float val)
        * matrix to take into account the gain.
        */
       if (stream->spl.parent.u.mixer) {
-         ALLEGRO_MIXER *mixer = stream->spl.parent.u.mixer;
-         ALLEGRO_MUTEX *stream_mutex = maybe_lock_mutex(stream->spl.mutex);
-         _al_kcm_mixer_rejig_sample_matrix(mixer, &stream->spl);
-         maybe_unlock_mutex(stream_mutex);
+         _al_kcm_mixer_update_sample(stream->spl.parent.u.mixer,
+            &stream->spl, _AL_KCM_UPDATE_MATRIX);
       }
    }
 
@@ -446,10 +438,8 @@ bool al_set_audio_stream_pan(ALLEGRO_AUDIO_STREAM *stream, float val)
        * matrix to take into account the panning.
        */
       if (stream->spl.parent.u.mixer) {
-         ALLEGRO_MIXER *mixer = stream->spl.parent.u.mixer;
-         ALLEGRO_MUTEX *stream_mutex = maybe_lock_mutex(stream->spl.mutex);
-         _al_kcm_mixer_rejig_sample_matrix(mixer, &stream->spl);
-         maybe_unlock_mutex(stream_mutex);
+         _al_kcm_mixer_update_sample(stream->spl.parent.u.mixer,
+            &stream->spl, _AL_KCM_UPDATE_MATRIX);
       }
    }
 
@@ -525,6 +515,12 @@ static void reset_stopped_stream(ALLEGRO_AUDIO_STREAM *stream)
    stream->spl.pos = stream->spl.spl_data.len;
    stream->spl.pos_bresenham_error = 0;
    stream->consumed_fragments = 0;
+
+   /* A stream fed directly may have been stopped while playing out the end
+    * of its data.  It is fed again when restarted.
+    */
+   if (stream->feed_directly)
+      stream->is_draining = false;
 }
 
 
@@ -779,8 +775,85 @@ void *_al_kcm_feed_stream(ALLEGRO_THREAD *self, void *vstream)
 }
 
 
+/* feed_stream_directly:
+ *  Refill the free fragments of a stream whose feeder only copies from
+ *  memory, in the calling thread.  This does what _al_kcm_feed_stream does
+ *  for fragment events, without the thread and without the events.
+ *  The stream mutex must be locked if there is one.
+ */
+static void feed_stream_directly(ALLEGRO_AUDIO_STREAM *stream)
+{
+   const int bytes_per_sample =
+      al_get_channel_count(stream->spl.spl_data.chan_conf) *
+      al_get_audio_depth_size(stream->spl.spl_data.depth);
+   const unsigned long bytes = stream->spl.spl_data.len * bytes_per_sample;
+   size_t i, n;
+
+   if (stream->is_draining) {
+      /* The end of the data is playing.  Once it has played the mixer stops
+       * the stream and calls this again.
+       */
+      if (!stream->spl.is_playing) {
+         ALLEGRO_EVENT fin_event;
+         stream->is_draining = false;
+
+         fin_event.user.type = ALLEGRO_EVENT_AUDIO_STREAM_FINISHED;
+         fin_event.user.timestamp = al_get_time();
+         al_emit_user_event(&stream->spl.es, &fin_event, NULL);
+      }
+      return;
+   }
+
+   for (n = 0; n < stream->buf_count && stream->pending_bufs[n]; n++)
+      ;
+
+   while (n < stream->buf_count && stream->used_bufs[0]) {
+      char *fragment = stream->used_bufs[0];
+      unsigned long bytes_written;
+
+      for (i = 0; i < stream->buf_count-1 && stream->used_bufs[i]; i++) {
+         stream->used_bufs[i] = stream->used_bufs[i+1];
+      }
+      stream->used_bufs[i] = NULL;
+
+      bytes_written = stream->feeder(stream, fragment, bytes);
+
+      if (stream->spl.loop == _ALLEGRO_PLAYMODE_STREAM_ONEDIR) {
+         while (bytes_written < bytes) {
+            size_t bw;
+            stream->rewind_feeder(stream);
+            bw = stream->feeder(stream, fragment + bytes_written,
+               bytes - bytes_written);
+            if (bw == 0)
+               break;
+            bytes_written += bw;
+         }
+      }
+
+      if (bytes_written < bytes) {
+         al_fill_silence(fragment + bytes_written,
+            (bytes - bytes_written) / bytes_per_sample,
+            stream->spl.spl_data.depth, stream->spl.spl_data.chan_conf);
+      }
+
+      stream->pending_bufs[n++] = fragment;
+
+      if (bytes_written < bytes &&
+            stream->spl.loop == _ALLEGRO_PLAYMODE_STREAM_ONCE) {
+         stream->is_draining = true;
+         break;
+      }
+   }
+}
+
+
 void _al_kcm_emit_stream_events(ALLEGRO_AUDIO_STREAM *stream)
 {
+   if (stream->feed_directly) {
+      feed_stream_directly(stream);
+      return;
+   }
+
    /* Emit one event for each stream fragment available right now.
     *
     * There may already be an event corresponding to an available fragment in
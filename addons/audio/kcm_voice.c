@@ -146,6 +146,13 @@ bool al_attach_sample_instance_to_voice(ALLEGRO_SAMPLE_INSTANCE *spl,
       return false;
    }
 
+   if (spl->window) {
+      ALLEGRO_WARN("Attempted to attach a compressed sample to a voice\n");
+      _al_set_error(ALLEGRO_INVALID_OBJECT,
+         "Compressed samples can only be attached to mixers");
+      return false;
+   }
+
    if (voice->chan_conf != spl->spl_data.chan_conf ||
       voice->frequency != spl->spl_data.frequency ||
       voice->depth != spl->spl_data.depth)
@@ -219,6 +226,10 @@ static void stream_read(void *source, void **vbuf, unsigned int *samples,
       if (!stream->pending_bufs[0]) {
          if (stream->is_draining) {
             stream->spl.is_playing = false;
+            /* As in the mixer, this is where a stream fed directly sends
+             * ALLEGRO_EVENT_AUDIO_STREAM_FINISHED.
+             */
+            _al_kcm_emit_stream_events(stream);
          }
          *vbuf = NULL;
          *samples = 0;
@@ -48,6 +48,10 @@
 typedef struct ALLEGRO_FONT ALLEGRO_FONT;
 #if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_FONT_SRC)
 
+/* Type: ALLEGRO_TEXT_LAYOUT
+*/
+typedef struct ALLEGRO_TEXT_LAYOUT ALLEGRO_TEXT_LAYOUT;
+
 /* Type: ALLEGRO_GLYPH
 */
 typedef struct ALLEGRO_GLYPH ALLEGRO_GLYPH;
@@ -134,6 +138,23 @@ ALLEGRO_FONT_FUNC(void, al_do_multiline_ustr, (const ALLEGRO_FONT *font,
    bool (*cb)(int line_num, const ALLEGRO_USTR *line, void *extra),
    void *extra));
 
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_FONT_SRC)
+ALLEGRO_FONT_FUNC(ALLEGRO_TEXT_LAYOUT *, al_create_text_layout, (const ALLEGRO_FONT *font));
+ALLEGRO_FONT_FUNC(void, al_destroy_text_layout, (ALLEGRO_TEXT_LAYOUT *layout));
+ALLEGRO_FONT_FUNC(bool, al_set_text_layout_text, (ALLEGRO_TEXT_LAYOUT *layout, const char *text));
+ALLEGRO_FONT_FUNC(bool, al_set_text_layout_ustr, (ALLEGRO_TEXT_LAYOUT *layout, const ALLEGRO_USTR *ustr));
+ALLEGRO_FONT_FUNC(void, al_set_text_layout_max_width, (ALLEGRO_TEXT_LAYOUT *layout, float max_width));
+ALLEGRO_FONT_FUNC(float, al_get_text_layout_max_width, (const ALLEGRO_TEXT_LAYOUT *layout));
+ALLEGRO_FONT_FUNC(int, al_get_text_layout_line_count, (ALLEGRO_TEXT_LAYOUT *layout));
+ALLEGRO_FONT_FUNC(const ALLEGRO_USTR *, al_get_text_layout_line, (ALLEGRO_TEXT_LAYOUT *layout,
+   int line_num, ALLEGRO_USTR_INFO *info));
+ALLEGRO_FONT_FUNC(void, al_do_text_layout, (ALLEGRO_TEXT_LAYOUT *layout,
+   bool (*cb)(int line_num, const ALLEGRO_USTR *line, void *extra),
+   void *extra));
+ALLEGRO_FONT_FUNC(void, al_draw_text_layout, (ALLEGRO_TEXT_LAYOUT *layout,
+   ALLEGRO_COLOR color, float x, float y, float line_height, int flags));
+#endif
+
 ALLEGRO_FONT_FUNC(void, al_set_fallback_font, (ALLEGRO_FONT *font,
    ALLEGRO_FONT *fallback));
 ALLEGRO_FONT_FUNC(ALLEGRO_FONT *, al_get_fallback_font, (
@@ -38,4 +38,31 @@ struct ALLEGRO_FONT_VTABLE
    ALLEGRO_FONT_METHOD(bool, get_glyph, (const ALLEGRO_FONT *f, int prev_codepoint, int codepoint, ALLEGRO_GLYPH *glyph));
 };
 
+/* A single "hard" line of text (no newlines) with the advance of every
+ * codepoint measured once, and the "soft" line breaks computed for it.
+ */
+typedef struct _AL_TEXT_PARAGRAPH
+{
+   const ALLEGRO_USTR *text;
+   int num_chars;
+   int *offset;         /* byte offset of each char, plus end of text */
+   int *advance;        /* prefix sums of the kerned advances */
+   int *last;           /* unkerned advance, used for the last char */
+   int *separator;      /* char index of each space/tab, plus num_chars */
+   int num_separators;
+   int chars_size;
+
+   int *lines;          /* start and end byte offset of each soft line */
+   int num_lines;
+   int lines_size;
+   float break_width;
+   bool breaks_valid;
+} _AL_TEXT_PARAGRAPH;
+
+void _al_text_paragraph_init(_AL_TEXT_PARAGRAPH *para);
+void _al_text_paragraph_free(_AL_TEXT_PARAGRAPH *para);
+bool _al_text_paragraph_measure(_AL_TEXT_PARAGRAPH *para,
+   const ALLEGRO_FONT *font, const ALLEGRO_USTR *text);
+bool _al_text_paragraph_break(_AL_TEXT_PARAGRAPH *para, float max_width);
+
 #endif
@@ -0,0 +1,650 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Multi-line text layout with cached line breaks.
+ *
+ *      See readme.txt for copyright information.
+ */
+
+
+#include <string.h>
+#include "allegro5/allegro.h"
+
+#include "allegro5/allegro_font.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_font.h"
+
+ALLEGRO_DEBUG_CHANNEL("font")
+
+
+typedef struct LAYOUT_PARAGRAPH
+{
+   _AL_TEXT_PARAGRAPH para;
+   ALLEGRO_USTR *text;
+   uint32_t hash;
+   int first_line;
+} LAYOUT_PARAGRAPH;
+
+
+struct ALLEGRO_TEXT_LAYOUT
+{
+   const ALLEGRO_FONT *font;
+   float max_width;
+   LAYOUT_PARAGRAPH **paragraphs;
+   int num_paragraphs;
+   int num_lines;
+   bool lines_valid;
+};
+
+
+
+void _al_text_paragraph_init(_AL_TEXT_PARAGRAPH *para)
+{
+   memset(para, 0, sizeof(*para));
+}
+
+
+
+void _al_text_paragraph_free(_AL_TEXT_PARAGRAPH *para)
+{
+   /* All the per-char arrays share the allocation of offset. */
+   al_free(para->offset);
+   al_free(para->lines);
+   _al_text_paragraph_init(para);
+}
+
+
+
+static bool reserve_chars(_AL_TEXT_PARAGRAPH *para, int size)
+{
+   int *buf;
+
+   if (size <= para->chars_size && para->offset)
+      return true;
+
+   /* A codepoint takes at least one byte so size is an upper bound on
+    * the number of chars. Each array has room for a sentinel.
+    */
+   buf = al_realloc(para->offset, 4 * (size + 1) * sizeof(int));
+   if (!buf)
+      return false;
+
+   para->offset = buf;
+   para->advance = buf + (size + 1);
+   para->last = buf + 2 * (size + 1);
+   para->separator = buf + 3 * (size + 1);
+   para->chars_size = size;
+   return true;
+}
+
+
+
+/* Measures the advance of every codepoint in text exactly once.
+ * The paragraph keeps a reference to text, which must not be modified
+ * or freed while the paragraph is in use.
+ */
+bool _al_text_paragraph_measure(_AL_TEXT_PARAGRAPH *para,
+   const ALLEGRO_FONT *font, const ALLEGRO_USTR *text)
+{
+   int size = al_ustr_size(text);
+   int pos = 0;
+   int next_pos = 0;
+   int n = 0;
+   int ns = 0;
+   int x = 0;
+   int32_t ch, nch;
+
+   para->breaks_valid = false;
+   para->num_chars = 0;
+   para->num_separators = 0;
+
+   if (!reserve_chars(para, size))
+      return false;
+
+   para->text = text;
+
+   nch = al_ustr_get_next(text, &next_pos);
+   while (nch != -1) {
+      ch = nch;
+      para->offset[n] = pos;
+      pos = next_pos;
+      nch = al_ustr_get_next(text, &next_pos);
+
+      para->advance[n] = x;
+      if (ch < 0) {
+         /* Invalid byte sequence, takes no space. */
+         para->last[n] = 0;
+      }
+      else if (nch < 0) {
+         para->last[n] = al_get_glyph_advance(font, ch, ALLEGRO_NO_KERNING);
+         x += para->last[n];
+      }
+      else {
+         para->last[n] = al_get_glyph_advance(font, ch, ALLEGRO_NO_KERNING);
+         x += al_get_glyph_advance(font, ch, nch);
+      }
+
+      if (ch == ' ' || ch == '\t')
+         para->separator[ns++] = n;
+      n++;
+   }
+
+   para->offset[n] = size;
+   para->advance[n] = x;
+   para->separator[ns] = n;
+   para->num_chars = n;
+   para->num_separators = ns;
+   return true;
+}
+
+
+
+/* Width of the chars [a, b), the same as al_get_ustr_width would return
+ * for that part of the text.
+ */
+static int chars_width(const _AL_TEXT_PARAGRAPH *para, int a, int b)
+{
+   if (b <= a)
+      return 0;
+   return para->advance[b - 1] - para->advance[a] + para->last[b - 1];
+}
+
+
+
+static bool add_line(_AL_TEXT_PARAGRAPH *para, int start, int end)
+{
+   if (para->num_lines >= para->lines_size) {
+      int new_size = para->lines_size ? para->lines_size * 2 : 4;
+      int *lines = al_realloc(para->lines, 2 * new_size * sizeof(int));
+      if (!lines)
+         return false;
+      para->lines = lines;
+      para->lines_size = new_size;
+   }
+
+   para->lines[2 * para->num_lines] = para->offset[start];
+   para->lines[2 * para->num_lines + 1] = para->offset[end];
+   para->num_lines++;
+   return true;
+}
+
+
+
+/* Splits a measured paragraph into "soft" lines which fit max_width,
+ * breaking at a space or tab. The split follows the same rules as
+ * al_do_multiline_ustr always has: a word that does not fit on a line
+ * of its own is returned as a line anyway, and the whitespace character
+ * a line was broken at is not part of either line.
+ * Every word is only looked at once, using the cached advances.
+ */
+bool _al_text_paragraph_break(_AL_TEXT_PARAGRAPH *para, float max_width)
+{
+   const int n = para->num_chars;
+   int start = 0;
+   int k = 0;
+
+   if (para->breaks_valid && para->break_width == max_width)
+      return true;
+
+   para->num_lines = 0;
+   para->breaks_valid = false;
+
+   /* An empty hard line is a single empty soft line. */
+   if (n == 0) {
+      if (!add_line(para, 0, 0))
+         return false;
+   }
+
+   while (start < n) {
+      int old_end = -1;
+      int line_end;
+      int next;
+
+      /* Word k spans from start (or the char after separator k-1) up
+       * to separator k.
+       */
+      for (;;) {
+         int end = para->separator[k];
+
+         if (chars_width(para, start, end) > max_width) {
+            if (old_end < 0) {
+               /* A single word may not even fit the line. */
+               line_end = end;
+               next = end + 1;
+               k++;
+            }
+            else {
+               line_end = old_end;
+               next = old_end + 1;
+            }
+            break;
+         }
+
+         old_end = end;
+         k++;
+         if (end + 1 >= n) {
+            /* The rest of the line fits. */
+            line_end = n;
+            next = n;
+            break;
+         }
+      }
+
+      if (!add_line(para, start, line_end))
+         return false;
+      start = next;
+   }
+
+   para->break_width = max_width;
+   para->breaks_valid = true;
+   return true;
+}
+
+
+
+/* FNV-1a */
+static uint32_t hash_bytes(const char *s, int size)
+{
+   uint32_t h = 2166136261u;
+   int i;
+
+   for (i = 0; i < size; i++) {
+      h ^= (unsigned char)s[i];
+      h *= 16777619u;
+   }
+   return h;
+}
+
+
+
+static void destroy_paragraph(LAYOUT_PARAGRAPH *lp)
+{
+   _al_text_paragraph_free(&lp->para);
+   al_ustr_free(lp->text);
+   al_free(lp);
+}
+
+
+
+static LAYOUT_PARAGRAPH *create_paragraph(const ALLEGRO_FONT *font,
+   const ALLEGRO_USTR *text, uint32_t hash)
+{
+   LAYOUT_PARAGRAPH *lp = al_calloc(1, sizeof(*lp));
+   if (!lp)
+      return NULL;
+
+   _al_text_paragraph_init(&lp->para);
+   lp->text = al_ustr_dup(text);
+   lp->hash = hash;
+   if (!lp->text || !_al_text_paragraph_measure(&lp->para, font, lp->text)) {
+      destroy_paragraph(lp);
+      return NULL;
+   }
+   return lp;
+}
+
+
+
+static void destroy_paragraphs(ALLEGRO_TEXT_LAYOUT *layout)
+{
+   int i;
+
+   for (i = 0; i < layout->num_paragraphs; i++) {
+      /* Paragraphs moved to a new text are NULL here. */
+      if (layout->paragraphs[i])
+         destroy_paragraph(layout->paragraphs[i]);
+   }
+   al_free(layout->paragraphs);
+   layout->paragraphs = NULL;
+   layout->num_paragraphs = 0;
+}
+
+
+
+/* Breaks all paragraphs which have not been broken at the current width
+ * yet and recounts the lines.
+ */
+static bool update_lines(ALLEGRO_TEXT_LAYOUT *layout)
+{
+   int i;
+
+   if (layout->lines_valid)
+      return true;
+
+   layout->num_lines = 0;
+   for (i = 0; i < layout->num_paragraphs; i++) {
+      LAYOUT_PARAGRAPH *lp = layout->paragraphs[i];
+      if (!_al_text_paragraph_break(&lp->para, layout->max_width)) {
+         layout->num_lines = 0;
+         return false;
+      }
+      lp->first_line = layout->num_lines;
+      layout->num_lines += lp->para.num_lines;
+   }
+
+   layout->lines_valid = true;
+   return true;
+}
+
+
+
+/* Function: al_create_text_layout
+ */
+ALLEGRO_TEXT_LAYOUT *al_create_text_layout(const ALLEGRO_FONT *font)
+{
+   ALLEGRO_TEXT_LAYOUT *layout;
+   ASSERT(font);
+
+   layout = al_calloc(1, sizeof(*layout));
+   if (!layout)
+      return NULL;
+
+   layout->font = font;
+   layout->lines_valid = true;
+   return layout;
+}
+
+
+
+/* Function: al_destroy_text_layout
+ */
+void al_destroy_text_layout(ALLEGRO_TEXT_LAYOUT *layout)
+{
+   if (!layout)
+      return;
+
+   destroy_paragraphs(layout);
+   al_free(layout);
+}
+
+
+
+/* Function: al_set_text_layout_ustr
+ */
+bool al_set_text_layout_ustr(ALLEGRO_TEXT_LAYOUT *layout,
+   const ALLEGRO_USTR *ustr)
+{
+   LAYOUT_PARAGRAPH **old = layout->paragraphs;
+   int num_old = layout->num_paragraphs;
+   LAYOUT_PARAGRAPH **paragraphs = NULL;
+   int num_paragraphs = 0;
+   int paragraphs_size = 0;
+   int *table = NULL;
+   int table_mask = 0;
+   int size = al_ustr_size(ustr);
+   const char *data = al_cstr(ustr);
+   int pos = 0;
+   int reused = 0;
+   int i;
+
+   ASSERT(layout);
+   ASSERT(ustr);
+
+   /* Index the old paragraphs by the hash of their text so unchanged
+    * paragraphs can be kept no matter where they moved to.
+    */
+   if (num_old > 0) {
+      int table_size = 16;
+      while (table_size < 2 * num_old)
+         table_size *= 2;
+      table = al_malloc(table_size * sizeof(int));
+      if (!table)
+         return false;
+      table_mask = table_size - 1;
+      for (i = 0; i < table_size; i++)
+         table[i] = -1;
+      for (i = 0; i < num_old; i++) {
+         int slot = old[i]->hash & table_mask;
+         while (table[slot] >= 0)
+            slot = (slot + 1) & table_mask;
+         table[slot] = i;
+      }
+   }
+
+   /* Like al_do_multiline_ustr, a trailing newline does not start another
+    * paragraph.
+    */
+   while (pos < size) {
+      ALLEGRO_USTR_INFO info;
+      const ALLEGRO_USTR *text;
+      LAYOUT_PARAGRAPH *lp = NULL;
+      uint32_t hash;
+      int end = al_ustr_find_chr(ustr, pos, '\n');
+
+      if (end < 0)
+         end = size;
+      text = al_ref_ustr(&info, ustr, pos, end);
+      hash = hash_bytes(data + pos, end - pos);
+
+      if (table) {
+         int slot = hash & table_mask;
+         while (table[slot] >= 0) {
+            LAYOUT_PARAGRAPH *candidate = old[table[slot]];
+            if (candidate && candidate->hash == hash &&
+                  al_ustr_equal(candidate->text, text)) {
+               lp = candidate;
+               old[table[slot]] = NULL;
+               reused++;
+               break;
+            }
+            slot = (slot + 1) & table_mask;
+         }
+      }
+
+      if (!lp)
+         lp = create_paragraph(layout->font, text, hash);
+
+      if (lp && num_paragraphs >= paragraphs_size) {
+         LAYOUT_PARAGRAPH **p;
+         paragraphs_size = paragraphs_size ? paragraphs_size * 2 : 16;
+         p = al_realloc(paragraphs, paragraphs_size * sizeof(*p));
+         if (!p) {
+            destroy_paragraph(lp);
+            lp = NULL;
+         }
+         else {
+            paragraphs = p;
+         }
+      }
+
+      if (!lp) {
+         /* Out of memory, leave the layout empty. */
+         for (i = 0; i < num_paragraphs; i++)
+            destroy_paragraph(paragraphs[i]);
+         al_free(paragraphs);
+         al_free(table);
+         destroy_paragraphs(layout);
+         layout->num_lines = 0;
+         layout->lines_valid = true;
+         return false;
+      }
+
+      paragraphs[num_paragraphs++] = lp;
+      pos = end + 1;
+   }
+
+   ALLEGRO_DEBUG("Text layout: %d paragraphs, %d reused.\n", num_paragraphs,
+      reused);
+
+   al_free(table);
+   destroy_paragraphs(layout);
+   layout->paragraphs = paragraphs;
+   layout->num_paragraphs = num_paragraphs;
+   layout->lines_valid = false;
+   return true;
+}
+
+
+
+/* Function: al_set_text_layout_text
+ */
+bool al_set_text_layout_text(ALLEGRO_TEXT_LAYOUT *layout, const char *text)
+{
+   ALLEGRO_USTR_INFO info;
+   ASSERT(text);
+
+   return al_set_text_layout_ustr(layout, al_ref_cstr(&info, text));
+}
+
+
+
+/* Function: al_set_text_layout_max_width
+ */
+void al_set_text_layout_max_width(ALLEGRO_TEXT_LAYOUT *layout,
+   float max_width)
+{
+   ASSERT(layout);
+
+   if (layout->max_width != max_width) {
+      layout->max_width = max_width;
+      layout->lines_valid = false;
+   }
+}
+
+
+
+/* Function: al_get_text_layout_max_width
+ */
+float al_get_text_layout_max_width(const ALLEGRO_TEXT_LAYOUT *layout)
+{
+   ASSERT(layout);
+
+   return layout->max_width;
+}
+
+
+
+/* Function: al_get_text_layout_line_count
+ */
+int al_get_text_layout_line_count(ALLEGRO_TEXT_LAYOUT *layout)
+{
+   ASSERT(layout);
+
+   update_lines(layout);
+   return layout->num_lines;
+}
+
+
+
+/* Function: al_get_text_layout_line
+ */
+const ALLEGRO_USTR *al_get_text_layout_line(ALLEGRO_TEXT_LAYOUT *layout,
+   int line_num, ALLEGRO_USTR_INFO *info)
+{
+   LAYOUT_PARAGRAPH *lp;
+   int lo, hi;
+   int i;
+
+   ASSERT(layout);
+   ASSERT(info);
+
+   if (!update_lines(layout))
+      return NULL;
+   if (line_num < 0 || line_num >= layout->num_lines)
+      return NULL;
+
+   /* Find the last paragraph starting at or before line_num. */
+   lo = 0;
+   hi = layout->num_paragraphs - 1;
+   while (lo < hi) {
+      int mid = (lo + hi + 1) / 2;
+      if (layout->paragraphs[mid]->first_line <= line_num)
+         lo = mid;
+      else
+         hi = mid - 1;
+   }
+
+   lp = layout->paragraphs[lo];
+   i = line_num - lp->first_line;
+   return al_ref_ustr(info, lp->text, lp->para.lines[2 * i],
+      lp->para.lines[2 * i + 1]);
+}
+
+
+
+/* Function: al_do_text_layout
+ */
+void al_do_text_layout(ALLEGRO_TEXT_LAYOUT *layout,
+   bool (*cb)(int line_num, const ALLEGRO_USTR *line, void *extra),
+   void *extra)
+{
+   int line_num = 0;
+   int i, j;
+
+   ASSERT(layout);
+   ASSERT(cb);
+
+   if (!update_lines(layout))
+      return;
+
+   for (i = 0; i < layout->num_paragraphs; i++) {
+      LAYOUT_PARAGRAPH *lp = layout->paragraphs[i];
+      for (j = 0; j < lp->para.num_lines; j++) {
+         ALLEGRO_USTR_INFO info;
+         const ALLEGRO_USTR *line = al_ref_ustr(&info, lp->text,
+            lp->para.lines[2 * j], lp->para.lines[2 * j + 1]);
+         if (!cb(line_num, line, extra))
+            return;
+         line_num++;
+      }
+   }
+}
+
+
+
+/* Helper struct for al_draw_text_layout. */
+typedef struct DRAW_TEXT_LAYOUT_EXTRA {
+   const ALLEGRO_FONT *font;
+   ALLEGRO_COLOR color;
+   float x;
+   float y;
+   float line_height;
+   int flags;
+} DRAW_TEXT_LAYOUT_EXTRA;
+
+
+
+static bool draw_text_layout_cb(int line_num, const ALLEGRO_USTR *line,
+   void *extra)
+{
+   DRAW_TEXT_LAYOUT_EXTRA *s = extra;
+
+   al_draw_ustr(s->font, s->color, s->x, s->y + s->line_height * line_num,
+      s->flags, line);
+   return true;
+}
+
+
+
+/* Function: al_draw_text_layout
+ */
+void al_draw_text_layout(ALLEGRO_TEXT_LAYOUT *layout,
+   ALLEGRO_COLOR color, float x, float y, float line_height, int flags)
+{
+   DRAW_TEXT_LAYOUT_EXTRA extra;
+   ASSERT(layout);
+
+   extra.font = layout->font;
+   extra.color = color;
+   extra.x = x;
+   extra.y = y;
+   if (line_height < 1) {
+      extra.line_height = al_get_font_line_height(layout->font);
+   }
+   else {
+      extra.line_height = line_height;
+   }
+   extra.flags = flags;
+
+   al_do_text_layout(layout, draw_text_layout_cb, &extra);
+}
+
+
+/* vim: set sts=3 sw=3 et: */
@@ -246,6 +246,25 @@ ALLEGRO_PRIM_FUNC(void, al_draw_polygon, (const float* vertices, int vertex_coun
 ALLEGRO_PRIM_FUNC(void, al_draw_filled_polygon, (const float* vertices, int vertex_count, ALLEGRO_COLOR color));
 ALLEGRO_PRIM_FUNC(void, al_draw_filled_polygon_with_holes, (const float* vertices, const int* vertex_counts, ALLEGRO_COLOR color));
 
+/*
+* Retained shapes and vertex cache
+*/
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_PRIMITIVES_SRC)
+/* Type: ALLEGRO_SHAPE
+ */
+typedef struct ALLEGRO_SHAPE ALLEGRO_SHAPE;
+
+ALLEGRO_PRIM_FUNC(ALLEGRO_SHAPE*, al_create_shape, (int flags));
+ALLEGRO_PRIM_FUNC(void, al_destroy_shape, (ALLEGRO_SHAPE* shape));
+ALLEGRO_PRIM_FUNC(bool, al_begin_shape, (ALLEGRO_SHAPE* shape));
+ALLEGRO_PRIM_FUNC(void, al_end_shape, (void));
+ALLEGRO_PRIM_FUNC(int, al_draw_shape, (ALLEGRO_SHAPE* shape));
+
+ALLEGRO_PRIM_FUNC(void, al_set_vertex_cache_size, (int num_vertices));
+ALLEGRO_PRIM_FUNC(int, al_get_vertex_cache_size, (void));
+ALLEGRO_PRIM_FUNC(unsigned int, al_get_prim_draw_call_count, (void));
+#endif
+
 
 #ifdef __cplusplus
 }
@@ -20,6 +20,9 @@ struct ALLEGRO_VERTEX_DECL {
 
 typedef struct ALLEGRO_PRIM_VERTEX_CACHE {
    ALLEGRO_VERTEX  buffer[ALLEGRO_VERTEX_CACHE_SIZE];
+   ALLEGRO_VERTEX* vertices; /* buffer, or a larger array once the cache grows */
+   size_t          capacity;
+   struct _AL_PRIM_THREAD_STATE* owner; /* whose array vertices is, if any */
    ALLEGRO_VERTEX* current;
    size_t          size;
    ALLEGRO_COLOR   color;
@@ -52,14 +55,64 @@ struct ALLEGRO_INDEX_BUFFER {
    ALLEGRO_BUFFER_COMMON common;
 };
 
+/* A run of indices drawn with a single call. */
+typedef struct ALLEGRO_SHAPE_BATCH {
+   int type;
+   ALLEGRO_BITMAP* texture;
+   int start;
+   int count;
+} ALLEGRO_SHAPE_BATCH;
+
+struct ALLEGRO_SHAPE {
+   int flags;
+   ALLEGRO_VERTEX* vertices;
+   int num_vertices;
+   int vertex_capacity;
+   int* indices;
+   int num_indices;
+   int index_capacity;
+   ALLEGRO_SHAPE_BATCH* batches;
+   int num_batches;
+   int batch_capacity;
+   ALLEGRO_VERTEX_BUFFER* vertex_buffer;
+   ALLEGRO_INDEX_BUFFER* index_buffer;
+};
+
+/* Default of al_set_vertex_cache_size. */
+#define _AL_PRIM_DEFAULT_MAX_CACHE_SIZE (1 << 14)
+
+/* What the addon keeps for each thread drawing with it. */
+typedef struct _AL_PRIM_THREAD_STATE {
+   ALLEGRO_VERTEX* vertices; /* reused by vertex caches that outgrow their buffer */
+   size_t capacity;
+   bool in_use;
+   ALLEGRO_SHAPE* recording;
+   unsigned int draw_calls;
+   struct _AL_PRIM_THREAD_STATE* next;
+} _AL_PRIM_THREAD_STATE;
+
+/* Largest segment count with a cached unit circle table. */
+#define _AL_PRIM_MAX_UNIT_CIRCLE 1024
+
 /* Internal cache for primitives. */
 void _al_prim_cache_init(ALLEGRO_PRIM_VERTEX_CACHE* cache, int prim_type, ALLEGRO_COLOR color);
 void _al_prim_cache_init_ex(ALLEGRO_PRIM_VERTEX_CACHE* cache, int prim_type, ALLEGRO_COLOR color, void* user_data);
 void _al_prim_cache_term(ALLEGRO_PRIM_VERTEX_CACHE* cache);
+void _al_prim_cache_reserve(ALLEGRO_PRIM_VERTEX_CACHE* cache, size_t num_vertices);
 void _al_prim_cache_flush(ALLEGRO_PRIM_VERTEX_CACHE* cache);
 void _al_prim_cache_push_point(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* v);
 void _al_prim_cache_push_triangle(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* v0, const float* v1, const float* v2);
 
+/* Shape recording, see shape.c. */
+int _al_prim_record_shape(const ALLEGRO_VERTEX* vtxs, ALLEGRO_BITMAP* texture, const int* indices, int start, int end, int type);
+
+/* State shared between threads and kept per thread. */
+void                   _al_prim_init_shared_state(void);
+void                   _al_prim_shutdown_shared_state(void);
+_AL_PRIM_THREAD_STATE* _al_prim_get_thread_state(void);
+void                   _al_prim_count_draw_call(void);
+const float*           _al_prim_get_unit_circle(int num_segments);
+
 
 /* Internal functions. */
 float     _al_prim_get_scale(void);
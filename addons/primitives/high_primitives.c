@@ -41,7 +41,9 @@
 #ifdef ALLEGRO_CFG_OPENGL
 #include "allegro5/allegro_opengl.h"
 #endif
+#include "allegro5/internal/aintern.h"
 #include "allegro5/internal/aintern_bitmap.h"
+#include "allegro5/internal/aintern_prim.h"
 #include <math.h>
 
 #ifdef ALLEGRO_MSVC
@@ -418,16 +420,69 @@ void al_draw_filled_rectangle(float x1, float y1, float x2, float y2,
    al_draw_prim(vtx, 0, 0, 0, 4, ALLEGRO_PRIM_TRIANGLE_FAN);
 }
 
+/*
+ * Walks the points of an arc. Arcs whose step is a whole fraction of a turn
+ * read them from a cached unit circle, rotated to the start angle; others
+ * use a rotation recurrence.
+ */
+typedef struct ARC_WALKER {
+   const float* table;
+   int num_segments;
+   int index;
+   float dir;
+   float start_x, start_y;
+   float c, s;
+   float x, y;
+} ARC_WALKER;
+
+static void arc_walker_init(ARC_WALKER* arc, float start_theta, float theta)
+{
+   float turns = theta != 0 ? 2 * ALLEGRO_PI / fabsf(theta) : 0;
+   int num_segments = 0;
+
+   arc->start_x = arc->x = cosf(start_theta);
+   arc->start_y = arc->y = sinf(start_theta);
+   arc->table = NULL;
+
+   if (turns >= 3 && turns <= _AL_PRIM_MAX_UNIT_CIRCLE) {
+      num_segments = (int)floorf(turns + 0.5f);
+      if (fabsf(turns - num_segments) <= turns * 1e-5f)
+         arc->table = _al_prim_get_unit_circle(num_segments);
+   }
+
+   if (arc->table) {
+      arc->num_segments = num_segments;
+      arc->index = 0;
+      arc->dir = theta < 0 ? -1.0f : 1.0f;
+   } else {
+      arc->c = cosf(theta);
+      arc->s = sinf(theta);
+   }
+}
+
+static void arc_walker_next(ARC_WALKER* arc)
+{
+   if (arc->table) {
+      const float* p;
+      if (++arc->index == arc->num_segments)
+         arc->index = 0;
+      p = arc->table + 2 * arc->index;
+      arc->x = arc->start_x * p[0] - arc->start_y * p[1] * arc->dir;
+      arc->y = arc->start_y * p[0] + arc->start_x * p[1] * arc->dir;
+   } else {
+      float t = arc->x;
+      arc->x = arc->c * arc->x - arc->s * arc->y;
+      arc->y = arc->s * t + arc->c * arc->y;
+   }
+}
+
 /* Function: al_calculate_arc
  */
 void al_calculate_arc(float* dest, int stride, float cx, float cy,
    float rx, float ry, float start_theta, float delta_theta, float thickness,
    int num_points)
 {   
-   float theta;
-   float c;
-   float s;
-   float x, y, t;
+   ARC_WALKER arc;
    int ii;
  
    ASSERT(dest);
@@ -435,13 +490,9 @@ void al_calculate_arc(float* dest, int stride, float cx, float cy,
    ASSERT(rx >= 0);
    ASSERT(ry >= 0);
 
+   arc_walker_init(&arc, start_theta, delta_theta / ((float)(num_points) - 1));
+
    if (thickness > 0.0f) {
-      theta = delta_theta / ((float)(num_points) - 1);
-      c = cosf(theta);
-      s = sinf(theta);
-      x = cosf(start_theta);
-      y = sinf(start_theta);
- 
       if (rx == ry) {
          /*
          The circle case is particularly simple
@@ -449,52 +500,40 @@ void al_calculate_arc(float* dest, int stride, float cx, float cy,
          float r1 = rx - thickness / 2.0f;
          float r2 = rx + thickness / 2.0f;
          for (ii = 0; ii < num_points; ii ++) {
-            *dest =       r2 * x + cx;
-            *(dest + 1) = r2 * y + cy;
+            *dest =       r2 * arc.x + cx;
+            *(dest + 1) = r2 * arc.y + cy;
             dest = (float*)(((char*)dest) + stride);
-            *dest =        r1 * x + cx;
-            *(dest + 1) =  r1 * y + cy;
+            *dest =        r1 * arc.x + cx;
+            *(dest + 1) =  r1 * arc.y + cy;
             dest = (float*)(((char*)dest) + stride);
             
-            t = x;
-            x = c * x - s * y;
-            y = s * t + c * y;
+            arc_walker_next(&arc);
          }
       } else {
          if (rx != 0 && ry != 0) {
             for (ii = 0; ii < num_points; ii++) {
-               float denom = hypotf(ry * x, rx * y);
-               float nx = thickness / 2 * ry * x / denom;
-               float ny = thickness / 2 * rx * y / denom;
+               float denom = hypotf(ry * arc.x, rx * arc.y);
+               float nx = thickness / 2 * ry * arc.x / denom;
+               float ny = thickness / 2 * rx * arc.y / denom;
 
-               *dest =       rx * x + cx + nx;
-               *(dest + 1) = ry * y + cy + ny;
+               *dest =       rx * arc.x + cx + nx;
+               *(dest + 1) = ry * arc.y + cy + ny;
                dest = (float*)(((char*)dest) + stride);
-               *dest =       rx * x + cx - nx;
-               *(dest + 1) = ry * y + cy - ny;
+               *dest =       rx * arc.x + cx - nx;
+               *(dest + 1) = ry * arc.y + cy - ny;
                dest = (float*)(((char*)dest) + stride);
 
-               t = x;
-               x = c * x - s * y;
-               y = s * t + c * y;
+               arc_walker_next(&arc);
             }
          }
       }
    } else {
-      theta = delta_theta / ((float)num_points - 1);
-      c = cosf(theta);
-      s = sinf(theta);
-      x = cosf(start_theta);
-      y = sinf(start_theta);
-      
       for (ii = 0; ii < num_points; ii++) {
-         *dest =       rx * x + cx;
-         *(dest + 1) = ry * y + cy;
+         *dest =       rx * arc.x + cx;
+         *(dest + 1) = ry * arc.y + cy;
          dest = (float*)(((char*)dest) + stride);
 
-         t = x;
-         x = c * x - s * y;
-         y = s * t + c * y;
+         arc_walker_next(&arc);
       }
    }
 }
@@ -1021,7 +1060,7 @@ void al_calculate_spline(float* dest, int stride, float points[8],
    ASSERT(points);
 
    if (num_segments > (int)(sizeof(cache_point_buffer_storage) / sizeof(float) / 2)) {
-      cache_point_buffer = al_malloc(2 * sizeof(float) * num_segments);
+      cache_point_buffer = _al_transient_malloc(2 * sizeof(float) * num_segments);
    }
 
    dt = 1.0 / (num_segments - 1);
@@ -1070,7 +1109,7 @@ void al_calculate_spline(float* dest, int stride, float points[8],
    al_calculate_ribbon(dest, stride, cache_point_buffer, 2 * sizeof(float), thickness, num_segments);
 
    if (cache_point_buffer != cache_point_buffer_storage) {
-      al_free(cache_point_buffer);
+      _al_transient_free(cache_point_buffer);
    }
 }
 
@@ -58,12 +58,15 @@ void al_draw_filled_polygon(const float *vertices, int vertex_count,
 
    _al_prim_cache_init_ex(&cache, ALLEGRO_PRIM_VERTEX_CACHE_TRIANGLE, color, (void*)vertices);
 
+   if (vertex_count > 2)
+      _al_prim_cache_reserve(&cache, 3 * (vertex_count - 2));
+
    vertex_counts[0] = vertex_count;
    vertex_counts[1] = 0; /* terminator */
    al_triangulate_polygon(vertices, sizeof(float) * 2, vertex_counts,
       polygon_push_triangle_callback, &cache);
 
-   _al_prim_cache_flush(&cache);
+   _al_prim_cache_term(&cache);
 }
 
 /* Function: al_draw_filled_polygon_with_holes
@@ -72,13 +75,21 @@ void al_draw_filled_polygon_with_holes(const float *vertices,
    const int *vertex_counts, ALLEGRO_COLOR color)
 {
    ALLEGRO_PRIM_VERTEX_CACHE cache;
+   int num_vertices = 0;
+   int i;
 
    _al_prim_cache_init_ex(&cache, ALLEGRO_PRIM_VERTEX_CACHE_TRIANGLE, color, (void*)vertices);
 
+   /* Each hole adds two triangles, for the bridge to it. */
+   for (i = 0; vertex_counts[i] > 0; i++)
+      num_vertices += vertex_counts[i] + 2;
+   if (num_vertices > 4)
+      _al_prim_cache_reserve(&cache, 3 * (num_vertices - 4));
+
    al_triangulate_polygon(vertices, sizeof(float) * 2, vertex_counts,
       polygon_push_triangle_callback, &cache);
 
-   _al_prim_cache_flush(&cache);
+   _al_prim_cache_term(&cache);
 }
 
 /* vim: set sts=3 sw=3 et: */
@@ -18,6 +18,7 @@
 
 #include "allegro5/allegro.h"
 #include "allegro5/allegro_primitives.h"
+#include "allegro5/internal/aintern.h"
 #include "allegro5/internal/aintern_list.h"
 #include "allegro5/internal/aintern_prim.h"
 #include <float.h>
@@ -25,96 +26,180 @@
 
 
 /*
- * Computes direction, normal direction and the length of the segment.
+ * Directions of all segments and the shape of all joints of a polyline,
+ * computed up front in flat loops over plain arrays which the compiler can
+ * vectorize. Segment i runs from vertex i to vertex i + 1, wrapping around
+ * at the end. Joint i sits at vertex i, between segments i - 1 and i.
  */
-static float compute_direction_and_normal(const float* begin, const float* end, float* dir, float* normal)
+typedef struct POLYLINE_DATA {
+   int count;
+   float* x;
+   float* y;
+   float* dir_x;
+   float* dir_y;
+   float* length;
+   float* cross;
+   float* cos_half;
+   float* middle_x;
+   float* middle_y;
+   float* miter_distance;
+   uint8_t* sharp;
+} POLYLINE_DATA;
+
+static bool polyline_data_init(POLYLINE_DATA* data, const float* vertices, int vertex_stride, int vertex_count, float radius)
 {
-   float length;
+   float* block;
+   int n = vertex_count;
+   int i;
 
-   /* Determine direction, normal direction and length of the line segment. */
-   dir[0] = end[0] - begin[0];
-   dir[1] = end[1] - begin[1];
+   block = _al_transient_malloc((10 * n + 2) * sizeof(float) + n);
+   if (!block)
+      return false;
+
+   data->count          = n;
+   data->x              = block;
+   data->y              = data->x + n + 1;
+   data->dir_x          = data->y + n + 1;
+   data->dir_y          = data->dir_x + n;
+   data->length         = data->dir_y + n;
+   data->cross          = data->length + n;
+   data->cos_half       = data->cross + n;
+   data->middle_x       = data->cos_half + n;
+   data->middle_y       = data->middle_x + n;
+   data->miter_distance = data->middle_y + n;
+   data->sharp          = (uint8_t*)(data->miter_distance + n);
+
+   for (i = 0; i < n; i++) {
+      const float* v = (const float*)(((const uint8_t*)vertices) + vertex_stride * i);
+      data->x[i] = v[0];
+      data->y[i] = v[1];
+   }
+   data->x[n] = data->x[0];
+   data->y[n] = data->y[0];
+
+   /* Segments. */
+   for (i = 0; i < n; i++) {
+      float dx = data->x[i + 1] - data->x[i];
+      float dy = data->y[i + 1] - data->y[i];
+      float length = sqrtf(dx * dx + dy * dy);
+      float inv_length = length > 0.0f ? 1.0f / length : 1.0f;
+
+      data->dir_x[i]  = dx * inv_length;
+      data->dir_y[i]  = dy * inv_length;
+      data->length[i] = length;
+   }
 
-   length = _al_prim_normalize(dir);
+   /* Joints. The angle of deflection between the segments is only ever
+    * needed through the cosine of its half, which follows from the dot
+    * product without any trigonometry.
+    */
+   for (i = 0; i < n; i++) {
+      int prev = (i > 0) ? i - 1 : n - 1;
+      float dx0 = data->dir_x[prev], dy0 = data->dir_y[prev];
+      float dx1 = data->dir_x[i],    dy1 = data->dir_y[i];
+      float dot   = dx0 * dx1 + dy0 * dy1;
+      float cross = dx0 * dy1 - dy0 * dx1;
+      bool straight = (dot == 0.0f && cross == 0.0f) || (cross == 0.0f && dot > 0.0f);
+      float cos_half = straight ? 1.0f : sqrtf(_ALLEGRO_MAX(0.0f, (1.0f + dot) * 0.5f));
+      float miter_distance = cos_half > 0.0f ? radius / cos_half : 0.0f;
+      float mx = -dy0 - dy1;
+      float my =  dx0 + dx1;
+      float middle_length;
+      bool sharp = cos_half <= 0.0f;
+
+      /* If the angle is too sharp, we give up on trying not to overdraw. */
+      if (miter_distance > data->length[prev]) {
+         sharp = true;
+         miter_distance = data->length[prev];
+      }
+      if (miter_distance > data->length[i]) {
+         sharp = true;
+         miter_distance = data->length[i];
+      }
 
-   normal[0] = -dir[1];
-   normal[1] =  dir[0];
+      if (mx == 0.0f && my == 0.0f) {
+         mx = dx1;
+         my = dy1;
+      }
+      middle_length = sqrtf(mx * mx + my * my);
+      if (middle_length > 0.0f) {
+         mx /= middle_length;
+         my /= middle_length;
+      }
+
+      /* Point the middle towards the outside of the turn. */
+      if (cross >= 0.0f) {
+         mx = -mx;
+         my = -my;
+      }
 
-   return length;
+      data->cross[i]          = cross;
+      data->cos_half[i]       = cos_half;
+      data->middle_x[i]       = mx;
+      data->middle_y[i]       = my;
+      data->miter_distance[i] = miter_distance;
+      data->sharp[i]          = sharp;
+   }
+
+   return true;
+}
+
+static void polyline_data_term(POLYLINE_DATA* data)
+{
+   _al_transient_free(data->x);
 }
 
 /*
- * Compute end cross points.
+ * Returns an upper bound of the number of vertices emit_polyline produces.
  */
-static void compute_end_cross_points(const float* v0, const float* v1, float radius, float* p0, float* p1)
+static size_t count_polyline_vertices(const POLYLINE_DATA* data, int join_style)
 {
-   float dir[2];
-   float normal[2];
-   /* XXX delete this parameter? */
-   (void)radius;
+   /* Four triangles per segment plus the largest caps (round ones). */
+   size_t count = (size_t)(data->count + 1) * 12 + 2 * 3 * 34;
+   int i;
 
-   compute_direction_and_normal(v0, v1, dir, normal);
+   if (join_style == ALLEGRO_LINE_JOIN_BEVEL)
+      count += (size_t)data->count * 3;
+   else if (join_style == ALLEGRO_LINE_JOIN_MITER)
+      count += (size_t)data->count * 9;
+   else if (join_style == ALLEGRO_LINE_JOIN_ROUND) {
+      /* Round joins take emit_arc's 16 segments per half turn. */
+      for (i = 0; i < data->count; i++)
+         count += 3 * ((size_t)(acosf(data->cos_half[i]) * 64.0f / ALLEGRO_PI) + 2);
+   }
 
-   p0[0] = v1[0] + normal[0] * radius;
-   p0[1] = v1[1] + normal[1] * radius;
-   p1[0] = v1[0] - normal[0] * radius;
-   p1[1] = v1[1] - normal[1] * radius;
+   return count;
 }
 
 /*
- * Compute cross points.
+ * Compute end cross points, where segment ends at its vertex 'end'.
  */
-static void compute_cross_points(const float* v0, const float* v1, const float* v2, float radius,
-   float* l0, float* l1, float* r0, float* r1, float* out_middle, float* out_angle, float* out_miter_distance)
+static void compute_end_cross_points(const POLYLINE_DATA* data, int segment, int end, float radius, float* p0, float* p1)
 {
-   float normal_0[2], normal_1[2];
-   float dir_0[2], dir_1[2];
-   float middle[2];
-   float diff[2];
-   float miter_distance;
-   float angle;
-   float len_0, len_1;
-   bool sharp = false;
-
-   /* Compute directions. */
-   len_0 = compute_direction_and_normal(v0, v1, dir_0, normal_0);
-   len_1 = compute_direction_and_normal(v1, v2, dir_1, normal_1);
-
-   /* Compute angle of deflection between segments. */
-   diff[0] =   dir_0[0] * dir_1[0] + dir_0[1] * dir_1[1];
-   diff[1] = -(dir_0[0] * dir_1[1] - dir_0[1] * dir_1[0]);
-
-   angle = (diff[0] || diff[1]) ? atan2f(diff[1], diff[0]) : 0.0f;
-
-   /* Calculate miter distance. */
-   miter_distance = angle != 0.0f ? radius / cosf(fabsf(angle) * 0.5f) : radius;
-
-   /* If the angle is too sharp, we give up on trying not to overdraw. */
-   if (miter_distance < 0) {
-      sharp = true;
-      miter_distance = 0;
-   }
-   if (miter_distance > len_0) {
-      sharp = true;
-      miter_distance = len_0;
-   }
-   if(miter_distance > len_1) {
-      sharp = true;
-      miter_distance = len_1;
-   }
-
-   middle[0] = normal_0[0] + normal_1[0];
-   middle[1] = normal_0[1] + normal_1[1];
+   float normal[2] = { -data->dir_y[segment], data->dir_x[segment] };
 
-   if (middle[0] == middle[1] && middle[0] == 0.0) {
-      middle[0] = dir_1[0];
-      middle[1] = dir_1[1];
-   }
+   p0[0] = data->x[end] + normal[0] * radius;
+   p0[1] = data->y[end] + normal[1] * radius;
+   p1[0] = data->x[end] - normal[0] * radius;
+   p1[1] = data->y[end] - normal[1] * radius;
+}
 
-   _al_prim_normalize(middle);
+/*
+ * Compute cross points at a joint.
+ */
+static void compute_cross_points(const POLYLINE_DATA* data, int joint, float radius,
+   float* l0, float* l1, float* r0, float* r1)
+{
+   int prev = (joint > 0) ? joint - 1 : data->count - 1;
+   const float v1[2] = { data->x[joint], data->y[joint] };
+   const float normal_0[2] = { -data->dir_y[prev], data->dir_x[prev] };
+   const float normal_1[2] = { -data->dir_y[joint], data->dir_x[joint] };
+   const float middle[2] = { data->middle_x[joint], data->middle_y[joint] };
+   float miter_distance = data->miter_distance[joint];
+   bool sharp = data->sharp[joint];
 
    /* Compute points. */
-   if (angle > 0.0f)
+   if (data->cross[joint] < 0.0f)
    {
       l0[0] = v1[0] + normal_0[0] * radius;
       l0[1] = v1[1] + normal_0[1] * radius;
@@ -134,9 +219,6 @@ static void compute_cross_points(const float* v0, const float* v1, const float*
    }
    else
    {
-      middle[0] = -middle[0];
-      middle[1] = -middle[1];
-
       l1[0] = v1[0] - normal_0[0] * radius;
       l1[1] = v1[1] - normal_0[1] * radius;
       r1[0] = v1[0] - normal_1[0] * radius;
@@ -153,15 +235,6 @@ static void compute_cross_points(const float* v0, const float* v1, const float*
          l0[1] = r0[1] = v1[1] - middle[1] * miter_distance;
       }
    }
-
-   if (out_angle)
-      *out_angle = angle;
-
-   if (out_miter_distance)
-      *out_miter_distance = miter_distance;
-
-   if (out_middle)
-      memcpy(out_middle, middle, sizeof(float) * 2);
 }
 
 /*
@@ -275,15 +348,11 @@ static void emit_round_end_cap(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* pi
 /*
  * Emits end cap.
  *
- * Direction of the end cap is defined by vector [v1 - v0]. p0 and p1 are starting
- * and ending point of the cap. Both should be located on the circle with center
- * in v1 and specified radius. p0 have to be located on the negative and p0 on the
- * positive half plane defined by direction vector.
+ * The cap sits at pivot and points along the unit vector dir.
  */
-static void emit_end_cap(ALLEGRO_PRIM_VERTEX_CACHE* cache, int cap_style, const float* v0, const float* v1, float radius)
+static void emit_end_cap(ALLEGRO_PRIM_VERTEX_CACHE* cache, int cap_style, const float* pivot, const float* dir, float radius)
 {
-   float dir[2];
-   float normal[2];
+   float normal[2] = { -dir[1], dir[0] };
 
    /* Do do not want you to call this function for closed cap.
     * It is special and there is nothing we can do with it there.
@@ -294,16 +363,13 @@ static void emit_end_cap(ALLEGRO_PRIM_VERTEX_CACHE* cache, int cap_style, const
    if (cap_style == ALLEGRO_LINE_CAP_NONE)
       return;
 
-   /* Compute normal and direction for our segment. */
-   compute_direction_and_normal(v0, v1, dir, normal);
-
    /* Emit vertices for cap. */
    if (cap_style == ALLEGRO_LINE_CAP_SQUARE)
-      emit_square_end_cap(cache, v1, dir, normal, radius);
+      emit_square_end_cap(cache, pivot, dir, normal, radius);
    else if (cap_style == ALLEGRO_LINE_CAP_TRIANGLE)
-      emit_triange_end_cap(cache, v1, dir, normal, radius);
+      emit_triange_end_cap(cache, pivot, dir, normal, radius);
    else if (cap_style == ALLEGRO_LINE_CAP_ROUND)
-      emit_round_end_cap(cache, v1, dir, normal, radius);
+      emit_round_end_cap(cache, pivot, dir, normal, radius);
    else {
 
       ASSERT("Unknown or unsupported style of ending cap." && false);
@@ -334,9 +400,11 @@ static void emit_round_join(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* pivot
 
 /*
  * Emits miter join.
+ *
+ * cos_half is the cosine of half the angle of deflection between the segments.
  */
 static void emit_miter_join(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* pivot, const float* p0, const float* p1,
-   float radius, const float* middle, float angle, float miter_distance, float max_miter_distance)
+   float radius, const float* middle, float cos_half, float miter_distance, float max_miter_distance)
 {
    /* XXX delete this parameter? */
    (void)radius;
@@ -345,7 +413,9 @@ static void emit_miter_join(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* pivot
 
       float normal[2] = { -middle[1], middle[0] };
 
-      float offset = (miter_distance - max_miter_distance) * tanf((ALLEGRO_PI - fabsf(angle)) * 0.5f);
+      float sin_half = sqrtf(_ALLEGRO_MAX(0.0f, 1.0f - cos_half * cos_half));
+
+      float offset = sin_half > 0.0f ? (miter_distance - max_miter_distance) * cos_half / sin_half : 0.0f;
 
       float v0[2] = {
          pivot[0] + middle[0] * max_miter_distance + normal[0] * offset,
@@ -378,7 +448,7 @@ static void emit_miter_join(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* pivot
  */
 static void emit_join(ALLEGRO_PRIM_VERTEX_CACHE* cache, int join_style, const float* pivot,
    const float* p0, const float* p1, float radius, const float* middle,
-   float angle, float miter_distance, float miter_limit)
+   float cos_half, float miter_distance, float miter_limit)
 {
    /* There is nothing to do for this type of join. */
    if (join_style == ALLEGRO_LINE_JOIN_NONE)
@@ -389,7 +459,7 @@ static void emit_join(ALLEGRO_PRIM_VERTEX_CACHE* cache, int join_style, const fl
    else if (join_style == ALLEGRO_LINE_JOIN_ROUND)
       emit_round_join(cache, pivot, p0, p1, radius);
    else if (join_style == ALLEGRO_LINE_JOIN_MITER)
-      emit_miter_join(cache, pivot, p0, p1, radius, middle, angle, miter_distance, miter_limit * radius);
+      emit_miter_join(cache, pivot, p0, p1, radius, middle, cos_half, miter_distance, miter_limit * radius);
    else {
 
       ASSERT("Unknown or unsupported style of join." && false);
@@ -398,8 +468,7 @@ static void emit_join(ALLEGRO_PRIM_VERTEX_CACHE* cache, int join_style, const fl
 
 static void emit_polyline(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* vertices, int vertex_stride, int vertex_count, int join_style, int cap_style, float thickness, float miter_limit)
 {
-# define VERTEX(index)  ((const float*)(((uint8_t*)vertices) + vertex_stride * ((vertex_count + (index)) % vertex_count)))
-
+   POLYLINE_DATA data;
    float l0[2], l1[2];
    float r0[2], r1[2];
    float p0[2], p1[2];
@@ -421,20 +490,26 @@ static void emit_polyline(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* vertice
    if (vertex_count == 2 && cap_style == ALLEGRO_LINE_CAP_CLOSED)
       cap_style = ALLEGRO_LINE_CAP_NONE;
 
+   if (!polyline_data_init(&data, vertices, vertex_stride, vertex_count, radius))
+      return;
+
+   /* Make room for the whole line, so that it goes out in a single draw. */
+   _al_prim_cache_reserve(cache, count_polyline_vertices(&data, join_style));
+
    /* Prepare initial set of vertices. */
    if (cap_style != ALLEGRO_LINE_CAP_CLOSED)
    {
-      /* We can emit ending caps right now.
-      *
-      * VERTEX(-2) and similar are safe, because it at this place
-      * it is guaranteed that there are at least two vertices
-      * in the buffer.
-      */
-      emit_end_cap(cache, cap_style,  VERTEX(1),  VERTEX(0), radius);
-      emit_end_cap(cache, cap_style, VERTEX(-2), VERTEX(-1), radius);
+      const float start[2] = { data.x[0], data.y[0] };
+      const float end[2] = { data.x[vertex_count - 1], data.y[vertex_count - 1] };
+      const float start_dir[2] = { -data.dir_x[0], -data.dir_y[0] };
+      const float end_dir[2] = { data.dir_x[vertex_count - 2], data.dir_y[vertex_count - 2] };
+
+      /* We can emit ending caps right now. */
+      emit_end_cap(cache, cap_style, start, start_dir, radius);
+      emit_end_cap(cache, cap_style, end, end_dir, radius);
 
       /* Compute points on the left side of the very first segment. */
-      compute_end_cross_points(VERTEX(1), VERTEX(0), radius, p1, p0);
+      compute_end_cross_points(&data, 0, 0, radius, p0, p1);
 
       /* For non-closed line we have N - 1 steps, but since we iterate
       * from one, N is right value.
@@ -444,7 +519,7 @@ static void emit_polyline(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* vertice
    else
    {
       /* Compute points on the left side of the very first segment. */
-      compute_cross_points(VERTEX(-1), VERTEX(0), VERTEX(1), radius, l0, l1, p0, p1, NULL, NULL, NULL);
+      compute_cross_points(&data, 0, radius, l0, l1, p0, p1);
 
       /* Closed line use N steps, because last vertex have to be
       * connected with first one.
@@ -456,28 +531,26 @@ static void emit_polyline(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* vertice
    for (i = 1; i < steps; ++i)
    {
       /* Pick vertex and their neighbors. */
-      const float* v0 = VERTEX(i - 1);
-      const float* v1 = VERTEX(i);
-      const float* v2 = VERTEX(i + 1);
+      int joint = (i < vertex_count) ? i : 0;
+      const float v0[2] = { data.x[i - 1], data.y[i - 1] };
+      const float v1[2] = { data.x[joint], data.y[joint] };
 
       /* Choose correct cross points. */
       if ((cap_style == ALLEGRO_LINE_CAP_CLOSED) || (i < steps - 1)) {
 
-         float middle[2];
-         float miter_distance;
-         float angle;
+         const float middle[2] = { data.middle_x[joint], data.middle_y[joint] };
 
          /* Compute cross points. */
-         compute_cross_points(v0, v1, v2, radius, l0, l1, r0, r1, middle, &angle, &miter_distance);
+         compute_cross_points(&data, joint, radius, l0, l1, r0, r1);
 
          /* Emit join. */
-         if (angle >= 0.0f)
-            emit_join(cache, join_style, v1, l0, r0, radius, middle, angle, miter_distance, miter_limit);
+         if (data.cross[joint] <= 0.0f)
+            emit_join(cache, join_style, v1, l0, r0, radius, middle, data.cos_half[joint], data.miter_distance[joint], miter_limit);
          else
-            emit_join(cache, join_style, v1, r1, l1, radius, middle, angle, miter_distance, miter_limit);
+            emit_join(cache, join_style, v1, r1, l1, radius, middle, data.cos_half[joint], data.miter_distance[joint], miter_limit);
       }
       else
-         compute_end_cross_points(v0, v1, radius, l0, l1);
+         compute_end_cross_points(&data, i - 1, i, radius, l0, l1);
 
       /* Emit triangles. */
       _al_prim_cache_push_triangle(cache, v0, v1, l1);
@@ -490,7 +563,7 @@ static void emit_polyline(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* vertice
       memcpy(p1, r1, sizeof(float) * 2);
    }
 
-# undef VERTEX
+   polyline_data_term(&data);
 }
 
 static void do_draw_polyline(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* vertices, int vertex_stride, int vertex_count, int join_style, int cap_style, ALLEGRO_COLOR color, float thickness, float miter_limit)
@@ -508,20 +581,13 @@ static void do_draw_polyline(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* vert
       int i;
 
       _al_prim_cache_init(cache, ALLEGRO_PRIM_VERTEX_CACHE_LINE_STRIP, color);
+      _al_prim_cache_reserve(cache, vertex_count + 1);
 
-      for (i = 0; i < vertex_count; ++i) {
-         if (cache->size >= (ALLEGRO_VERTEX_CACHE_SIZE - 2))
-            _al_prim_cache_flush(cache);
-
+      for (i = 0; i < vertex_count; ++i)
          _al_prim_cache_push_point(cache, VERTEX(i));
-      }
-
-      if (cap_style == ALLEGRO_LINE_CAP_CLOSED && vertex_count > 2) {
-         if (cache->size >= (ALLEGRO_VERTEX_CACHE_SIZE - 2))
-            _al_prim_cache_flush(cache);
 
+      if (cap_style == ALLEGRO_LINE_CAP_CLOSED && vertex_count > 2)
          _al_prim_cache_push_point(cache, VERTEX(0));
-      }
 
       _al_prim_cache_term(cache);
 
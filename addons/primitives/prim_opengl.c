@@ -29,6 +29,7 @@
 #ifdef ALLEGRO_CFG_OPENGL
 
 #include "allegro5/allegro_opengl.h"
+#include "allegro5/internal/aintern.h"
 #include "allegro5/internal/aintern_opengl.h"
 
 static void convert_storage(ALLEGRO_PRIM_STORAGE storage, GLenum* type, int* ncoord, bool* normalized)
@@ -510,7 +511,7 @@ static int draw_prim_indexed_raw(ALLEGRO_BITMAP* target, ALLEGRO_BITMAP* texture
 #if defined ALLEGRO_IPHONE
    if (!use_buffers) {
       int ii;
-      iphone_idx = al_malloc(num_vtx * sizeof(GLushort));
+      iphone_idx = _al_transient_malloc(num_vtx * sizeof(GLushort));
       for (ii = start; ii < end; ii++) {
          iphone_idx[ii] = (GLushort)indices[ii];
       }
@@ -573,7 +574,7 @@ static int draw_prim_indexed_raw(ALLEGRO_BITMAP* target, ALLEGRO_BITMAP* texture
    }
 
 #if defined ALLEGRO_IPHONE
-   al_free(iphone_idx);
+   _al_transient_free(iphone_idx);
 #endif
    
    return num_primitives;
@@ -18,10 +18,13 @@
 
 #include "allegro5/allegro.h"
 #include "allegro5/allegro_primitives.h"
+#include "allegro5/internal/aintern.h"
 #include "allegro5/internal/aintern_list.h"
 #include "allegro5/internal/aintern_prim.h"
+#include "allegro5/internal/aintern_tls.h"
 #include <float.h>
 #include <math.h>
+#include <string.h>
 
 #ifdef ALLEGRO_MSVC
    #define hypotf(x, y) _hypotf((x), (y))
@@ -170,6 +173,9 @@ void _al_prim_cache_init(ALLEGRO_PRIM_VERTEX_CACHE* cache, int prim_type, ALLEGR
 
 void _al_prim_cache_init_ex(ALLEGRO_PRIM_VERTEX_CACHE* cache, int prim_type, ALLEGRO_COLOR color, void* user_data)
 {
+   cache->vertices  = cache->buffer;
+   cache->capacity  = ALLEGRO_VERTEX_CACHE_SIZE;
+   cache->owner     = NULL;
    cache->size      = 0;
    cache->current   = cache->buffer;
    cache->color     = color;
@@ -180,6 +186,94 @@ void _al_prim_cache_init_ex(ALLEGRO_PRIM_VERTEX_CACHE* cache, int prim_type, ALL
 void _al_prim_cache_term(ALLEGRO_PRIM_VERTEX_CACHE* cache)
 {
    _al_prim_cache_flush(cache);
+
+   if (cache->owner)
+      cache->owner->in_use = false;
+   else if (cache->vertices != cache->buffer)
+      _al_transient_free(cache->vertices);
+
+   cache->vertices = cache->buffer;
+   cache->capacity = ALLEGRO_VERTEX_CACHE_SIZE;
+   cache->owner    = NULL;
+   cache->current  = cache->buffer;
+}
+
+/*
+ * Grows the cache so that it holds at least num_vertices, up to the limit set
+ * with al_set_vertex_cache_size. The larger array is the thread's reusable
+ * one, unless another cache of the thread is using it. Failing to grow is
+ * not an error, the cache just flushes more often.
+ */
+void _al_prim_cache_reserve(ALLEGRO_PRIM_VERTEX_CACHE* cache, size_t num_vertices)
+{
+   size_t max_size = (size_t)al_get_vertex_cache_size();
+   _AL_PRIM_THREAD_STATE* state;
+   ALLEGRO_VERTEX* vertices;
+
+   if (num_vertices > max_size)
+      num_vertices = max_size;
+   if (num_vertices <= cache->capacity)
+      return;
+
+   state = cache->owner;
+   if (!state && cache->vertices == cache->buffer) {
+      state = _al_prim_get_thread_state();
+      if (state && state->in_use)
+         state = NULL;
+   }
+
+   if (state) {
+      if (state->capacity < num_vertices) {
+         /* Keep what the cache holds when the array is already its own. */
+         if (cache->owner) {
+            vertices = al_realloc(state->vertices, num_vertices * sizeof(ALLEGRO_VERTEX));
+         }
+         else {
+            vertices = al_malloc(num_vertices * sizeof(ALLEGRO_VERTEX));
+            if (vertices)
+               al_free(state->vertices);
+         }
+         if (!vertices)
+            return;
+         state->vertices = vertices;
+         state->capacity = num_vertices;
+      }
+      if (!cache->owner)
+         memcpy(state->vertices, cache->vertices, cache->size * sizeof(ALLEGRO_VERTEX));
+      state->in_use   = true;
+      cache->owner    = state;
+      cache->vertices = state->vertices;
+      cache->capacity = state->capacity;
+   }
+   else {
+      vertices = _al_transient_malloc(num_vertices * sizeof(ALLEGRO_VERTEX));
+      if (!vertices)
+         return;
+
+      memcpy(vertices, cache->vertices, cache->size * sizeof(ALLEGRO_VERTEX));
+      if (cache->vertices != cache->buffer)
+         _al_transient_free(cache->vertices);
+
+      cache->vertices = vertices;
+      cache->capacity = num_vertices;
+   }
+
+   cache->current = cache->vertices + cache->size;
+}
+
+/*
+ * Makes room for num_vertices more vertices, growing the cache while it can
+ * and flushing it when it cannot.
+ */
+static void cache_make_room(ALLEGRO_PRIM_VERTEX_CACHE* cache, size_t num_vertices)
+{
+   if (cache->size + num_vertices <= cache->capacity)
+      return;
+
+   _al_prim_cache_reserve(cache, cache->capacity * 2);
+
+   if (cache->size + num_vertices > cache->capacity)
+      _al_prim_cache_flush(cache);
 }
 
 void _al_prim_cache_flush(ALLEGRO_PRIM_VERTEX_CACHE* cache)
@@ -188,27 +282,26 @@ void _al_prim_cache_flush(ALLEGRO_PRIM_VERTEX_CACHE* cache)
       return;
 
    if (cache->prim_type == ALLEGRO_PRIM_VERTEX_CACHE_TRIANGLE)
-      al_draw_prim(cache->buffer, NULL, NULL, 0, cache->size, ALLEGRO_PRIM_TRIANGLE_LIST);
+      al_draw_prim(cache->vertices, NULL, NULL, 0, cache->size, ALLEGRO_PRIM_TRIANGLE_LIST);
    else if (cache->prim_type == ALLEGRO_PRIM_VERTEX_CACHE_LINE_STRIP)
-      al_draw_prim(cache->buffer, NULL, NULL, 0, cache->size, ALLEGRO_PRIM_LINE_STRIP);
+      al_draw_prim(cache->vertices, NULL, NULL, 0, cache->size, ALLEGRO_PRIM_LINE_STRIP);
 
    if (cache->prim_type == ALLEGRO_PRIM_VERTEX_CACHE_LINE_STRIP)
    {
-      cache->buffer[0] = *(cache->current - 1);
-      cache->current   = cache->buffer + 1;
-      cache->size      = 1;
+      cache->vertices[0] = *(cache->current - 1);
+      cache->current     = cache->vertices + 1;
+      cache->size        = 1;
    }
    else
    {
-      cache->current = cache->buffer;
+      cache->current = cache->vertices;
       cache->size    = 0;
    }
 }
 
 void _al_prim_cache_push_triangle(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* v0, const float* v1, const float* v2)
 {
-   if (cache->size >= (ALLEGRO_VERTEX_CACHE_SIZE - 3))
-      _al_prim_cache_flush(cache);
+   cache_make_room(cache, 3);
 
    cache->current->x     = v0[0];
    cache->current->y     = v0[1];
@@ -238,8 +331,7 @@ void _al_prim_cache_push_triangle(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float*
 
 void _al_prim_cache_push_point(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* v)
 {
-   if (cache->size >= (ALLEGRO_VERTEX_CACHE_SIZE - 1))
-      _al_prim_cache_flush(cache);
+   cache_make_room(cache, 1);
 
    cache->current->x     = v[0];
    cache->current->y     = v[1];
@@ -249,3 +341,197 @@ void _al_prim_cache_push_point(ALLEGRO_PRIM_VERTEX_CACHE* cache, const float* v)
    ++cache->current;
    ++cache->size;
 }
+
+
+/*
+ * State shared by all threads, guarded by prim_mutex.
+ *
+ * Unit circle tables serve all arcs whose angular step is a whole fraction
+ * of a turn. Tables are created on first use and live until the addon is
+ * shut down, so a pointer handed out stays valid without holding the mutex.
+ *
+ * A thread's state is freed when the thread exits, where the platform tells
+ * us, and unlinked from the list of thread states. Shutting the addon down
+ * frees the states left in that list. The TLS remembers the generation of the
+ * addon a state was made in, so pointers left behind in other threads are
+ * never followed after that.
+ */
+static ALLEGRO_MUTEX* prim_mutex = NULL;
+static float* unit_circles[_AL_PRIM_MAX_UNIT_CIRCLE + 1];
+static _AL_PRIM_THREAD_STATE* thread_states = NULL;
+static intptr_t generation = 1;
+static int max_cache_size = _AL_PRIM_DEFAULT_MAX_CACHE_SIZE;
+
+/*
+ * Frees the state of an exiting thread, see _al_tls_set_addon_dtor.
+ */
+static void destroy_thread_state(void** addon_data)
+{
+   _AL_PRIM_THREAD_STATE* state = addon_data[_AL_TLS_PRIMITIVES_STATE];
+   _AL_PRIM_THREAD_STATE** link;
+   bool found = false;
+
+   addon_data[_AL_TLS_PRIMITIVES_STATE] = NULL;
+
+   if (!prim_mutex || (intptr_t)addon_data[_AL_TLS_PRIMITIVES_GENERATION] != generation)
+      return;
+
+   al_lock_mutex(prim_mutex);
+   for (link = &thread_states; *link; link = &(*link)->next) {
+      if (*link == state) {
+         *link = state->next;
+         found = true;
+         break;
+      }
+   }
+   al_unlock_mutex(prim_mutex);
+
+   if (found) {
+      al_free(state->vertices);
+      al_free(state);
+   }
+}
+
+
+void _al_prim_init_shared_state(void)
+{
+   if (!prim_mutex)
+      prim_mutex = al_create_mutex();
+   _al_tls_set_addon_dtor(_AL_TLS_PRIMITIVES_STATE, destroy_thread_state);
+}
+
+
+void _al_prim_shutdown_shared_state(void)
+{
+   _AL_PRIM_THREAD_STATE* state;
+   void** slot;
+   int ii;
+
+   _al_tls_set_addon_dtor(_AL_TLS_PRIMITIVES_STATE, NULL);
+
+   for (ii = 0; ii <= _AL_PRIM_MAX_UNIT_CIRCLE; ii++) {
+      al_free(unit_circles[ii]);
+      unit_circles[ii] = NULL;
+   }
+
+   if (prim_mutex)
+      al_lock_mutex(prim_mutex);
+   while ((state = thread_states) != NULL) {
+      thread_states = state->next;
+      al_free(state->vertices);
+      al_free(state);
+   }
+   generation++;
+   if (prim_mutex)
+      al_unlock_mutex(prim_mutex);
+
+   slot = _al_tls_get_addon_data(_AL_TLS_PRIMITIVES_STATE);
+   if (slot)
+      *slot = NULL;
+
+   al_destroy_mutex(prim_mutex);
+   prim_mutex = NULL;
+}
+
+
+/*
+ * Returns the calling thread's state, creating it if needed, or NULL if the
+ * addon is not initialized or memory runs out.
+ */
+_AL_PRIM_THREAD_STATE* _al_prim_get_thread_state(void)
+{
+   _AL_PRIM_THREAD_STATE* state;
+   void** slot = _al_tls_get_addon_data(_AL_TLS_PRIMITIVES_STATE);
+   void** slot_generation = _al_tls_get_addon_data(_AL_TLS_PRIMITIVES_GENERATION);
+
+   if (!slot || !slot_generation)
+      return NULL;
+
+   if (*slot && (intptr_t)*slot_generation == generation)
+      return *slot;
+
+   if (!prim_mutex)
+      return NULL;
+
+   state = al_calloc(1, sizeof(_AL_PRIM_THREAD_STATE));
+   if (!state)
+      return NULL;
+
+   al_lock_mutex(prim_mutex);
+   state->next = thread_states;
+   thread_states = state;
+   al_unlock_mutex(prim_mutex);
+
+   *slot = state;
+   *slot_generation = (void*)generation;
+   return state;
+}
+
+
+/*
+ * Counts one draw call handed to a backend, for al_get_prim_draw_call_count.
+ */
+void _al_prim_count_draw_call(void)
+{
+   _AL_PRIM_THREAD_STATE* state = _al_prim_get_thread_state();
+   if (state)
+      state->draw_calls++;
+}
+
+
+/* Function: al_set_vertex_cache_size
+ */
+void al_set_vertex_cache_size(int num_vertices)
+{
+   if (num_vertices < ALLEGRO_VERTEX_CACHE_SIZE)
+      num_vertices = ALLEGRO_VERTEX_CACHE_SIZE;
+   max_cache_size = num_vertices;
+}
+
+
+/* Function: al_get_vertex_cache_size
+ */
+int al_get_vertex_cache_size(void)
+{
+   return max_cache_size;
+}
+
+
+/* Function: al_get_prim_draw_call_count
+ */
+unsigned int al_get_prim_draw_call_count(void)
+{
+   _AL_PRIM_THREAD_STATE* state = _al_prim_get_thread_state();
+   return state ? state->draw_calls : 0;
+}
+
+
+/*
+ * Returns cos and sin, interleaved, of 2 pi k / num_segments for k from 0 to
+ * num_segments - 1, or NULL if there is no such table.
+ */
+const float* _al_prim_get_unit_circle(int num_segments)
+{
+   float* table;
+   int ii;
+
+   if (!prim_mutex || num_segments < 3 || num_segments > _AL_PRIM_MAX_UNIT_CIRCLE)
+      return NULL;
+
+   al_lock_mutex(prim_mutex);
+   table = unit_circles[num_segments];
+   if (!table) {
+      table = al_malloc(2 * num_segments * sizeof(float));
+      if (table) {
+         for (ii = 0; ii < num_segments; ii++) {
+            double theta = 2 * ALLEGRO_PI * ii / num_segments;
+            table[2 * ii]     = (float)cos(theta);
+            table[2 * ii + 1] = (float)sin(theta);
+         }
+         unit_circles[num_segments] = table;
+      }
+   }
+   al_unlock_mutex(prim_mutex);
+
+   return table;
+}
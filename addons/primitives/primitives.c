@@ -47,6 +47,7 @@ bool al_init_primitives_addon(void)
 {
    bool ret = true;
    ret &= _al_init_d3d_driver();
+   _al_prim_init_shared_state();
    
    addon_initialized = ret;
    
@@ -67,6 +68,7 @@ bool al_is_primitives_addon_initialized(void)
 void al_shutdown_primitives_addon(void)
 {
    _al_shutdown_d3d_driver();
+   _al_prim_shutdown_shared_state();
    addon_initialized = false;
 }
 
@@ -84,6 +86,9 @@ int al_draw_prim(const void* vtxs, const ALLEGRO_VERTEX_DECL* decl,
    ASSERT(start >= 0);
    ASSERT(type >= 0 && type < ALLEGRO_PRIM_NUM_TYPES);
 
+   if (!decl && (ret = _al_prim_record_shape(vtxs, texture, NULL, start, end, type)) >= 0)
+      return ret;
+
    target = al_get_target_bitmap();
 
    /* In theory, if we ever get a camera concept for this addon, the transformation into
@@ -103,6 +108,8 @@ int al_draw_prim(const void* vtxs, const ALLEGRO_VERTEX_DECL* decl,
       }
    }
    
+   _al_prim_count_draw_call();
+
    return ret;
 }
 
@@ -120,6 +127,9 @@ int al_draw_indexed_prim(const void* vtxs, const ALLEGRO_VERTEX_DECL* decl,
    ASSERT(num_vtx > 0);
    ASSERT(type >= 0 && type < ALLEGRO_PRIM_NUM_TYPES);
 
+   if (!decl && (ret = _al_prim_record_shape(vtxs, texture, indices, 0, num_vtx, type)) >= 0)
+      return ret;
+
    target = al_get_target_bitmap();
    
    /* In theory, if we ever get a camera concept for this addon, the transformation into
@@ -139,6 +149,8 @@ int al_draw_indexed_prim(const void* vtxs, const ALLEGRO_VERTEX_DECL* decl,
       }
    }
    
+   _al_prim_count_draw_call();
+
    return ret;
 }
 
@@ -485,7 +497,7 @@ int _al_draw_buffer_common_soft(ALLEGRO_VERTEX_BUFFER* vertex_buffer, ALLEGRO_BI
       ASSERT(idx);
 
       if (index_buffer->index_size != 4) {
-         int_idx = al_malloc(num_vtx * sizeof(int));
+         int_idx = _al_transient_malloc(num_vtx * sizeof(int));
          for (ii = 0; ii < num_vtx; ii++) {
             int_idx[ii] = ((unsigned short*)idx)[ii];
          }
@@ -495,7 +507,7 @@ int _al_draw_buffer_common_soft(ALLEGRO_VERTEX_BUFFER* vertex_buffer, ALLEGRO_BI
       num_primitives = _al_draw_prim_indexed_soft(texture, vtx, vertex_buffer->decl, idx, num_vtx, type);
 
       al_unlock_index_buffer(index_buffer);
-      al_free(int_idx);
+      _al_transient_free(int_idx);
    }
    else {
       num_primitives = _al_draw_prim_soft(texture, vtx, vertex_buffer->decl, 0, num_vtx, type);
@@ -537,6 +549,8 @@ int al_draw_vertex_buffer(ALLEGRO_VERTEX_BUFFER* vertex_buffer,
       }
    }
 
+   _al_prim_count_draw_call();
+
    return ret;
 }
 
@@ -575,6 +589,8 @@ int al_draw_indexed_buffer(ALLEGRO_VERTEX_BUFFER* vertex_buffer,
       }
    }
 
+   _al_prim_count_draw_call();
+
    return ret;
 }
 
@@ -0,0 +1,349 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Retained shapes: primitives tessellated once and redrawn.
+ *
+ *
+ *      See readme.txt for copyright information.
+ */
+
+#include "allegro5/allegro.h"
+#include "allegro5/allegro_primitives.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_prim.h"
+#include <string.h>
+
+ALLEGRO_DEBUG_CHANNEL("primitives")
+
+
+static ALLEGRO_SHAPE* get_recording_shape(void)
+{
+   _AL_PRIM_THREAD_STATE* state = _al_prim_get_thread_state();
+   return state ? state->recording : NULL;
+}
+
+
+/*
+ * Makes room for needed elements, doubling the capacity as it goes.
+ */
+static bool reserve(void** items, int* capacity, int needed, size_t item_size)
+{
+   void* new_items;
+   int new_capacity;
+
+   if (needed <= *capacity)
+      return true;
+
+   new_capacity = *capacity ? *capacity : 64;
+   while (new_capacity < needed)
+      new_capacity *= 2;
+
+   new_items = al_realloc(*items, new_capacity * item_size);
+   if (!new_items)
+      return false;
+
+   *items = new_items;
+   *capacity = new_capacity;
+   return true;
+}
+
+
+static void destroy_buffers(ALLEGRO_SHAPE* shape)
+{
+   if (shape->vertex_buffer) {
+      al_destroy_vertex_buffer(shape->vertex_buffer);
+      shape->vertex_buffer = NULL;
+   }
+   if (shape->index_buffer) {
+      al_destroy_index_buffer(shape->index_buffer);
+      shape->index_buffer = NULL;
+   }
+}
+
+
+/*
+ * Copies the shape into GPU buffers. If that is not possible the shape keeps
+ * being drawn from its own arrays.
+ */
+static void upload_shape(ALLEGRO_SHAPE* shape)
+{
+   int index_size = shape->num_vertices <= 65536 ? 2 : 4;
+   void* index_data = shape->indices;
+   int ii;
+
+   if (!shape->flags || shape->num_indices == 0 || !al_get_current_display())
+      return;
+
+   if (index_size == 2) {
+      uint16_t* short_indices = _al_transient_malloc(shape->num_indices * sizeof(uint16_t));
+      if (!short_indices)
+         return;
+      for (ii = 0; ii < shape->num_indices; ii++)
+         short_indices[ii] = (uint16_t)shape->indices[ii];
+      index_data = short_indices;
+   }
+
+   shape->vertex_buffer = al_create_vertex_buffer(NULL, shape->vertices,
+      shape->num_vertices, shape->flags);
+   if (shape->vertex_buffer) {
+      shape->index_buffer = al_create_index_buffer(index_size, index_data,
+         shape->num_indices, shape->flags);
+   }
+
+   if (index_data != shape->indices)
+      _al_transient_free(index_data);
+
+   if (!shape->index_buffer) {
+      ALLEGRO_WARN("Could not create buffers for a shape, drawing from memory.\n");
+      destroy_buffers(shape);
+   }
+}
+
+
+/*
+ * Appends a draw call to the shape being recorded by this thread, converting
+ * strips, fans and loops into lists so that consecutive calls with the same
+ * texture share one batch. Returns the number of primitives, as al_draw_prim
+ * would, or -1 if nothing is being recorded.
+ */
+int _al_prim_record_shape(const ALLEGRO_VERTEX* vtxs, ALLEGRO_BITMAP* texture,
+   const int* indices, int start, int end, int type)
+{
+   ALLEGRO_SHAPE* shape = get_recording_shape();
+   ALLEGRO_SHAPE_BATCH* batch;
+   int count = end - start;
+   int first = start;
+   int last = end - 1;
+   int list_type, num_prims, num_indices;
+   int base, ii;
+   int* out;
+
+   if (!shape)
+      return -1;
+   if (count <= 0)
+      return 0;
+
+   /* Indexed draws copy the range of vertices they refer to. */
+   if (indices) {
+      first = last = indices[start];
+      for (ii = start + 1; ii < end; ii++) {
+         if (indices[ii] < first)
+            first = indices[ii];
+         if (indices[ii] > last)
+            last = indices[ii];
+      }
+   }
+
+   switch (type) {
+      case ALLEGRO_PRIM_LINE_LIST:
+         list_type = ALLEGRO_PRIM_LINE_LIST;
+         num_prims = count / 2;
+         num_indices = num_prims * 2;
+         break;
+      case ALLEGRO_PRIM_LINE_STRIP:
+         list_type = ALLEGRO_PRIM_LINE_LIST;
+         num_prims = count - 1;
+         num_indices = num_prims * 2;
+         break;
+      case ALLEGRO_PRIM_LINE_LOOP:
+         list_type = ALLEGRO_PRIM_LINE_LIST;
+         num_prims = count > 1 ? count : 0;
+         num_indices = num_prims * 2;
+         break;
+      case ALLEGRO_PRIM_TRIANGLE_LIST:
+         list_type = ALLEGRO_PRIM_TRIANGLE_LIST;
+         num_prims = count / 3;
+         num_indices = num_prims * 3;
+         break;
+      case ALLEGRO_PRIM_TRIANGLE_STRIP:
+      case ALLEGRO_PRIM_TRIANGLE_FAN:
+         list_type = ALLEGRO_PRIM_TRIANGLE_LIST;
+         num_prims = count - 2;
+         num_indices = num_prims * 3;
+         break;
+      case ALLEGRO_PRIM_POINT_LIST:
+         list_type = ALLEGRO_PRIM_POINT_LIST;
+         num_prims = count;
+         num_indices = count;
+         break;
+      default:
+         ASSERT(0);
+         return 0;
+   }
+
+   if (num_prims <= 0)
+      return 0;
+
+   if (!reserve((void**)&shape->vertices, &shape->vertex_capacity,
+         shape->num_vertices + last - first + 1, sizeof(ALLEGRO_VERTEX)) ||
+       !reserve((void**)&shape->indices, &shape->index_capacity,
+         shape->num_indices + num_indices, sizeof(int)) ||
+       !reserve((void**)&shape->batches, &shape->batch_capacity,
+         shape->num_batches + 1, sizeof(ALLEGRO_SHAPE_BATCH))) {
+      ALLEGRO_ERROR("Out of memory while recording a shape.\n");
+      return 0;
+   }
+
+   base = shape->num_vertices;
+   memcpy(shape->vertices + base, vtxs + first,
+      (last - first + 1) * sizeof(ALLEGRO_VERTEX));
+   shape->num_vertices += last - first + 1;
+
+#define SEQ(i) (indices ? base + indices[start + (i)] - first : base + (i))
+
+   out = shape->indices + shape->num_indices;
+   switch (type) {
+      case ALLEGRO_PRIM_LINE_LIST:
+      case ALLEGRO_PRIM_TRIANGLE_LIST:
+      case ALLEGRO_PRIM_POINT_LIST:
+         for (ii = 0; ii < num_indices; ii++)
+            *out++ = SEQ(ii);
+         break;
+      case ALLEGRO_PRIM_LINE_STRIP:
+      case ALLEGRO_PRIM_LINE_LOOP:
+         for (ii = 0; ii < num_prims; ii++) {
+            *out++ = SEQ(ii);
+            *out++ = SEQ((ii + 1) % count);
+         }
+         break;
+      case ALLEGRO_PRIM_TRIANGLE_STRIP:
+         for (ii = 0; ii < num_prims; ii++) {
+            /* Keep the winding of every other triangle consistent. */
+            *out++ = SEQ(ii + (ii & 1));
+            *out++ = SEQ(ii + 1 - (ii & 1));
+            *out++ = SEQ(ii + 2);
+         }
+         break;
+      case ALLEGRO_PRIM_TRIANGLE_FAN:
+         for (ii = 0; ii < num_prims; ii++) {
+            *out++ = SEQ(0);
+            *out++ = SEQ(ii + 1);
+            *out++ = SEQ(ii + 2);
+         }
+         break;
+   }
+
+#undef SEQ
+
+   batch = shape->num_batches ? &shape->batches[shape->num_batches - 1] : NULL;
+   if (!batch || batch->type != list_type || batch->texture != texture) {
+      batch = &shape->batches[shape->num_batches++];
+      batch->type = list_type;
+      batch->texture = texture;
+      batch->start = shape->num_indices;
+      batch->count = 0;
+   }
+   batch->count += num_indices;
+   shape->num_indices += num_indices;
+
+   return num_prims;
+}
+
+
+/* Function: al_create_shape
+ */
+ALLEGRO_SHAPE* al_create_shape(int flags)
+{
+   ALLEGRO_SHAPE* shape = al_calloc(1, sizeof(ALLEGRO_SHAPE));
+   if (!shape)
+      return NULL;
+
+   shape->flags = flags;
+   return shape;
+}
+
+
+/* Function: al_destroy_shape
+ */
+void al_destroy_shape(ALLEGRO_SHAPE* shape)
+{
+   _AL_PRIM_THREAD_STATE* state;
+
+   if (!shape)
+      return;
+
+   state = _al_prim_get_thread_state();
+   if (state && state->recording == shape)
+      state->recording = NULL;
+
+   destroy_buffers(shape);
+   al_free(shape->vertices);
+   al_free(shape->indices);
+   al_free(shape->batches);
+   al_free(shape);
+}
+
+
+/* Function: al_begin_shape
+ */
+bool al_begin_shape(ALLEGRO_SHAPE* shape)
+{
+   _AL_PRIM_THREAD_STATE* state = _al_prim_get_thread_state();
+
+   ASSERT(shape);
+
+   if (!state || state->recording)
+      return false;
+
+   destroy_buffers(shape);
+   shape->num_vertices = 0;
+   shape->num_indices = 0;
+   shape->num_batches = 0;
+
+   state->recording = shape;
+   return true;
+}
+
+
+/* Function: al_end_shape
+ */
+void al_end_shape(void)
+{
+   _AL_PRIM_THREAD_STATE* state = _al_prim_get_thread_state();
+   ALLEGRO_SHAPE* shape = state ? state->recording : NULL;
+
+   if (!shape)
+      return;
+
+   state->recording = NULL;
+   upload_shape(shape);
+}
+
+
+/* Function: al_draw_shape
+ */
+int al_draw_shape(ALLEGRO_SHAPE* shape)
+{
+   bool recording = get_recording_shape() != NULL;
+   int ret = 0;
+   int ii;
+
+   ASSERT(shape);
+   ASSERT(get_recording_shape() != shape);
+
+   for (ii = 0; ii < shape->num_batches; ii++) {
+      ALLEGRO_SHAPE_BATCH* batch = &shape->batches[ii];
+
+      /* While recording another shape, go through al_draw_indexed_prim so
+       * that this one is copied into it.
+       */
+      if (shape->vertex_buffer && !recording) {
+         ret += al_draw_indexed_buffer(shape->vertex_buffer, batch->texture,
+            shape->index_buffer, batch->start, batch->start + batch->count,
+            batch->type);
+      }
+      else {
+         ret += al_draw_indexed_prim(shape->vertices, NULL, batch->texture,
+            shape->indices + batch->start, batch->count, batch->type);
+      }
+   }
+
+   return ret;
+}
@@ -13,798 +13,1092 @@
  *
  *      By Michał Cichoń.
  *
+ *      Ear clipping over a circular vertex list, after the "earcut"
+ *      algorithm by Vladimir Agafonkin, with ear tests accelerated by
+ *      a uniform grid.
+ *
  *      See readme.txt for copyright information.
  */
 
 
 # include "allegro5/allegro.h"
 # include "allegro5/allegro_primitives.h"
+# include "allegro5/internal/aintern.h"
 # include "allegro5/internal/aintern_prim.h"
-# include "allegro5/internal/aintern_list.h"
-# include <float.h>
 # include <math.h>
 
 
-# define POLY_DEBUG 0
+/* Polygons with more vertices than this use a grid to find vertices
+ * near a candidate ear; for smaller ones a plain scan is faster.
+ */
+# define POLY_GRID_THRESHOLD    80
 
+/* Number of nodes allocated at once when a polygon has to be split. */
+# define POLY_NODE_BLOCK_SIZE   256
 
-/* */
-# define POLY_VERTEX_ATTR_REFLEX      0x0001
-# define POLY_VERTEX_ATTR_EAR_CLIP    0x0002
-# define POLY_VERTEX_ATTR_ALL         (POLY_VERTEX_ATTR_REFLEX | POLY_VERTEX_ATTR_EAR_CLIP)
+/* Number of edge records allocated at once while bridging holes. */
+# define POLY_EDGE_BLOCK_SIZE   1024
 
 
 typedef void (*POLY_EMIT_TRIANGLE)(int, int, int, void*);
 
+/*
+ *  Polygon vertex. Every ring is kept as a circular doubly linked list,
+ *  and holes are bridged into the outline by duplicating the two vertices
+ *  at the ends of each bridge. Nodes are also linked into the list of the
+ *  grid cell they fall in, if there is a grid, and into the queue of
+ *  candidate ears while they are waiting to be tested.
+ */
+typedef struct POLY_NODE POLY_NODE;
+struct POLY_NODE {
+   int         index;
+   int         ring;
+   float       x;
+   float       y;
+   bool        steiner;
+   POLY_NODE*  prev;
+   POLY_NODE*  next;
+   POLY_NODE*  next_cell;
+   POLY_NODE** cell_link;
+   bool        queued;
+   POLY_NODE*  prev_queued;
+   POLY_NODE*  next_queued;
+};
+
+typedef struct POLY_NODE_BLOCK POLY_NODE_BLOCK;
+struct POLY_NODE_BLOCK {
+   POLY_NODE_BLOCK*  next;
+   size_t            used;
+   size_t            size;
+   POLY_NODE*        nodes;
+};
+
+/*
+ *  Record of the edge starting at 'node' in one row of the grid.
+ */
+typedef struct POLY_EDGE POLY_EDGE;
+struct POLY_EDGE {
+   POLY_NODE*  node;
+   POLY_EDGE*  next;
+};
+
+typedef struct POLY_EDGE_BLOCK POLY_EDGE_BLOCK;
+struct POLY_EDGE_BLOCK {
+   POLY_EDGE_BLOCK*  next;
+   size_t            used;
+   POLY_EDGE         edges[POLY_EDGE_BLOCK_SIZE];
+};
+
 typedef struct POLY {
    const float*            vertex_buffer;
    size_t                  vertex_stride;
-   size_t                  vertex_count;
-   const int*              split_indices;
-   size_t                  split_stride;
-   size_t                  split_count;
    POLY_EMIT_TRIANGLE      emit;
    void*                   userdata;
-   _AL_LIST*               vertex_list;
-   _AL_LIST*               reflex_list;
-   _AL_LIST*               ear_list;
+   bool                    flip;
+   bool                    failed;
+   POLY_NODE_BLOCK*        blocks;
+   POLY_NODE               queue;
+   int                     ring_count;
+   POLY_NODE**             cells;
+   POLY_EDGE**             edge_rows;
+   POLY_EDGE_BLOCK*        edge_blocks;
+   int                     cols;
+   int                     rows;
+   float                   min_x;
+   float                   min_y;
+   float                   inv_cell_w;
+   float                   inv_cell_h;
+   double                  cell_w;
+   double                  cell_h;
 } POLY;
 
-typedef struct POLY_SPLIT {
-   int      begin;
-   size_t   size;
-   float*   point;
-   int      max_index;
-} POLY_SPLIT;
 
+/* Internal functions. */
+static void poly_triangulate_ring(POLY* polygon, POLY_NODE* ear, int pass);
 
-# if POLY_DEBUG
-typedef void (*poly_debug_draw_text_t)(float x, float y, int line, const char* format, ...);
 
-#if defined _MSC_VER
-#define EXPORT __declspec(dllexport)
-#else
-#define EXPORT
-#define __noop ((void)0)
-#endif
+# define POLY_VERTEX(polygon, i) \
+   ((const float*)((const char*)(polygon)->vertex_buffer + (i) * (polygon)->vertex_stride))
 
-EXPORT int                     g_poly_debug_split_step      = -1;
-EXPORT int                     g_poly_debug_step            = -1;
-EXPORT int                     g_poly_debug_step_current    = 0;
-EXPORT poly_debug_draw_text_t  g_poly_debug_draw_text       = NULL;
-EXPORT float                   g_poly_debug_scale           = 1.0f;
 
-#undef EXPORT
+/*
+ *  Allocates a block big enough for 'size' nodes and pushes it on
+ *  the polygon's list of blocks.
+ */
+static bool poly_add_node_block(POLY* polygon, size_t size)
+{
+   POLY_NODE_BLOCK* block;
 
-# define POLY_DEBUG_TEXT(x,y,...)            (g_poly_debug_draw_text ? g_poly_debug_draw_text(x,y,INT_MAX,__VA_ARGS__) : __noop)
-# define POLY_DEBUG_TEXT_LINE(x,y,line,...)  (g_poly_debug_draw_text ? g_poly_debug_draw_text(x,y,line,__VA_ARGS__)    : __noop)
+   block = _al_transient_malloc(sizeof(POLY_NODE_BLOCK) + size * sizeof(POLY_NODE));
+   if (!block) {
+      polygon->failed = true;
+      return false;
+   }
 
-# endif
+   block->next  = polygon->blocks;
+   block->used  = 0;
+   block->size  = size;
+   block->nodes = (POLY_NODE*)(block + 1);
+   polygon->blocks = block;
+   return true;
+}
 
 
-/* Internal functions. */
-static bool      poly_initialize(POLY* poly);
-static void      poly_classify_vertices(_AL_LIST* vertices, _AL_LIST* reflex, _AL_LIST* ear);
-static void      poly_classify_vertices_in_range(_AL_LIST_ITEM* begin, _AL_LIST_ITEM* end, _AL_LIST* vertices, _AL_LIST* reflex, _AL_LIST* ear);
-static void      poly_do_triangulate(POLY* poly);
+static void poly_free_node_blocks(POLY* polygon)
+{
+   while (polygon->blocks) {
+      POLY_NODE_BLOCK* next = polygon->blocks->next;
+      _al_transient_free(polygon->blocks);
+      polygon->blocks = next;
+   }
+}
+
 
-static _AL_LIST* poly_create_split_list(POLY* polygon);
-static void      poly_split_list_dtor(void* user_data);
+/*
+ *  Returns a new unlinked node for vertex 'index', or NULL if memory
+ *  ran out.
+ */
+static POLY_NODE* poly_create_node(POLY* polygon, int index, float x, float y)
+{
+   POLY_NODE_BLOCK* block = polygon->blocks;
+   POLY_NODE* node;
+
+   if (!block || block->used == block->size) {
+      if (!poly_add_node_block(polygon, POLY_NODE_BLOCK_SIZE))
+         return NULL;
+      block = polygon->blocks;
+   }
+
+   node = block->nodes + block->used++;
+   node->index     = index;
+   node->ring      = 0;
+   node->x         = x;
+   node->y         = y;
+   node->steiner   = false;
+   node->prev      = NULL;
+   node->next      = NULL;
+   node->next_cell = NULL;
+   node->cell_link = NULL;
+   node->queued    = false;
+   return node;
+}
 
 
 /*
- *  Seek for closest intersection point of polygon with a ray directed
- *  to the right.
- *
- *  Returns true if intersection was found. 'point', 'edge0' and 'edge1'
- *  are set to proper values (if not NULL).
- *  Returns false if intersection was not fount and none of above
- *  are modified.
+ *  Creates a node and links it after 'last'.
  */
-static bool poly_find_closest_intersection(_AL_LIST* vertices, const float* vertex, float* point, _AL_LIST_ITEM** edge0, _AL_LIST_ITEM** edge1)
-{
-   size_t i;
-   const float* v0 = NULL;
-   float v1[2];
-   float intersection[2];
-   float t0, t1;
-   float best_point[2] = {0, 0};
-   float best_t;
-   _AL_LIST_ITEM* item = NULL;
-   _AL_LIST_ITEM* next = NULL;
-   _AL_LIST_ITEM* best_e0 = NULL;
-   _AL_LIST_ITEM* best_e1 = NULL;
-
-   /* Assemble line pointing to the right. */
-   v0    = vertex;
-   v1[0] = v0[0] + 1.0f;
-   v1[1] = v0[1];
-
-   /* Seek for the closest intersection. */
-   best_t = FLT_MAX;
-   item = _al_list_front(vertices);
-   next = _al_list_next_circular(vertices, item);
-   for (i = 0; i < _al_list_size(vertices); ++i, item = next, next = _al_list_next_circular(vertices, next)) {
-
-      float* p0 = (float*)_al_list_item_data(item);
-      float* p1 = (float*)_al_list_item_data(next);
-
-      /* Perform quick rejection.
-       *
-       * We are interested only with outer edges. That mean only those
-       * whose go from the bottom to the up. Note we cannot intersect
-       * parallel line.
-       *
-       * Second condition reject edges lying completely on the left
-       * side of ray origin.
-       */
-      if ((p0[1] < p1[1]) || (p0[0] <= vertex[0] && p1[0] <= vertex[0]))
-         continue;
+static POLY_NODE* poly_insert_node(POLY* polygon, int index, float x, float y, POLY_NODE* last)
+{
+   POLY_NODE* node = poly_create_node(polygon, index, x, y);
 
-      if (_al_prim_intersect_segment(v0, v1, p0, p1, intersection, &t0, &t1) && (t1 >= 0.0f) && (t1 <= 1.0f) && (t0 >= 0.0f) && (t0 < best_t)) {
+   if (!node)
+      return NULL;
 
-         best_t        = t0;
-         best_point[0] = intersection[0];
-         best_point[1] = intersection[1];
-         best_e0       = item;
-         best_e1       = next;
-      }
+   if (!last) {
+      node->prev = node;
+      node->next = node;
+   }
+   else {
+      node->next = last->next;
+      node->prev = last;
+      last->next->prev = node;
+      last->next = node;
    }
 
-   if (NULL != best_e0) {
+   return node;
+}
 
-      if (NULL != point) {
 
-         point[0] = best_point[0];
-         point[1] = best_point[1];
-      }
+/*
+ *  The queue of candidate ears is a circular list with 'polygon->queue'
+ *  as its head, so nodes can leave it without knowing the polygon.
+ */
+static void poly_queue_remove(POLY_NODE* node)
+{
+   if (node->queued) {
+      node->prev_queued->next_queued = node->next_queued;
+      node->next_queued->prev_queued = node->prev_queued;
+      node->queued = false;
+   }
+}
 
-      if (NULL != edge0)
-         *edge0 = best_e0;
 
-      if (NULL != edge1)
-         *edge1 = best_e1;
+static void poly_queue_push(POLY* polygon, POLY_NODE* node)
+{
+   POLY_NODE* head = &polygon->queue;
 
-# if POLY_DEBUG
-      //al_draw_line(v0[0], v0[1], point[0], point[1], al_map_rgb(255, 0, 0), 0.0f);
-# endif
+   poly_queue_remove(node);
 
-      return true;
-   }
-   else
-      return false;
+   node->prev_queued = head->prev_queued;
+   node->next_queued = head;
+   head->prev_queued->next_queued = node;
+   head->prev_queued = node;
+   node->queued = true;
 }
 
 
-/*
- *  Seek for the best vertex in polygon for doing split.
- *
- *  Returns vertex after which split (hole) vertices
- *  can be inserted.
- */
-static _AL_LIST_ITEM* poly_find_outter_split_vertex(POLY* polygon, POLY_SPLIT* split)
-{
-   float intersection[2];
-   _AL_LIST_ITEM* edge_vertex_0;
-   _AL_LIST_ITEM* edge_vertex_1;
-   _AL_LIST_ITEM* vertex;
-   _AL_LIST_ITEM* reflex_item;
-   _AL_LIST_ITEM* best_vertex;
-   float  best_distance;
-   float* p0;
-   float* p1;
-   float* p;
-
-   if (!poly_find_closest_intersection(polygon->vertex_list, split->point, intersection, &edge_vertex_0, &edge_vertex_1))
+static POLY_NODE* poly_queue_pop(POLY* polygon)
+{
+   POLY_NODE* node = polygon->queue.next_queued;
+
+   if (node == &polygon->queue)
       return NULL;
 
-   p0 = (float*)_al_list_item_data(edge_vertex_0);
-   p1 = (float*)_al_list_item_data(edge_vertex_1);
+   poly_queue_remove(node);
+   return node;
+}
+
 
-   /* Maybe we hit an edge vertex? */
-   if (_al_prim_are_points_equal(split->point, p0))
-      return edge_vertex_0;
+static void poly_remove_node(POLY_NODE* node)
+{
+   poly_queue_remove(node);
 
-   if (_al_prim_are_points_equal(split->point, p1))
-      return edge_vertex_1;
+   /* Removed nodes belong to no ring. */
+   node->ring = -1;
 
-   /* No luck. Pick point which most far away from us. */
-   if (p0[0] > p1[0]) {
+   node->next->prev = node->prev;
+   node->prev->next = node->next;
 
-      vertex = edge_vertex_0;
-      p      = p0;
+   if (node->cell_link) {
+      *node->cell_link = node->next_cell;
+      if (node->next_cell)
+         node->next_cell->cell_link = node->cell_link;
    }
-   else {
+}
 
-      vertex = edge_vertex_1;
-      p      = p1;
-   }
 
-   /* Seek in reflex vertices. */
-   best_vertex = NULL;
-   best_distance = FLT_MAX;
+/*
+ *  Returns the row and column of the grid containing 'y' and 'x'.
+ */
+static int poly_row(const POLY* polygon, float y)
+{
+   int row = (int)((y - polygon->min_y) * polygon->inv_cell_h);
+   return _ALLEGRO_CLAMP(0, row, polygon->rows - 1);
+}
+
 
-   for (reflex_item = _al_list_front(polygon->reflex_list); reflex_item; reflex_item = _al_list_next(polygon->reflex_list, reflex_item)) {
+static int poly_col(const POLY* polygon, float x)
+{
+   int col = (int)((x - polygon->min_x) * polygon->inv_cell_w);
+   return _ALLEGRO_CLAMP(0, col, polygon->cols - 1);
+}
 
-      _AL_LIST_ITEM* reflex_vertex = (_AL_LIST_ITEM*)_al_list_item_data(reflex_item);
 
-      float* reflex_point = (float*)_al_list_item_data(reflex_vertex);
+static void poly_grid_insert(POLY* polygon, POLY_NODE* node)
+{
+   POLY_NODE** cell;
 
-      if (_al_prim_is_point_in_triangle(reflex_point, split->point, p, intersection)) {
+   if (!polygon->cells)
+      return;
+
+   cell = polygon->cells + poly_row(polygon, node->y) * polygon->cols + poly_col(polygon, node->x);
+   node->next_cell = *cell;
+   node->cell_link = cell;
+   if (*cell)
+      (*cell)->cell_link = &node->next_cell;
+   *cell = node;
+}
+
+
+/*
+ *  Records the edge starting at 'node' in every row it spans, so that
+ *  the ray cast from a hole only has to look at the edges of one row.
+ *  Records are never removed; whoever reads them checks that the node
+ *  is still part of the outline and uses its current neighbour.
+ */
+static void poly_add_edge(POLY* polygon, POLY_NODE* node)
+{
+   int row, row0, row1;
 
-         float diff_x = reflex_point[0] - split->point[0];
-         float diff_y = reflex_point[1] - split->point[1];
+   if (!polygon->edge_rows)
+      return;
 
-         float dist = diff_x * diff_x + diff_y * diff_y;
+   row0 = poly_row(polygon, _ALLEGRO_MIN(node->y, node->next->y));
+   row1 = poly_row(polygon, _ALLEGRO_MAX(node->y, node->next->y));
 
-         if (dist < best_distance) {
+   for (row = row0; row <= row1; row++) {
+      POLY_EDGE_BLOCK* block = polygon->edge_blocks;
+      POLY_EDGE* edge;
 
-            best_distance = dist;
-            best_vertex   = reflex_vertex;
+      if (!block || block->used == POLY_EDGE_BLOCK_SIZE) {
+         block = _al_transient_malloc(sizeof(POLY_EDGE_BLOCK));
+         if (!block) {
+            polygon->failed = true;
+            return;
          }
+         block->next = polygon->edge_blocks;
+         block->used = 0;
+         polygon->edge_blocks = block;
       }
+
+      edge = block->edges + block->used++;
+      edge->node = node;
+      edge->next = polygon->edge_rows[row];
+      polygon->edge_rows[row] = edge;
    }
+}
 
-   if (NULL != best_vertex)
-      vertex = best_vertex;
 
-//# if POLY_DEBUG
-//   p0 = (float*)_al_list_item_data(vertex);
-//   al_draw_line(p0[0], p0[1], intersection[0], intersection[1], al_map_rgb(255, 0, 0), 0.0f);
-//# endif
+static void poly_free_edges(POLY* polygon)
+{
+   while (polygon->edge_blocks) {
+      POLY_EDGE_BLOCK* next = polygon->edge_blocks->next;
+      _al_transient_free(polygon->edge_blocks);
+      polygon->edge_blocks = next;
+   }
 
-   return vertex;
+   _al_transient_free(polygon->edge_rows);
+   polygon->edge_rows = NULL;
 }
 
 
-# define POLY_VERTEX(index)      ((float*)(((uint8_t*)polygon->vertex_buffer) + (index) * polygon->vertex_stride))
-# define POLY_SPLIT(index)       (*((int*)(((uint8_t*)polygon->split_indices) + (index) * polygon->split_stride)))
-# define POLY_SPLIT_INDEX(split) (((uint8_t*)split - (uint8_t*)polygon->split_indices) / polygon->split_stride)
-
-
 /*
- *  Create list of the splits.
+ *  Sets up a uniform grid over the given bounds with about one cell per
+ *  vertex, so that ear tests only have to look at the vertices close to
+ *  the candidate triangle. If the grid cannot be allocated every search
+ *  falls back to walking the whole ring.
  */
-static _AL_LIST* poly_create_split_list(POLY* polygon)
+static void poly_create_grid(POLY* polygon, int vertex_count, bool with_edges,
+   float min_x, float min_y, float max_x, float max_y)
 {
-   int i;
-   int last_split;
+   double width  = (double)max_x - min_x;
+   double height = (double)max_y - min_y;
+   int cols, rows;
 
-   _AL_LIST*       list   = _al_list_create_static(polygon->split_count);
-   POLY_SPLIT* splits = (POLY_SPLIT*)al_malloc(polygon->split_count * sizeof(POLY_SPLIT));
+   if (width > 0 && height > 0)
+      cols = (int)ceil(sqrt(vertex_count * width / height));
+   else
+      cols = (width > 0) ? vertex_count : 1;
+   cols = _ALLEGRO_CLAMP(1, cols, vertex_count);
+   rows = _ALLEGRO_MAX(1, (vertex_count + cols - 1) / cols);
+   if (height <= 0)
+      rows = 1;
+
+   polygon->cells = _al_transient_calloc(cols * rows, sizeof(POLY_NODE*));
+   if (!polygon->cells)
+      return;
+
+   if (with_edges) {
+      polygon->edge_rows = _al_transient_calloc(rows, sizeof(POLY_EDGE*));
+      if (!polygon->edge_rows) {
+         _al_transient_free(polygon->cells);
+         polygon->cells = NULL;
+         return;
+      }
+   }
 
-   if ((NULL == list) || (NULL == splits)) {
+   polygon->cols   = cols;
+   polygon->rows   = rows;
+   polygon->min_x  = min_x;
+   polygon->min_y  = min_y;
+   polygon->cell_w = width > 0 ? width / cols : 1;
+   polygon->cell_h = height > 0 ? height / rows : 1;
+   polygon->inv_cell_w = (float)(1 / polygon->cell_w);
+   polygon->inv_cell_h = (float)(1 / polygon->cell_h);
+}
 
-      _al_list_destroy(list);
-      al_free(splits);
 
-      return NULL;
-   }
+static void poly_grid_insert_ring(POLY* polygon, POLY_NODE* start)
+{
+   POLY_NODE* p = start;
 
-   /* Set list destructor, so we will don't worry about
-    * manually releasing allocated memory.
-    */
-   _al_list_set_dtor(list, poly_split_list_dtor);
-   _al_list_set_user_data(list, splits);
+   do {
+      poly_grid_insert(polygon, p);
+      poly_add_edge(polygon, p);
+      p = p->next;
+   } while (p != start);
+}
 
-   last_split = POLY_SPLIT(0);
-   for (i = 1; i < (int)polygon->split_count; ++i) {
 
-      int j;
-      float max;
-      POLY_SPLIT* split = splits + i;
-      _AL_LIST_ITEM* where;
+/*
+ *  Twice the signed area of the triangle (p, q, r). Coordinates are
+ *  widened so that the products of float differences are exact and
+ *  the sign can be trusted.
+ */
+static double poly_area(const POLY_NODE* p, const POLY_NODE* q, const POLY_NODE* r)
+{
+   return ((double)q->y - p->y) * ((double)r->x - q->x) -
+          ((double)q->x - p->x) * ((double)r->y - q->y);
+}
 
-      split->begin = last_split;
-      split->size  = POLY_SPLIT(i) - last_split;
-      last_split   = last_split + split->size;
 
-      max = -FLT_MAX;
-      split->max_index = -1;
-      for (j = split->begin; j < split->begin + (int)split->size; ++j) {
+static bool poly_equals(const POLY_NODE* p, const POLY_NODE* q)
+{
+   return p->x == q->x && p->y == q->y;
+}
 
-         float* point = POLY_VERTEX(j);
 
-         if (point[0] >= max) {
+static bool poly_point_in_triangle(
+   double ax, double ay, double bx, double by, double cx, double cy, double px, double py)
+{
+   return (cx - px) * (ay - py) >= (ax - px) * (cy - py) &&
+          (ax - px) * (by - py) >= (bx - px) * (ay - py) &&
+          (bx - px) * (cy - py) >= (cx - px) * (by - py);
+}
 
-            max               = point[0];
-            split->point      = point;
-            split->max_index  = j;
-         }
-      }
 
-      split->max_index -= split->begin;
+static int poly_sign(double value)
+{
+   return (value > 0) - (value < 0);
+}
 
-      ASSERT(split->max_index >= 0);
 
-      where = NULL;
-      if (!_al_list_is_empty(list)) {
+/*
+ *  Tests whether 'q' lies within the bounding box of segment 'p'-'r'.
+ *  Only meaningful if the three points are collinear.
+ */
+static bool poly_on_segment(const POLY_NODE* p, const POLY_NODE* q, const POLY_NODE* r)
+{
+   return q->x <= _ALLEGRO_MAX(p->x, r->x) && q->x >= _ALLEGRO_MIN(p->x, r->x) &&
+          q->y <= _ALLEGRO_MAX(p->y, r->y) && q->y >= _ALLEGRO_MIN(p->y, r->y);
+}
 
-         for (where = _al_list_front(list); where; where = _al_list_next(list, where)) {
 
-            POLY_SPLIT* local_split = (POLY_SPLIT*)_al_list_item_data(where);
+static bool poly_intersects(const POLY_NODE* p1, const POLY_NODE* q1, const POLY_NODE* p2, const POLY_NODE* q2)
+{
+   int o1 = poly_sign(poly_area(p1, q1, p2));
+   int o2 = poly_sign(poly_area(p1, q1, q2));
+   int o3 = poly_sign(poly_area(p2, q2, p1));
+   int o4 = poly_sign(poly_area(p2, q2, q1));
 
-            if (local_split->point[0] < max)
-               break;
-         }
-      }
+   if (o1 != o2 && o3 != o4)
+      return true;
 
-      if (NULL == where)
-         _al_list_push_back(list, split);
-      else
-         _al_list_insert_before(list, where, split);
-   }
+   if (o1 == 0 && poly_on_segment(p1, p2, q1)) return true;
+   if (o2 == 0 && poly_on_segment(p1, q2, q1)) return true;
+   if (o3 == 0 && poly_on_segment(p2, p1, q2)) return true;
+   if (o4 == 0 && poly_on_segment(p2, q1, q2)) return true;
 
-   return list;
+   return false;
 }
 
 
 /*
- *  Release memory allocated by split list. This method
- *  serve as callback to the list.
+ *  Tests whether diagonal 'a'-'b' crosses any edge of the ring.
  */
-static void poly_split_list_dtor(void* user_data)
+static bool poly_intersects_ring(const POLY_NODE* a, const POLY_NODE* b)
 {
-   /* This is array of POLY_SPLIT. */
-   al_free(user_data);
+   const POLY_NODE* p = a;
+
+   do {
+      if (p->index != a->index && p->next->index != a->index &&
+          p->index != b->index && p->next->index != b->index &&
+          poly_intersects(p, p->next, a, b))
+         return true;
+      p = p->next;
+   } while (p != a);
+
+   return false;
 }
 
 
 /*
- *  Perform initialization step to polygon triangulation.
- *
- *  Three linked list are initialized: vertex_list, reflex_list
- *  and ear_list.
- *
- *  All provided splits (holes) are resolved in this step.
- *  Therefore at the end we have simple polygon.
+ *  Tests whether diagonal 'a'-'b' starts inside the polygon at 'a'.
  */
-static bool poly_initialize(POLY* polygon)
-{
-   _AL_LIST* vertex_list;
-   _AL_LIST* reflex_list;
-   _AL_LIST* ear_list;
-   _AL_LIST* split_list;
-   _AL_LIST_ITEM* split_item;
-   size_t vertex_count;
-   bool use_split_list;
-   size_t j;
-   int i;
-
-# if POLY_DEBUG
-   if (g_poly_debug_split_step >= 0)
-      polygon->split_count = min(g_poly_debug_split_step, polygon->split_count);
-# endif
+static bool poly_locally_inside(const POLY_NODE* a, const POLY_NODE* b)
+{
+   if (poly_area(a->prev, a, a->next) < 0)
+      return poly_area(a, b, a->next) >= 0 && poly_area(a, a->prev, b) >= 0;
+   else
+      return poly_area(a, b, a->prev) < 0 || poly_area(a, a->next, b) < 0;
+}
 
-   /* Every hole add two extra vertices to the list. */
-   vertex_count = polygon->vertex_count + (polygon->split_count - 1) * 2;
 
-   /* Create lists for polygon. */
-   vertex_list = _al_list_create_static(vertex_count);
-   reflex_list = _al_list_create_static(vertex_count);
-   ear_list    = _al_list_create_static(vertex_count);
+/*
+ *  Tests whether the middle of diagonal 'a'-'b' is inside the ring.
+ */
+static bool poly_middle_inside(const POLY_NODE* a, const POLY_NODE* b)
+{
+   const POLY_NODE* p = a;
+   bool inside = false;
+   double px = ((double)a->x + b->x) / 2;
+   double py = ((double)a->y + b->y) / 2;
+
+   do {
+      if (((p->y > py) != (p->next->y > py)) && p->next->y != p->y &&
+          (px < ((double)p->next->x - p->x) * (py - p->y) / ((double)p->next->y - p->y) + p->x))
+         inside = !inside;
+      p = p->next;
+   } while (p != a);
+
+   return inside;
+}
 
-   if (polygon->split_count > 1) {
 
-      split_list     = poly_create_split_list(polygon);
-      use_split_list = true;
-   }
-   else {
-      split_list = NULL;
-      use_split_list = false;
-   }
+static bool poly_is_valid_diagonal(const POLY_NODE* a, const POLY_NODE* b)
+{
+   if (a->next->index == b->index || a->prev->index == b->index)
+      return false;
 
-   if ((NULL == vertex_list) || (NULL == reflex_list) || (NULL == ear_list) || (use_split_list && (NULL == split_list))) {
+   if (poly_intersects_ring(a, b))
+      return false;
 
-      _al_list_destroy(vertex_list);
-      _al_list_destroy(reflex_list);
-      _al_list_destroy(ear_list);
-      _al_list_destroy(split_list);
+   /* Locally visible and not creating opposite-facing sectors... */
+   if (poly_locally_inside(a, b) && poly_locally_inside(b, a) && poly_middle_inside(a, b) &&
+       (poly_area(a->prev, a, b->prev) != 0 || poly_area(a, b->prev, b) != 0))
+      return true;
 
-      return false;
-   }
+   /* ...or the special case of a zero-length diagonal. */
+   return poly_equals(a, b) &&
+          poly_area(a->prev, a, a->next) > 0 && poly_area(b->prev, b, b->next) > 0;
+}
 
-   /* Store lists in polygon. */
-   polygon->vertex_list = vertex_list;
-   polygon->reflex_list = reflex_list;
-   polygon->ear_list    = ear_list;
 
-   /* Push main polygon outline. */
-   for (i = 0; i < POLY_SPLIT(0); ++i)
-      _al_list_push_back(vertex_list, POLY_VERTEX(i));
+/*
+ *  Links 'a' and 'b' with a bridge. If both belong to the same ring it is
+ *  split in two; if they belong to different rings those are joined into
+ *  one. Returns the copy of 'b' which now heads the other half; the copies
+ *  keep the ring numbers of their originals.
+ */
+static POLY_NODE* poly_split_ring(POLY* polygon, POLY_NODE* a, POLY_NODE* b)
+{
+   POLY_NODE* a2 = poly_create_node(polygon, a->index, a->x, a->y);
+   POLY_NODE* b2 = poly_create_node(polygon, b->index, b->x, b->y);
+   POLY_NODE* an = a->next;
+   POLY_NODE* bp = b->prev;
 
-   if (use_split_list) {
+   if (!a2 || !b2)
+      return NULL;
 
-# if POLY_DEBUG
-       int current_split = 0;
-# endif
+   a->next = b;
+   b->prev = a;
 
-       poly_classify_vertices(vertex_list, reflex_list, NULL);
+   a2->next = an;
+   an->prev = a2;
 
-      /* Resolve all holes. */
-      for (split_item = _al_list_front(split_list); split_item; split_item = _al_list_next(split_list, split_item)) {
+   b2->next = a2;
+   a2->prev = b2;
 
-         _AL_LIST_ITEM* first_vertex;
-         _AL_LIST_ITEM* last_vertex;
-         POLY_SPLIT* split;
+   bp->next = b2;
+   b2->prev = bp;
 
-# if POLY_DEBUG
-         if (g_poly_debug_split_step >= 0 && current_split >= g_poly_debug_split_step)
-             break;
+   a2->ring = a->ring;
+   b2->ring = b->ring;
 
-         ++current_split;
-# endif
+   poly_grid_insert(polygon, a2);
+   poly_grid_insert(polygon, b2);
 
-         split = (POLY_SPLIT*)_al_list_item_data(split_item);
+   poly_add_edge(polygon, a);
+   poly_add_edge(polygon, a2);
+   poly_add_edge(polygon, b2);
 
-         first_vertex = poly_find_outter_split_vertex(polygon, split);
+   return b2;
+}
 
-         if (NULL == first_vertex)
-            break;
 
-         /* Insert hole vertices. */
-         last_vertex = first_vertex;
-         for (j = 0; j <= split->size; ++j)
-            last_vertex = _al_list_insert_after(vertex_list, last_vertex,
-               POLY_VERTEX(split->begin + ((j + split->max_index) % split->size)));
-         last_vertex = _al_list_insert_after(vertex_list, last_vertex, _al_list_item_data(first_vertex));
+/*
+ *  Builds ring number 'ring' from 'count' vertices starting at 'first',
+ *  oriented as requested regardless of the order of the input. Returns
+ *  the last node of the ring, or NULL if memory ran out.
+ */
+static POLY_NODE* poly_create_ring(POLY* polygon, int ring, int first, int count, bool clockwise, bool* reversed)
+{
+   POLY_NODE* last = NULL;
+   double sum = 0;
+   int i, j;
+
+   for (i = 0, j = count - 1; i < count; j = i++) {
+      const float* vi = POLY_VERTEX(polygon, first + i);
+      const float* vj = POLY_VERTEX(polygon, first + j);
+      sum += ((double)vj[0] - vi[0]) * ((double)vi[1] + vj[1]);
+   }
 
-         _al_list_remove(reflex_list, first_vertex);
+   *reversed = (clockwise != (sum > 0));
 
-         poly_classify_vertices_in_range(first_vertex, _al_list_next(vertex_list, last_vertex), vertex_list, reflex_list, NULL);
-      }
+   for (i = 0; i < count; i++) {
+      int index = *reversed ? first + count - 1 - i : first + i;
+      const float* v = POLY_VERTEX(polygon, index);
 
-      _al_list_destroy(split_list);
+      last = poly_insert_node(polygon, index, v[0], v[1], last);
+      if (!last)
+         return NULL;
+      last->ring = ring;
+   }
 
-      poly_classify_vertices(vertex_list, NULL, ear_list);
+   if (last && poly_equals(last, last->next)) {
+      poly_remove_node(last);
+      last = last->next;
    }
-   else
-      /* Initialize reflex and ear vertex lists. */
-      poly_classify_vertices(vertex_list, reflex_list, ear_list);
 
-   return true;
+   return last;
 }
 
-# undef POLY_VERTEX
-# undef POLY_SPLIT
-# undef POLY_SPLIT_INDEX
+
+/*
+ *  Removes duplicate and collinear vertices between 'start' and 'end'.
+ */
+static POLY_NODE* poly_filter_points(POLY* polygon, POLY_NODE* start, POLY_NODE* end)
+{
+   POLY_NODE* p;
+   bool again;
+
+   if (!start)
+      return start;
+   if (!end)
+      end = start;
+
+   p = start;
+   do {
+      again = false;
+
+      if (!p->steiner && (poly_equals(p, p->next) || poly_area(p->prev, p, p->next) == 0)) {
+         poly_remove_node(p);
+         p = end = p->prev;
+         if (p == p->next)
+            break;
+         poly_add_edge(polygon, p);
+         again = true;
+      }
+      else {
+         p = p->next;
+      }
+   } while (again || p != end);
+
+   return end;
+}
 
 
 /*
- *  Compute polygon vertex attributes. Currently supported attributes are:
- *    - ear clip
- *    - reflex
- *
- *  Vertex is an ear clip when triangle made by their edges does not contain
- *  any other vertices.
- *
- *  Vertex is a reflex when angle between edges is greater or equal
- *  to 180 degrees.
- *
- *  Optionally function may take reflex list (if not NULL). In this case test
- *  for ear clip is performed only on reflex vertices not on entire polygon.
- *  This is used for triangulation speed optimization, because convex
- *  (non reflect) vertices will never became reflex.
- *
- *  Flags are used to determine for which attribute we want to check.
- *  Use POLY_VERTEX_ATTR_ALL to test for all attributes.
+ *  Tests whether 'p' is a reflex vertex of the same ring lying inside
+ *  the triangle, which would stop 'ear' from being clipped.
  */
-static int poly_compute_vertex_attributes(_AL_LIST* vertices, _AL_LIST_ITEM* item, int flags, _AL_LIST* reflex)
+static bool poly_blocks_ear(const POLY_NODE* ear, const POLY_NODE* p,
+   float x0, float y0, float x1, float y1)
 {
-   size_t i;
-   _AL_LIST_ITEM* prev = _al_list_previous_circular(vertices, item);
-   _AL_LIST_ITEM* next = _al_list_next_circular(vertices, item);
-   _AL_LIST_ITEM* point = NULL;
-   int result = 0;
-   float* v0;
-   float* v1;
-   float* v2;
-   float cross;
+   const POLY_NODE* a = ear->prev;
+   const POLY_NODE* c = ear->next;
 
-   // Oops, degenerate triangle in store.
-   if (_al_list_size(vertices) < 3)
-      return result;
+   return p->x >= x0 && p->x <= x1 && p->y >= y0 && p->y <= y1 &&
+          p != a && p != ear && p != c && p->ring == ear->ring &&
+          poly_point_in_triangle(a->x, a->y, ear->x, ear->y, c->x, c->y, p->x, p->y) &&
+          poly_area(p->prev, p, p->next) >= 0;
+}
 
-   // Get points.
-   v0 = (float*)_al_list_item_data(prev);
-   v1 = (float*)_al_list_item_data(item);
-   v2 = (float*)_al_list_item_data(next);
 
-   // Compute the cross product between the two edges
-   cross = (v0[0] - v1[0]) * (v2[1] - v1[1]) - (v0[1] - v1[1]) * (v2[0] - v1[0]);
+/*
+ *  Finds the horizontal extent of triangle 'v' within the band y0..y1.
+ */
+static bool poly_triangle_span(const POLY_NODE* v[3], double y0, double y1, double* x0, double* x1)
+{
+   int i;
+
+   *x0 = HUGE_VAL;
+   *x1 = -HUGE_VAL;
+
+   for (i = 0; i < 3; i++) {
+      const POLY_NODE* u = v[i];
+      const POLY_NODE* w = v[(i + 1) % 3];
+      double y[2];
+      int j;
+
+      if (u->y >= y0 && u->y <= y1) {
+         *x0 = _ALLEGRO_MIN(*x0, u->x);
+         *x1 = _ALLEGRO_MAX(*x1, u->x);
+      }
+
+      y[0] = y0;
+      y[1] = y1;
+      for (j = 0; j < 2; j++) {
+         if ((u->y < y[j] && w->y > y[j]) || (u->y > y[j] && w->y < y[j])) {
+            double x = u->x + (y[j] - u->y) * ((double)w->x - u->x) / ((double)w->y - u->y);
+            *x0 = _ALLEGRO_MIN(*x0, x);
+            *x1 = _ALLEGRO_MAX(*x1, x);
+         }
+      }
+   }
 
-# if POLY_DEBUG
-   if (g_poly_debug_step == g_poly_debug_step_current) {
+   return *x0 <= *x1;
+}
 
-      float step = 0.25f * 0.0f;
 
-      float dir0[2] = { v0[0] - v1[0], v0[1] - v1[1] };
-      float dir2[2] = { v2[0] - v1[0], v2[1] - v1[1] };
+static bool poly_is_ear(const POLY* polygon, const POLY_NODE* ear)
+{
+   const POLY_NODE* v[3];
+   const POLY_NODE* p;
+   float x0, y0, x1, y1;
+   double eps_x, eps_y;
+   int row, row0, row1;
 
-      POLY_DEBUG_TEXT(v1[0], v1[1], "%d", cross > 0);
+   v[0] = ear->prev;
+   v[1] = ear;
+   v[2] = ear->next;
 
-      al_draw_line(v1[0], v1[1], v1[0] + dir0[0] * step, v1[1] + dir0[1] * step, al_map_rgb(255, 0, 0), 4.0f * g_poly_debug_scale);
-      al_draw_line(v1[0], v1[1], v1[0] + dir2[0] * step, v1[1] + dir2[1] * step, al_map_rgb(255, 0, 0), 4.0f * g_poly_debug_scale);
+   if (poly_area(v[0], v[1], v[2]) >= 0)
+      return false;
+
+   x0 = _ALLEGRO_MIN(v[0]->x, _ALLEGRO_MIN(v[1]->x, v[2]->x));
+   y0 = _ALLEGRO_MIN(v[0]->y, _ALLEGRO_MIN(v[1]->y, v[2]->y));
+   x1 = _ALLEGRO_MAX(v[0]->x, _ALLEGRO_MAX(v[1]->x, v[2]->x));
+   y1 = _ALLEGRO_MAX(v[0]->y, _ALLEGRO_MAX(v[1]->y, v[2]->y));
+
+   if (!polygon->cells) {
+      for (p = v[2]->next; p != v[0]; p = p->next) {
+         if (poly_blocks_ear(ear, p, x0, y0, x1, y1))
+            return false;
+      }
+      return true;
    }
-# endif
-
-   // If internal angle is less than 180 degrees then we may
-   // have an ear clip vertex, otherwise we have reflex.
-   if (cross >= 0)
-   {
-      if (flags & POLY_VERTEX_ATTR_EAR_CLIP)
-      {
-         _AL_LIST_ITEM* start;
-         _AL_LIST* search_list;
-         size_t size;
-
-         if (reflex) {
-
-            search_list = reflex;
-            size        = _al_list_size(search_list);
-            start       = _al_list_front(reflex);
-         }
-         else {
-            search_list = vertices;
-            size        = _al_list_size(search_list) - 3;
-            start       = _al_list_next_circular(search_list, next);
-         }
 
-         // Check for ear vertex.
-         point = start;
-         for (i = 0; i < size; ++i, point = _al_list_next_circular(search_list, point)) {
+   /* Visit only the cells the triangle overlaps, row by row. Bands and
+    * spans are padded a little so that rounding cannot skip a vertex
+    * lying exactly on the triangle's edge.
+    */
+   eps_x = polygon->cell_w * 1e-3;
+   eps_y = polygon->cell_h * 1e-3;
 
-            float* v;
+   row0 = poly_row(polygon, y0);
+   row1 = poly_row(polygon, y1);
 
-            // TODO: optimize this by removing if
-            if (search_list == reflex)
-               v = (float*)_al_list_item_data((_AL_LIST_ITEM*)_al_list_item_data(point));
-            else
-               v = (float*)_al_list_item_data(point);
+   for (row = row0; row <= row1; row++) {
+      double band0 = polygon->min_y + row * polygon->cell_h - eps_y;
+      double band1 = band0 + polygon->cell_h + 2 * eps_y;
+      double span0, span1;
+      int col, col0, col1;
 
-            // Ignore vertices which belong to the triangle.
-            if ((v == v0) || (v == v1) || (v == v2))
-               continue;
+      if (!poly_triangle_span(v, _ALLEGRO_MAX(band0, y0), _ALLEGRO_MIN(band1, y1), &span0, &span1))
+         continue;
 
-            // Set point to NULL if we find any point inside the triangle.
-            if (_al_prim_is_point_in_triangle(v, v0, v1, v2)) {
-               point = NULL;
-               break;
-            }
-         }
+      col0 = poly_col(polygon, (float)(span0 - eps_x));
+      col1 = poly_col(polygon, (float)(span1 + eps_x));
 
-         // If point is not NULL, we have ear vertex.
-         if ((NULL != point) || _al_list_is_empty(search_list))
-            result |= POLY_VERTEX_ATTR_EAR_CLIP;
+      for (col = col0; col <= col1; col++) {
+         for (p = polygon->cells[row * polygon->cols + col]; p; p = p->next_cell) {
+            if (poly_blocks_ear(ear, p, x0, y0, x1, y1))
+               return false;
+         }
       }
    }
-   else if (flags & POLY_VERTEX_ATTR_REFLEX)
-      result |= POLY_VERTEX_ATTR_REFLEX;
 
-   return result;
+   return true;
 }
 
 
-/*
- *  Classify all vertices into reflex or ear group.
- *
- *  One of target group may be NULL so it will be simply ignored.
- */
-static void poly_classify_vertices(_AL_LIST* vertices, _AL_LIST* reflex, _AL_LIST* ear)
+static void poly_emit(const POLY* polygon, const POLY_NODE* a, const POLY_NODE* b, const POLY_NODE* c)
 {
-   poly_classify_vertices_in_range(_al_list_front(vertices), NULL, vertices, reflex, ear);
+   if (polygon->flip)
+      polygon->emit(c->index, b->index, a->index, polygon->userdata);
+   else
+      polygon->emit(a->index, b->index, c->index, polygon->userdata);
 }
 
 
 /*
- *  Classify selected range of vertices [begin, end) into
- *  reflex or ear group.
- *
- *  One of target group may be NULL so it will be simply ignored.
+ *  Clips triangles where two consecutive edges cross each other, which
+ *  untangles small self-intersections left after filtering.
  */
-static void poly_classify_vertices_in_range(_AL_LIST_ITEM* begin, _AL_LIST_ITEM* end, _AL_LIST* vertices, _AL_LIST* reflex, _AL_LIST* ear)
+static POLY_NODE* poly_cure_local_intersections(POLY* polygon, POLY_NODE* start)
 {
-   _AL_LIST_ITEM* item = NULL;
-   int attribute_mask = 0;
+   POLY_NODE* p = start;
 
-   if (NULL != ear)
-      attribute_mask |= POLY_VERTEX_ATTR_EAR_CLIP;
+   do {
+      POLY_NODE* a = p->prev;
+      POLY_NODE* b = p->next->next;
 
-   if (NULL != reflex)
-      attribute_mask |= POLY_VERTEX_ATTR_REFLEX;
+      if (!poly_equals(a, b) && poly_intersects(a, p, p->next, b) &&
+          poly_locally_inside(a, b) && poly_locally_inside(b, a)) {
 
-   for (item = begin; item != end; item = _al_list_next(vertices, item))
-   {
-      int attr = poly_compute_vertex_attributes(vertices, item, attribute_mask, NULL);
+         poly_emit(polygon, a, p, b);
 
-      if (0 == attr)
-         continue;
+         poly_remove_node(p);
+         poly_remove_node(p->next);
 
-      if (attr & POLY_VERTEX_ATTR_EAR_CLIP)
-         _al_list_push_back(ear, item);
+         p = start = b;
+      }
+      p = p->next;
+   } while (p != start);
 
-      if (attr & POLY_VERTEX_ATTR_REFLEX)
-         _al_list_push_back(reflex, item);
-   }
+   return poly_filter_points(polygon, p, NULL);
+}
+
+
+/*
+ *  Last resort: find a valid diagonal, split the ring along it and
+ *  triangulate both halves independently.
+ */
+static void poly_split_triangulate(POLY* polygon, POLY_NODE* start)
+{
+   POLY_NODE* a = start;
+
+   do {
+      POLY_NODE* b = a->next->next;
+
+      while (b != a->prev) {
+         if (a->index != b->index && poly_is_valid_diagonal(a, b)) {
+            POLY_NODE* c = poly_split_ring(polygon, a, b);
+            POLY_NODE* p;
+            int ring;
+
+            if (!c)
+               return;
+
+            /* The grid is shared, so tell the halves apart. */
+            ring = ++polygon->ring_count;
+            p = c;
+            do {
+               p->ring = ring;
+               p = p->next;
+            } while (p != c);
+
+            a = poly_filter_points(polygon, a, a->next);
+            c = poly_filter_points(polygon, c, c->next);
+
+            poly_triangulate_ring(polygon, a, 0);
+            poly_triangulate_ring(polygon, c, 0);
+            return;
+         }
+         b = b->next;
+      }
+      a = a->next;
+   } while (a != start);
 }
 
 
 /*
- *  Reclassify vertex. After triangle was emitted one vertex
- *  is removed from the list. Two neighbor vertices may
- *  change their attributes. In this place we have general
- *  function which update lists to match new attributes
- *  of provided vertex.
+ *  Main ear clipping loop.
  */
-static void poly_update_vertex_attributes(_AL_LIST* vertices, _AL_LIST* reflex, _AL_LIST* ear, _AL_LIST_ITEM* vertex)
+static void poly_triangulate_ring(POLY* polygon, POLY_NODE* ear, int pass)
 {
-   _AL_LIST_ITEM* item;
+   POLY_NODE* p;
+   bool clipped;
 
-   int attr = poly_compute_vertex_attributes(vertices, vertex, POLY_VERTEX_ATTR_ALL, reflex);
+   if (!ear || polygon->failed)
+      return;
 
-   // Update reflex list only if an attribute change.
-   item = _al_list_find_first(reflex, vertex);
-   if (attr & POLY_VERTEX_ATTR_REFLEX) {
+   do {
+      clipped = false;
 
-      if (NULL == item)
-         _al_list_push_back(reflex, vertex);
+      /* Start with every vertex as a candidate... */
+      p = ear;
+      do {
+         poly_queue_push(polygon, p);
+         p = p->next;
+      } while (p != ear);
 
-      _al_list_remove(ear, vertex);
-   }
-   else {
+      /* ...then after each clip reconsider only the two neighbours, whose
+       * angles have changed. Moving them to the back of the queue leads to
+       * less sliver triangles.
+       */
+      while (ear->prev != ear->next && (p = poly_queue_pop(polygon))) {
+         POLY_NODE* prev = p->prev;
+         POLY_NODE* next = p->next;
 
-      if (NULL != item)
-         _al_list_erase(reflex, item);
+         if (poly_is_ear(polygon, p)) {
+            poly_emit(polygon, prev, p, next);
+            poly_remove_node(p);
 
-      item = _al_list_find_first(ear, vertex);
-      if (attr & POLY_VERTEX_ATTR_EAR_CLIP) {
+            poly_queue_push(polygon, prev);
+            poly_queue_push(polygon, next);
 
-         if (NULL == item)
-            _al_list_push_front(ear, vertex);
+            ear = next;
+            clipped = true;
+         }
       }
-      else {
+   } while (clipped && ear->prev != ear->next);
 
-         if (NULL != item)
-            _al_list_erase(ear, item);
-      }
+   while (poly_queue_pop(polygon)) {
+      /* do nothing */
+   }
+
+   if (ear->prev == ear->next)
+      return;
+
+   /* No ear was found among the remaining vertices. */
+   if (pass == 0) {
+      poly_triangulate_ring(polygon, poly_filter_points(polygon, ear, NULL), 1);
+   }
+   else if (pass == 1) {
+      ear = poly_cure_local_intersections(polygon, poly_filter_points(polygon, ear, NULL));
+      poly_triangulate_ring(polygon, ear, 2);
+   }
+   else {
+      poly_split_triangulate(polygon, ear);
    }
 }
 
 
-/*
- *  Triangulator iterate trough list of ear vertices
- *  and clip isolated triangles. This process repeats
- *  until there are ear vertices.
- */
-static void poly_do_triangulate(POLY* polygon)
+static POLY_NODE* poly_leftmost(POLY_NODE* start)
 {
-# define VERTEX_INDEX(vertex) ((((uint8_t*)vertex) - ((uint8_t*)polygon->vertex_buffer)) / polygon->vertex_stride)
+   POLY_NODE* p = start;
+   POLY_NODE* leftmost = start;
+
+   do {
+      if (p->x < leftmost->x || (p->x == leftmost->x && p->y < leftmost->y))
+         leftmost = p;
+      p = p->next;
+   } while (p != start);
 
-# if POLY_DEBUG
-   g_poly_debug_step_current = 0;
+   return leftmost;
+}
+
+
+static bool poly_sector_contains_sector(const POLY_NODE* m, const POLY_NODE* p)
+{
+   return poly_area(m->prev, m, p->prev) < 0 && poly_area(p->next, m, m->next) < 0;
+}
 
-   {
-      _AL_LIST_ITEM* item;
-      _AL_LIST_ITEM* next;
-      int* histogram = al_calloc(_al_list_size(polygon->vertex_list), sizeof(int));
 
-      /*std::map<float*, int> histogram;*/
+/*
+ *  Checks where the edge starting at 'p' crosses the ray cast to the left
+ *  from 'hole', keeping the nearest crossing in 'qx' and the endpoint with
+ *  the lesser x as the bridge candidate in 'm'. Returns true if the hole
+ *  touches the edge, in which case no better candidate exists.
+ */
+static bool poly_cast_ray(const POLY_NODE* hole, POLY_NODE* p, double* qx, POLY_NODE** m)
+{
+   double hx = hole->x;
+   double hy = hole->y;
+
+   if (hy <= p->y && hy >= p->next->y && p->next->y != p->y) {
+      double x = p->x + (hy - p->y) * ((double)p->next->x - p->x) / ((double)p->next->y - p->y);
+      if (x <= hx && x > *qx) {
+         *qx = x;
+         *m = p->x < p->next->x ? p : p->next;
+         return x == hx;
+      }
+   }
 
-      int index = 0;
-      for (item = _al_list_front(polygon->vertex_list); item; item = _al_list_next(polygon->vertex_list, item)) {
+   return false;
+}
 
-         float* point0;
-         float* point1;
-         float n[2];
-         float l, r;
-         char status[3] = { 0 };
-         int status_index = 0;
 
-         next = _al_list_next_circular(polygon->vertex_list, item);
+/*
+ *  If 'p' lies inside the triangle formed by the hole vertex, the
+ *  crossing point 'qx' and the first candidate at ('mx', 'my'), it may
+ *  hide the candidate; prefer the vertex with the smallest angle to the
+ *  ray.
+ */
+static void poly_check_bridge(const POLY_NODE* hole, POLY_NODE* p, double qx, double mx, double my,
+   POLY_NODE** m, double* tan_min)
+{
+   double hx = hole->x;
+   double hy = hole->y;
+   double tan;
 
-         point0 = (float*)_al_list_item_data(item);
-         point1 = (float*)_al_list_item_data(next);
+   if (!(hx >= p->x && p->x >= mx && hx != p->x &&
+         poly_point_in_triangle(hy < my ? hx : qx, hy, mx, my, hy < my ? qx : hx, hy, p->x, p->y)))
+      return;
 
-         n[0] = -(point1[1] - point0[1]);
-         n[1] =   point1[0] - point0[0];
+   tan = fabs(hy - p->y) / (hx - p->x);
 
-         l = 2.0f * sqrtf(n[0] * n[0] + n[1] * n[1]);
+   if (poly_locally_inside(p, hole) &&
+       (tan < *tan_min || (tan == *tan_min &&
+         (p->x > (*m)->x || (p->x == (*m)->x && poly_sector_contains_sector(*m, p)))))) {
+      *m = p;
+      *tan_min = tan;
+   }
+}
 
-         n[0] /= l;
-         n[1] /= l;
 
-         r = 1.0f * 0.0f;
+/*
+ *  Finds a vertex of the outline visible from the leftmost vertex of
+ *  a hole, by casting a ray to the left.
+ */
+static POLY_NODE* poly_find_hole_bridge(const POLY* polygon, POLY_NODE* hole, POLY_NODE* outer)
+{
+   POLY_NODE* m = NULL;
+   POLY_NODE* p;
+   double qx = -HUGE_VAL;
+   double mx, my, tan_min = HUGE_VAL;
 
-         al_draw_line(point0[0] + n[0] * r, point0[1] + n[1] * r, point1[0] + n[0] * r, point1[1] + n[1] * r, al_map_rgba(255, 0, 255, 128), r * g_poly_debug_scale);
+   if (polygon->edge_rows) {
+      const POLY_EDGE* edge = polygon->edge_rows[poly_row(polygon, hole->y)];
 
-         if (_al_list_contains(polygon->reflex_list, item))
-            status[status_index++] = 'R';
-         if (_al_list_contains(polygon->ear_list, item))
-            status[status_index++] = 'E';
+      for (; edge; edge = edge->next) {
+         if (edge->node->ring == outer->ring && poly_cast_ray(hole, edge->node, &qx, &m))
+            return m;
+      }
+   }
+   else {
+      p = outer;
+      do {
+         if (poly_cast_ray(hole, p, &qx, &m))
+            return m;
+         p = p->next;
+      } while (p != outer);
+   }
 
-         POLY_DEBUG_TEXT_LINE(point0[0], point0[1], -histogram[VERTEX_INDEX(point0)], "%s %d", status, index++);
+   if (!m)
+      return NULL;
 
-         ++histogram[VERTEX_INDEX(point0)];
+   mx = m->x;
+   my = m->y;
+
+   if (polygon->cells) {
+      int row0 = poly_row(polygon, (float)_ALLEGRO_MIN(hole->y, my));
+      int row1 = poly_row(polygon, (float)_ALLEGRO_MAX(hole->y, my));
+      int col0 = poly_col(polygon, (float)mx);
+      int col1 = poly_col(polygon, hole->x);
+      int row, col;
+
+      for (row = row0; row <= row1; row++) {
+         for (col = col0; col <= col1; col++) {
+            for (p = polygon->cells[row * polygon->cols + col]; p; p = p->next_cell) {
+               if (p->ring == outer->ring)
+                  poly_check_bridge(hole, p, qx, mx, my, &m, &tan_min);
+            }
+         }
       }
+   }
+   else {
+      POLY_NODE* stop = m;
 
-      al_free(histogram);
+      p = m;
+      do {
+         poly_check_bridge(hole, p, qx, mx, my, &m, &tan_min);
+         p = p->next;
+      } while (p != stop);
    }
-# endif
-
-   // Repeat until there are ear clips.
-   while (!_al_list_is_empty(polygon->ear_list)) {
-
-      _AL_LIST_ITEM* ear_item;
-      _AL_LIST_ITEM* vertex_item;
-      _AL_LIST_ITEM* next;
-      _AL_LIST_ITEM* prev;
-      float* v0;
-      float* v1;
-      float* v2;
-
-      // Get point and corresponding item on polygon->vertex_list list.
-      ear_item    = _al_list_front(polygon->ear_list);
-      vertex_item = (_AL_LIST_ITEM*)_al_list_item_data(ear_item);
-      prev        = _al_list_previous_circular(polygon->vertex_list, vertex_item);
-      next        = _al_list_next_circular(polygon->vertex_list,     vertex_item);
-      v0 = (float*)_al_list_item_data(prev);
-      v1 = (float*)_al_list_item_data(vertex_item);
-      v2 = (float*)_al_list_item_data(next);
-
-# if POLY_DEBUG
-      if (g_poly_debug_step == g_poly_debug_step_current) {
-         _AL_LIST_ITEM* item;
-         ALLEGRO_COLOR color;
-         int second = 0;
-
-         al_draw_filled_triangle(v0[0], v0[1], v1[0], v1[1], v2[0], v2[1], al_map_rgba(0, 0, 255, 64));
-
-         for (item = _al_list_front(polygon->vertex_list); item; item = _al_list_next(polygon->vertex_list, item)) {
-
-            float* point = (float*)_al_list_item_data(item);
-            al_draw_filled_circle(point[0], point[1], 6.0f * g_poly_debug_scale, al_map_rgb(255, 255, 255));
-         }
 
-         for (item = _al_list_front(polygon->reflex_list); item; item = _al_list_next(polygon->reflex_list, item)) {
+   return m;
+}
 
-            float* point = (float*)_al_list_item_data((_AL_LIST_ITEM*)_al_list_item_data(item));
 
-            al_draw_filled_circle(point[0], point[1], 6.0f * g_poly_debug_scale, al_map_rgb(255, 255, 0));
-         }
+static int poly_compare_x(const void* a, const void* b)
+{
+   const POLY_NODE* p = *(const POLY_NODE* const*)a;
+   const POLY_NODE* q = *(const POLY_NODE* const*)b;
+
+   if (p->x != q->x)
+      return p->x < q->x ? -1 : 1;
+   if (p->y != q->y)
+      return p->y < q->y ? -1 : 1;
+   return 0;
+}
 
-         color = al_map_rgb(255, 0, 0);
-         second = _al_list_size(polygon->ear_list) - 1;
-         for (item = _al_list_back(polygon->ear_list); item; item = _al_list_previous(polygon->ear_list, item), --second) {
 
-            float* point = (float*)_al_list_item_data((_AL_LIST_ITEM*)_al_list_item_data(item));
+/*
+ *  Joins every hole to the outline, from left to right so that each
+ *  bridge is found before the holes to its right are merged in.
+ */
+static POLY_NODE* poly_eliminate_holes(POLY* polygon, POLY_NODE* outer, POLY_NODE** holes, int hole_count)
+{
+   int i;
 
-            if (second == 0)
-               color = al_map_rgb(0, 255, 0);
-            else if (second == 1)
-               color = al_map_rgb(0, 0, 255);
+   qsort(holes, hole_count, sizeof(POLY_NODE*), poly_compare_x);
 
-            al_draw_circle(point[0], point[1], 9.0f * g_poly_debug_scale, color, 2.0f * g_poly_debug_scale);
-         }
-      }
-      if (g_poly_debug_step >= 0 && g_poly_debug_step_current >= g_poly_debug_step)
-         break;
-      g_poly_debug_step_current++;
-# endif
+   for (i = 0; i < hole_count && !polygon->failed; i++) {
+      POLY_NODE* bridge = poly_find_hole_bridge(polygon, holes[i], outer);
+      POLY_NODE* bridge_reverse;
+      POLY_NODE* p;
 
-      // Emit triangle.
-      polygon->emit(VERTEX_INDEX(v0), VERTEX_INDEX(v1), VERTEX_INDEX(v2), polygon->userdata);
+      if (!bridge)
+         continue;
+
+      p = holes[i];
+      do {
+         p->ring = outer->ring;
+         p = p->next;
+      } while (p != holes[i]);
 
-      // Remove polygon->ear_list clip from all lists.
-      _al_list_erase(polygon->ear_list,      ear_item);
-      _al_list_erase(polygon->vertex_list, vertex_item);
-      _al_list_erase(polygon->reflex_list, _al_list_find_first(polygon->reflex_list, vertex_item));
+      bridge_reverse = poly_split_ring(polygon, bridge, holes[i]);
+      if (!bridge_reverse)
+         break;
 
-      // Update attributes of corner vertices.
-      poly_update_vertex_attributes(polygon->vertex_list, polygon->reflex_list, polygon->ear_list, prev);
-      poly_update_vertex_attributes(polygon->vertex_list, polygon->reflex_list, polygon->ear_list, next);
+      poly_filter_points(polygon, bridge_reverse, bridge_reverse->next);
+      outer = poly_filter_points(polygon, bridge, bridge->next);
    }
 
-# undef VERTEX_INDEX
+   return outer;
 }
 
 
@@ -816,55 +1110,95 @@ bool al_triangulate_polygon(
    void (*emit_triangle)(int, int, int, void*), void* userdata)
 {
    POLY polygon;
+   POLY_NODE* outer;
+   POLY_NODE** holes = NULL;
    int vertex_count;
-   int split_count;
-   int *splits;
+   int hole_count;
+   int first;
    int i;
-   bool ret;
 
-   for (i = 0; vertex_counts[i] > 0; i++) {
-      /* do nothing */
-   }
-   ASSERT(i > 0);
-   split_count = i;
-
-   splits = malloc(split_count * sizeof(int));
-   if (!splits) {
-      return false;
-   }
-   vertex_count = 0;
-   for (i = 0; i < split_count; i++) {
+   for (i = 0, vertex_count = 0; vertex_counts[i] > 0; i++) {
       vertex_count += vertex_counts[i];
-      splits[i] = vertex_count;
    }
+   ASSERT(i > 0);
+   hole_count = i - 1;
 
    memset(&polygon, 0, sizeof(polygon));
    polygon.vertex_buffer = vertices;
    polygon.vertex_stride = vertex_stride;
-   polygon.vertex_count  = vertex_count;
-   polygon.split_indices = splits;
-   polygon.split_stride  = sizeof(int);   /* XXX can simplify code now */
-   polygon.split_count   = split_count;
    polygon.emit          = emit_triangle;
    polygon.userdata      = userdata;
+   polygon.ring_count    = hole_count;
+   polygon.queue.prev_queued = &polygon.queue;
+   polygon.queue.next_queued = &polygon.queue;
+
+   /* Every bridge to a hole adds two vertices. */
+   if (!poly_add_node_block(&polygon, vertex_count + 2 * hole_count))
+      return false;
 
-   if (poly_initialize(&polygon)) {
+   if (hole_count > 0) {
+      holes = _al_transient_malloc(hole_count * sizeof(POLY_NODE*));
+      if (!holes) {
+         poly_free_node_blocks(&polygon);
+         return false;
+      }
+   }
 
-      poly_do_triangulate(&polygon);
+   /* Triangles are emitted with the same winding as the outline. */
+   outer = poly_create_ring(&polygon, 0, 0, vertex_counts[0], true, &polygon.flip);
+   first = vertex_counts[0];
+
+   for (i = 0; i < hole_count && outer; i++) {
+      bool reversed;
+      POLY_NODE* hole = poly_create_ring(&polygon, i + 1, first, vertex_counts[i + 1], false, &reversed);
+
+      if (!hole) {
+         outer = NULL;
+         break;
+      }
 
-      _al_list_destroy(polygon.vertex_list);
-      _al_list_destroy(polygon.reflex_list);
-      _al_list_destroy(polygon.ear_list);
+      if (hole == hole->next)
+         hole->steiner = true;
 
-      ret = true;
+      holes[i] = poly_leftmost(hole);
+      first += vertex_counts[i + 1];
    }
-   else {
-      ret = false;
+
+   if (outer && outer->next != outer->prev) {
+      if (vertex_count > POLY_GRID_THRESHOLD) {
+         float min_x, min_y, max_x, max_y;
+
+         min_x = max_x = vertices[0];
+         min_y = max_y = vertices[1];
+         for (i = 1; i < vertex_count; i++) {
+            const float* v = POLY_VERTEX(&polygon, i);
+            min_x = _ALLEGRO_MIN(min_x, v[0]);
+            min_y = _ALLEGRO_MIN(min_y, v[1]);
+            max_x = _ALLEGRO_MAX(max_x, v[0]);
+            max_y = _ALLEGRO_MAX(max_y, v[1]);
+         }
+
+         poly_create_grid(&polygon, vertex_count, hole_count > 0, min_x, min_y, max_x, max_y);
+
+         poly_grid_insert_ring(&polygon, outer);
+         for (i = 0; i < hole_count; i++)
+            poly_grid_insert_ring(&polygon, holes[i]);
+      }
+
+      if (hole_count > 0)
+         outer = poly_eliminate_holes(&polygon, outer, holes, hole_count);
+
+      poly_free_edges(&polygon);
+
+      if (!polygon.failed)
+         poly_triangulate_ring(&polygon, outer, 0);
    }
 
-   free(splits);
+   _al_transient_free(holes);
+   _al_transient_free(polygon.cells);
+   poly_free_node_blocks(&polygon);
 
-   return ret;
+   return !polygon.failed;
 }
 
 /* vim: set sts=3 sw=3 et: */
@@ -1,9 +1,7 @@
 /* Ogg Theora/Vorbis video backend
  *
  * TODO:
- * - seeking
  * - generate video frame events
- * - better ycbcr->rgb
  * - improve frame skipping
  * - Ogg Skeleton support
  * - pass Theora test suite
@@ -14,12 +12,23 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include "allegro5/allegro5.h"
 #include "allegro5/allegro_audio.h"
 #include "allegro5/allegro_video.h"
+#include "allegro5/internal/aintern.h"
 #include "allegro5/internal/aintern_vector.h"
 #include "allegro5/internal/aintern_video.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || \
+   (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+   #define OGV_USE_SSE2
+   #include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+   #define OGV_USE_NEON
+   #include <arm_neon.h>
+#endif
+
 #include <ogg/ogg.h>
 #include <theora/theora.h>
 #include <theora/theoradec.h>
@@ -33,12 +42,25 @@ static const int NUM_FRAGS    = 2;
 static const int FRAG_SAMPLES = 4096;
 static const int RGB_PIXEL_FORMAT = ALLEGRO_PIXEL_FORMAT_ABGR_8888;
 
+/* Frames are converted to RGB in bands of rows on worker threads when they
+ * have at least two bands of this many pixels.
+ */
+#define MAX_CONVERT_THREADS   7
+#define MIN_PIXELS_PER_BAND   (1 << 18)
+
+/* Seeking bisects the file until the range left to search is this small,
+ * then reads it through.
+ */
+#define SEEK_LINEAR_BYTES     (64 * 1024)
+
 
 typedef struct OGG_VIDEO OGG_VIDEO;
 typedef struct STREAM STREAM;
 typedef struct THEORA_STREAM THEORA_STREAM;
 typedef struct VORBIS_STREAM VORBIS_STREAM;
 typedef struct PACKET_NODE PACKET_NODE;
+typedef struct CONVERT_POOL CONVERT_POOL;
+typedef struct KEYFRAME KEYFRAME;
 
 enum {
    STREAM_TYPE_UNKNOWN = 0,
@@ -83,6 +105,30 @@ struct STREAM {
    } u;
 };
 
+/* Worker threads for converting the rows of a frame in parallel.  The thread
+ * submitting the frame converts bands too.
+ */
+struct CONVERT_POOL {
+   ALLEGRO_MUTEX *mutex;
+   ALLEGRO_COND *work_cond;
+   ALLEGRO_COND *done_cond;
+   ALLEGRO_THREAD *threads[MAX_CONVERT_THREADS];
+   int num_threads;
+   bool started;
+   bool quit;
+
+   unsigned char *dest;
+   int pitch;
+   int num_bands;
+   int next_band;
+   int unfinished;
+};
+
+struct KEYFRAME {
+   int64_t frame;
+   int64_t offset;                  /* where to read from to decode it */
+};
+
 struct OGG_VIDEO {
    ALLEGRO_FILE *fp;
    bool reached_eof;
@@ -91,12 +137,26 @@ struct OGG_VIDEO {
    STREAM *selected_video_stream;   /* one of the streams */
    STREAM *selected_audio_stream;   /* one of the streams */
    int seek_counter;
-
-   /* Video output. */
+   double seek_to;
+
+   /* Keyframe index, filled in by a thread reading its own file handle.
+    * The thread is started by the first seek.
+    */
+   bool index_started;
+   ALLEGRO_FILE *index_fp;
+   ALLEGRO_THREAD *index_thread;
+   ALLEGRO_MUTEX *index_mutex;
+   _AL_VECTOR keyframes;            /* vector of KEYFRAME, in order */
+   int64_t indexed_frame;           /* index is complete up to this frame */
+   bool index_done;
+
+   /* Video output.  The planes of 'buffer' are copies owned by us, since
+    * the decoder may overwrite its own while a frame is being converted.
+    */
    th_pixel_fmt pixel_fmt;
    th_ycbcr_buffer buffer;
    bool buffer_dirty;
-   unsigned char* rgb_data;
+   CONVERT_POOL convert_pool;
    ALLEGRO_BITMAP *frame_bmp;
    ALLEGRO_BITMAP *pic_bmp;         /* frame_bmp, or subbitmap thereof */
 
@@ -736,8 +796,6 @@ static void setup_theora_stream_decode(ALLEGRO_VIDEO *video, OGG_VIDEO *ogv,
       ogv->pic_bmp = al_create_sub_bitmap(ogv->frame_bmp,
          pic_x, pic_y, pic_w, pic_h);
    }
-   ogv->rgb_data =
-      al_malloc(al_get_pixel_size(RGB_PIXEL_FORMAT) * frame_w * frame_h);
 
    video->fps =
       (double)tstream->info.fps_numerator /
@@ -816,7 +874,6 @@ static bool handle_theora_data(ALLEGRO_VIDEO *video, THEORA_STREAM *tstream,
 }
 
 /* Y'CrCb to RGB conversion. */
-/* XXX simple slow implementation */
 
 static unsigned char clamp(int x)
 {
@@ -827,24 +884,173 @@ static unsigned char clamp(int x)
    return x;
 }
 
-static INLINE void ycbcr_to_rgb(th_ycbcr_buffer buffer,
-   unsigned char* rgb_data, int pixel_size, int pitch, int xshift, int yshift)
+#if defined(OGV_USE_SSE2)
+
+/* Converts 8 pixels at a time with the same integer arithmetic as the
+ * plain C loop below.  Returns the number of pixels converted.
+ */
+static int ycbcr_to_rgb_span_simd(const unsigned char *yrow,
+   const unsigned char *cbrow, const unsigned char *crrow,
+   unsigned char *out, int w, int xshift)
+{
+   const __m128i zero = _mm_setzero_si128();
+   const __m128i one = _mm_set1_epi16(1);
+   const __m128i y_offset = _mm_set1_epi16(16);
+   const __m128i c_offset = _mm_set1_epi16(128);
+   const __m128i alpha = _mm_set1_epi8((char)0xff);
+   /* Coefficients for (C, 1) and (D, E) pairs. */
+   const __m128i k_y = _mm_setr_epi16(298, 128, 298, 128, 298, 128, 298, 128);
+   const __m128i k_r = _mm_setr_epi16(0, 409, 0, 409, 0, 409, 0, 409);
+   const __m128i k_g = _mm_setr_epi16(-100, -208, -100, -208, -100, -208, -100, -208);
+   const __m128i k_b = _mm_setr_epi16(516, 0, 516, 0, 516, 0, 516, 0);
+   int x;
+
+   for (x = 0; x + 8 <= w; x += 8) {
+      __m128i y8 = _mm_loadl_epi64((const __m128i *)(yrow + x));
+      __m128i cb8, cr8;
+      __m128i C, D, E, yl, yh, del, deh, r, g, b, rg, ba;
+
+      if (xshift) {
+         int cb, cr;
+         memcpy(&cb, cbrow + (x >> 1), 4);
+         memcpy(&cr, crrow + (x >> 1), 4);
+         cb8 = _mm_cvtsi32_si128(cb);
+         cr8 = _mm_cvtsi32_si128(cr);
+         cb8 = _mm_unpacklo_epi8(cb8, cb8);
+         cr8 = _mm_unpacklo_epi8(cr8, cr8);
+      }
+      else {
+         cb8 = _mm_loadl_epi64((const __m128i *)(cbrow + x));
+         cr8 = _mm_loadl_epi64((const __m128i *)(crrow + x));
+      }
+
+      C = _mm_sub_epi16(_mm_unpacklo_epi8(y8, zero), y_offset);
+      D = _mm_sub_epi16(_mm_unpacklo_epi8(cb8, zero), c_offset);
+      E = _mm_sub_epi16(_mm_unpacklo_epi8(cr8, zero), c_offset);
+
+      yl = _mm_madd_epi16(_mm_unpacklo_epi16(C, one), k_y);
+      yh = _mm_madd_epi16(_mm_unpackhi_epi16(C, one), k_y);
+      del = _mm_unpacklo_epi16(D, E);
+      deh = _mm_unpackhi_epi16(D, E);
+
+#define COMPONENT(k)                                                          \
+      _mm_packs_epi32(                                                        \
+         _mm_srai_epi32(_mm_add_epi32(yl, _mm_madd_epi16(del, k)), 8),        \
+         _mm_srai_epi32(_mm_add_epi32(yh, _mm_madd_epi16(deh, k)), 8))
+
+      r = COMPONENT(k_r);
+      g = COMPONENT(k_g);
+      b = COMPONENT(k_b);
+
+#undef COMPONENT
+
+      rg = _mm_unpacklo_epi8(_mm_packus_epi16(r, r), _mm_packus_epi16(g, g));
+      ba = _mm_unpacklo_epi8(_mm_packus_epi16(b, b), alpha);
+      _mm_storeu_si128((__m128i *)(out + x * 4), _mm_unpacklo_epi16(rg, ba));
+      _mm_storeu_si128((__m128i *)(out + x * 4 + 16), _mm_unpackhi_epi16(rg, ba));
+   }
+
+   return x;
+}
+
+#elif defined(OGV_USE_NEON)
+
+static int ycbcr_to_rgb_span_simd(const unsigned char *yrow,
+   const unsigned char *cbrow, const unsigned char *crrow,
+   unsigned char *out, int w, int xshift)
+{
+   const int32x4_t rounding = vdupq_n_s32(128);
+   int x;
+
+   for (x = 0; x + 8 <= w; x += 8) {
+      uint8x8_t y8 = vld1_u8(yrow + x);
+      uint8x8_t cb8, cr8;
+      int16x8_t C, D, E;
+      int32x4_t yl, yh;
+      uint8x8x4_t px;
+
+      if (xshift) {
+         uint32_t cb, cr;
+         uint8x8_t t;
+         memcpy(&cb, cbrow + (x >> 1), 4);
+         memcpy(&cr, crrow + (x >> 1), 4);
+         t = vreinterpret_u8_u32(vdup_n_u32(cb));
+         cb8 = vzip_u8(t, t).val[0];
+         t = vreinterpret_u8_u32(vdup_n_u32(cr));
+         cr8 = vzip_u8(t, t).val[0];
+      }
+      else {
+         cb8 = vld1_u8(cbrow + x);
+         cr8 = vld1_u8(crrow + x);
+      }
+
+      C = vreinterpretq_s16_u16(vsubl_u8(y8, vdup_n_u8(16)));
+      D = vreinterpretq_s16_u16(vsubl_u8(cb8, vdup_n_u8(128)));
+      E = vreinterpretq_s16_u16(vsubl_u8(cr8, vdup_n_u8(128)));
+
+      yl = vmlal_n_s16(rounding, vget_low_s16(C), 298);
+      yh = vmlal_n_s16(rounding, vget_high_s16(C), 298);
+
+      px.val[0] = vqmovun_s16(vcombine_s16(
+         vshrn_n_s32(vmlal_n_s16(yl, vget_low_s16(E), 409), 8),
+         vshrn_n_s32(vmlal_n_s16(yh, vget_high_s16(E), 409), 8)));
+      px.val[1] = vqmovun_s16(vcombine_s16(
+         vshrn_n_s32(vmlal_n_s16(vmlal_n_s16(yl, vget_low_s16(D), -100),
+            vget_low_s16(E), -208), 8),
+         vshrn_n_s32(vmlal_n_s16(vmlal_n_s16(yh, vget_high_s16(D), -100),
+            vget_high_s16(E), -208), 8)));
+      px.val[2] = vqmovun_s16(vcombine_s16(
+         vshrn_n_s32(vmlal_n_s16(yl, vget_low_s16(D), 516), 8),
+         vshrn_n_s32(vmlal_n_s16(yh, vget_high_s16(D), 516), 8)));
+      px.val[3] = vdup_n_u8(0xff);
+
+      vst4_u8(out + x * 4, px);
+   }
+
+   return x;
+}
+
+#else
+
+static int ycbcr_to_rgb_span_simd(const unsigned char *yrow,
+   const unsigned char *cbrow, const unsigned char *crrow,
+   unsigned char *out, int w, int xshift)
+{
+   (void)yrow;
+   (void)cbrow;
+   (void)crrow;
+   (void)out;
+   (void)w;
+   (void)xshift;
+   return 0;
+}
+
+#endif
+
+/* Converts rows y0 to y1 - 1 into ABGR_8888 pixels, which are R, G, B, A in
+ * memory.
+ */
+static void ycbcr_to_rgb(const th_img_plane *buffer, unsigned char *rgb_data,
+   int pitch, int xshift, int yshift, int y0, int y1)
 {
    const int w = buffer[0].width;
-   const int h = buffer[0].height;
    int x, y;
 
-   for (y = 0; y < h; y++) {
+   for (y = y0; y < y1; y++) {
       const int y2 = y >> yshift;
-      for (x = 0; x < w; x++) {
+      const unsigned char *yrow = buffer[0].data + y * buffer[0].stride;
+      const unsigned char *cbrow = buffer[1].data + y2 * buffer[1].stride;
+      const unsigned char *crrow = buffer[2].data + y2 * buffer[2].stride;
+      unsigned char *row = rgb_data + y * pitch;
+
+      x = ycbcr_to_rgb_span_simd(yrow, cbrow, crrow, row, w, xshift);
+
+      for (; x < w; x++) {
          const int x2 = x >> xshift;
-         unsigned char * const data = rgb_data + y * pitch + x * pixel_size;
-         const int yp = buffer[0].data[y  * buffer[0].stride + x ];
-         const int cb = buffer[1].data[y2 * buffer[1].stride + x2];
-         const int cr = buffer[2].data[y2 * buffer[2].stride + x2];
-         const int C = yp - 16;
-         const int D = cb - 128;
-         const int E = cr - 128;
+         unsigned char * const data = row + x * 4;
+         const int C = yrow[x] - 16;
+         const int D = cbrow[x2] - 128;
+         const int E = crrow[x2] - 128;
 
          data[0] = clamp((298*C         + 409*E + 128) >> 8);
          data[1] = clamp((298*C - 100*D - 208*E + 128) >> 8);
@@ -854,27 +1060,200 @@ static INLINE void ycbcr_to_rgb(th_ycbcr_buffer buffer,
    }
 }
 
-static void convert_buffer_to_rgba(OGG_VIDEO *ogv)
+static void convert_band(OGG_VIDEO *ogv, int band)
 {
-   const int pixel_size = al_get_pixel_size(RGB_PIXEL_FORMAT);
-   const int pitch = pixel_size * al_get_bitmap_width(ogv->frame_bmp);
+   CONVERT_POOL * const pool = &ogv->convert_pool;
+   const int h = ogv->buffer[0].height;
+   const int y0 = (int64_t)h * band / pool->num_bands;
+   const int y1 = (int64_t)h * (band + 1) / pool->num_bands;
 
    switch (ogv->pixel_fmt) {
       case TH_PF_420:
-         ycbcr_to_rgb(ogv->buffer, ogv->rgb_data, pixel_size, pitch, 1, 1);
+         ycbcr_to_rgb(ogv->buffer, pool->dest, pool->pitch, 1, 1, y0, y1);
          break;
       case TH_PF_422:
-         ycbcr_to_rgb(ogv->buffer, ogv->rgb_data, pixel_size, pitch, 1, 0);
+         ycbcr_to_rgb(ogv->buffer, pool->dest, pool->pitch, 1, 0, y0, y1);
          break;
       case TH_PF_444:
-         ycbcr_to_rgb(ogv->buffer, ogv->rgb_data, pixel_size, pitch, 0, 0);
+         ycbcr_to_rgb(ogv->buffer, pool->dest, pool->pitch, 0, 0, y0, y1);
          break;
       default:
-         ALLEGRO_ERROR("Unsupported pixel format.\n");
          break;
    }
 }
 
+/* Converts bands until none are left to start.
+ * The pool mutex must be locked.
+ */
+static void convert_bands(OGG_VIDEO *ogv)
+{
+   CONVERT_POOL * const pool = &ogv->convert_pool;
+
+   while (pool->next_band < pool->num_bands) {
+      int band = pool->next_band++;
+
+      al_unlock_mutex(pool->mutex);
+      convert_band(ogv, band);
+      al_lock_mutex(pool->mutex);
+
+      if (--pool->unfinished == 0)
+         al_broadcast_cond(pool->done_cond);
+   }
+}
+
+static void *convert_thread_func(ALLEGRO_THREAD *thread, void *_ogv)
+{
+   OGG_VIDEO * const ogv = _ogv;
+   CONVERT_POOL * const pool = &ogv->convert_pool;
+   (void)thread;
+
+   al_lock_mutex(pool->mutex);
+   while (!pool->quit) {
+      convert_bands(ogv);
+      if (!pool->quit)
+         al_wait_cond(pool->work_cond, pool->mutex);
+   }
+   al_unlock_mutex(pool->mutex);
+
+   return NULL;
+}
+
+/* Starts the worker threads the first time a large frame is converted.
+ * Returns false if there are none.
+ */
+static bool start_convert_pool(OGG_VIDEO *ogv)
+{
+   CONVERT_POOL * const pool = &ogv->convert_pool;
+   int n, i;
+
+   if (pool->started)
+      return pool->num_threads > 0;
+   pool->started = true;
+
+   n = _ALLEGRO_MIN(al_get_cpu_count() - 1, MAX_CONVERT_THREADS);
+   if (n <= 0)
+      return false;
+
+   pool->mutex = al_create_mutex();
+   pool->work_cond = al_create_cond();
+   pool->done_cond = al_create_cond();
+   if (!pool->mutex || !pool->work_cond || !pool->done_cond) {
+      ALLEGRO_WARN("Could not create the conversion threads.\n");
+      return false;
+   }
+
+   for (i = 0; i < n; i++) {
+      ALLEGRO_THREAD *thread = al_create_thread(convert_thread_func, ogv);
+      if (!thread)
+         break;
+      pool->threads[pool->num_threads++] = thread;
+      al_start_thread(thread);
+   }
+
+   ALLEGRO_INFO("Started %d conversion threads\n", pool->num_threads);
+   return pool->num_threads > 0;
+}
+
+static void stop_convert_pool(OGG_VIDEO *ogv)
+{
+   CONVERT_POOL * const pool = &ogv->convert_pool;
+   int i;
+
+   if (pool->mutex && pool->work_cond) {
+      al_lock_mutex(pool->mutex);
+      pool->quit = true;
+      al_broadcast_cond(pool->work_cond);
+      al_unlock_mutex(pool->mutex);
+   }
+
+   for (i = 0; i < pool->num_threads; i++) {
+      al_join_thread(pool->threads[i], NULL);
+      al_destroy_thread(pool->threads[i]);
+   }
+
+   if (pool->mutex)
+      al_destroy_mutex(pool->mutex);
+   if (pool->work_cond)
+      al_destroy_cond(pool->work_cond);
+   if (pool->done_cond)
+      al_destroy_cond(pool->done_cond);
+
+   memset(pool, 0, sizeof(*pool));
+}
+
+/* Converts the current frame into rgb_data, spreading the rows of large
+ * frames over the conversion threads.
+ */
+static void convert_buffer_to_rgba(OGG_VIDEO *ogv, unsigned char *rgb_data,
+   int pitch)
+{
+   CONVERT_POOL * const pool = &ogv->convert_pool;
+   const int pixels = ogv->buffer[0].width * ogv->buffer[0].height;
+   int num_bands = pixels / MIN_PIXELS_PER_BAND;
+
+   if (ogv->pixel_fmt != TH_PF_420 && ogv->pixel_fmt != TH_PF_422 &&
+         ogv->pixel_fmt != TH_PF_444) {
+      ALLEGRO_ERROR("Unsupported pixel format.\n");
+      return;
+   }
+
+   pool->dest = rgb_data;
+   pool->pitch = pitch;
+
+   if (num_bands < 2 || !start_convert_pool(ogv)) {
+      pool->num_bands = 1;
+      convert_band(ogv, 0);
+      return;
+   }
+
+   al_lock_mutex(pool->mutex);
+   pool->num_bands = _ALLEGRO_MIN(num_bands, pool->num_threads + 1);
+   pool->next_band = 0;
+   pool->unfinished = pool->num_bands;
+   al_broadcast_cond(pool->work_cond);
+
+   convert_bands(ogv);
+   while (pool->unfinished > 0)
+      al_wait_cond(pool->done_cond, pool->mutex);
+   al_unlock_mutex(pool->mutex);
+}
+
+/* Copies a decoded frame into our own planes.  The rows are packed.
+ * On failure there is no frame to show.
+ */
+static bool copy_ycbcr_buffer(OGG_VIDEO *ogv, const th_img_plane *src)
+{
+   int i, y;
+
+   for (i = 0; i < 3; i++) {
+      th_img_plane *dst = &ogv->buffer[i];
+
+      if (dst->width != src[i].width || dst->height != src[i].height ||
+            !dst->data) {
+         al_free(dst->data);
+         dst->data = al_malloc(src[i].width * src[i].height);
+         if (!dst->data) {
+            ALLEGRO_ERROR("Out of memory.\n");
+            for (i = 0; i < 3; i++) {
+               al_free(ogv->buffer[i].data);
+               memset(&ogv->buffer[i], 0, sizeof(ogv->buffer[i]));
+            }
+            return false;
+         }
+         dst->width = src[i].width;
+         dst->height = src[i].height;
+         dst->stride = src[i].width;
+      }
+
+      for (y = 0; y < src[i].height; y++) {
+         memcpy(dst->data + y * dst->stride,
+            src[i].data + y * src[i].stride, src[i].width);
+      }
+   }
+
+   return true;
+}
+
 static int poll_theora_decode(ALLEGRO_VIDEO *video, STREAM *tstream_outer)
 {
    OGG_VIDEO * const ogv = video->data;
@@ -921,14 +1300,14 @@ static int poll_theora_decode(ALLEGRO_VIDEO *video, STREAM *tstream_outer)
 
    if (new_frame) {
       ALLEGRO_EVENT event;
+      th_ycbcr_buffer buffer;
       al_lock_mutex(ogv->mutex);
 
-      rc = th_decode_ycbcr_out(tstream->ctx, ogv->buffer);
+      /* The frame is converted to RGB when it is displayed. */
+      rc = th_decode_ycbcr_out(tstream->ctx, buffer);
       ASSERT(rc == 0);
 
-      convert_buffer_to_rgba(ogv);
-
-      ogv->buffer_dirty = true;
+      ogv->buffer_dirty = copy_ycbcr_buffer(ogv, buffer);
 
       event.type = ALLEGRO_EVENT_VIDEO_FRAME_SHOW;
       event.user.data1 = (intptr_t)video;
@@ -941,14 +1320,18 @@ static int poll_theora_decode(ALLEGRO_VIDEO *video, STREAM *tstream_outer)
 }
 
 
-/* Seeking. */
+/* Seeking.
+ *
+ * Pages are found by bisecting the file on their granule positions.  A
+ * Theora frame can only be decoded starting from the keyframe before it, so
+ * for video we find that keyframe, read on from the last page ending a
+ * packet before it, and decode up to the target frame without outputting
+ * anything.
+ */
 
-static void seek_to_beginning(ALLEGRO_VIDEO *video, OGG_VIDEO *ogv,
-   THEORA_STREAM *tstream)
+static void reset_streams(OGG_VIDEO *ogv)
 {
    unsigned i;
-   int rc;
-   bool seeked;
 
    for (i = 0; i < _al_vector_size(&ogv->streams); i++) {
       STREAM **slot = _al_vector_ref(&ogv->streams, i);
@@ -957,6 +1340,311 @@ static void seek_to_beginning(ALLEGRO_VIDEO *video, OGG_VIDEO *ogv,
       ogg_stream_reset(&stream->state);
       free_packet_queue(stream);
    }
+}
+
+static void start_reading_at(OGG_VIDEO *ogv, int64_t offset)
+{
+   int rc;
+   bool seeked;
+
+   rc = ogg_sync_reset(&ogv->sync_state);
+   ASSERT(rc == 0);
+
+   seeked = al_fseek(ogv->fp, offset, SEEK_SET);
+   ASSERT(seeked);
+}
+
+/* Returns true if got a page starting before 'end'.  Reading goes on from
+ * file position *pos, which is moved past the page.
+ */
+static bool next_page(ALLEGRO_FILE *fp, ogg_sync_state *sync, int64_t *pos,
+   int64_t end, ogg_page *page, int64_t *page_offset)
+{
+   const int buffer_size = 4096;
+
+   while (*pos < end) {
+      long n = ogg_sync_pageseek(sync, page);
+      char *buffer;
+      size_t bytes;
+      int rc;
+
+      if (n > 0) {
+         *page_offset = *pos;
+         *pos += n;
+         return true;
+      }
+
+      if (n < 0) {
+         /* Skipped bytes which are not part of a page. */
+         *pos -= n;
+         continue;
+      }
+
+      buffer = ogg_sync_buffer(sync, buffer_size);
+      bytes = al_fread(fp, buffer, buffer_size);
+      if (bytes == 0) {
+         return false;
+      }
+
+      rc = ogg_sync_wrote(sync, bytes);
+      ASSERT(rc == 0);
+   }
+
+   return false;
+}
+
+/* Frames for Theora, samples for Vorbis. */
+static int64_t granule_units(STREAM *stream, ogg_int64_t granulepos)
+{
+   if (stream->stream_type == STREAM_TYPE_THEORA) {
+      return th_granule_frame(&stream->u.theora.info, granulepos);
+   }
+
+   return granulepos;
+}
+
+static int64_t granule_keyframe(THEORA_STREAM *tstream, ogg_int64_t granulepos)
+{
+   const int shift = tstream->info.keyframe_granule_shift;
+
+   return th_granule_frame(&tstream->info, (granulepos >> shift) << shift);
+}
+
+/* Granule position of a frame if it were a keyframe. */
+static ogg_int64_t keyframe_granulepos(THEORA_STREAM *tstream, int64_t frame)
+{
+   const int shift = tstream->info.keyframe_granule_shift;
+   /* Since Theora 3.2.1 granule positions count frames from one. */
+   const int64_t first = 1 - th_granule_frame(&tstream->info,
+      (ogg_int64_t)1 << shift);
+
+   if (frame + first < 0) {
+      return 0;
+   }
+   return (frame + first) << shift;
+}
+
+/* Returns the offset of the last page of the stream starting before 'end'
+ * whose granule position is before 'units', or -1 if there is none.
+ */
+static int64_t find_page_before(OGG_VIDEO *ogv, STREAM *stream, int64_t end,
+   int64_t units, ogg_int64_t *ret_granulepos)
+{
+   const int serial = stream->state.serialno;
+   int64_t lo = 0;
+   int64_t hi = end;
+   int64_t found = -1;
+   int64_t pos;
+   int64_t page_offset;
+   ogg_int64_t granulepos;
+   ogg_page page;
+
+   while (hi - lo > SEEK_LINEAR_BYTES) {
+      int64_t mid = lo + (hi - lo) / 2;
+      bool before = false;
+
+      pos = mid;
+      start_reading_at(ogv, pos);
+      while (next_page(ogv->fp, &ogv->sync_state, &pos, hi, &page,
+            &page_offset)) {
+         granulepos = ogg_page_granulepos(&page);
+         if (ogg_page_serialno(&page) != serial || granulepos < 0) {
+            continue;
+         }
+         if (granule_units(stream, granulepos) < units) {
+            found = page_offset;
+            *ret_granulepos = granulepos;
+            lo = pos;
+            before = true;
+         }
+         break;
+      }
+
+      if (!before) {
+         hi = mid;
+      }
+   }
+
+   pos = lo;
+   start_reading_at(ogv, pos);
+   while (next_page(ogv->fp, &ogv->sync_state, &pos, hi, &page,
+         &page_offset)) {
+      granulepos = ogg_page_granulepos(&page);
+      if (ogg_page_serialno(&page) != serial || granulepos < 0) {
+         continue;
+      }
+      if (granule_units(stream, granulepos) >= units) {
+         break;
+      }
+      found = page_offset;
+      *ret_granulepos = granulepos;
+   }
+
+   return found;
+}
+
+static bool find_indexed_keyframe(OGG_VIDEO *ogv, int64_t frame,
+   int64_t *ret_keyframe, int64_t *ret_offset)
+{
+   bool found = false;
+
+   if (!ogv->index_mutex) {
+      return false;
+   }
+
+   al_lock_mutex(ogv->index_mutex);
+
+   if (ogv->index_done || ogv->indexed_frame >= frame) {
+      unsigned lo = 0;
+      unsigned hi = _al_vector_size(&ogv->keyframes);
+
+      /* Find the last keyframe not after the frame. */
+      while (lo < hi) {
+         unsigned mid = lo + (hi - lo) / 2;
+         KEYFRAME *keyframe = _al_vector_ref(&ogv->keyframes, mid);
+
+         if (keyframe->frame <= frame) {
+            lo = mid + 1;
+         }
+         else {
+            hi = mid;
+         }
+      }
+
+      if (lo > 0) {
+         KEYFRAME *keyframe = _al_vector_ref(&ogv->keyframes, lo - 1);
+
+         *ret_keyframe = keyframe->frame;
+         *ret_offset = keyframe->offset;
+         found = true;
+      }
+   }
+
+   al_unlock_mutex(ogv->index_mutex);
+
+   return found;
+}
+
+/* Reads Theora packets from the current file position on, decoding those
+ * from the keyframe up to the target frame and queueing the rest.
+ */
+static void decode_to_frame(ALLEGRO_VIDEO *video, OGG_VIDEO *ogv,
+   STREAM *tstream_outer, int64_t keyframe, int64_t target_frame)
+{
+   THEORA_STREAM * const tstream = &tstream_outer->u.theora;
+   PACKET_NODE *pending = NULL;
+   PACKET_NODE **pending_tail = &pending;
+   int num_pending = 0;
+   ogg_int64_t granpos;
+   ogg_packet packet;
+   int rc;
+
+   granpos = keyframe_granulepos(tstream, keyframe - 1);
+   rc = th_decode_ctl(tstream->ctx, TH_DECCTL_SET_GRANPOS, &granpos,
+      sizeof(granpos));
+   ASSERT(rc == 0);
+
+   tstream->prev_framenum = keyframe - 1;
+
+   while (read_packet(ogv, tstream_outer, &packet)) {
+      int64_t framenum;
+
+      *pending_tail = create_packet_node(&packet);
+      pending_tail = &(*pending_tail)->next;
+      num_pending++;
+
+      /* Only the last packet ending on a page has a granule position, so
+       * the packets before it are numbered back from there.
+       */
+      if (packet.granulepos < 0) {
+         continue;
+      }
+
+      framenum = th_granule_frame(&tstream->info, packet.granulepos)
+         - num_pending + 1;
+
+      while (pending) {
+         PACKET_NODE *node = pending;
+         pending = node->next;
+         node->next = NULL;
+
+         if (framenum >= target_frame) {
+            add_tail_packet(tstream_outer, node);
+         }
+         else {
+            if (framenum >= keyframe) {
+               th_decode_packetin(tstream->ctx, &node->pkt, NULL);
+               tstream->prev_framenum = framenum;
+            }
+            free_packet_node(node);
+         }
+         framenum++;
+      }
+      pending_tail = &pending;
+      num_pending = 0;
+
+      if (framenum > target_frame) {
+         break;
+      }
+   }
+
+   /* Packets left at the end of the file. */
+   while (pending) {
+      PACKET_NODE *node = pending;
+      pending = node->next;
+      node->next = NULL;
+      add_tail_packet(tstream_outer, node);
+   }
+
+   video->video_position = tstream->prev_framenum * tstream->frame_duration;
+}
+
+/* Reads Vorbis packets from the current file position on, and drops the
+ * decoded samples before the target sample.
+ */
+static void decode_to_sample(OGG_VIDEO *ogv, STREAM *vstream_outer,
+   int64_t target_sample)
+{
+   VORBIS_STREAM * const vstream = &vstream_outer->u.vorbis;
+   ogg_packet packet;
+
+   vorbis_synthesis_restart(&vstream->dsp);
+   vstream->next_fragment_pos = 0;
+
+   while (read_packet(ogv, vstream_outer, &packet)) {
+      int samples;
+      int64_t first_sample;
+
+      /* Header packets are ignored here when reading from the start. */
+      if (vorbis_synthesis(&vstream->block, &packet) == 0) {
+         vorbis_synthesis_blockin(&vstream->dsp, &vstream->block);
+      }
+
+      if (packet.granulepos < 0) {
+         continue;
+      }
+
+      /* The granule position is that of the last sample available now. */
+      samples = vorbis_synthesis_pcmout(&vstream->dsp, NULL);
+      first_sample = packet.granulepos - samples;
+
+      if (packet.granulepos >= target_sample) {
+         if (target_sample > first_sample) {
+            vorbis_synthesis_read(&vstream->dsp, target_sample - first_sample);
+         }
+         break;
+      }
+
+      vorbis_synthesis_read(&vstream->dsp, samples);
+   }
+}
+
+static void seek_to_beginning(ALLEGRO_VIDEO *video, OGG_VIDEO *ogv,
+   THEORA_STREAM *tstream)
+{
+   int rc;
+
+   reset_streams(ogv);
 
    if (tstream) {
       ogg_int64_t granpos = 0;
@@ -968,11 +1656,7 @@ static void seek_to_beginning(ALLEGRO_VIDEO *video, OGG_VIDEO *ogv,
       tstream->prev_framenum = -1;
    }
 
-   rc = ogg_sync_reset(&ogv->sync_state);
-   ASSERT(rc == 0);
-
-   seeked = al_fseek(ogv->fp, 0, SEEK_SET);
-   ASSERT(seeked);
+   start_reading_at(ogv, 0);
    /* XXX read enough file data to get into position */
 
    ogv->reached_eof = false;
@@ -983,6 +1667,192 @@ static void seek_to_beginning(ALLEGRO_VIDEO *video, OGG_VIDEO *ogv,
    /* XXX maybe clear backlog of time and stream fragment events */
 }
 
+/* Keyframe index.  Reading the file through once in the background from
+ * the first seek on lets later seeks into the part already read go straight
+ * to the right page.
+ */
+
+static void *index_thread_func(ALLEGRO_THREAD *thread, void *_ogv)
+{
+   OGG_VIDEO * const ogv = _ogv;
+   STREAM * const stream = ogv->selected_video_stream;
+   THEORA_STREAM * const tstream = &stream->u.theora;
+   const int serial = stream->state.serialno;
+   ogg_sync_state sync;
+   ogg_page page;
+   int64_t pos = 0;
+   int64_t page_offset;
+   int64_t prev_offset = 0;
+   int64_t last_keyframe = -1;
+   bool eof = true;
+
+   ALLEGRO_DEBUG("Keyframe index thread started.\n");
+
+   ogg_sync_init(&sync);
+
+   while (next_page(ogv->index_fp, &sync, &pos, INT64_MAX, &page,
+         &page_offset)) {
+      ogg_int64_t granulepos = ogg_page_granulepos(&page);
+      int64_t keyframe;
+
+      if (al_get_thread_should_stop(thread)) {
+         eof = false;
+         break;
+      }
+
+      if (ogg_page_serialno(&page) != serial || granulepos < 0) {
+         continue;
+      }
+
+      /* The previous page ends a packet of an earlier keyframe's frames,
+       * hence one before this keyframe.
+       */
+      keyframe = granule_keyframe(tstream, granulepos);
+
+      al_lock_mutex(ogv->index_mutex);
+      if (keyframe > last_keyframe) {
+         KEYFRAME *entry = _al_vector_alloc_back(&ogv->keyframes);
+         if (entry) {
+            entry->frame = keyframe;
+            entry->offset = prev_offset;
+            last_keyframe = keyframe;
+         }
+      }
+      ogv->indexed_frame = th_granule_frame(&tstream->info, granulepos);
+      al_unlock_mutex(ogv->index_mutex);
+
+      prev_offset = page_offset;
+   }
+
+   al_lock_mutex(ogv->index_mutex);
+   ogv->index_done = eof;
+   al_unlock_mutex(ogv->index_mutex);
+
+   ogg_sync_clear(&sync);
+
+   ALLEGRO_DEBUG("Keyframe index thread exit with %u keyframes.\n",
+      (unsigned)_al_vector_size(&ogv->keyframes));
+
+   return NULL;
+}
+
+static bool want_keyframe_index(void)
+{
+   const char *value = al_get_config_value(al_get_system_config(), "video",
+      "keyframe_index");
+
+   return !value || strcmp(value, "false") != 0;
+}
+
+static void stop_index_thread(OGG_VIDEO *ogv)
+{
+   if (ogv->index_thread) {
+      al_join_thread(ogv->index_thread, NULL);
+      al_destroy_thread(ogv->index_thread);
+      ogv->index_thread = NULL;
+   }
+   if (ogv->index_mutex) {
+      al_destroy_mutex(ogv->index_mutex);
+      ogv->index_mutex = NULL;
+   }
+   if (ogv->index_fp) {
+      al_fclose(ogv->index_fp);
+      ogv->index_fp = NULL;
+   }
+}
+
+static void start_index_thread(OGG_VIDEO *ogv, const char *filename)
+{
+   ogv->index_fp = al_fopen(filename, "rb");
+   ogv->index_mutex = al_create_mutex();
+   if (ogv->index_fp && ogv->index_mutex) {
+      ogv->index_thread = al_create_thread(index_thread_func, ogv);
+   }
+
+   if (!ogv->index_thread) {
+      ALLEGRO_WARN("Could not start keyframe index thread.\n");
+      stop_index_thread(ogv);
+      return;
+   }
+
+   al_start_thread(ogv->index_thread);
+}
+
+static void seek_to_position(ALLEGRO_VIDEO *video, OGG_VIDEO *ogv,
+   STREAM *tstream_outer, STREAM *vstream_outer, double seek_to)
+{
+   const int64_t size = al_fsize(ogv->fp);
+   int64_t offset = -1;
+   int64_t keyframe = 0;
+   int64_t target_frame = 0;
+   int64_t target_sample = 0;
+   ogg_int64_t granulepos;
+
+   /* Videos which are only played through never need the index. */
+   if (tstream_outer && !ogv->index_started) {
+      ogv->index_started = true;
+      if (want_keyframe_index()) {
+         start_index_thread(ogv,
+            al_path_cstr(video->filename, ALLEGRO_NATIVE_PATH_SEP));
+      }
+   }
+
+   reset_streams(ogv);
+
+   if (vstream_outer) {
+      target_sample = seek_to * vstream_outer->u.vorbis.info.rate;
+   }
+
+   if (tstream_outer) {
+      THEORA_STREAM * const tstream = &tstream_outer->u.theora;
+
+      target_frame = seek_to / tstream->frame_duration;
+
+      if (!find_indexed_keyframe(ogv, target_frame, &keyframe, &offset)
+         && size > 0)
+      {
+         offset = find_page_before(ogv, tstream_outer, size,
+            target_frame + 1, &granulepos);
+         if (offset >= 0) {
+            /* Before any frame the page is a header page. */
+            keyframe = _ALLEGRO_MAX(0, granule_keyframe(tstream, granulepos));
+            offset = find_page_before(ogv, tstream_outer, offset, keyframe,
+               &granulepos);
+         }
+      }
+   }
+   else if (size > 0) {
+      /* The audio is read from a page before the target so that the
+       * decoder has the previous packet to overlap with.
+       */
+      offset = find_page_before(ogv, vstream_outer, size, target_sample,
+         &granulepos);
+   }
+
+   ALLEGRO_DEBUG("Seek to %f from offset %ld, keyframe %ld\n", seek_to,
+      (long)offset, (long)keyframe);
+
+   start_reading_at(ogv, offset > 0 ? offset : 0);
+   ogv->reached_eof = false;
+
+   if (tstream_outer) {
+      decode_to_frame(video, ogv, tstream_outer, keyframe, target_frame);
+   }
+   else {
+      video->video_position = seek_to;
+   }
+
+   if (vstream_outer) {
+      decode_to_sample(ogv, vstream_outer, target_sample);
+   }
+
+   video->audio_position = seek_to;
+   video->position = seek_to;
+
+   /* XXX maybe clear backlog of time and stream fragment events */
+}
+
+
 /* Decode thread. */
 
 static void *decode_thread_func(ALLEGRO_THREAD *thread, void *_video)
@@ -1050,11 +1920,14 @@ static void *decode_thread_func(ALLEGRO_THREAD *thread, void *_video)
       al_wait_for_event(ogv->queue, &ev);
 
       if (ev.type == _ALLEGRO_EVENT_VIDEO_SEEK) {
-         double seek_to = ev.user.data1 / 1.0e6;
-         /* XXX we only know how to seek to start of video */
-         ASSERT(seek_to <= 0.0);
          al_lock_mutex(ogv->mutex);
-         seek_to_beginning(video, ogv, tstream);
+         if (ogv->seek_to > 0.0) {
+            seek_to_position(video, ogv, tstream_outer, vstream_outer,
+               ogv->seek_to);
+         }
+         else {
+            seek_to_beginning(video, ogv, tstream);
+         }
          ogv->seek_counter++;
          al_broadcast_cond(ogv->cond);
          al_unlock_mutex(ogv->mutex);
@@ -1119,8 +1992,6 @@ static void *decode_thread_func(ALLEGRO_THREAD *thread, void *_video)
 static bool update_frame_bmp(OGG_VIDEO *ogv)
 {
    ALLEGRO_LOCKED_REGION *lr;
-   int y;
-   int pitch = al_get_pixel_size(RGB_PIXEL_FORMAT) * al_get_bitmap_width(ogv->frame_bmp);
 
    lr = al_lock_bitmap(ogv->frame_bmp, RGB_PIXEL_FORMAT,
       ALLEGRO_LOCK_WRITEONLY);
@@ -1129,9 +2000,7 @@ static bool update_frame_bmp(OGG_VIDEO *ogv)
       return false;
    }
 
-   for (y = 0; y < al_get_bitmap_height(ogv->frame_bmp); y++) {
-      memcpy((unsigned char*)lr->data + y * lr->pitch, ogv->rgb_data + y * pitch, pitch);
-   }
+   convert_buffer_to_rgba(ogv, lr->data, lr->pitch);
 
    al_unlock_bitmap(ogv->frame_bmp);
    return true;
@@ -1195,6 +2064,7 @@ static bool ogv_open_video(ALLEGRO_VIDEO *video)
    rc = ogg_sync_init(&ogv->sync_state);
    ASSERT(rc == 0);
    _al_vector_init(&ogv->streams, sizeof(STREAM *));
+   _al_vector_init(&ogv->keyframes, sizeof(KEYFRAME));
 
    if (!do_open_video(video, ogv)) {
       ALLEGRO_ERROR("No audio or video stream found.\n");
@@ -1224,6 +2094,9 @@ static bool ogv_close_video(ALLEGRO_VIDEO *video)
          al_destroy_thread(ogv->thread);
       }
 
+      stop_index_thread(ogv);
+      _al_vector_free(&ogv->keyframes);
+
       al_fclose(ogv->fp);
       ogg_sync_clear(&ogv->sync_state);
       for (i = 0; i < _al_vector_size(&ogv->streams); i++) {
@@ -1236,7 +2109,10 @@ static bool ogv_close_video(ALLEGRO_VIDEO *video)
       }
       al_destroy_bitmap(ogv->frame_bmp);
 
-      al_free(ogv->rgb_data);
+      stop_convert_pool(ogv);
+      for (i = 0; i < 3; i++) {
+         al_free(ogv->buffer[i].data);
+      }
 
       al_free(ogv);
    }
@@ -1287,17 +2163,13 @@ static bool ogv_seek_video(ALLEGRO_VIDEO *video, double seek_to)
    ALLEGRO_EVENT ev;
    int seek_counter;
 
-   /* XXX we only know how to seek to beginning */
-   if (seek_to > 0.0) {
-      return false;
-   }
-
    al_lock_mutex(ogv->mutex);
 
    seek_counter = ogv->seek_counter;
+   ogv->seek_to = seek_to;
 
    ev.user.type = _ALLEGRO_EVENT_VIDEO_SEEK;
-   ev.user.data1 = seek_to * 1.0e6;
+   ev.user.data1 = 0;
    ev.user.data2 = 0;
    ev.user.data3 = 0;
    ev.user.data4 = 0;
@@ -47,6 +47,7 @@ set(ALLEGRO_SRC_FILES
     src/touch_input.c
     src/transformations.c
     src/tri_soft.c
+    src/ustr_intern.c
     src/utf8.c
     src/misc/aatree.c
     src/misc/bstrlib.c
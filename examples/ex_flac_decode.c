@@ -0,0 +1,103 @@
+/*
+ *    Example program for the Allegro library.
+ *
+ *    Load FLAC files as samples decoded on one thread and on several
+ *    threads, and check that both give the same sample data.  Use files of
+ *    a few minutes, some of them without a seektable, e.g.
+ *
+ *       flac -o seek.flac music.wav
+ *       flac --no-seektable -o noseek.flac music.wav
+ *       ex_flac_decode seek.flac noseek.flac
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "allegro5/allegro.h"
+#include "allegro5/allegro_audio.h"
+#include "allegro5/allegro_acodec.h"
+
+#include "common.c"
+
+static ALLEGRO_SAMPLE *load(const char *filename, const char *threads,
+   double *secs)
+{
+   ALLEGRO_SAMPLE *spl;
+   double t0;
+
+   al_set_config_value(al_get_system_config(), "audio",
+      "flac_decode_threads", threads);
+   t0 = al_get_time();
+   spl = al_load_sample(filename);
+   *secs = al_get_time() - t0;
+   return spl;
+}
+
+static size_t sample_bytes(ALLEGRO_SAMPLE *spl)
+{
+   return al_get_sample_length(spl) *
+      al_get_channel_count(al_get_sample_channels(spl)) *
+      al_get_audio_depth_size(al_get_sample_depth(spl));
+}
+
+static bool check(const char *filename)
+{
+   ALLEGRO_SAMPLE *serial;
+   ALLEGRO_SAMPLE *parallel;
+   double serial_secs, parallel_secs;
+   bool same;
+
+   serial = load(filename, "1", &serial_secs);
+   parallel = load(filename, "", &parallel_secs);
+   if (!serial || !parallel) {
+      log_printf("%s: could not load\n", filename);
+      al_destroy_sample(serial);
+      al_destroy_sample(parallel);
+      return false;
+   }
+
+   same = al_get_sample_length(serial) == al_get_sample_length(parallel) &&
+      al_get_sample_channels(serial) == al_get_sample_channels(parallel) &&
+      al_get_sample_depth(serial) == al_get_sample_depth(parallel) &&
+      memcmp(al_get_sample_data(serial), al_get_sample_data(parallel),
+         sample_bytes(serial)) == 0;
+
+   log_printf("%s: %u samples, %.3f s on one thread, %.3f s on %d CPUs: %s\n",
+      filename, al_get_sample_length(serial), serial_secs, parallel_secs,
+      al_get_cpu_count(), same ? "identical" : "DIFFERENT");
+
+   al_destroy_sample(serial);
+   al_destroy_sample(parallel);
+   return same;
+}
+
+int main(int argc, char **argv)
+{
+   int failed = 0;
+   int i;
+
+   if (argc < 2) {
+      abort_example("Usage: %s file.flac...\n", argv[0]);
+   }
+
+   if (!al_init()) {
+      abort_example("Could not init Allegro.\n");
+   }
+
+   open_log();
+
+   if (!al_install_audio()) {
+      abort_example("Could not init sound.\n");
+   }
+   al_init_acodec_addon();
+
+   for (i = 1; i < argc; i++) {
+      if (!check(argv[i]))
+         failed++;
+   }
+
+   close_log(false);
+
+   return failed ? 1 : 0;
+}
+
+/* vim: set sts=3 sw=3 et: */
@@ -0,0 +1,242 @@
+/*
+ *    Example program for the Allegro library.
+ *
+ *    Benchmark al_triangulate_polygon on large polygons with holes, and
+ *    check that the triangles cover exactly the area of the polygon.
+ *
+ *    Usage: ex_triangulate [max_vertices]
+ */
+
+#define ALLEGRO_UNSTABLE
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "allegro5/allegro.h"
+#include "allegro5/allegro_primitives.h"
+
+#include "common.c"
+
+#define MAX_HOLES 4096
+
+typedef struct SHAPE {
+   float *vertices;
+   int vertex_counts[MAX_HOLES + 2];
+   int num_vertices;
+   int num_holes;
+} SHAPE;
+
+typedef struct RESULT {
+   const float *vertices;
+   int num_triangles;
+   double area;
+} RESULT;
+
+
+static float frand(void)
+{
+   return (float)rand() / (float)RAND_MAX;
+}
+
+
+static void shape_init(SHAPE *shape, int max_vertices)
+{
+   shape->vertices = malloc(max_vertices * 2 * sizeof(float));
+   if (!shape->vertices)
+      abort_example("Out of memory\n");
+   shape->num_vertices = 0;
+   shape->num_holes = -1;
+}
+
+
+static void shape_add(SHAPE *shape, float x, float y)
+{
+   shape->vertices[shape->num_vertices * 2 + 0] = x;
+   shape->vertices[shape->num_vertices * 2 + 1] = y;
+   shape->num_vertices++;
+   shape->vertex_counts[shape->num_holes]++;
+}
+
+
+static void shape_begin_ring(SHAPE *shape)
+{
+   shape->num_holes++;
+   shape->vertex_counts[shape->num_holes] = 0;
+   shape->vertex_counts[shape->num_holes + 1] = 0;
+}
+
+
+/* Signed area of one ring; the outline is anti-clockwise (with y pointing
+ * down) and so has a positive area, while holes are negative.
+ */
+static double ring_area(const float *v, int n)
+{
+   double sum = 0;
+   int i, j;
+
+   for (i = 0, j = n - 1; i < n; j = i++)
+      sum += ((double)v[i * 2] - v[j * 2]) * ((double)v[i * 2 + 1] + v[j * 2 + 1]);
+
+   return sum / 2;
+}
+
+
+static double shape_area(const SHAPE *shape)
+{
+   const float *v = shape->vertices;
+   double area = 0;
+   int i;
+
+   for (i = 0; shape->vertex_counts[i] > 0; i++) {
+      area += ring_area(v, shape->vertex_counts[i]);
+      v += shape->vertex_counts[i] * 2;
+   }
+
+   return area;
+}
+
+
+/* A star with n spikes of random length. */
+static void make_star(SHAPE *shape, int n)
+{
+   int i;
+
+   shape_begin_ring(shape);
+   for (i = 0; i < n; i++) {
+      float a = 2 * ALLEGRO_PI * i / n;
+      float r = (i & 1) ? 500 + 400 * frand() : 300;
+      shape_add(shape, 500 + r * cosf(a), 500 - r * sinf(a));
+   }
+}
+
+
+/* A ragged coastline around a grid of small lakes. */
+static void make_coast(SHAPE *shape, int n, int holes_per_side, int hole_vertices)
+{
+   int i, j, k;
+
+   shape_begin_ring(shape);
+   for (i = 0; i < n; i++) {
+      float a = 2 * ALLEGRO_PI * i / n;
+      float r = 1000 + 60 * sinf(a * 17) + 30 * frand();
+      shape_add(shape, 1000 + r * cosf(a), 1000 - r * sinf(a));
+   }
+
+   for (j = 0; j < holes_per_side; j++) {
+      for (i = 0; i < holes_per_side; i++) {
+         float cell = 1200.0f / holes_per_side;
+         float cx = 400 + (i + 0.5f) * cell;
+         float cy = 400 + (j + 0.5f) * cell;
+
+         shape_begin_ring(shape);
+         for (k = 0; k < hole_vertices; k++) {
+            float a = 2 * ALLEGRO_PI * k / hole_vertices;
+            float r = cell * (0.2f + 0.2f * frand());
+            shape_add(shape, cx + r * cosf(a), cy + r * sinf(a));
+         }
+      }
+   }
+}
+
+
+/* A comb whose teeth make almost every other vertex reflex. */
+static void make_comb(SHAPE *shape, int n)
+{
+   int teeth = (n - 2) / 4;
+   int i;
+
+   shape_begin_ring(shape);
+   shape_add(shape, 0, 0);
+   shape_add(shape, 0, 100);
+   for (i = 0; i < teeth; i++) {
+      float x = i * 10;
+      shape_add(shape, x + 5, 100);
+      shape_add(shape, x + 5, 1000 + 50 * frand());
+      shape_add(shape, x + 10, 1000 + 50 * frand());
+      shape_add(shape, x + 10, 100);
+   }
+   shape->vertex_counts[0] -= 1;
+   shape->num_vertices -= 1;
+   shape_add(shape, teeth * 10, 0);
+}
+
+
+static void emit_triangle(int a, int b, int c, void *userdata)
+{
+   RESULT *result = userdata;
+   const float *v = result->vertices;
+   double ux = (double)v[b * 2] - v[a * 2];
+   double uy = (double)v[b * 2 + 1] - v[a * 2 + 1];
+   double vx = (double)v[c * 2] - v[a * 2];
+   double vy = (double)v[c * 2 + 1] - v[a * 2 + 1];
+
+   result->num_triangles++;
+   result->area += fabs(ux * vy - uy * vx) / 2;
+}
+
+
+static void run(const char *name, SHAPE *shape)
+{
+   RESULT result;
+   double expected = shape_area(shape);
+   double t0, t1;
+   bool ok;
+
+   result.vertices = shape->vertices;
+   result.num_triangles = 0;
+   result.area = 0;
+
+   t0 = al_get_time();
+   al_triangulate_polygon(shape->vertices, 2 * sizeof(float),
+      shape->vertex_counts, emit_triangle, &result);
+   t1 = al_get_time();
+
+   ok = result.num_triangles == shape->num_vertices + 2 * shape->num_holes - 2
+      && fabs(result.area - expected) <= fabs(expected) * 1e-4;
+
+   log_printf("%-8s %7d vertices %5d holes %10.3f ms %8d triangles  %s\n",
+      name, shape->num_vertices, shape->num_holes, (t1 - t0) * 1000,
+      result.num_triangles, ok ? "ok" : "MISMATCH");
+
+   free(shape->vertices);
+}
+
+
+int main(int argc, char **argv)
+{
+   static const int sizes[] = { 1000, 10000, 50000, 200000 };
+   int max_vertices = 50000;
+   unsigned i;
+
+   if (argc > 1)
+      max_vertices = atoi(argv[1]);
+
+   if (!al_init()) {
+      abort_example("Could not init Allegro.\n");
+   }
+   open_log();
+
+   srand(1);
+   for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+      int n = sizes[i];
+      int side = (int)sqrt(n / 100.0);
+      SHAPE shape;
+
+      if (n > max_vertices)
+         break;
+
+      shape_init(&shape, n);
+      make_star(&shape, n);
+      run("star", &shape);
+
+      shape_init(&shape, n + side * side * 16);
+      make_coast(&shape, n, side, 16);
+      run("coast", &shape);
+
+      shape_init(&shape, n);
+      make_comb(&shape, n);
+      run("comb", &shape);
+   }
+
+   close_log(true);
+   return 0;
+}
@@ -0,0 +1,144 @@
+/*
+ *    Example program for the Allegro library.
+ *
+ *    Count the memory allocations made by string-heavy code: loading
+ *    configuration files, manipulating paths, and building temporary
+ *    strings on the heap versus in the scratch arena.
+ */
+
+#define ALLEGRO_UNSTABLE
+#include <stdio.h>
+#include <stdlib.h>
+#include "allegro5/allegro.h"
+
+#include "common.c"
+
+static int num_allocs;
+
+static void *count_malloc(size_t n, int line, const char *file,
+   const char *func)
+{
+   (void)line; (void)file; (void)func;
+   num_allocs++;
+   return malloc(n);
+}
+
+static void *count_realloc(void *ptr, size_t n, int line, const char *file,
+   const char *func)
+{
+   (void)line; (void)file; (void)func;
+   num_allocs++;
+   return realloc(ptr, n);
+}
+
+static void *count_calloc(size_t count, size_t n, int line, const char *file,
+   const char *func)
+{
+   (void)line; (void)file; (void)func;
+   num_allocs++;
+   return calloc(count, n);
+}
+
+static void count_free(void *ptr, int line, const char *file,
+   const char *func)
+{
+   (void)line; (void)file; (void)func;
+   free(ptr);
+}
+
+static ALLEGRO_MEMORY_INTERFACE counting_interface = {
+   count_malloc,
+   count_free,
+   count_realloc,
+   count_calloc
+};
+
+#define ITERATIONS 100
+
+static void bench_config(const char *filename)
+{
+   double t0 = al_get_time();
+   int i;
+
+   num_allocs = 0;
+   for (i = 0; i < ITERATIONS; i++) {
+      ALLEGRO_CONFIG *cfg = al_load_config_file(filename);
+      if (!cfg)
+         abort_example("Couldn't load %s\n", filename);
+      al_destroy_config(cfg);
+   }
+
+   log_printf("config load:       %8d allocations, %.3f ms per iteration\n",
+      num_allocs / ITERATIONS, (al_get_time() - t0) * 1000 / ITERATIONS);
+}
+
+static void bench_path(void)
+{
+   double t0 = al_get_time();
+   int i, j;
+
+   num_allocs = 0;
+   for (i = 0; i < ITERATIONS; i++) {
+      ALLEGRO_PATH *path = al_create_path("/usr/share/games/data/levels/one.map");
+      for (j = 0; j < 20; j++) {
+         al_append_path_component(path, "sub");
+         al_set_path_extension(path, ".bak");
+         al_set_path_filename(path, "two.map");
+         (void)al_path_cstr(path, '/');
+         al_drop_path_tail(path);
+      }
+      al_destroy_path(path);
+   }
+
+   log_printf("path manipulation: %8d allocations, %.3f ms per iteration\n",
+      num_allocs / ITERATIONS, (al_get_time() - t0) * 1000 / ITERATIONS);
+}
+
+static void bench_temporaries(bool scratch)
+{
+   double t0 = al_get_time();
+   int i, j;
+
+   num_allocs = 0;
+   for (i = 0; i < ITERATIONS; i++) {
+      for (j = 0; j < 100; j++) {
+         ALLEGRO_USTR *us = scratch ? al_ustr_new_scratch("item") : al_ustr_new("item");
+         al_ustr_appendf(us, " %d of %d", j, 100);
+         if (!scratch)
+            al_ustr_free(us);
+      }
+      if (scratch)
+         al_ustr_free_scratch();
+   }
+
+   log_printf("%s: %8d allocations, %.3f ms per iteration\n",
+      scratch ? "scratch strings  " : "heap strings     ",
+      num_allocs / ITERATIONS, (al_get_time() - t0) * 1000 / ITERATIONS);
+}
+
+int main(int argc, char **argv)
+{
+   const char *filename = "data/sample.cfg";
+
+   if (argc > 1)
+      filename = argv[1];
+
+   if (!al_init()) {
+      abort_example("Could not init Allegro.\n");
+   }
+   open_log();
+
+   al_set_memory_interface(&counting_interface);
+
+   bench_config(filename);
+   bench_path();
+   bench_temporaries(false);
+   bench_temporaries(true);
+
+   al_set_memory_interface(NULL);
+
+   close_log(true);
+   return 0;
+}
+
+/* vim: set sts=3 sw=3 et: */
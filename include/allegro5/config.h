@@ -2,6 +2,7 @@
 #define __al_included_allegro5_config_h
 
 #include "allegro5/file.h"
+#include "allegro5/utf8.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -42,6 +43,26 @@ AL_FUNC(char const *, al_get_first_config_entry, (ALLEGRO_CONFIG const *config,
 	ALLEGRO_CONFIG_ENTRY **iterator));
 AL_FUNC(char const *, al_get_next_config_entry, (ALLEGRO_CONFIG_ENTRY **iterator));
 
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+AL_FUNC(void, al_set_config_value_interned, (ALLEGRO_CONFIG *config,
+   const ALLEGRO_USTR *section, const ALLEGRO_USTR *key, const char *value));
+AL_FUNC(const char *, al_get_config_value_interned, (const ALLEGRO_CONFIG *config,
+   const ALLEGRO_USTR *section, const ALLEGRO_USTR *key));
+
+/* Type: ALLEGRO_FROZEN_CONFIG
+ */
+typedef struct ALLEGRO_FROZEN_CONFIG ALLEGRO_FROZEN_CONFIG;
+
+AL_FUNC(ALLEGRO_FROZEN_CONFIG *, al_freeze_config, (const ALLEGRO_CONFIG *config));
+AL_FUNC(void, al_destroy_frozen_config, (ALLEGRO_FROZEN_CONFIG *config));
+AL_FUNC(const char *, al_get_frozen_config_value, (const ALLEGRO_FROZEN_CONFIG *config,
+   const char *section, const char *key));
+AL_FUNC(bool, al_get_frozen_config_int, (const ALLEGRO_FROZEN_CONFIG *config,
+   const char *section, const char *key, int *ret_value));
+AL_FUNC(bool, al_get_frozen_config_float, (const ALLEGRO_FROZEN_CONFIG *config,
+   const char *section, const char *key, float *ret_value));
+#endif
+
 #ifdef __cplusplus
 }
 #endif
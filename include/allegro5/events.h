@@ -250,8 +250,19 @@ AL_FUNC(void, al_register_event_source, (ALLEGRO_EVENT_QUEUE*, ALLEGRO_EVENT_SOU
 AL_FUNC(void, al_unregister_event_source, (ALLEGRO_EVENT_QUEUE*, ALLEGRO_EVENT_SOURCE*));
 AL_FUNC(void, al_pause_event_queue, (ALLEGRO_EVENT_QUEUE*, bool));
 AL_FUNC(bool, al_is_event_queue_paused, (const ALLEGRO_EVENT_QUEUE*));
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+AL_FUNC(void, al_set_event_queue_filter, (ALLEGRO_EVENT_QUEUE *queue,
+   bool (*filter)(const ALLEGRO_EVENT *event, void *extra), void *extra));
+AL_FUNC(bool, al_set_event_queue_coalescing, (ALLEGRO_EVENT_QUEUE *queue,
+   ALLEGRO_EVENT_TYPE type, bool coalesce));
+AL_FUNC(bool, al_get_event_queue_coalescing, (const ALLEGRO_EVENT_QUEUE *queue,
+   ALLEGRO_EVENT_TYPE type));
+#endif
 AL_FUNC(bool, al_is_event_queue_empty, (ALLEGRO_EVENT_QUEUE*));
 AL_FUNC(bool, al_get_next_event, (ALLEGRO_EVENT_QUEUE*, ALLEGRO_EVENT *ret_event));
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+AL_FUNC(int, al_get_next_events, (ALLEGRO_EVENT_QUEUE*, ALLEGRO_EVENT *buf, int max));
+#endif
 AL_FUNC(bool, al_peek_next_event, (ALLEGRO_EVENT_QUEUE*, ALLEGRO_EVENT *ret_event));
 AL_FUNC(bool, al_drop_next_event, (ALLEGRO_EVENT_QUEUE*));
 AL_FUNC(void, al_flush_event_queue, (ALLEGRO_EVENT_QUEUE*));
@@ -263,6 +274,11 @@ AL_FUNC(bool, al_wait_for_event_timed, (ALLEGRO_EVENT_QUEUE*,
 AL_FUNC(bool, al_wait_for_event_until, (ALLEGRO_EVENT_QUEUE *queue,
                                         ALLEGRO_EVENT *ret_event,
                                         ALLEGRO_TIMEOUT *timeout));
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+AL_FUNC(int, al_wait_for_events_timed, (ALLEGRO_EVENT_QUEUE *queue,
+                                        ALLEGRO_EVENT *buf, int max,
+                                        float secs));
+#endif
 
 #ifdef __cplusplus
    }
@@ -40,6 +40,24 @@ int _al_get_least_multiple(int val, int mul);
 AL_FUNC(void *, _al_sane_realloc, (void *ptr, size_t size));
 AL_FUNC(char *, _al_sane_strncpy, (char *dest, const char *src, size_t n));
 
+/* short-lived buffers, taken from the thread's current allocator */
+#define _al_transient_malloc(n) \
+   (_al_transient_malloc_with_context((n), __LINE__, __FILE__, __func__))
+#define _al_transient_calloc(c, n) \
+   (_al_transient_calloc_with_context((c), (n), __LINE__, __FILE__, __func__))
+#define _al_transient_free(p) \
+   (_al_transient_free_with_context((p), __LINE__, __FILE__, __func__))
+
+AL_FUNC(void *, _al_transient_malloc_with_context, (size_t n,
+   int line, const char *file, const char *func));
+AL_FUNC(void *, _al_transient_calloc_with_context, (size_t count, size_t n,
+   int line, const char *file, const char *func));
+AL_FUNC(void, _al_transient_free_with_context, (void *ptr,
+   int line, const char *file, const char *func));
+
+/* memory tracking */
+void _al_log_memory_tracking(void);
+
 
 #define _AL_RAND_MAX  0xFFFF
 AL_FUNC(void, _al_srand, (int seed));
@@ -19,6 +19,39 @@
       return __sync_sub_and_fetch(ptr, 1);
    })
 
+   #define _AL_HAVE_ATOMIC_CAS
+
+   AL_INLINE(_AL_ATOMIC,
+      _al_atomic_load, (volatile _AL_ATOMIC *ptr),
+   {
+   #ifdef __ATOMIC_SEQ_CST
+      return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+   #else
+      _AL_ATOMIC value = *ptr;
+      __sync_synchronize();
+      return value;
+   #endif
+   })
+
+   AL_INLINE(void,
+      _al_atomic_store, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC value),
+   {
+   #ifdef __ATOMIC_SEQ_CST
+      __atomic_store_n(ptr, value, __ATOMIC_SEQ_CST);
+   #else
+      __sync_synchronize();
+      *ptr = value;
+      __sync_synchronize();
+   #endif
+   })
+
+   AL_INLINE(int,
+      _al_compare_and_swap, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC old_value,
+         _AL_ATOMIC new_value),
+   {
+      return __sync_bool_compare_and_swap(ptr, old_value, new_value);
+   })
+
 #elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
 
    /* gcc, x86 or x86-64 */
@@ -49,11 +82,49 @@
       return old - 1;
    })
 
-#elif defined(_MSC_VER) && _M_IX86 >= 400
+   #define _AL_HAVE_ATOMIC_CAS
 
-   /* MSVC, x86 */
+   /* Loads are not reordered with other loads on x86. */
+   AL_INLINE(_AL_ATOMIC,
+      _al_atomic_load, (volatile _AL_ATOMIC *ptr),
+   {
+      _AL_ATOMIC value = *ptr;
+      __asm__ __volatile__ ("" : : : "memory");
+      return value;
+   })
+
+   AL_INLINE(void,
+      _al_atomic_store, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC value),
+   {
+      __asm__ __volatile__ (
+         "xchgl %0, %1"
+         : "+r" (value), "+m" (*ptr)
+         :
+         : "memory"
+      );
+   })
+
+   AL_INLINE(int,
+      _al_compare_and_swap, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC old_value,
+         _AL_ATOMIC new_value),
+   {
+      _AL_ATOMIC prev;
+      __asm__ __volatile__ (
+         "lock; cmpxchgl %2, %1"
+         : "=a" (prev), "+m" (*ptr)
+         : "r" (new_value), "0" (old_value)
+         : "memory"
+      );
+      return prev == old_value;
+   })
+
+#elif defined(_MSC_VER) && (_M_IX86 >= 400 || defined(_M_X64))
+
+   /* MSVC, x86 or x86-64 */
    /* MinGW supports these too, but we already have asm code above. */
 
+   #include <intrin.h>
+
    typedef LONG _AL_ATOMIC;
 
    AL_INLINE(_AL_ATOMIC,
@@ -68,6 +139,29 @@
       return InterlockedDecrement(ptr);
    })
 
+   #define _AL_HAVE_ATOMIC_CAS
+
+   AL_INLINE(_AL_ATOMIC,
+      _al_atomic_load, (volatile _AL_ATOMIC *ptr),
+   {
+      _AL_ATOMIC value = *ptr;
+      _ReadWriteBarrier();
+      return value;
+   })
+
+   AL_INLINE(void,
+      _al_atomic_store, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC value),
+   {
+      InterlockedExchange(ptr, value);
+   })
+
+   AL_INLINE(int,
+      _al_compare_and_swap, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC old_value,
+         _AL_ATOMIC new_value),
+   {
+      return InterlockedCompareExchange(ptr, new_value, old_value) == old_value;
+   })
+
 #elif defined(ALLEGRO_HAVE_OSATOMIC_H)
 
    /* OS X, GCC < 4.1
@@ -93,10 +187,38 @@
       return OSAtomicDecrement32Barrier((_AL_ATOMIC *)ptr);
    })
 
+   #define _AL_HAVE_ATOMIC_CAS
+
+   AL_INLINE(_AL_ATOMIC,
+      _al_atomic_load, (volatile _AL_ATOMIC *ptr),
+   {
+      _AL_ATOMIC value = *ptr;
+      OSMemoryBarrier();
+      return value;
+   })
+
+   AL_INLINE(void,
+      _al_atomic_store, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC value),
+   {
+      OSMemoryBarrier();
+      *ptr = value;
+      OSMemoryBarrier();
+   })
+
+   AL_INLINE(int,
+      _al_compare_and_swap, (volatile _AL_ATOMIC *ptr, _AL_ATOMIC old_value,
+         _AL_ATOMIC new_value),
+   {
+      return OSAtomicCompareAndSwap32Barrier(old_value, new_value,
+         (_AL_ATOMIC *)ptr);
+   })
+
 
 #else
 
-   /* Hope for the best? */
+   /* Hope for the best? Code using compare-and-swap checks for
+    * _AL_HAVE_ATOMIC_CAS and falls back to locking without it.
+    */
    #warning Atomic operations undefined for your compiler/architecture.
 
    typedef int _AL_ATOMIC;
@@ -5,13 +5,13 @@
 
 struct ALLEGRO_CONFIG_ENTRY {
    bool is_comment;
-   ALLEGRO_USTR *key;    /* comment if is_comment is true */
+   const ALLEGRO_USTR *key;   /* interned, or an owned comment if is_comment */
    ALLEGRO_USTR *value;
    ALLEGRO_CONFIG_ENTRY *prev, *next;
 };
 
 struct ALLEGRO_CONFIG_SECTION {
-   ALLEGRO_USTR *name;
+   const ALLEGRO_USTR *name;  /* interned */
    ALLEGRO_CONFIG_ENTRY *head;
    ALLEGRO_CONFIG_ENTRY *last;
    _AL_AATREE *tree;
@@ -24,6 +24,25 @@ struct ALLEGRO_CONFIG {
    _AL_AATREE *tree;
 };
 
+typedef struct ALLEGRO_FROZEN_CONFIG_ENTRY {
+   uint32_t hash;
+   uint32_t section;     /* offsets into the string pool */
+   uint32_t key;
+   uint32_t value;
+   bool has_int;
+   bool has_float;
+   int int_value;
+   float float_value;
+} ALLEGRO_FROZEN_CONFIG_ENTRY;
+
+struct ALLEGRO_FROZEN_CONFIG {
+   char *strings;
+   ALLEGRO_FROZEN_CONFIG_ENTRY *entries;
+   uint32_t num_entries;
+   uint32_t *slots;      /* entry index + 1, or 0 if empty */
+   uint32_t mask;
+};
+
 
 #endif
 
@@ -51,6 +51,7 @@ struct ALLEGRO_SYSTEM_INTERFACE
    double (*get_time)(void);
    void (*rest)(double seconds);
    void (*init_timeout)(ALLEGRO_TIMEOUT *timeout, double seconds);
+   void (*rest_until)(double time);
 };
 
 struct ALLEGRO_SYSTEM
@@ -67,6 +68,8 @@ void _al_register_system_interfaces(void);
 extern _AL_VECTOR _al_system_interfaces;
 AL_VAR(_AL_DTOR_LIST *, _al_dtor_list);
 
+void _al_rest_until(double time);
+
 AL_FUNC(void *, _al_open_library, (const char *filename));
 AL_FUNC(void *, _al_import_symbol, (void *library, const char *symbol));
 AL_FUNC(void, _al_close_library, (void *library));
@@ -11,6 +11,18 @@ void _al_reinitialize_tls_values(void);
 
 int *_al_tls_get_dtor_owner_count(void);
 
+struct _AL_USTR_SCRATCH_BLOCK **_al_tls_get_ustr_scratch(void);
+
+#define _AL_MAX_ALLOCATOR_STACK  8
+
+/* Slots for per-thread addon state, see _al_tls_get_addon_data. */
+#define _AL_TLS_PRIMITIVES_STATE      0
+#define _AL_TLS_PRIMITIVES_GENERATION 1
+#define _AL_MAX_ADDON_TLS             4
+
+AL_FUNC(void **, _al_tls_get_addon_data, (int slot));
+AL_FUNC(void, _al_tls_set_addon_dtor, (int slot, void (*dtor)(void **addon_data)));
+
 
 #ifdef __cplusplus
    }
@@ -0,0 +1,44 @@
+#ifndef __al_included_allegro5_aintern_ustr_h
+#define __al_included_allegro5_aintern_ustr_h
+
+#ifdef __cplusplus
+   extern "C" {
+#endif
+
+
+void _al_init_interned_strings(void);
+
+const ALLEGRO_USTR *_al_intern_ref(const ALLEGRO_USTR *us);
+void _al_intern_retain(const ALLEGRO_USTR *handle);
+void _al_intern_unref(const ALLEGRO_USTR *handle);
+bool _al_is_interned(const ALLEGRO_USTR *handle);
+uint32_t _al_intern_hash(const ALLEGRO_USTR *handle);
+uint32_t _al_intern_hash_ustr(const ALLEGRO_USTR *us);
+
+typedef struct _AL_USTR_SCRATCH_BLOCK _AL_USTR_SCRATCH_BLOCK;
+
+void *_al_ustr_scratch_alloc(size_t size);
+void _al_ustr_free_scratch_blocks(_AL_USTR_SCRATCH_BLOCK *block);
+
+typedef struct _AL_USTR_INDEX _AL_USTR_INDEX;
+
+/* Every string header allocated by Allegro itself (heap and scratch
+ * strings, i.e. those with mlen > 0) is preceded by a slot which holds the
+ * string's code point index, or NULL.  Scratch strings never have an index,
+ * so their slot holds _AL_USTR_SCRATCH_TAG instead.
+ */
+#define _AL_USTR_INDEX_SLOT(b)   (((_AL_USTR_INDEX **)(b))[-1])
+#define _AL_USTR_HEADER_PREFIX   sizeof(_AL_USTR_INDEX *)
+#define _AL_USTR_SCRATCH_TAG     ((_AL_USTR_INDEX *)(uintptr_t)1)
+
+#define _al_ustr_is_scratch(b) \
+   ((b)->mlen > 0 && _AL_USTR_INDEX_SLOT(b) == _AL_USTR_SCRATCH_TAG)
+
+
+#ifdef __cplusplus
+   }
+#endif
+
+#endif
+
+/* vim: set ts=8 sts=3 sw=3 et: */
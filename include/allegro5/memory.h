@@ -67,6 +67,47 @@ AL_FUNC(void *, al_realloc_with_context, (void *ptr, size_t n,
 AL_FUNC(void *, al_calloc_with_context, (size_t count, size_t n,
    int line, const char *file, const char *func));
 
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+/* Type: ALLEGRO_ALLOCATOR
+ */
+typedef struct ALLEGRO_ALLOCATOR ALLEGRO_ALLOCATOR;
+
+struct ALLEGRO_ALLOCATOR {
+   void *(*alloc)(ALLEGRO_ALLOCATOR *allocator, size_t n);
+   void (*release)(ALLEGRO_ALLOCATOR *allocator, void *ptr);
+};
+
+AL_FUNC(bool, al_push_allocator, (ALLEGRO_ALLOCATOR *allocator));
+AL_FUNC(void, al_pop_allocator, (void));
+AL_FUNC(ALLEGRO_ALLOCATOR *, al_get_current_allocator, (void));
+
+AL_FUNC(ALLEGRO_ALLOCATOR *, al_create_arena_allocator, (size_t block_size));
+AL_FUNC(void, al_reset_arena_allocator, (ALLEGRO_ALLOCATOR *allocator));
+AL_FUNC(void, al_destroy_arena_allocator, (ALLEGRO_ALLOCATOR *allocator));
+
+/* Type: ALLEGRO_MEMORY_STATS
+ */
+typedef struct ALLEGRO_MEMORY_STATS ALLEGRO_MEMORY_STATS;
+
+struct ALLEGRO_MEMORY_STATS {
+   const char *subsystem;
+   const char *file;
+   int line;
+   const char *function;
+   size_t live_bytes;
+   size_t peak_bytes;
+   size_t total_bytes;
+   int live_count;
+   int64_t num_allocs;
+   int64_t num_frees;
+};
+
+AL_FUNC(bool, al_start_memory_tracking, (void));
+AL_FUNC(void, al_stop_memory_tracking, (void));
+AL_FUNC(int, al_get_memory_tracking_sites, (ALLEGRO_MEMORY_STATS *stats, int max));
+AL_FUNC(int, al_get_memory_tracking_subsystems, (ALLEGRO_MEMORY_STATS *stats, int max));
+#endif
+
 
 #ifdef __cplusplus
    }
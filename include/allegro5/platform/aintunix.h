@@ -34,6 +34,7 @@ extern "C" {
 ALLEGRO_PATH *_al_unix_get_path(int id);
 double _al_unix_get_time(void);
 void _al_unix_rest(double seconds);
+void _al_unix_rest_until(double time);
 void _al_unix_init_timeout(ALLEGRO_TIMEOUT *timeout, double seconds);
 
 
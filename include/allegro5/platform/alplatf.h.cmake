@@ -58,6 +58,7 @@
 #cmakedefine ALLEGRO_HAVE_MMAP
 #cmakedefine ALLEGRO_HAVE_MPROTECT
 #cmakedefine ALLEGRO_HAVE_SCHED_YIELD
+#cmakedefine ALLEGRO_HAVE_CLOCK_NANOSLEEP
 #cmakedefine ALLEGRO_HAVE_SYSCONF
 #cmakedefine ALLEGRO_HAVE_SYSCTL
 
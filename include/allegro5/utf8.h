@@ -141,6 +141,19 @@ AL_FUNC(size_t, al_ustr_encode_utf16, (const ALLEGRO_USTR *us, uint16_t *s, size
 AL_FUNC(size_t, al_utf16_width, (int c));
 AL_FUNC(size_t, al_utf16_encode, (uint16_t s[], int32_t c));
 
+#if defined(ALLEGRO_UNSTABLE) || defined(ALLEGRO_INTERNAL_UNSTABLE) || defined(ALLEGRO_SRC)
+/* Scratch strings */
+AL_FUNC(ALLEGRO_USTR *, al_ustr_new_scratch, (const char *s));
+AL_FUNC(void, al_ustr_free_scratch, (void));
+
+/* Code point index */
+AL_FUNC(bool, al_ustr_enable_index, (ALLEGRO_USTR *us, bool enable));
+
+/* Interned strings */
+AL_FUNC(const ALLEGRO_USTR *, al_intern_cstr, (const char *s));
+AL_FUNC(const ALLEGRO_USTR *, al_intern_ustr, (const ALLEGRO_USTR *us));
+#endif
+
 #ifdef __cplusplus
    }
 #endif
@@ -18,17 +18,63 @@
 
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
 #include "allegro5/allegro.h"
 #include "allegro5/internal/aintern.h"
 #include "allegro5/internal/aintern_aatree.h"
 #include "allegro5/internal/aintern_config.h"
+#include "allegro5/internal/aintern_ustr.h"
 
 
 
-static int cmp_ustr(void const *a, void const *b)
+/* Section names and keys are interned strings.  The trees are ordered by
+ * hash, then by contents, so that plain strings are looked up without
+ * going through the table of interned strings and its lock.  Interned
+ * strings which are equal are told apart by address before any contents
+ * are compared.
+ */
+typedef struct CONFIG_LOOKUP {
+   uint32_t hash;
+   const ALLEGRO_USTR *name;
+} CONFIG_LOOKUP;
+
+
+static int cmp_hashed(uint32_t hash, const ALLEGRO_USTR *name,
+   const ALLEGRO_USTR *handle)
+{
+   uint32_t handle_hash = _al_intern_hash(handle);
+
+   if (hash != handle_hash)
+      return (hash < handle_hash) ? -1 : 1;
+   if (name == handle)
+      return 0;
+   return al_ustr_compare(name, handle);
+}
+
+
+/* Both keys are interned strings. */
+static int cmp_handle(void const *a, void const *b)
+{
+   return cmp_hashed(_al_intern_hash(a), a, b);
+}
+
+
+/* The first key is a CONFIG_LOOKUP. */
+static int cmp_lookup(void const *a, void const *b)
+{
+   const CONFIG_LOOKUP *lookup = a;
+   return cmp_hashed(lookup->hash, lookup->name, b);
+}
+
+
+static void init_lookup(CONFIG_LOOKUP *lookup, const ALLEGRO_USTR *name)
 {
-   return al_ustr_compare(a, b);
+   lookup->hash = _al_intern_hash_ustr(name);
+   lookup->name = name;
 }
 
 
@@ -43,50 +89,54 @@ ALLEGRO_CONFIG *al_create_config(void)
 }
 
 
+static ALLEGRO_CONFIG_SECTION *find_section_h(const ALLEGRO_CONFIG *config,
+   const ALLEGRO_USTR *hsection)
+{
+   return _al_aa_search(config->tree, hsection, cmp_handle);
+}
+
+
 static ALLEGRO_CONFIG_SECTION *find_section(const ALLEGRO_CONFIG *config,
    const ALLEGRO_USTR *section)
 {
-   return _al_aa_search(config->tree, section, cmp_ustr);
+   CONFIG_LOOKUP lookup;
+
+   init_lookup(&lookup, section);
+   return _al_aa_search(config->tree, &lookup, cmp_lookup);
 }
 
 
-static ALLEGRO_CONFIG_ENTRY *find_entry(const ALLEGRO_CONFIG_SECTION *section,
-   const ALLEGRO_USTR *key)
+static ALLEGRO_CONFIG_ENTRY *find_entry_h(const ALLEGRO_CONFIG_SECTION *section,
+   const ALLEGRO_USTR *hkey)
 {
-   return _al_aa_search(section->tree, key, cmp_ustr);
+   return _al_aa_search(section->tree, hkey, cmp_handle);
 }
 
 
-static void get_key_and_value(const ALLEGRO_USTR *buf,
-   ALLEGRO_USTR *key, ALLEGRO_USTR *value)
+static ALLEGRO_CONFIG_ENTRY *find_entry(const ALLEGRO_CONFIG_SECTION *section,
+   const ALLEGRO_USTR *key)
 {
-   int eq = al_ustr_find_chr(buf, 0, '=');
+   CONFIG_LOOKUP lookup;
 
-   if (eq == -1) {
-      al_ustr_assign(key, buf);
-      al_ustr_assign_cstr(value, "");
-   }
-   else {
-      al_ustr_assign_substr(key, buf, 0, eq);
-      al_ustr_assign_substr(value, buf, eq + 1, al_ustr_size(buf));
-   }
-
-   al_ustr_trim_ws(key);
-   al_ustr_trim_ws(value);
+   init_lookup(&lookup, key);
+   return _al_aa_search(section->tree, &lookup, cmp_lookup);
 }
 
 
-static ALLEGRO_CONFIG_SECTION *config_add_section(ALLEGRO_CONFIG *config,
-   const ALLEGRO_USTR *name)
+static ALLEGRO_CONFIG_SECTION *config_add_section_h(ALLEGRO_CONFIG *config,
+   const ALLEGRO_USTR *hname)
 {
    ALLEGRO_CONFIG_SECTION *sec = config->head;
    ALLEGRO_CONFIG_SECTION *section;
 
-   if ((section = find_section(config, name)))
+   if ((section = find_section_h(config, hname)))
       return section;
 
    section = al_calloc(1, sizeof(ALLEGRO_CONFIG_SECTION));
-   section->name = al_ustr_dup(name);
+   if (!section)
+      return NULL;
+   section->name = hname;
+   _al_intern_retain(hname);
 
    if (sec == NULL) {
       config->head = section;
@@ -99,12 +149,31 @@ static ALLEGRO_CONFIG_SECTION *config_add_section(ALLEGRO_CONFIG *config,
       config->last = section;
    }
 
-   config->tree = _al_aa_insert(config->tree, section->name, section, cmp_ustr);
+   config->tree = _al_aa_insert(config->tree, section->name, section, cmp_handle);
 
    return section;
 }
 
 
+/* Returns NULL if out of memory. */
+static ALLEGRO_CONFIG_SECTION *config_add_section(ALLEGRO_CONFIG *config,
+   const ALLEGRO_USTR *name)
+{
+   ALLEGRO_CONFIG_SECTION *section;
+   const ALLEGRO_USTR *hname;
+
+   if ((section = find_section(config, name)))
+      return section;
+
+   hname = _al_intern_ref(name);
+   if (!hname)
+      return NULL;
+   section = config_add_section_h(config, hname);
+   _al_intern_unref(hname);
+   return section;
+}
+
+
 /* Function: al_add_config_section
  */
 void al_add_config_section(ALLEGRO_CONFIG *config, const char *name)
@@ -117,45 +186,84 @@ void al_add_config_section(ALLEGRO_CONFIG *config, const char *name)
 }
 
 
-static void config_set_value(ALLEGRO_CONFIG *config,
-   const ALLEGRO_USTR *section, const ALLEGRO_USTR *key,
-   const ALLEGRO_USTR *value)
+static void section_append_entry(ALLEGRO_CONFIG_SECTION *s,
+   ALLEGRO_CONFIG_ENTRY *entry)
+{
+   if (s->head == NULL) {
+      s->head = entry;
+      s->last = entry;
+   }
+   else {
+      ASSERT(s->last->next == NULL);
+      s->last->next = entry;
+      entry->prev = s->last;
+      s->last = entry;
+   }
+}
+
+
+static bool section_set_value_h(ALLEGRO_CONFIG_SECTION *s,
+   const ALLEGRO_USTR *hkey, const ALLEGRO_USTR *value)
 {
-   ALLEGRO_CONFIG_SECTION *s;
    ALLEGRO_CONFIG_ENTRY *entry;
 
-   s = find_section(config, section);
-   if (s) {
-      entry = find_entry(s, key);
-      if (entry) {
-         al_ustr_assign(entry->value, value);
-         al_ustr_trim_ws(entry->value);
-         return;
-      }
+   entry = find_entry_h(s, hkey);
+   if (entry) {
+      al_ustr_assign(entry->value, value);
+      al_ustr_trim_ws(entry->value);
+      return true;
    }
 
    entry = al_calloc(1, sizeof(ALLEGRO_CONFIG_ENTRY));
+   if (!entry)
+      return false;
    entry->is_comment = false;
-   entry->key = al_ustr_dup(key);
+   entry->key = hkey;
+   _al_intern_retain(hkey);
    entry->value = al_ustr_dup(value);
    al_ustr_trim_ws(entry->value);
 
-   if (!s) {
-      s = config_add_section(config, section);
-   }
+   section_append_entry(s, entry);
 
-   if (s->head == NULL) {
-      s->head = entry;
-      s->last = entry;
-   }
-   else {
-      ASSERT(s->last->next == NULL);
-      s->last->next = entry;
-      entry->prev = s->last;
-      s->last = entry;
+   s->tree = _al_aa_insert(s->tree, entry->key, entry, cmp_handle);
+   return true;
+}
+
+
+/* Returns false if out of memory. */
+static bool section_set_value(ALLEGRO_CONFIG_SECTION *s,
+   const ALLEGRO_USTR *key, const ALLEGRO_USTR *value)
+{
+   ALLEGRO_CONFIG_ENTRY *entry;
+   const ALLEGRO_USTR *hkey;
+   bool ok;
+
+   entry = find_entry(s, key);
+   if (entry) {
+      al_ustr_assign(entry->value, value);
+      al_ustr_trim_ws(entry->value);
+      return true;
    }
 
-   s->tree = _al_aa_insert(s->tree, entry->key, entry, cmp_ustr);
+   hkey = _al_intern_ref(key);
+   if (!hkey)
+      return false;
+   ok = section_set_value_h(s, hkey, value);
+   _al_intern_unref(hkey);
+   return ok;
+}
+
+
+static void config_set_value_h(ALLEGRO_CONFIG *config,
+   const ALLEGRO_USTR *hsection, const ALLEGRO_USTR *hkey,
+   const ALLEGRO_USTR *value)
+{
+   ALLEGRO_CONFIG_SECTION *s;
+
+   s = config_add_section_h(config, hsection);
+   if (s) {
+      section_set_value_h(s, hkey, value);
+   }
 }
 
 
@@ -167,9 +275,7 @@ void al_set_config_value(ALLEGRO_CONFIG *config,
    ALLEGRO_USTR_INFO section_info;
    ALLEGRO_USTR_INFO key_info;
    ALLEGRO_USTR_INFO value_info;
-   const ALLEGRO_USTR *usection;
-   const ALLEGRO_USTR *ukey;
-   const ALLEGRO_USTR *uvalue;
+   ALLEGRO_CONFIG_SECTION *s;
 
    if (section == NULL) {
       section = "";
@@ -178,44 +284,66 @@ void al_set_config_value(ALLEGRO_CONFIG *config,
    ASSERT(key);
    ASSERT(value);
 
-   usection = al_ref_cstr(&section_info, section);
-   ukey = al_ref_cstr(&key_info, key);
+   s = config_add_section(config, al_ref_cstr(&section_info, section));
+   if (s) {
+      section_set_value(s, al_ref_cstr(&key_info, key),
+         al_ref_cstr(&value_info, value));
+   }
+}
+
+
+/* Function: al_set_config_value_interned
+ */
+void al_set_config_value_interned(ALLEGRO_CONFIG *config,
+   const ALLEGRO_USTR *section, const ALLEGRO_USTR *key, const char *value)
+{
+   ALLEGRO_USTR_INFO value_info;
+   const ALLEGRO_USTR *uvalue;
+
+   if (section == NULL) {
+      al_set_config_value(config, NULL, al_cstr(key), value);
+      return;
+   }
+
+   ASSERT(key);
+   ASSERT(value);
+   ASSERT(_al_is_interned(section));
+   ASSERT(_al_is_interned(key));
+
    uvalue = al_ref_cstr(&value_info, value);
 
-   config_set_value(config, usection, ukey, uvalue);
+   config_set_value_h(config, section, key, uvalue);
 }
 
 
-static void config_add_comment(ALLEGRO_CONFIG *config,
-   const ALLEGRO_USTR *section, const ALLEGRO_USTR *comment)
+static void section_add_comment(ALLEGRO_CONFIG_SECTION *s,
+   const ALLEGRO_USTR *comment)
 {
-   ALLEGRO_CONFIG_SECTION *s;
    ALLEGRO_CONFIG_ENTRY *entry;
-
-   s = find_section(config, section);
+   ALLEGRO_USTR *text;
 
    entry = al_calloc(1, sizeof(ALLEGRO_CONFIG_ENTRY));
    entry->is_comment = true;
-   entry->key = al_ustr_dup(comment);
+   text = al_ustr_dup(comment);
 
    /* Replace all newline characters by spaces, otherwise the written comment
     * file will be corrupted.
     */
-   al_ustr_find_replace_cstr(entry->key, 0, "\n", " ");
+   al_ustr_find_replace_cstr(text, 0, "\n", " ");
+   entry->key = text;
 
-   if (!s) {
-      s = config_add_section(config, section);
-   }
+   section_append_entry(s, entry);
+}
 
-   if (s->head == NULL) {
-      s->head = entry;
-      s->last = entry;
-   }
-   else {
-      ASSERT(s->last->next == NULL);
-      s->last->next = entry;
-      entry->prev = s->last;
-      s->last = entry;
+
+static void config_add_comment(ALLEGRO_CONFIG *config,
+   const ALLEGRO_USTR *section, const ALLEGRO_USTR *comment)
+{
+   ALLEGRO_CONFIG_SECTION *s;
+
+   s = config_add_section(config, section);
+   if (s) {
+      section_add_comment(s, comment);
    }
 }
 
@@ -243,18 +371,18 @@ void al_add_config_comment(ALLEGRO_CONFIG *config,
 }
 
 
-static bool config_get_value(const ALLEGRO_CONFIG *config,
-   const ALLEGRO_USTR *section, const ALLEGRO_USTR *key,
+static bool config_get_value_h(const ALLEGRO_CONFIG *config,
+   const ALLEGRO_USTR *hsection, const ALLEGRO_USTR *hkey,
    const ALLEGRO_USTR **ret_value)
 {
    ALLEGRO_CONFIG_SECTION *s;
    ALLEGRO_CONFIG_ENTRY *e;
 
-   s = find_section(config, section);
+   s = find_section_h(config, hsection);
    if (!s)
       return false;
 
-   e = find_entry(s, key);
+   e = find_entry_h(s, hkey);
    if (!e)
       return false;
 
@@ -270,37 +398,171 @@ const char *al_get_config_value(const ALLEGRO_CONFIG *config,
 {
    ALLEGRO_USTR_INFO section_info;
    ALLEGRO_USTR_INFO key_info;
-   const ALLEGRO_USTR *usection;
-   const ALLEGRO_USTR *ukey;
-   const ALLEGRO_USTR *value;
+   ALLEGRO_CONFIG_SECTION *s;
+   ALLEGRO_CONFIG_ENTRY *e;
 
    if (section == NULL) {
       section = "";
    }
 
-   usection = al_ref_cstr(&section_info, section);
-   ukey = al_ref_cstr(&key_info, key);
+   s = find_section(config, al_ref_cstr(&section_info, section));
+   if (!s)
+      return NULL;
+
+   e = find_entry(s, al_ref_cstr(&key_info, key));
+   if (!e)
+      return NULL;
+
+   return al_cstr(e->value);
+}
+
+
+/* Function: al_get_config_value_interned
+ */
+const char *al_get_config_value_interned(const ALLEGRO_CONFIG *config,
+   const ALLEGRO_USTR *section, const ALLEGRO_USTR *key)
+{
+   const ALLEGRO_USTR *value;
+
+   if (section == NULL) {
+      return al_get_config_value(config, NULL, al_cstr(key));
+   }
 
-   if (config_get_value(config, usection, ukey, &value))
+   ASSERT(key);
+   ASSERT(_al_is_interned(section));
+   ASSERT(_al_is_interned(key));
+
+   if (config_get_value_h(config, section, key, &value))
       return al_cstr(value);
    else
       return NULL;
 }
 
 
-static bool readline(ALLEGRO_FILE *file, ALLEGRO_USTR *line)
+/* read_whole_file:
+ *  Read everything from the current position to the end of the file into
+ *  one buffer, so the parser does not have to go through al_fgets line by
+ *  line.  The buffer must be freed with al_free.
+ */
+static char *read_whole_file(ALLEGRO_FILE *file, size_t *ret_size)
 {
-   char buf[128];
+   int64_t fsize = al_fsize(file);
+   int64_t pos = al_ftell(file);
+   size_t cap = 4096;
+   size_t size = 0;
+   char *buf;
+
+   /* One more than the expected size, so the final read sees the EOF. */
+   if (fsize > 0 && pos >= 0 && fsize > pos)
+      cap = (size_t)(fsize - pos) + 1;
+
+   buf = al_malloc(cap);
+   if (!buf)
+      return NULL;
 
-   if (!al_fgets(file, buf, sizeof(buf))) {
-      return false;
-   }
+   for (;;) {
+      size_t n;
 
-   do {
-      al_ustr_append_cstr(line, buf);
-      if (al_ustr_has_suffix_cstr(line, "\n"))
+      if (size == cap) {
+         char *newbuf = al_realloc(buf, cap * 2);
+         if (!newbuf) {
+            al_free(buf);
+            return NULL;
+         }
+         buf = newbuf;
+         cap *= 2;
+      }
+
+      n = al_fread(file, buf + size, cap - size);
+      if (n == 0)
          break;
-   } while (al_fgets(file, buf, sizeof(buf)));
+      size += n;
+   }
+
+   *ret_size = size;
+   return buf;
+}
+
+
+static bool is_ws(char c)
+{
+   return isspace((unsigned char)c);
+}
+
+
+/* parse_config:
+ *  Tokenize a whole configuration file in one pass.  Lines, keys and values
+ *  are referenced in place; only the strings stored in the configuration
+ *  are allocated.
+ */
+static bool parse_config(ALLEGRO_CONFIG *config, const char *buf, size_t size)
+{
+   ALLEGRO_CONFIG_SECTION *current_section = NULL;
+   const char *p = buf;
+   const char *end = buf + size;
+
+   while (p < end) {
+      const char *start = p;
+      const char *stop;
+      const char *nl = memchr(p, '\n', end - p);
+      ALLEGRO_USTR_INFO line_info;
+      const ALLEGRO_USTR *line;
+
+      stop = nl ? nl : end;
+      p = nl ? nl + 1 : end;
+
+      while (start < stop && is_ws(*start))
+         start++;
+      while (stop > start && is_ws(stop[-1]))
+         stop--;
+
+      if (start == stop || *start == '#') {
+         /* Preserve comments and blank lines */
+         if (!current_section)
+            current_section = config_add_section(config, al_ustr_empty_string());
+         if (!current_section)
+            return false;
+         line = al_ref_buffer(&line_info, start, stop - start);
+         section_add_comment(current_section, line);
+      }
+      else if (*start == '[') {
+         ALLEGRO_USTR_INFO name_info;
+         const ALLEGRO_USTR *name;
+         const char *rbracket = stop;
+         while (rbracket > start && rbracket[-1] != ']')
+            rbracket--;
+         if (rbracket == start)
+            rbracket = stop;
+         else
+            rbracket--;
+         name = al_ref_buffer(&name_info, start + 1, rbracket - (start + 1));
+         current_section = config_add_section(config, name);
+         if (!current_section)
+            return false;
+      }
+      else {
+         ALLEGRO_USTR_INFO key_info;
+         ALLEGRO_USTR_INFO value_info;
+         const ALLEGRO_USTR *key;
+         const ALLEGRO_USTR *value;
+         const char *eq = memchr(start, '=', stop - start);
+         const char *key_end = eq ? eq : stop;
+         const char *value_start = eq ? eq + 1 : stop;
+
+         while (key_end > start && is_ws(key_end[-1]))
+            key_end--;
+         while (value_start < stop && is_ws(*value_start))
+            value_start++;
+
+         key = al_ref_buffer(&key_info, start, key_end - start);
+         value = al_ref_buffer(&value_info, value_start, stop - value_start);
+
+         if (!current_section)
+            current_section = config_add_section(config, al_ustr_empty_string());
+         if (!current_section || !section_set_value(current_section, key, value))
+            return false;
+      }
+   }
 
    return true;
 }
@@ -328,58 +590,22 @@ ALLEGRO_CONFIG *al_load_config_file(const char *filename)
 ALLEGRO_CONFIG *al_load_config_file_f(ALLEGRO_FILE *file)
 {
    ALLEGRO_CONFIG *config;
-   ALLEGRO_CONFIG_SECTION *current_section = NULL;
-   ALLEGRO_USTR *line;
-   ALLEGRO_USTR *section;
-   ALLEGRO_USTR *key;
-   ALLEGRO_USTR *value;
+   char *buf;
+   size_t size;
    ASSERT(file);
 
-   config = al_create_config();
-   if (!config) {
+   buf = read_whole_file(file, &size);
+   if (!buf) {
       return NULL;
    }
 
-   line = al_ustr_new("");
-   section = al_ustr_new("");
-   key = al_ustr_new("");
-   value = al_ustr_new("");
-
-   while (1) {
-      al_ustr_assign_cstr(line, "");
-      if (!readline(file, line))
-         break;
-      al_ustr_trim_ws(line);
-
-      if (al_ustr_has_prefix_cstr(line, "#") || al_ustr_size(line) == 0) {
-         /* Preserve comments and blank lines */
-         const ALLEGRO_USTR *name;
-         if (current_section)
-            name = current_section->name;
-         else
-            name = al_ustr_empty_string();
-         config_add_comment(config, name, line);
-      }
-      else if (al_ustr_has_prefix_cstr(line, "[")) {
-         int rbracket = al_ustr_rfind_chr(line, al_ustr_size(line), ']');
-         if (rbracket == -1)
-            rbracket = al_ustr_size(line);
-         al_ustr_assign_substr(section, line, 1, rbracket);
-         current_section = config_add_section(config, section);
-      }
-      else {
-         get_key_and_value(line, key, value);
-         if (current_section == NULL)
-            config_set_value(config, al_ustr_empty_string(), key, value);
-         else
-            config_set_value(config, current_section->name, key, value);
-      }
+   config = al_create_config();
+   if (config && !parse_config(config, buf, size)) {
+      al_destroy_config(config);
+      config = NULL;
    }
 
-   al_ustr_free(line);
-   al_ustr_free(section);
-   al_ustr_free(key);
-   al_ustr_free(value);
+   al_free(buf);
 
    return config;
 }
@@ -494,11 +720,11 @@ static void do_config_merge_into(ALLEGRO_CONFIG *master,
    /* Save each section */
    s = add->head;
    while (s != NULL) {
-      config_add_section(master, s->name);
+      config_add_section_h(master, s->name);
       e = s->head;
       while (e != NULL) {
          if (!e->is_comment) {
-            config_set_value(master, s->name, e->key, e->value);
+            config_set_value_h(master, s->name, e->key, e->value);
          }
          else if (merge_comments) {
             config_add_comment(master, s->name, e->key);
@@ -534,7 +760,10 @@ ALLEGRO_CONFIG *al_merge_config(const ALLEGRO_CONFIG *cfg1,
 
 static void destroy_entry(ALLEGRO_CONFIG_ENTRY *e)
 {
-   al_ustr_free(e->key);
+   if (e->is_comment)
+      al_ustr_free((ALLEGRO_USTR *)e->key);
+   else
+      _al_intern_unref(e->key);
    al_ustr_free(e->value);
    al_free(e);
 }
@@ -548,7 +777,7 @@ static void destroy_section(ALLEGRO_CONFIG_SECTION *s)
       destroy_entry(e);
       e = tmp;
    }
-   al_ustr_free(s->name);
+   _al_intern_unref(s->name);
    _al_aa_free(s->tree);
    al_free(s);
 }
@@ -658,17 +887,17 @@ char const *al_get_next_config_entry(ALLEGRO_CONFIG_ENTRY **iterator)
 bool al_remove_config_section(ALLEGRO_CONFIG *config, char const *section)
 {
    ALLEGRO_USTR_INFO section_info;
-   ALLEGRO_USTR const *usection;
+   CONFIG_LOOKUP lookup;
    void *value;
    ALLEGRO_CONFIG_SECTION *s;
 
    if (section == NULL)
       section = "";
 
-   usection = al_ref_cstr(&section_info, section);
+   init_lookup(&lookup, al_ref_cstr(&section_info, section));
 
    value = NULL;
-   config->tree = _al_aa_delete(config->tree, usection, cmp_ustr, &value);
+   config->tree = _al_aa_delete(config->tree, &lookup, cmp_lookup, &value);
    if (!value)
       return false;
 
@@ -703,7 +932,7 @@ bool al_remove_config_key(ALLEGRO_CONFIG *config, char const *section,
    ALLEGRO_USTR_INFO section_info;
    ALLEGRO_USTR_INFO key_info;
    ALLEGRO_USTR const *usection;
-   ALLEGRO_USTR const *ukey = al_ref_cstr(&key_info, key);
+   CONFIG_LOOKUP lookup;
    void *value;
    ALLEGRO_CONFIG_ENTRY * e;
 
@@ -716,8 +945,10 @@ bool al_remove_config_key(ALLEGRO_CONFIG *config, char const *section,
    if (!s)
       return false;
 
+   init_lookup(&lookup, al_ref_cstr(&key_info, key));
+
    value = NULL;
-   s->tree = _al_aa_delete(s->tree, ukey, cmp_ustr, &value);
+   s->tree = _al_aa_delete(s->tree, &lookup, cmp_lookup, &value);
    if (!value)
       return false;
 
@@ -744,4 +975,241 @@ bool al_remove_config_key(ALLEGRO_CONFIG *config, char const *section,
    return true;
 }
 
+
+
+/*
+ * Frozen configurations are an immutable snapshot of a configuration,
+ * laid out for fast lookups: all strings live in one pool and the entries
+ * are indexed by an open-addressed hash table keyed on section and key.
+ */
+
+
+static uint32_t frozen_hash_bytes(uint32_t h, const char *s, size_t n)
+{
+   size_t i;
+
+   /* FNV-1a */
+   for (i = 0; i < n; i++) {
+      h ^= (unsigned char)s[i];
+      h *= 16777619u;
+   }
+   return h;
+}
+
+
+static uint32_t frozen_hash(const char *section, size_t section_size,
+   const char *key, size_t key_size)
+{
+   uint32_t h = 2166136261u;
+   h = frozen_hash_bytes(h, section, section_size);
+   /* Separate the section from the key so "a"+"bc" and "ab"+"c" differ. */
+   h = frozen_hash_bytes(h, "", 1);
+   return frozen_hash_bytes(h, key, key_size);
+}
+
+
+static uint32_t frozen_add_string(char *pool, uint32_t *pos,
+   const ALLEGRO_USTR *us)
+{
+   uint32_t offset = *pos;
+   size_t size = al_ustr_size(us);
+
+   memcpy(pool + offset, al_cstr(us), size);
+   pool[offset + size] = '\0';
+   *pos += size + 1;
+   return offset;
+}
+
+
+static void frozen_parse_value(ALLEGRO_FROZEN_CONFIG_ENTRY *fe,
+   const char *value)
+{
+   char *endp;
+   long l;
+   double d;
+
+   if (value[0] == '\0')
+      return;
+
+   errno = 0;
+   l = strtol(value, &endp, 10);
+   if (*endp == '\0' && errno == 0 && l >= INT_MIN && l <= INT_MAX) {
+      fe->has_int = true;
+      fe->int_value = (int)l;
+   }
+
+   errno = 0;
+   d = strtod(value, &endp);
+   if (*endp == '\0' && errno == 0) {
+      fe->has_float = true;
+      fe->float_value = (float)d;
+   }
+}
+
+
+/* Function: al_freeze_config
+ */
+ALLEGRO_FROZEN_CONFIG *al_freeze_config(const ALLEGRO_CONFIG *config)
+{
+   ALLEGRO_FROZEN_CONFIG *frozen;
+   ALLEGRO_CONFIG_SECTION *s;
+   ALLEGRO_CONFIG_ENTRY *e;
+   size_t pool_size = 0;
+   uint32_t num_entries = 0;
+   uint32_t num_slots;
+   uint32_t pos = 0;
+   uint32_t i;
+   ASSERT(config);
+
+   for (s = config->head; s; s = s->next) {
+      pool_size += al_ustr_size(s->name) + 1;
+      for (e = s->head; e; e = e->next) {
+         if (e->is_comment)
+            continue;
+         pool_size += al_ustr_size(e->key) + 1;
+         pool_size += al_ustr_size(e->value) + 1;
+         num_entries++;
+      }
+   }
+
+   if (pool_size > UINT32_MAX || num_entries > UINT32_MAX / 4)
+      return NULL;
+
+   /* Keep the table at most half full. */
+   num_slots = 16;
+   while (num_slots < num_entries * 2)
+      num_slots *= 2;
+
+   frozen = al_calloc(1, sizeof *frozen);
+   if (!frozen)
+      return NULL;
+   frozen->strings = al_malloc(pool_size ? pool_size : 1);
+   frozen->entries = al_calloc(num_entries ? num_entries : 1,
+      sizeof(ALLEGRO_FROZEN_CONFIG_ENTRY));
+   frozen->slots = al_calloc(num_slots, sizeof(uint32_t));
+   if (!frozen->strings || !frozen->entries || !frozen->slots) {
+      al_destroy_frozen_config(frozen);
+      return NULL;
+   }
+   frozen->mask = num_slots - 1;
+
+   i = 0;
+   for (s = config->head; s; s = s->next) {
+      uint32_t section = frozen_add_string(frozen->strings, &pos, s->name);
+      for (e = s->head; e; e = e->next) {
+         ALLEGRO_FROZEN_CONFIG_ENTRY *fe;
+         uint32_t slot;
+
+         if (e->is_comment)
+            continue;
+
+         fe = &frozen->entries[i];
+         fe->section = section;
+         fe->key = frozen_add_string(frozen->strings, &pos, e->key);
+         fe->value = frozen_add_string(frozen->strings, &pos, e->value);
+         fe->hash = frozen_hash(al_cstr(s->name), al_ustr_size(s->name),
+            al_cstr(e->key), al_ustr_size(e->key));
+         frozen_parse_value(fe, frozen->strings + fe->value);
+
+         slot = fe->hash & frozen->mask;
+         while (frozen->slots[slot])
+            slot = (slot + 1) & frozen->mask;
+         frozen->slots[slot] = ++i;
+      }
+   }
+   frozen->num_entries = num_entries;
+
+   return frozen;
+}
+
+
+/* Function: al_destroy_frozen_config
+ */
+void al_destroy_frozen_config(ALLEGRO_FROZEN_CONFIG *config)
+{
+   if (!config) {
+      return;
+   }
+
+   al_free(config->strings);
+   al_free(config->entries);
+   al_free(config->slots);
+   al_free(config);
+}
+
+
+static const ALLEGRO_FROZEN_CONFIG_ENTRY *frozen_find(
+   const ALLEGRO_FROZEN_CONFIG *config, const char *section, const char *key)
+{
+   size_t section_size;
+   size_t key_size;
+   uint32_t hash;
+   uint32_t slot;
+   ASSERT(config);
+   ASSERT(key);
+
+   if (section == NULL)
+      section = "";
+
+   section_size = strlen(section);
+   key_size = strlen(key);
+   hash = frozen_hash(section, section_size, key, key_size);
+
+   for (slot = hash & config->mask; config->slots[slot];
+         slot = (slot + 1) & config->mask) {
+      const ALLEGRO_FROZEN_CONFIG_ENTRY *fe =
+         &config->entries[config->slots[slot] - 1];
+      if (fe->hash == hash
+            && strcmp(config->strings + fe->key, key) == 0
+            && strcmp(config->strings + fe->section, section) == 0) {
+         return fe;
+      }
+   }
+
+   return NULL;
+}
+
+
+/* Function: al_get_frozen_config_value
+ */
+const char *al_get_frozen_config_value(const ALLEGRO_FROZEN_CONFIG *config,
+   const char *section, const char *key)
+{
+   const ALLEGRO_FROZEN_CONFIG_ENTRY *fe = frozen_find(config, section, key);
+
+   return fe ? config->strings + fe->value : NULL;
+}
+
+
+/* Function: al_get_frozen_config_int
+ */
+bool al_get_frozen_config_int(const ALLEGRO_FROZEN_CONFIG *config,
+   const char *section, const char *key, int *ret_value)
+{
+   const ALLEGRO_FROZEN_CONFIG_ENTRY *fe = frozen_find(config, section, key);
+   ASSERT(ret_value);
+
+   if (!fe || !fe->has_int)
+      return false;
+
+   *ret_value = fe->int_value;
+   return true;
+}
+
+
+/* Function: al_get_frozen_config_float
+ */
+bool al_get_frozen_config_float(const ALLEGRO_FROZEN_CONFIG *config,
+   const char *section, const char *key, float *ret_value)
+{
+   const ALLEGRO_FROZEN_CONFIG_ENTRY *fe = frozen_find(config, section, key);
+   ASSERT(ret_value);
+
+   if (!fe || !fe->has_float)
+      return false;
+
+   *ret_value = fe->float_value;
+   return true;
+}
+
 /* vim: set sts=3 sw=3 et: */
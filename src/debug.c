@@ -300,6 +300,8 @@ void _al_trace_suffix(const char *msg, ...)
    if (_al_user_trace_handler) {
       _al_user_trace_handler(static_trace_buffer);
       static_trace_buffer[0] = '\0';
+      _al_mutex_unlock(&trace_info.trace_mutex);
+      errno = olderr;
       return;
    }
 
@@ -26,6 +26,7 @@
 
 #include "allegro5/allegro.h"
 #include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_atomicops.h"
 #include "allegro5/internal/aintern_dtor.h"
 #include "allegro5/internal/aintern_exitfunc.h"
 #include "allegro5/internal/aintern_events.h"
@@ -33,6 +34,22 @@
 
 
 
+/* Size of the lock-free ring buffer, must be a power of two. */
+#define FAST_EVENTS_SIZE   64
+
+/* Event types al_set_event_queue_coalescing accepts. */
+enum {
+   COALESCE_MOUSE_AXES     = 1 << 0,
+   COALESCE_TOUCH_MOVE     = 1 << 1,
+   COALESCE_JOYSTICK_AXIS  = 1 << 2
+};
+
+typedef struct FAST_EVENT_CELL
+{
+   _AL_ATOMIC sequence;
+   ALLEGRO_EVENT event;
+} FAST_EVENT_CELL;
+
 struct ALLEGRO_EVENT_QUEUE
 {
    _AL_VECTOR sources;  /* vector of (ALLEGRO_EVENT_SOURCE *) */
@@ -40,9 +57,23 @@ struct ALLEGRO_EVENT_QUEUE
    unsigned int events_head;  /* write end of circular array */
    unsigned int events_tail;  /* read end of circular array */
    bool paused;
+   bool (*filter)(const ALLEGRO_EVENT *event, void *extra);
+   void *filter_extra;
+   int coalesce;        /* COALESCE_* flags */
+   int waiters;         /* number of threads blocked on cond */
    _AL_MUTEX mutex;
    _AL_COND cond;
    _AL_LIST_ITEM *dtor_item;
+#ifdef _AL_HAVE_ATOMIC_CAS
+   /* Bounded lock-free ring buffer, used while locked_only is zero.
+    * See the comment above push_fast_event.
+    */
+   FAST_EVENT_CELL fast_events[FAST_EVENTS_SIZE];
+   _AL_ATOMIC fast_head;
+   _AL_ATOMIC fast_tail;
+   _AL_ATOMIC fast_producers;
+   _AL_ATOMIC locked_only;
+#endif
 };
 
 
@@ -57,7 +88,8 @@ static void shutdown_events(void);
 static bool do_wait_for_event(ALLEGRO_EVENT_QUEUE *queue,
    ALLEGRO_EVENT *ret_event, ALLEGRO_TIMEOUT *timeout);
 static void copy_event(ALLEGRO_EVENT *dest, const ALLEGRO_EVENT *src);
-static void ref_if_user_event(ALLEGRO_EVENT *event);
+static ALLEGRO_EVENT *alloc_event(ALLEGRO_EVENT_QUEUE *queue);
+static void ref_if_user_event(const ALLEGRO_EVENT *event);
 static void unref_if_user_event(ALLEGRO_EVENT *event);
 static void discard_events_of_source(ALLEGRO_EVENT_QUEUE *queue,
    const ALLEGRO_EVENT_SOURCE *source);
@@ -85,6 +117,230 @@ static void shutdown_events(void)
 
 
 
+/* Most of the time an event queue is written to by one or two background
+ * threads and read by the main loop. Taking the queue mutex for every
+ * event makes those threads contend, so events are first put into a
+ * bounded lock-free ring buffer (Dmitry Vyukov's MPMC queue, so more than
+ * one producer or consumer is still safe).
+ *
+ * Everything which needs more than pushing or popping a single event
+ * (peeking, dropping events of a source, blocking waits, a full ring)
+ * takes the mutex and calls use_locked_events. That sets locked_only,
+ * waits for pushes already in progress and moves the contents of the
+ * ring to the end of the circular events array, which is empty whenever
+ * locked_only is zero. From then on all events go through the events
+ * array until it is empty and no thread waits for events anymore, so
+ * events from one source can never overtake each other.
+ */
+#ifdef _AL_HAVE_ATOMIC_CAS
+
+/* The ring positions wrap around, so do the arithmetic unsigned. */
+#define FAST_ADD(pos, n)   ((_AL_ATOMIC)((unsigned int)(pos) + (n)))
+#define FAST_DIFF(a, b)    ((int)((unsigned int)(a) - (unsigned int)(b)))
+#define FAST_CELL(queue, pos) \
+   (&(queue)->fast_events[(unsigned int)(pos) & (FAST_EVENTS_SIZE - 1)])
+
+static void init_fast_events(ALLEGRO_EVENT_QUEUE *queue)
+{
+   int i;
+
+   for (i = 0; i < FAST_EVENTS_SIZE; i++) {
+      queue->fast_events[i].sequence = i;
+   }
+   queue->fast_head = 0;
+   queue->fast_tail = 0;
+   queue->fast_producers = 0;
+   queue->locked_only = 0;
+}
+
+
+
+static bool push_fast_event(ALLEGRO_EVENT_QUEUE *queue,
+   const ALLEGRO_EVENT *event)
+{
+   FAST_EVENT_CELL *cell = NULL;
+   _AL_ATOMIC pos;
+   bool pushed = false;
+
+   /* Announce ourselves before looking at locked_only, use_locked_events
+    * does the opposite.
+    */
+   _al_fetch_and_add1(&queue->fast_producers);
+   if (_al_atomic_load(&queue->locked_only))
+      goto done;
+
+   pos = _al_atomic_load(&queue->fast_head);
+   for (;;) {
+      int dif;
+      cell = FAST_CELL(queue, pos);
+      dif = FAST_DIFF(_al_atomic_load(&cell->sequence), pos);
+      if (dif == 0) {
+         if (_al_compare_and_swap(&queue->fast_head, pos, FAST_ADD(pos, 1)))
+            break;
+      }
+      else if (dif < 0) {
+         /* The ring is full. */
+         goto done;
+      }
+      pos = _al_atomic_load(&queue->fast_head);
+   }
+
+   copy_event(&cell->event, event);
+   _al_atomic_store(&cell->sequence, FAST_ADD(pos, 1));
+   pushed = true;
+
+done:
+   _al_sub1_and_fetch(&queue->fast_producers);
+   return pushed;
+}
+
+
+
+static bool pop_fast_event(ALLEGRO_EVENT_QUEUE *queue,
+   ALLEGRO_EVENT *ret_event)
+{
+   FAST_EVENT_CELL *cell;
+   _AL_ATOMIC pos;
+
+   pos = _al_atomic_load(&queue->fast_tail);
+   for (;;) {
+      int dif;
+      cell = FAST_CELL(queue, pos);
+      dif = FAST_DIFF(_al_atomic_load(&cell->sequence), FAST_ADD(pos, 1));
+      if (dif == 0) {
+         if (_al_compare_and_swap(&queue->fast_tail, pos, FAST_ADD(pos, 1)))
+            break;
+      }
+      else if (dif < 0) {
+         /* The ring is empty. */
+         return false;
+      }
+      pos = _al_atomic_load(&queue->fast_tail);
+   }
+
+   copy_event(ret_event, &cell->event);
+   _al_atomic_store(&cell->sequence, FAST_ADD(pos, FAST_EVENTS_SIZE));
+   return true;
+}
+
+
+
+/* get_fast_event:
+ *  Pop the next event without locking, if the queue is not locked_only.
+ */
+static bool get_fast_event(ALLEGRO_EVENT_QUEUE *queue,
+   ALLEGRO_EVENT *ret_event)
+{
+   if (_al_atomic_load(&queue->locked_only))
+      return false;
+   return pop_fast_event(queue, ret_event);
+}
+
+
+
+static bool is_fast_empty(ALLEGRO_EVENT_QUEUE *queue)
+{
+   return _al_atomic_load(&queue->fast_head) ==
+      _al_atomic_load(&queue->fast_tail);
+}
+
+
+
+static bool is_locked_only(ALLEGRO_EVENT_QUEUE *queue)
+{
+   return _al_atomic_load(&queue->locked_only);
+}
+
+
+
+/* use_locked_events:
+ *  Stop using the ring buffer and move its events into the events array.
+ *  The event queue must be locked.
+ */
+static void use_locked_events(ALLEGRO_EVENT_QUEUE *queue)
+{
+   ALLEGRO_EVENT event;
+   int spins = 0;
+
+   if (!queue->locked_only) {
+      _al_atomic_store(&queue->locked_only, 1);
+
+      /* Producers which saw locked_only unset may still be writing. */
+      while (_al_atomic_load(&queue->fast_producers) > 0) {
+         if (++spins > 100)
+            al_rest(0);
+      }
+   }
+
+   while (pop_fast_event(queue, &event)) {
+      copy_event(alloc_event(queue), &event);
+   }
+}
+
+
+
+/* maybe_use_fast_events:
+ *  Go back to the ring buffer if nothing is left in the events array and
+ *  nobody is waiting for the condition variable to be signalled.
+ *  The event queue must be locked.
+ */
+static void maybe_use_fast_events(ALLEGRO_EVENT_QUEUE *queue)
+{
+   if (queue->locked_only && queue->waiters == 0 &&
+         queue->events_head == queue->events_tail) {
+      _al_atomic_store(&queue->locked_only, 0);
+   }
+}
+
+#else /* !_AL_HAVE_ATOMIC_CAS */
+
+static void init_fast_events(ALLEGRO_EVENT_QUEUE *queue)
+{
+   (void)queue;
+}
+
+static bool push_fast_event(ALLEGRO_EVENT_QUEUE *queue,
+   const ALLEGRO_EVENT *event)
+{
+   (void)queue;
+   (void)event;
+   return false;
+}
+
+static bool get_fast_event(ALLEGRO_EVENT_QUEUE *queue,
+   ALLEGRO_EVENT *ret_event)
+{
+   (void)queue;
+   (void)ret_event;
+   return false;
+}
+
+static bool is_fast_empty(ALLEGRO_EVENT_QUEUE *queue)
+{
+   (void)queue;
+   return true;
+}
+
+static bool is_locked_only(ALLEGRO_EVENT_QUEUE *queue)
+{
+   (void)queue;
+   return true;
+}
+
+static void use_locked_events(ALLEGRO_EVENT_QUEUE *queue)
+{
+   (void)queue;
+}
+
+static void maybe_use_fast_events(ALLEGRO_EVENT_QUEUE *queue)
+{
+   (void)queue;
+}
+
+#endif /* _AL_HAVE_ATOMIC_CAS */
+
+
+
 /* Function: al_create_event_queue
  */
 ALLEGRO_EVENT_QUEUE *al_create_event_queue(void)
@@ -101,6 +357,11 @@ ALLEGRO_EVENT_QUEUE *al_create_event_queue(void)
       queue->events_head = 0;
       queue->events_tail = 0;
       queue->paused = false;
+      queue->filter = NULL;
+      queue->filter_extra = NULL;
+      queue->coalesce = 0;
+      queue->waiters = 0;
+      init_fast_events(queue);
 
       _AL_MARK_MUTEX_UNINITED(queue->mutex);
       _al_mutex_init(&queue->mutex);
@@ -133,6 +394,7 @@ void al_destroy_event_queue(ALLEGRO_EVENT_QUEUE *queue)
    _al_vector_free(&queue->sources);
 
    ASSERT(queue->events_head == queue->events_tail);
+   ASSERT(is_fast_empty(queue));
    _al_vector_free(&queue->events);
 
    _al_cond_destroy(&queue->cond);
@@ -196,7 +458,9 @@ void al_unregister_event_source(ALLEGRO_EVENT_QUEUE *queue,
 
       /* Drop all the events in the queue that belonged to the source. */
       _al_mutex_lock(&queue->mutex);
+      use_locked_events(queue);
       discard_events_of_source(queue, source);
+      maybe_use_fast_events(queue);
       _al_mutex_unlock(&queue->mutex);
    }
 }
@@ -227,6 +491,72 @@ bool al_is_event_queue_paused(const ALLEGRO_EVENT_QUEUE *queue)
 
 
 
+/* Function: al_set_event_queue_filter
+ */
+void al_set_event_queue_filter(ALLEGRO_EVENT_QUEUE *queue,
+   bool (*filter)(const ALLEGRO_EVENT *event, void *extra), void *extra)
+{
+   ASSERT(queue);
+
+   _al_mutex_lock(&queue->mutex);
+   queue->filter = filter;
+   queue->filter_extra = extra;
+   _al_mutex_unlock(&queue->mutex);
+}
+
+
+
+static int coalesce_flag(ALLEGRO_EVENT_TYPE type)
+{
+   switch (type) {
+      case ALLEGRO_EVENT_MOUSE_AXES:
+         return COALESCE_MOUSE_AXES;
+      case ALLEGRO_EVENT_TOUCH_MOVE:
+         return COALESCE_TOUCH_MOVE;
+      case ALLEGRO_EVENT_JOYSTICK_AXIS:
+         return COALESCE_JOYSTICK_AXIS;
+      default:
+         return 0;
+   }
+}
+
+
+
+/* Function: al_set_event_queue_coalescing
+ */
+bool al_set_event_queue_coalescing(ALLEGRO_EVENT_QUEUE *queue,
+   ALLEGRO_EVENT_TYPE type, bool coalesce)
+{
+   int flag = coalesce_flag(type);
+   ASSERT(queue);
+
+   if (!flag)
+      return false;
+
+   _al_mutex_lock(&queue->mutex);
+   if (coalesce)
+      queue->coalesce |= flag;
+   else
+      queue->coalesce &= ~flag;
+   _al_mutex_unlock(&queue->mutex);
+
+   return true;
+}
+
+
+
+/* Function: al_get_event_queue_coalescing
+ */
+bool al_get_event_queue_coalescing(const ALLEGRO_EVENT_QUEUE *queue,
+   ALLEGRO_EVENT_TYPE type)
+{
+   ASSERT(queue);
+
+   return (queue->coalesce & coalesce_flag(type)) != 0;
+}
+
+
+
 static void heartbeat(void)
 {
    ALLEGRO_SYSTEM *system = al_get_system_driver();
@@ -251,7 +581,7 @@ bool al_is_event_queue_empty(ALLEGRO_EVENT_QUEUE *queue)
 
    heartbeat();
 
-   return is_event_queue_empty(queue);
+   return is_event_queue_empty(queue) && is_fast_empty(queue);
 }
 
 
@@ -301,6 +631,13 @@ bool al_get_next_event(ALLEGRO_EVENT_QUEUE *queue, ALLEGRO_EVENT *ret_event)
 
    heartbeat();
 
+   if (get_fast_event(queue, ret_event))
+      return true;
+
+   /* The events array is empty unless the queue is locked_only. */
+   if (!is_locked_only(queue))
+      return false;
+
    _al_mutex_lock(&queue->mutex);
 
    next_event = get_next_event_if_any(queue, true);
@@ -308,6 +645,7 @@ bool al_get_next_event(ALLEGRO_EVENT_QUEUE *queue, ALLEGRO_EVENT *ret_event)
       copy_event(ret_event, next_event);
       /* Don't increment reference count on user events. */
    }
+   maybe_use_fast_events(queue);
 
    _al_mutex_unlock(&queue->mutex);
 
@@ -316,6 +654,81 @@ bool al_get_next_event(ALLEGRO_EVENT_QUEUE *queue, ALLEGRO_EVENT *ret_event)
 
 
 
+/* take_events:
+ *  Remove up to max events from the events array and copy them into buf,
+ *  with at most two copies for the two ends of the circular array.
+ *  Returns the number of events taken. The event queue must be locked.
+ */
+static int take_events(ALLEGRO_EVENT_QUEUE *queue, ALLEGRO_EVENT *buf,
+   int max)
+{
+   const unsigned int size = _al_vector_size(&queue->events);
+   unsigned int count;
+   unsigned int first;
+
+   count = (queue->events_head + size - queue->events_tail) % size;
+   if (count > (unsigned int)max)
+      count = max;
+   if (count == 0)
+      return 0;
+
+   first = size - queue->events_tail;
+   if (first > count)
+      first = count;
+
+   memcpy(buf, _al_vector_ref(&queue->events, queue->events_tail),
+      first * sizeof(ALLEGRO_EVENT));
+   if (count > first) {
+      memcpy(buf + first, _al_vector_ref(&queue->events, 0),
+         (count - first) * sizeof(ALLEGRO_EVENT));
+   }
+
+   queue->events_tail = (queue->events_tail + count) % size;
+   return count;
+}
+
+
+
+/* get_next_events:
+ *  Helper for al_get_next_events, also used before blocking.
+ */
+static int get_next_events(ALLEGRO_EVENT_QUEUE *queue, ALLEGRO_EVENT *buf,
+   int max)
+{
+   int n = 0;
+
+   while (n < max && get_fast_event(queue, &buf[n])) {
+      n++;
+   }
+
+   if (n < max && is_locked_only(queue)) {
+      _al_mutex_lock(&queue->mutex);
+      n += take_events(queue, buf + n, max - n);
+      maybe_use_fast_events(queue);
+      _al_mutex_unlock(&queue->mutex);
+   }
+
+   return n;
+}
+
+
+
+/* Function: al_get_next_events
+ */
+int al_get_next_events(ALLEGRO_EVENT_QUEUE *queue, ALLEGRO_EVENT *buf,
+   int max)
+{
+   ASSERT(queue);
+   ASSERT(buf);
+   ASSERT(max >= 0);
+
+   heartbeat();
+
+   return get_next_events(queue, buf, max);
+}
+
+
+
 /* Function: al_peek_next_event
  */
 bool al_peek_next_event(ALLEGRO_EVENT_QUEUE *queue, ALLEGRO_EVENT *ret_event)
@@ -328,11 +741,13 @@ bool al_peek_next_event(ALLEGRO_EVENT_QUEUE *queue, ALLEGRO_EVENT *ret_event)
 
    _al_mutex_lock(&queue->mutex);
 
+   use_locked_events(queue);
    next_event = get_next_event_if_any(queue, false);
    if (next_event) {
       copy_event(ret_event, next_event);
       ref_if_user_event(ret_event);
    }
+   maybe_use_fast_events(queue);
 
    _al_mutex_unlock(&queue->mutex);
 
@@ -352,10 +767,12 @@ bool al_drop_next_event(ALLEGRO_EVENT_QUEUE *queue)
 
    _al_mutex_lock(&queue->mutex);
 
+   use_locked_events(queue);
    next_event = get_next_event_if_any(queue, true);
    if (next_event) {
       unref_if_user_event(next_event);
    }
+   maybe_use_fast_events(queue);
 
    _al_mutex_unlock(&queue->mutex);
 
@@ -375,6 +792,8 @@ void al_flush_event_queue(ALLEGRO_EVENT_QUEUE *queue)
 
    _al_mutex_lock(&queue->mutex);
 
+   use_locked_events(queue);
+
    /* Decrement reference counts on all user events. */
    i = queue->events_tail;
    while (i != queue->events_head) {
@@ -384,6 +803,7 @@ void al_flush_event_queue(ALLEGRO_EVENT_QUEUE *queue)
    }
 
    queue->events_head = queue->events_tail = 0;
+   maybe_use_fast_events(queue);
    _al_mutex_unlock(&queue->mutex);
 }
 
@@ -400,16 +820,27 @@ void al_wait_for_event(ALLEGRO_EVENT_QUEUE *queue, ALLEGRO_EVENT *ret_event)
 
    heartbeat();
 
+   if (ret_event && get_fast_event(queue, ret_event))
+      return;
+
    _al_mutex_lock(&queue->mutex);
    {
+      /* Producers only signal the condition variable when going through
+       * the locked path.
+       */
+      use_locked_events(queue);
+
       while (is_event_queue_empty(queue)) {
+         queue->waiters++;
          _al_cond_wait(&queue->cond, &queue->mutex);
+         queue->waiters--;
       }
 
       if (ret_event) {
          next_event = get_next_event_if_any(queue, true);
          copy_event(ret_event, next_event);
       }
+      maybe_use_fast_events(queue);
    }
    _al_mutex_unlock(&queue->mutex);
 }
@@ -459,16 +890,23 @@ static bool do_wait_for_event(ALLEGRO_EVENT_QUEUE *queue,
    bool timed_out = false;
    ALLEGRO_EVENT *next_event = NULL;
 
+   if (ret_event && get_fast_event(queue, ret_event))
+      return true;
+
    _al_mutex_lock(&queue->mutex);
    {
       int result = 0;
 
+      use_locked_events(queue);
+
       /* Is the queue is non-empty?  If not, block on a condition
        * variable, which will be signaled when an event is placed into
        * the queue.
        */
       while (is_event_queue_empty(queue) && (result != -1)) {
+         queue->waiters++;
          result = _al_cond_timedwait(&queue->cond, &queue->mutex, timeout);
+         queue->waiters--;
       }
 
       if (result == -1)
@@ -477,6 +915,7 @@ static bool do_wait_for_event(ALLEGRO_EVENT_QUEUE *queue,
          next_event = get_next_event_if_any(queue, true);
          copy_event(ret_event, next_event);
       }
+      maybe_use_fast_events(queue);
    }
    _al_mutex_unlock(&queue->mutex);
 
@@ -488,6 +927,55 @@ static bool do_wait_for_event(ALLEGRO_EVENT_QUEUE *queue,
 
 
 
+/* Function: al_wait_for_events_timed
+ */
+int al_wait_for_events_timed(ALLEGRO_EVENT_QUEUE *queue, ALLEGRO_EVENT *buf,
+   int max, float secs)
+{
+   ALLEGRO_TIMEOUT timeout;
+   int n;
+
+   ASSERT(queue);
+   ASSERT(buf);
+   ASSERT(max >= 0);
+   ASSERT(secs >= 0);
+
+   heartbeat();
+
+   if (max <= 0)
+      return 0;
+
+   n = get_next_events(queue, buf, max);
+   if (n > 0)
+      return n;
+
+   if (secs < 0.0)
+      al_init_timeout(&timeout, 0);
+   else
+      al_init_timeout(&timeout, secs);
+
+   _al_mutex_lock(&queue->mutex);
+   {
+      int result = 0;
+
+      use_locked_events(queue);
+
+      while (is_event_queue_empty(queue) && (result != -1)) {
+         queue->waiters++;
+         result = _al_cond_timedwait(&queue->cond, &queue->mutex, &timeout);
+         queue->waiters--;
+      }
+
+      n = take_events(queue, buf, max);
+      maybe_use_fast_events(queue);
+   }
+   _al_mutex_unlock(&queue->mutex);
+
+   return n;
+}
+
+
+
 /* expand_events_array:
  *  Expand the circular array holding events.
  */
@@ -554,7 +1042,7 @@ static void copy_event(ALLEGRO_EVENT *dest, const ALLEGRO_EVENT *src)
 /* Increment a user event's reference count, if the event passed is a user
  * event and requires it.
  */
-static void ref_if_user_event(ALLEGRO_EVENT *event)
+static void ref_if_user_event(const ALLEGRO_EVENT *event)
 {
    if (ALLEGRO_EVENT_TYPE_IS_USER(event->type)) {
       ALLEGRO_USER_EVENT_DESCRIPTOR *descr = event->user.__internal__descr;
@@ -580,6 +1068,99 @@ static void unref_if_user_event(ALLEGRO_EVENT *event)
 
 
 
+/* same_coalesced_stream:
+ *  Return true if the events, of the same type and source, describe the same
+ *  thing, so that the newer one can be merged into the older one.
+ */
+static bool same_coalesced_stream(const ALLEGRO_EVENT *a,
+   const ALLEGRO_EVENT *b)
+{
+   switch (a->type) {
+      case ALLEGRO_EVENT_MOUSE_AXES:
+         return a->mouse.display == b->mouse.display;
+
+      case ALLEGRO_EVENT_TOUCH_MOVE:
+         return a->touch.id == b->touch.id &&
+            a->touch.display == b->touch.display;
+
+      case ALLEGRO_EVENT_JOYSTICK_AXIS:
+         return a->joystick.id == b->joystick.id &&
+            a->joystick.stick == b->joystick.stick &&
+            a->joystick.axis == b->joystick.axis;
+
+      default:
+         return false;
+   }
+}
+
+
+
+/* coalesce_event:
+ *  If the queue holds a pending event of the same kind as event, merge event
+ *  into it and return true.  The queue is searched from the newest event
+ *  back, skipping events of other sources and events of the same type which
+ *  describe something else, e.g. another touch.  Any other event of the
+ *  same source stops the search, so the order of events from one source is
+ *  never changed.
+ *  The event queue must be locked and use_locked_events must have been
+ *  called.
+ */
+static bool coalesce_event(ALLEGRO_EVENT_QUEUE *queue,
+   const ALLEGRO_EVENT *event)
+{
+   const unsigned int size = _al_vector_size(&queue->events);
+   ALLEGRO_EVENT *pending = NULL;
+   unsigned int i;
+
+   i = queue->events_head;
+   while (i != queue->events_tail) {
+      ALLEGRO_EVENT *other;
+
+      i = (i + size - 1) % size;
+      other = _al_vector_ref(&queue->events, i);
+      if (other->any.source != event->any.source)
+         continue;
+      if (other->type != event->type)
+         break;
+      if (same_coalesced_stream(other, event)) {
+         pending = other;
+         break;
+      }
+   }
+   if (!pending)
+      return false;
+
+   switch (event->type) {
+      case ALLEGRO_EVENT_MOUSE_AXES: {
+         ALLEGRO_MOUSE_EVENT mouse = event->mouse;
+         /* Positions are absolute, deltas accumulate. */
+         mouse.dx += pending->mouse.dx;
+         mouse.dy += pending->mouse.dy;
+         mouse.dz += pending->mouse.dz;
+         mouse.dw += pending->mouse.dw;
+         pending->mouse = mouse;
+         return true;
+      }
+
+      case ALLEGRO_EVENT_TOUCH_MOVE: {
+         ALLEGRO_TOUCH_EVENT touch = event->touch;
+         touch.dx += pending->touch.dx;
+         touch.dy += pending->touch.dy;
+         pending->touch = touch;
+         return true;
+      }
+
+      case ALLEGRO_EVENT_JOYSTICK_AXIS:
+         pending->joystick = event->joystick;
+         return true;
+
+      default:
+         return false;
+   }
+}
+
+
+
 /* Internal function: _al_event_queue_push_event
  *  Event sources call this function when they have something to add to
  *  the queue.  If a queue cannot accept the event, the event's
@@ -592,22 +1173,59 @@ void _al_event_queue_push_event(ALLEGRO_EVENT_QUEUE *queue,
    const ALLEGRO_EVENT *orig_event)
 {
    ALLEGRO_EVENT *new_event;
+   bool (*filter)(const ALLEGRO_EVENT *event, void *extra);
+   bool coalesce;
    ASSERT(queue);
    ASSERT(orig_event);
 
    if (queue->paused)
       return;
 
+   /* The filter and its extra argument are set together, so they are read
+    * together under the lock.  The filter itself runs unlocked.
+    */
+   if (queue->filter) {
+      void *extra;
+
+      _al_mutex_lock(&queue->mutex);
+      filter = queue->filter;
+      extra = queue->filter_extra;
+      _al_mutex_unlock(&queue->mutex);
+
+      if (filter && !filter(orig_event, extra))
+         return;
+   }
+
+   /* Coalescing needs to look at the pending events, which can only be done
+    * with the queue locked.
+    */
+   coalesce = (queue->coalesce & coalesce_flag(orig_event->type)) != 0;
+
+   /* The reference must be taken before a consumer can see the event. */
+   ref_if_user_event(orig_event);
+
+   if (!coalesce && push_fast_event(queue, orig_event))
+      return;
+
    _al_mutex_lock(&queue->mutex);
    {
+      /* Keep the order of events already in the ring buffer. */
+      use_locked_events(queue);
+
+      if (coalesce && coalesce_event(queue, orig_event)) {
+         /* Nobody can be waiting, the queue was not empty. */
+         _al_mutex_unlock(&queue->mutex);
+         return;
+      }
+
       new_event = alloc_event(queue);
       copy_event(new_event, orig_event);
-      ref_if_user_event(new_event);
 
       /* Wake up threads that are waiting for an event to be placed in
        * the queue.
        */
-      _al_cond_broadcast(&queue->cond);
+      if (queue->waiters > 0)
+         _al_cond_broadcast(&queue->cond);
    }
    _al_mutex_unlock(&queue->mutex);
 }
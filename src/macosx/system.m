@@ -546,6 +546,7 @@ ALLEGRO_SYSTEM_INTERFACE *_al_system_osx_driver(void)
       vt->thread_exit = osx_thread_exit;
       vt->get_time = _al_unix_get_time;
       vt->rest = _al_unix_rest;
+      vt->rest_until = _al_unix_rest_until;
       vt->init_timeout = _al_unix_init_timeout;
 
    };
@@ -16,13 +16,130 @@
  */
 
 
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include "allegro5/allegro.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_thread.h"
+
+ALLEGRO_DEBUG_CHANNEL("memory")
 
 
 /* globals */
 static ALLEGRO_MEMORY_INTERFACE *mem = NULL;
 
 
+/* Transient buffers start with a header recording the allocator they came
+ * from, so they can be freed after the allocator has been popped.  The
+ * header is padded to keep the buffer suitably aligned.
+ */
+#define TRANSIENT_HEADER_SIZE   16
+
+ALLEGRO_STATIC_ASSERT(memory,
+   sizeof(ALLEGRO_ALLOCATOR *) <= TRANSIENT_HEADER_SIZE);
+
+
+/* Arena allocators hand out memory from a chain of large blocks, which is
+ * only reclaimed by al_reset_arena_allocator.
+ */
+#define ARENA_ALIGN                16
+#define ARENA_DEFAULT_BLOCK_SIZE   (64 * 1024)
+
+typedef struct ARENA_BLOCK ARENA_BLOCK;
+
+struct ARENA_BLOCK {
+   ARENA_BLOCK *next;
+   size_t size;
+   size_t used;
+};
+
+#define ARENA_BLOCK_HEADER_SIZE \
+   ((sizeof(ARENA_BLOCK) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+typedef struct ARENA {
+   ALLEGRO_ALLOCATOR allocator;  /* must be first */
+   size_t block_size;
+   ARENA_BLOCK *first;
+   ARENA_BLOCK *current;
+} ARENA;
+
+
+/* Memory tracking wraps the memory interface which was in place when it
+ * started.  Live blocks are kept in a hash table keyed by address, each
+ * pointing to the statistics of the call site which allocated it.  The
+ * bookkeeping itself uses malloc directly.
+ */
+#define TRACK_MAX_SUBSYSTEMS     64
+#define TRACK_SITE_BUCKETS       1024
+#define TRACK_NODES_PER_CHUNK    256
+
+typedef struct TRACK_SUBSYSTEM {
+   char name[32];
+   ALLEGRO_MEMORY_STATS stats;
+} TRACK_SUBSYSTEM;
+
+typedef struct TRACK_SITE TRACK_SITE;
+
+struct TRACK_SITE {
+   TRACK_SITE *next;
+   TRACK_SUBSYSTEM *subsystem;
+   ALLEGRO_MEMORY_STATS stats;
+};
+
+typedef struct TRACK_BLOCK TRACK_BLOCK;
+
+struct TRACK_BLOCK {
+   TRACK_BLOCK *next;
+   void *ptr;
+   size_t size;
+   TRACK_SITE *site;
+};
+
+typedef struct TRACK_CHUNK TRACK_CHUNK;
+
+struct TRACK_CHUNK {
+   TRACK_CHUNK *next;
+   TRACK_BLOCK blocks[TRACK_NODES_PER_CHUNK];
+};
+
+static struct {
+   bool active;
+   bool mutex_inited;
+   _AL_MUTEX mutex;
+   ALLEGRO_MEMORY_INTERFACE *wrapped;
+
+   TRACK_SUBSYSTEM subsystems[TRACK_MAX_SUBSYSTEMS];
+   int num_subsystems;
+   TRACK_SITE *sites[TRACK_SITE_BUCKETS];
+   int num_sites;
+
+   TRACK_BLOCK **blocks;
+   size_t num_buckets;
+   size_t num_blocks;
+   TRACK_BLOCK *free_blocks;
+   TRACK_CHUNK *chunks;
+} track;
+
+
+
+static void *track_malloc(size_t n,
+   int line, const char *file, const char *func);
+static void track_free(void *ptr,
+   int line, const char *file, const char *func);
+static void *track_realloc(void *ptr, size_t n,
+   int line, const char *file, const char *func);
+static void *track_calloc(size_t count, size_t n,
+   int line, const char *file, const char *func);
+
+static ALLEGRO_MEMORY_INTERFACE track_interface = {
+   track_malloc,
+   track_free,
+   track_realloc,
+   track_calloc
+};
+
+
 
 /* Function: al_set_memory_interface
  */
@@ -84,4 +201,671 @@ void *al_calloc_with_context(size_t count, size_t n,
 }
 
 
+/* _al_transient_malloc_with_context:
+ *  Allocate a buffer which will be freed shortly by _al_transient_free,
+ *  from the calling thread's current allocator if it has one.
+ */
+void *_al_transient_malloc_with_context(size_t n,
+   int line, const char *file, const char *func)
+{
+   ALLEGRO_ALLOCATOR *allocator = al_get_current_allocator();
+   char *p;
+
+   if (allocator)
+      p = allocator->alloc(allocator, TRANSIENT_HEADER_SIZE + n);
+   else
+      p = al_malloc_with_context(TRANSIENT_HEADER_SIZE + n, line, file, func);
+   if (!p)
+      return NULL;
+
+   *(ALLEGRO_ALLOCATOR **)p = allocator;
+   return p + TRANSIENT_HEADER_SIZE;
+}
+
+
+
+/* _al_transient_calloc_with_context:
+ *  Like _al_transient_malloc, but the buffer is cleared.
+ */
+void *_al_transient_calloc_with_context(size_t count, size_t n,
+   int line, const char *file, const char *func)
+{
+   void *p;
+
+   if (n != 0 && count > SIZE_MAX / n)
+      return NULL;
+
+   p = _al_transient_malloc_with_context(count * n, line, file, func);
+   if (p)
+      memset(p, 0, count * n);
+   return p;
+}
+
+
+
+/* _al_transient_free_with_context:
+ *  Free a buffer allocated by _al_transient_malloc or _al_transient_calloc.
+ */
+void _al_transient_free_with_context(void *ptr,
+   int line, const char *file, const char *func)
+{
+   char *p;
+   ALLEGRO_ALLOCATOR *allocator;
+
+   if (!ptr)
+      return;
+
+   p = (char *)ptr - TRANSIENT_HEADER_SIZE;
+   allocator = *(ALLEGRO_ALLOCATOR **)p;
+
+   if (!allocator)
+      al_free_with_context(p, line, file, func);
+   else if (allocator->release)
+      allocator->release(allocator, p);
+}
+
+
+
+static void *arena_alloc(ALLEGRO_ALLOCATOR *allocator, size_t n)
+{
+   ARENA *arena = (ARENA *)allocator;
+   ARENA_BLOCK *block;
+   ARENA_BLOCK *last = NULL;
+   char *p;
+
+   n = (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+   /* Blocks after the current one are empty since the last reset. */
+   for (block = arena->current; block; block = block->next) {
+      if (block->size - block->used >= n)
+         break;
+      last = block;
+   }
+
+   if (!block) {
+      size_t size = _ALLEGRO_MAX(arena->block_size, n);
+
+      block = al_malloc(ARENA_BLOCK_HEADER_SIZE + size);
+      if (!block)
+         return NULL;
+      block->next = NULL;
+      block->size = size;
+      block->used = 0;
+
+      if (last)
+         last->next = block;
+      else
+         arena->first = block;
+   }
+
+   arena->current = block;
+   p = (char *)block + ARENA_BLOCK_HEADER_SIZE + block->used;
+   block->used += n;
+   return p;
+}
+
+
+
+static void arena_release(ALLEGRO_ALLOCATOR *allocator, void *ptr)
+{
+   /* Nothing to do until the arena is reset. */
+   (void)allocator;
+   (void)ptr;
+}
+
+
+
+/* Function: al_create_arena_allocator
+ */
+ALLEGRO_ALLOCATOR *al_create_arena_allocator(size_t block_size)
+{
+   ARENA *arena = al_calloc(1, sizeof(*arena));
+   if (!arena)
+      return NULL;
+
+   arena->allocator.alloc = arena_alloc;
+   arena->allocator.release = arena_release;
+   arena->block_size = block_size ? block_size : ARENA_DEFAULT_BLOCK_SIZE;
+   return &arena->allocator;
+}
+
+
+
+/* Function: al_reset_arena_allocator
+ */
+void al_reset_arena_allocator(ALLEGRO_ALLOCATOR *allocator)
+{
+   ARENA *arena = (ARENA *)allocator;
+   ARENA_BLOCK *block;
+   ASSERT(allocator);
+
+   for (block = arena->first; block; block = block->next)
+      block->used = 0;
+   arena->current = arena->first;
+}
+
+
+
+/* Function: al_destroy_arena_allocator
+ */
+void al_destroy_arena_allocator(ALLEGRO_ALLOCATOR *allocator)
+{
+   ARENA *arena = (ARENA *)allocator;
+   ARENA_BLOCK *block;
+
+   if (!allocator)
+      return;
+
+   block = arena->first;
+   while (block) {
+      ARENA_BLOCK *next = block->next;
+      al_free(block);
+      block = next;
+   }
+   al_free(arena);
+}
+
+
+/* Name the subsystem a source file belongs to: the addon, the
+ * subdirectory of src, or "core" for the rest of the core library.
+ */
+static void subsystem_name(const char *file, char *name, size_t size)
+{
+   const char *dirs[] = { "addons", "src" };
+   const char *start = NULL;
+   const char *end;
+   const char *p;
+   unsigned i;
+
+   for (i = 0; i < sizeof(dirs) / sizeof(dirs[0]) && !start; i++) {
+      size_t len = strlen(dirs[i]);
+      for (p = file; (p = strstr(p, dirs[i])) != NULL; p += len) {
+         if ((p == file || p[-1] == '/' || p[-1] == '\\') &&
+               (p[len] == '/' || p[len] == '\\')) {
+            start = p + len + 1;
+         }
+      }
+   }
+
+   if (!start) {
+      _al_sane_strncpy(name, "other", size);
+      return;
+   }
+
+   for (end = start; *end && *end != '/' && *end != '\\'; end++)
+      ;
+   if (!*end) {
+      /* A file directly in src. */
+      _al_sane_strncpy(name, "core", size);
+      return;
+   }
+
+   if ((size_t)(end - start) >= size)
+      end = start + size - 1;
+   memcpy(name, start, end - start);
+   name[end - start] = '\0';
+}
+
+
+
+static TRACK_SITE *track_get_site(int line, const char *file,
+   const char *func)
+{
+   size_t h = (((size_t)file >> 4) ^ (size_t)line * 31) % TRACK_SITE_BUCKETS;
+   TRACK_SITE *site;
+   char name[32];
+   int i;
+
+   for (site = track.sites[h]; site; site = site->next) {
+      if (site->stats.file == file && site->stats.line == line)
+         return site;
+   }
+
+   site = calloc(1, sizeof(*site));
+   if (!site)
+      return NULL;
+
+   subsystem_name(file, name, sizeof(name));
+   for (i = 0; i < track.num_subsystems; i++) {
+      if (strcmp(track.subsystems[i].name, name) == 0)
+         break;
+   }
+   if (i == track.num_subsystems) {
+      if (i == TRACK_MAX_SUBSYSTEMS) {
+         /* Lump the rest together. */
+         i--;
+      }
+      else {
+         TRACK_SUBSYSTEM *sub = &track.subsystems[track.num_subsystems++];
+         strcpy(sub->name, name);
+         sub->stats.subsystem = sub->name;
+      }
+   }
+
+   site->subsystem = &track.subsystems[i];
+   site->stats.subsystem = site->subsystem->name;
+   site->stats.file = file;
+   site->stats.line = line;
+   site->stats.function = func;
+   site->next = track.sites[h];
+   track.sites[h] = site;
+   track.num_sites++;
+   return site;
+}
+
+
+
+static size_t track_hash(const void *ptr)
+{
+   return ((size_t)ptr >> 4) % track.num_buckets;
+}
+
+
+
+static bool track_grow_blocks(void)
+{
+   size_t num_buckets = track.num_buckets ? track.num_buckets * 2 : 4096;
+   TRACK_BLOCK **buckets = calloc(num_buckets, sizeof(*buckets));
+   size_t old_num_buckets = track.num_buckets;
+   TRACK_BLOCK **old = track.blocks;
+   size_t i;
+
+   if (!buckets)
+      return false;
+
+   track.blocks = buckets;
+   track.num_buckets = num_buckets;
+
+   for (i = 0; i < old_num_buckets; i++) {
+      TRACK_BLOCK *b = old[i];
+      while (b) {
+         TRACK_BLOCK *next = b->next;
+         size_t h = track_hash(b->ptr);
+         b->next = buckets[h];
+         buckets[h] = b;
+         b = next;
+      }
+   }
+
+   free(old);
+   return true;
+}
+
+
+
+static void stats_add(ALLEGRO_MEMORY_STATS *stats, size_t size)
+{
+   stats->live_bytes += size;
+   stats->total_bytes += size;
+   stats->live_count++;
+   stats->num_allocs++;
+   if (stats->live_bytes > stats->peak_bytes)
+      stats->peak_bytes = stats->live_bytes;
+}
+
+
+
+static void stats_remove(ALLEGRO_MEMORY_STATS *stats, size_t size)
+{
+   stats->live_bytes -= size;
+   stats->live_count--;
+   stats->num_frees++;
+}
+
+
+
+static void track_add(void *ptr, size_t size,
+   int line, const char *file, const char *func)
+{
+   TRACK_SITE *site;
+   TRACK_BLOCK *b;
+   size_t h;
+
+   _al_mutex_lock(&track.mutex);
+
+   if (!track.active)
+      goto done;
+
+   if (track.num_blocks >= track.num_buckets && !track_grow_blocks())
+      goto done;
+
+   if (!track.free_blocks) {
+      TRACK_CHUNK *chunk = malloc(sizeof(*chunk));
+      int i;
+      if (!chunk)
+         goto done;
+      chunk->next = track.chunks;
+      track.chunks = chunk;
+      for (i = 0; i < TRACK_NODES_PER_CHUNK; i++) {
+         chunk->blocks[i].next = track.free_blocks;
+         track.free_blocks = &chunk->blocks[i];
+      }
+   }
+
+   site = track_get_site(line, file, func);
+   if (!site)
+      goto done;
+
+   b = track.free_blocks;
+   track.free_blocks = b->next;
+   b->ptr = ptr;
+   b->size = size;
+   b->site = site;
+   h = track_hash(ptr);
+   b->next = track.blocks[h];
+   track.blocks[h] = b;
+   track.num_blocks++;
+
+   stats_add(&site->stats, size);
+   stats_add(&site->subsystem->stats, size);
+
+done:
+   _al_mutex_unlock(&track.mutex);
+}
+
+
+
+static void track_remove(void *ptr)
+{
+   TRACK_BLOCK **link;
+   TRACK_BLOCK *b;
+
+   _al_mutex_lock(&track.mutex);
+
+   if (!track.active || track.num_buckets == 0)
+      goto done;
+
+   /* Blocks allocated before tracking started are not found. */
+   for (link = &track.blocks[track_hash(ptr)]; (b = *link); link = &b->next) {
+      if (b->ptr == ptr) {
+         *link = b->next;
+         stats_remove(&b->site->stats, b->size);
+         stats_remove(&b->site->subsystem->stats, b->size);
+         b->next = track.free_blocks;
+         track.free_blocks = b;
+         track.num_blocks--;
+         break;
+      }
+   }
+
+done:
+   _al_mutex_unlock(&track.mutex);
+}
+
+
+
+static void *track_malloc(size_t n,
+   int line, const char *file, const char *func)
+{
+   void *p;
+
+   if (track.wrapped)
+      p = track.wrapped->mi_malloc(n, line, file, func);
+   else
+      p = malloc(n);
+
+   if (p)
+      track_add(p, n, line, file, func);
+   return p;
+}
+
+
+
+static void track_free(void *ptr,
+   int line, const char *file, const char *func)
+{
+   if (ptr)
+      track_remove(ptr);
+
+   if (track.wrapped)
+      track.wrapped->mi_free(ptr, line, file, func);
+   else
+      free(ptr);
+}
+
+
+
+static void *track_realloc(void *ptr, size_t n,
+   int line, const char *file, const char *func)
+{
+   void *p;
+
+   if (track.wrapped)
+      p = track.wrapped->mi_realloc(ptr, n, line, file, func);
+   else
+      p = realloc(ptr, n);
+
+   /* A failed realloc leaves the old block alone. */
+   if (p || n == 0) {
+      if (ptr)
+         track_remove(ptr);
+      if (p)
+         track_add(p, n, line, file, func);
+   }
+   return p;
+}
+
+
+
+static void *track_calloc(size_t count, size_t n,
+   int line, const char *file, const char *func)
+{
+   void *p;
+
+   if (track.wrapped)
+      p = track.wrapped->mi_calloc(count, n, line, file, func);
+   else
+      p = calloc(count, n);
+
+   if (p)
+      track_add(p, count * n, line, file, func);
+   return p;
+}
+
+
+
+/* Free all tracking records.  The mutex must be held. */
+static void track_clear(void)
+{
+   int i;
+
+   for (i = 0; i < TRACK_SITE_BUCKETS; i++) {
+      TRACK_SITE *site = track.sites[i];
+      while (site) {
+         TRACK_SITE *next = site->next;
+         free(site);
+         site = next;
+      }
+      track.sites[i] = NULL;
+   }
+   track.num_sites = 0;
+
+   memset(track.subsystems, 0, sizeof(track.subsystems));
+   track.num_subsystems = 0;
+
+   free(track.blocks);
+   track.blocks = NULL;
+   track.num_buckets = 0;
+   track.num_blocks = 0;
+
+   while (track.chunks) {
+      TRACK_CHUNK *next = track.chunks->next;
+      free(track.chunks);
+      track.chunks = next;
+   }
+   track.free_blocks = NULL;
+}
+
+
+
+/* Function: al_start_memory_tracking
+ */
+bool al_start_memory_tracking(void)
+{
+   if (mem == &track_interface)
+      return true;
+
+   if (!track.mutex_inited) {
+      _al_mutex_init(&track.mutex);
+      track.mutex_inited = true;
+   }
+
+   _al_mutex_lock(&track.mutex);
+   track_clear();
+   track.active = true;
+   track.wrapped = mem;
+   _al_mutex_unlock(&track.mutex);
+
+   mem = &track_interface;
+   return true;
+}
+
+
+
+/* Function: al_stop_memory_tracking
+ */
+void al_stop_memory_tracking(void)
+{
+   if (mem != &track_interface)
+      return;
+
+   mem = track.wrapped;
+
+   /* Keep the statistics, but forget the blocks. */
+   _al_mutex_lock(&track.mutex);
+   track.active = false;
+   free(track.blocks);
+   track.blocks = NULL;
+   track.num_buckets = 0;
+   track.num_blocks = 0;
+   while (track.chunks) {
+      TRACK_CHUNK *next = track.chunks->next;
+      free(track.chunks);
+      track.chunks = next;
+   }
+   track.free_blocks = NULL;
+   _al_mutex_unlock(&track.mutex);
+}
+
+
+
+static int compare_stats(const void *a, const void *b)
+{
+   const ALLEGRO_MEMORY_STATS *s1 = a;
+   const ALLEGRO_MEMORY_STATS *s2 = b;
+
+   if (s1->num_allocs != s2->num_allocs)
+      return (s1->num_allocs < s2->num_allocs) ? 1 : -1;
+   if (s1->live_bytes != s2->live_bytes)
+      return (s1->live_bytes < s2->live_bytes) ? 1 : -1;
+   return 0;
+}
+
+
+
+/* Copy the statistics of all sites or subsystems to a sorted array
+ * allocated with malloc.  Returns the number of entries.
+ */
+static int track_snapshot(bool subsystems, ALLEGRO_MEMORY_STATS **out)
+{
+   ALLEGRO_MEMORY_STATS *all;
+   int n = 0;
+   int i;
+
+   *out = NULL;
+   if (!track.mutex_inited)
+      return 0;
+
+   _al_mutex_lock(&track.mutex);
+
+   all = malloc(sizeof(*all) *
+      ((subsystems ? track.num_subsystems : track.num_sites) + 1));
+   if (all) {
+      if (subsystems) {
+         for (i = 0; i < track.num_subsystems; i++)
+            all[n++] = track.subsystems[i].stats;
+      }
+      else {
+         for (i = 0; i < TRACK_SITE_BUCKETS; i++) {
+            TRACK_SITE *site;
+            for (site = track.sites[i]; site; site = site->next)
+               all[n++] = site->stats;
+         }
+      }
+   }
+
+   _al_mutex_unlock(&track.mutex);
+
+   if (all)
+      qsort(all, n, sizeof(*all), compare_stats);
+   *out = all;
+   return n;
+}
+
+
+
+static int get_tracking_stats(bool subsystems, ALLEGRO_MEMORY_STATS *stats,
+   int max)
+{
+   ALLEGRO_MEMORY_STATS *all;
+   int n = track_snapshot(subsystems, &all);
+
+   if (all && stats && max > 0)
+      memcpy(stats, all, sizeof(*all) * _ALLEGRO_MIN(n, max));
+   free(all);
+   return n;
+}
+
+
+
+/* Function: al_get_memory_tracking_sites
+ */
+int al_get_memory_tracking_sites(ALLEGRO_MEMORY_STATS *stats, int max)
+{
+   return get_tracking_stats(false, stats, max);
+}
+
+
+
+/* Function: al_get_memory_tracking_subsystems
+ */
+int al_get_memory_tracking_subsystems(ALLEGRO_MEMORY_STATS *stats, int max)
+{
+   return get_tracking_stats(true, stats, max);
+}
+
+
+
+/* _al_log_memory_tracking:
+ *  Log a summary of memory use if tracking is active.  Called on shutdown.
+ */
+void _al_log_memory_tracking(void)
+{
+   ALLEGRO_MEMORY_STATS *all;
+   int n;
+   int i;
+
+   if (mem != &track_interface)
+      return;
+
+   n = track_snapshot(true, &all);
+   for (i = 0; i < n; i++) {
+      ALLEGRO_INFO("%-12s %10lu allocations, %10lu bytes live, %10lu peak\n",
+         all[i].subsystem, (unsigned long)all[i].num_allocs,
+         (unsigned long)all[i].live_bytes, (unsigned long)all[i].peak_bytes);
+   }
+   free(all);
+
+   n = track_snapshot(false, &all);
+   for (i = 0; i < n; i++) {
+      if (all[i].live_count > 0) {
+         ALLEGRO_WARN("%lu bytes in %d blocks still live from %s:%d (%s)\n",
+            (unsigned long)all[i].live_bytes, all[i].live_count,
+            all[i].file, all[i].line, all[i].function);
+      }
+   }
+   free(all);
+}
+
+
 /* vim: set ts=8 sts=3 sw=3 et: */
@@ -24,6 +24,7 @@
 #include <ctype.h>
 #include "allegro5/allegro.h"
 #include "allegro5/internal/bstrlib.h"
+#include "allegro5/internal/aintern_ustr.h"
 
 #define bstr__alloc(x)	    al_malloc(x)
 #define bstr__free(p)	    al_free(p)
@@ -97,6 +98,66 @@ static int snapUpSize (int i) {
 	return i;
 }
 
+/* Allegro: a string whose initial buffer is small gets it in the same
+   allocation as its header, right after it.  The buffer stays there until
+   the string needs to grow, when it is moved to an allocation of its own.
+   Headers are always allocated with at least one spare byte after them,
+   so a separately allocated buffer can never start at (b + 1).  They are
+   also preceded by the slot described in aintern_ustr.h.
+
+   Scratch strings (see al_ustr_new_scratch) live entirely inside the
+   thread's scratch arena; their buffers grow within the arena too and
+   they are never freed individually. */
+
+#define BSTR_INLINE_MAX 64
+
+#define bstr__inline_data(b) ((unsigned char *) ((b) + 1))
+#define bstr__is_inline(b) ((b)->data == bstr__inline_data (b))
+
+static _al_bstring bstr__new (int mlen) {
+char * p;
+_al_bstring b;
+
+	if (mlen <= BSTR_INLINE_MAX) {
+		p = (char *) bstr__alloc (_AL_USTR_HEADER_PREFIX + sizeof (struct _al_tagbstring) + mlen);
+		if (p == NULL) return NULL;
+		b = (_al_bstring) (p + _AL_USTR_HEADER_PREFIX);
+		b->data = bstr__inline_data (b);
+	} else {
+		p = (char *) bstr__alloc (_AL_USTR_HEADER_PREFIX + sizeof (struct _al_tagbstring) + 1);
+		if (p == NULL) return NULL;
+		b = (_al_bstring) (p + _AL_USTR_HEADER_PREFIX);
+		b->data = (unsigned char *) bstr__alloc ((size_t) mlen);
+		if (b->data == NULL) {
+			bstr__free (p);
+			return NULL;
+		}
+	}
+
+	_AL_USTR_INDEX_SLOT (b) = NULL;
+	b->mlen = mlen;
+	b->slen = 0;
+	return b;
+}
+
+/* Move the buffer of an inline or scratch string to a new one of len
+   bytes, which is never done with realloc. */
+static int bstr__move (_al_bstring b, int len) {
+unsigned char * x;
+
+	if (_al_ustr_is_scratch (b))
+		x = (unsigned char *) _al_ustr_scratch_alloc ((size_t) len);
+	else
+		x = (unsigned char *) bstr__alloc ((size_t) len);
+	if (x == NULL) return _AL_BSTR_ERR;
+
+	if (b->slen) bstr__memcpy ((char *) x, (char *) b->data, (size_t) b->slen);
+	b->data = x;
+	b->mlen = len;
+	b->data[b->slen] = (unsigned char) '\0';
+	return _AL_BSTR_OK;
+}
+
 /*  int _al_balloc (_al_bstring b, int len)
  *
  *  Increase the size of the memory backing the _al_bstring b to at least len.
@@ -113,6 +174,10 @@ int _al_balloc (_al_bstring b, int olen) {
 
 		if ((len = snapUpSize (olen)) <= b->mlen) return _AL_BSTR_OK;
 
+		if (bstr__is_inline (b) || _al_ustr_is_scratch (b)) {
+			return bstr__move (b, len);
+		}
+
 		/* Assume probability of a non-moving realloc is 0.125 */
 		if (7 * b->mlen < 8 * b->slen) {
 
@@ -173,6 +238,11 @@ int _al_ballocmin (_al_bstring b, int len) {
 
 	if (len < b->slen + 1) len = b->slen + 1;
 
+	if (bstr__is_inline (b) || _al_ustr_is_scratch (b)) {
+		/* These buffers cannot shrink. */
+		return (len > b->mlen) ? bstr__move (b, len) : _AL_BSTR_OK;
+	}
+
 	if (len != b->mlen) {
 		s = (unsigned char *) bstr__realloc (b->data, (size_t) len);
 		if (NULL == s) return _AL_BSTR_ERR;
@@ -199,13 +269,9 @@ size_t j;
 	i = snapUpSize ((int) (j + (2 - (j != 0))));
 	if (i <= (int) j) return NULL;
 
-	b = (_al_bstring) bstr__alloc (sizeof (struct _al_tagbstring));
+	b = bstr__new (i);
 	if (NULL == b) return NULL;
 	b->slen = (int) j;
-	if (NULL == (b->data = (unsigned char *) bstr__alloc (b->mlen = i))) {
-		bstr__free (b);
-		return NULL;
-	}
 
 	bstr__memcpy (b->data, str, j+1);
 	return b;
@@ -227,15 +293,11 @@ size_t j;
 	i = snapUpSize ((int) (j + (2 - (j != 0))));
 	if (i <= (int) j) return NULL;
 
-	b = (_al_bstring) bstr__alloc (sizeof (struct _al_tagbstring));
-	if (b == NULL) return NULL;
-	b->slen = (int) j;
 	if (i < mlen) i = mlen;
 
-	if (NULL == (b->data = (unsigned char *) bstr__alloc (b->mlen = i))) {
-		bstr__free (b);
-		return NULL;
-	}
+	b = bstr__new (i);
+	if (b == NULL) return NULL;
+	b->slen = (int) j;
 
 	bstr__memcpy (b->data, str, j+1);
 	return b;
@@ -251,20 +313,13 @@ _al_bstring b;
 int i;
 
 	if (blk == NULL || len < 0) return NULL;
-	b = (_al_bstring) bstr__alloc (sizeof (struct _al_tagbstring));
-	if (b == NULL) return NULL;
-	b->slen = len;
 
 	i = len + (2 - (len != 0));
 	i = snapUpSize (i);
 
-	b->mlen = i;
-
-	b->data = (unsigned char *) bstr__alloc ((size_t) b->mlen);
-	if (b->data == NULL) {
-		bstr__free (b);
-		return NULL;
-	}
+	b = bstr__new (i);
+	if (b == NULL) return NULL;
+	b->slen = len;
 
 	if (len > 0) bstr__memcpy (b->data, blk, (size_t) len);
 	b->data[len] = (unsigned char) '\0';
@@ -420,27 +475,16 @@ int i,j;
 	/* Attempted to copy an invalid string? */
 	if (b == NULL || b->slen < 0 || b->data == NULL) return NULL;
 
-	b0 = (_al_bstring) bstr__alloc (sizeof (struct _al_tagbstring));
-	if (b0 == NULL) {
-		/* Unable to allocate memory for string header */
-		return NULL;
-	}
-
 	i = b->slen;
 	j = snapUpSize (i + 1);
 
-	b0->data = (unsigned char *) bstr__alloc (j);
-	if (b0->data == NULL) {
-		j = i + 1;
-		b0->data = (unsigned char *) bstr__alloc (j);
-		if (b0->data == NULL) {
-			/* Unable to allocate memory for string data */
-			bstr__free (b0);
-			return NULL;
-		}
+	b0 = bstr__new (j);
+	if (b0 == NULL) {
+		/* Try the tightest possible allocation */
+		b0 = bstr__new (i + 1);
+		if (b0 == NULL) return NULL;
 	}
 
-	b0->mlen = j;
 	b0->slen = i;
 
 	if (i) bstr__memcpy ((char *) b0->data, (char *) b->data, i);
@@ -1003,7 +1047,12 @@ int _al_bdestroy (_al_bstring b) {
 	    b->data == NULL)
 		return _AL_BSTR_ERR;
 
-	bstr__free (b->data);
+	/* Scratch strings are freed with their arena. */
+	if (_al_ustr_is_scratch (b))
+		return _AL_BSTR_OK;
+
+	if (!bstr__is_inline (b))
+		bstr__free (b->data);
 
 	/* In case there is any stale usage, there is one more chance to 
 	   notice this error. */
@@ -1012,7 +1061,7 @@ int _al_bdestroy (_al_bstring b) {
 	b->mlen = -__LINE__;
 	b->data = NULL;
 
-	bstr__free (b);
+	bstr__free ((char *) b - _AL_USTR_HEADER_PREFIX);
 	return _AL_BSTR_OK;
 }
 
@@ -2253,15 +2302,8 @@ int i, c, v;
 
 	if (sep != NULL) c += (bl->qty - 1) * sep->slen;
 
-	b = (_al_bstring) bstr__alloc (sizeof (struct _al_tagbstring));
+	b = bstr__new (c);
 	if (NULL == b) return NULL; /* Out of memory */
-	b->data = (unsigned char *) bstr__alloc (c);
-	if (b->data == NULL) {
-		bstr__free (b);
-		return NULL;
-	}
-
-	b->mlen = c;
 	b->slen = c-1;
 
 	for (i = 0, c = 0; i < bl->qty; i++) {
@@ -107,7 +107,13 @@ static _AL_LIST* list_do_create(size_t capacity, size_t extra_item_size)
     */
    memory_size = sizeof(_AL_LIST) + (capacity + 1) * (sizeof(_AL_LIST_ITEM) + extra_item_size);
 
-   memory_ptr = (uint8_t*)al_malloc(memory_size);
+   /* Static lists are short-lived scratch space (the triangulator uses
+    * them), so they come from the thread's current allocator.
+    */
+   if (capacity > 0)
+      memory_ptr = (uint8_t*)_al_transient_malloc(memory_size);
+   else
+      memory_ptr = (uint8_t*)al_malloc(memory_size);
    if (NULL == memory_ptr) {
       ALLEGRO_ERROR("Out of memory.");
       return NULL;
@@ -268,7 +274,10 @@ void _al_list_destroy(_AL_LIST* list)
 
    _al_list_clear(list);
 
-   al_free(list);
+   if (list_is_static(list))
+      _al_transient_free(list);
+   else
+      al_free(list);
 }
 
 
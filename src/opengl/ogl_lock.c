@@ -594,7 +594,7 @@ static void ogl_unlock_region_nonbb_fbo_writeonly(ALLEGRO_BITMAP *bitmap,
    const int lock_format = bitmap->locked_region.format;
    const int orig_pixel_size = al_get_pixel_size(orig_format);
    const int dst_pitch = bitmap->lock_w * orig_pixel_size;
-   unsigned char * const tmpbuf = al_malloc(dst_pitch * bitmap->lock_h);
+   unsigned char * const tmpbuf = _al_transient_malloc(dst_pitch * bitmap->lock_h);
    GLenum e;
 
    _al_convert_bitmap_data(
@@ -619,7 +619,7 @@ static void ogl_unlock_region_nonbb_fbo_writeonly(ALLEGRO_BITMAP *bitmap,
          lock_format, _al_gl_error_string(e));
    }
 
-   al_free(tmpbuf);
+   _al_transient_free(tmpbuf);
 }
 
 
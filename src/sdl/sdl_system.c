@@ -124,10 +124,7 @@ static void sdl_heartbeat(void)
       }
    }
 #ifdef __EMSCRIPTEN__
-   double t = al_get_time();
-   double interval = t - s->timer_time;
-   _al_timer_thread_handle_tick(interval);
-   s->timer_time = t;
+   _al_timer_thread_handle_tick(al_get_time());
 #endif
    al_unlock_mutex(s->mutex);
 }
@@ -155,10 +152,6 @@ static void sdl_heartbeat_init(void)
     * once the system was created.
     */
    s->mutex = al_create_mutex();
-
-#ifdef __EMSCRIPTEN__
-   s->timer_time = al_get_time();
-#endif
 }
 
 static void sdl_shutdown_system(void)
@@ -34,6 +34,7 @@
 #include "allegro5/internal/aintern_thread.h"
 #include "allegro5/internal/aintern_timer.h"
 #include "allegro5/internal/aintern_tls.h"
+#include "allegro5/internal/aintern_ustr.h"
 #include "allegro5/internal/aintern_vector.h"
 
 ALLEGRO_DEBUG_CHANNEL("system")
@@ -284,6 +285,8 @@ bool al_install_system(int version, int (*atexit_ptr)(void (*)(void)))
 
    _al_init_timers();
 
+   _al_init_interned_strings();
+
 #ifdef ALLEGRO_CFG_SHADER_GLSL
    _al_glsl_init_shaders();
 #endif
@@ -327,6 +330,7 @@ void al_uninstall_system(void)
    _al_glsl_shutdown_shaders();
 #endif
 
+   _al_log_memory_tracking();
    _al_shutdown_logging();
 
    /* shutdown_system_driver is registered as an exit func so we don't need
@@ -519,6 +523,27 @@ void al_rest(double seconds)
 }
 
 
+/* _al_rest_until:
+ *  Sleep until al_get_time() reaches the given time.  System drivers may
+ *  provide an absolute sleep, which does not drift like al_rest does.
+ */
+void _al_rest_until(double time)
+{
+   double now;
+
+   ASSERT(active_sysdrv);
+
+   if (active_sysdrv->vt->rest_until) {
+      active_sysdrv->vt->rest_until(time);
+      return;
+   }
+
+   now = al_get_time();
+   if (time > now)
+      al_rest(time - now);
+}
+
+
 /* Function: al_init_timeout
  */
 void al_init_timeout(ALLEGRO_TIMEOUT *timeout, double seconds)
@@ -17,6 +17,7 @@
 
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "allegro5/allegro.h"
 #include "allegro5/internal/aintern.h"
@@ -34,7 +35,7 @@
 
 
 /* forward declarations */
-static void timer_handle_tick(ALLEGRO_TIMER *timer);
+static void timer_handle_tick(ALLEGRO_TIMER *timer, double lateness);
 
 
 struct ALLEGRO_TIMER
@@ -43,7 +44,11 @@ struct ALLEGRO_TIMER
    bool started;
    double speed_secs;
    int64_t count;
-   double counter;		/* counts down to zero=blastoff */
+   double counter;		/* time left until the next tick while stopped */
+   double deadline;		/* absolute time of the next tick while started */
+   int heap_index;		/* position in active_timers, or -1 */
+   ALLEGRO_TIMER_STATS stats;
+   double lateness_sum;
    _AL_LIST_ITEM *dtor_item;
 };
 
@@ -60,6 +65,113 @@ static ALLEGRO_COND *timer_cond = NULL;
 static bool destroy_thread = false;
 
 
+/* The timer thread waits on timer_cond until this long before the next
+ * deadline, so that starting or changing a timer can wake it up, and then
+ * sleeps until the exact deadline.
+ */
+#define TIMER_WAKEUP_MARGIN   0.001
+
+
+
+/*
+ * active_timers is a binary min-heap ordered by deadline, so the timer
+ * thread only ever looks at the earliest timer.  Each timer remembers its
+ * own position in the heap so it can be removed or re-keyed in O(log n).
+ */
+
+static ALLEGRO_TIMER *heap_get(unsigned int i)
+{
+   ALLEGRO_TIMER **slot = _al_vector_ref(&active_timers, i);
+   return *slot;
+}
+
+
+
+static void heap_set(unsigned int i, ALLEGRO_TIMER *timer)
+{
+   ALLEGRO_TIMER **slot = _al_vector_ref(&active_timers, i);
+   *slot = timer;
+   timer->heap_index = i;
+}
+
+
+
+static void heap_sift_up(unsigned int i)
+{
+   ALLEGRO_TIMER *timer = heap_get(i);
+
+   while (i > 0) {
+      unsigned int parent = (i - 1) / 2;
+      ALLEGRO_TIMER *p = heap_get(parent);
+      if (p->deadline <= timer->deadline)
+         break;
+      heap_set(i, p);
+      i = parent;
+   }
+
+   heap_set(i, timer);
+}
+
+
+
+static void heap_sift_down(unsigned int i)
+{
+   unsigned int n = _al_vector_size(&active_timers);
+   ALLEGRO_TIMER *timer = heap_get(i);
+
+   for (;;) {
+      unsigned int child = 2 * i + 1;
+      ALLEGRO_TIMER *c;
+      if (child >= n)
+         break;
+      c = heap_get(child);
+      if (child + 1 < n && heap_get(child + 1)->deadline < c->deadline) {
+         child++;
+         c = heap_get(child);
+      }
+      if (timer->deadline <= c->deadline)
+         break;
+      heap_set(i, c);
+      i = child;
+   }
+
+   heap_set(i, timer);
+}
+
+
+
+static void heap_insert(ALLEGRO_TIMER *timer)
+{
+   ALLEGRO_TIMER **slot = _al_vector_alloc_back(&active_timers);
+   *slot = timer;
+   heap_sift_up(_al_vector_size(&active_timers) - 1);
+}
+
+
+
+static void heap_remove(ALLEGRO_TIMER *timer)
+{
+   unsigned int i = timer->heap_index;
+   unsigned int last = _al_vector_size(&active_timers) - 1;
+
+   ASSERT(heap_get(i) == timer);
+
+   if (i != last) {
+      ALLEGRO_TIMER *moved = heap_get(last);
+      _al_vector_delete_at(&active_timers, last);
+      heap_set(i, moved);
+      heap_sift_up(i);
+      heap_sift_down(moved->heap_index);
+   }
+   else {
+      _al_vector_delete_at(&active_timers, last);
+   }
+
+   timer->heap_index = -1;
+}
+
+
+
 /* timer_thread_proc: [timer thread]
  *  The timer thread procedure itself.
  */
@@ -95,64 +207,62 @@ static void timer_thread_proc(_AL_THREAD *self, void *unused)
    }
 #endif
 
-   double old_time = al_get_time();
-   double new_time;
-   double interval = 0.032768;
+   al_lock_mutex(timers_mutex);
 
-   while (!_al_get_thread_should_stop(self)) {
-      al_lock_mutex(timers_mutex);
-      while (_al_vector_size(&active_timers) == 0 && !destroy_thread) {
+   while (!_al_get_thread_should_stop(self) && !destroy_thread) {
+      double deadline;
+      double delay;
+
+      if (_al_vector_size(&active_timers) == 0) {
          al_wait_cond(timer_cond, timers_mutex);
-         old_time = al_get_time() - interval;
+         continue;
       }
-      al_unlock_mutex(timers_mutex);
 
-      al_rest(interval);
+      deadline = heap_get(0)->deadline;
+      delay = deadline - al_get_time();
 
-      al_lock_mutex(timers_mutex);
-      {
-         /* Calculate actual time elapsed.  */
-         new_time = al_get_time();
-         interval = new_time - old_time;
-         old_time = new_time;
+      if (delay > TIMER_WAKEUP_MARGIN) {
+         /* Stay interruptible while the deadline is far away. */
+         ALLEGRO_TIMEOUT timeout;
+         al_init_timeout(&timeout, delay - TIMER_WAKEUP_MARGIN);
+         al_wait_cond_until(timer_cond, timers_mutex, &timeout);
+         continue;
+      }
 
-         /* Handle a tick.  */
-         interval = _al_timer_thread_handle_tick(interval);
+      if (delay > 0) {
+         al_unlock_mutex(timers_mutex);
+         _al_rest_until(deadline);
+         al_lock_mutex(timers_mutex);
       }
-      al_unlock_mutex(timers_mutex);
+
+      _al_timer_thread_handle_tick(al_get_time());
    }
 
+   al_unlock_mutex(timers_mutex);
+
    (void)unused;
 }
 
 
 
 /* timer_thread_handle_tick: [timer thread]
- *  Call handle_tick() method of every timer in active_timers, and
- *  returns the duration that the timer thread should try to sleep
- *  next time.
+ *  Tick every timer in active_timers whose deadline is at or before
+ *  the given time, and return the time until the next deadline.
  */
-double _al_timer_thread_handle_tick(double interval)
+double _al_timer_thread_handle_tick(double now)
 {
-   double new_delay = 0.032768;
-   unsigned int i;
+   while (_al_vector_size(&active_timers) > 0) {
+      ALLEGRO_TIMER *timer = heap_get(0);
 
-   for (i = 0; i < _al_vector_size(&active_timers); i++) {
-      ALLEGRO_TIMER **slot = _al_vector_ref(&active_timers, i);
-      ALLEGRO_TIMER *timer = *slot;
-
-      timer->counter -= interval;
-
-      while (timer->counter <= 0) {
-         timer_handle_tick(timer);
-         timer->counter += timer->speed_secs;
-      }
+      if (timer->deadline > now)
+         return timer->deadline - now;
 
-      if ((timer->counter > 0) && (timer->counter < new_delay))
-         new_delay = timer->counter;
+      timer_handle_tick(timer, now - timer->deadline);
+      timer->deadline += timer->speed_secs;
+      heap_sift_down(0);
    }
 
-   return new_delay;
+   return 0.0;
 }
 
 
@@ -194,15 +304,13 @@ static void enable_timer(ALLEGRO_TIMER *timer, bool reset_counter)
 
       al_lock_mutex(timers_mutex);
       {
-         ALLEGRO_TIMER **slot;
-
          timer->started = true;
 
          if (reset_counter)
             timer->counter = timer->speed_secs;
 
-         slot = _al_vector_alloc_back(&active_timers);
-         *slot = timer;
+         timer->deadline = al_get_time() + timer->counter;
+         heap_insert(timer);
 
          al_signal_cond(timer_cond);
       }
@@ -254,6 +362,10 @@ ALLEGRO_TIMER *al_create_timer(double speed_secs)
          timer->count = 0;
          timer->speed_secs = speed_secs;
          timer->counter = 0;
+         timer->deadline = 0;
+         timer->heap_index = -1;
+         memset(&timer->stats, 0, sizeof(timer->stats));
+         timer->lateness_sum = 0;
 
          timer->dtor_item = _al_register_destructor(_al_dtor_list, "timer", timer,
             (void (*)(void *)) al_destroy_timer);
@@ -310,7 +422,10 @@ void al_stop_timer(ALLEGRO_TIMER *timer)
 
       al_lock_mutex(timers_mutex);
       {
-         _al_vector_find_and_delete(&active_timers, &timer);
+         heap_remove(timer);
+         timer->counter = timer->deadline - al_get_time();
+         if (timer->counter < 0)
+            timer->counter = 0;
          timer->started = false;
       }
       al_unlock_mutex(timers_mutex);
@@ -351,8 +466,11 @@ void al_set_timer_speed(ALLEGRO_TIMER *timer, double new_speed_secs)
    al_lock_mutex(timers_mutex);
    {
       if (timer->started) {
-         timer->counter -= timer->speed_secs;
-         timer->counter += new_speed_secs;
+         timer->deadline -= timer->speed_secs;
+         timer->deadline += new_speed_secs;
+         heap_sift_up(timer->heap_index);
+         heap_sift_down(timer->heap_index);
+         al_signal_cond(timer_cond);
       }
 
       timer->speed_secs = new_speed_secs;
@@ -402,11 +520,52 @@ void al_add_timer_count(ALLEGRO_TIMER *timer, int64_t diff)
 }
 
 
+/* Function: al_get_timer_stats
+ */
+void al_get_timer_stats(const ALLEGRO_TIMER *timer, ALLEGRO_TIMER_STATS *stats)
+{
+   ASSERT(timer);
+   ASSERT(stats);
+
+   al_lock_mutex(timers_mutex);
+   {
+      *stats = timer->stats;
+   }
+   al_unlock_mutex(timers_mutex);
+}
+
+
+
+/* Function: al_reset_timer_stats
+ */
+void al_reset_timer_stats(ALLEGRO_TIMER *timer)
+{
+   ASSERT(timer);
+
+   al_lock_mutex(timers_mutex);
+   {
+      memset(&timer->stats, 0, sizeof(timer->stats));
+      timer->lateness_sum = 0;
+   }
+   al_unlock_mutex(timers_mutex);
+}
+
+
+
 /* timer_handle_tick: [timer thread]
- *  Handle a single tick.
+ *  Handle a single tick, which happened `lateness' seconds after its
+ *  deadline.
  */
-static void timer_handle_tick(ALLEGRO_TIMER *timer)
+static void timer_handle_tick(ALLEGRO_TIMER *timer, double lateness)
 {
+   /* Update the statistics.  */
+   timer->stats.ticks++;
+   timer->stats.last_lateness = lateness;
+   if (lateness > timer->stats.max_lateness)
+      timer->stats.max_lateness = lateness;
+   timer->lateness_sum += lateness;
+   timer->stats.mean_lateness = timer->lateness_sum / timer->stats.ticks;
+
    /* Lock out event source helper functions (e.g. the release hook
     * could be invoked simultaneously with this function).
     */
@@ -421,7 +580,7 @@ static void timer_handle_tick(ALLEGRO_TIMER *timer)
          event.timer.type = ALLEGRO_EVENT_TIMER;
          event.timer.timestamp = al_get_time();
          event.timer.count = timer->count;
-         event.timer.error = -timer->counter;
+         event.timer.error = lateness;
          _al_event_source_emit_event(&timer->es, &event);
       }
    }
@@ -44,6 +44,7 @@
 #include "allegro5/internal/aintern_fshook.h"
 #include "allegro5/internal/aintern_shader.h"
 #include "allegro5/internal/aintern_tls.h"
+#include "allegro5/internal/aintern_ustr.h"
 
 #ifdef ALLEGRO_ANDROID
 #include "allegro5/internal/aintern_android.h"
@@ -107,6 +108,16 @@ typedef struct thread_local_state {
 
    /* Destructor ownership count */
    int dtor_owner_count;
+
+   /* Arena for al_ustr_new_scratch */
+   struct _AL_USTR_SCRATCH_BLOCK *ustr_scratch;
+
+   /* Allocators for transient memory */
+   ALLEGRO_ALLOCATOR *allocators[_AL_MAX_ALLOCATOR_STACK];
+   int num_allocators;
+
+   /* Per-thread pointers owned by addons */
+   void *addon_data[_AL_MAX_ADDON_TLS];
 } thread_local_state;
 
 
@@ -151,6 +162,28 @@ static void initialize_tls_values(thread_local_state *tls)
    _al_fill_display_settings(&tls->new_display_settings);
 }
 
+/* Called when a thread exits, for each slot of addon data it has set, see
+ * _al_tls_set_addon_dtor.
+ */
+static void (*addon_dtors[_AL_MAX_ADDON_TLS])(void **addon_data);
+
+
+/* Free what a thread which exits has left in its state. */
+static void destroy_thread_data(thread_local_state *tls)
+{
+   int slot;
+
+   _al_ustr_free_scratch_blocks(tls->ustr_scratch);
+   tls->ustr_scratch = NULL;
+
+   for (slot = 0; slot < _AL_MAX_ADDON_TLS; slot++) {
+      if (addon_dtors[slot] && tls->addon_data[slot]) {
+         addon_dtors[slot](tls->addon_data);
+         tls->addon_data[slot] = NULL;
+      }
+   }
+}
+
 // FIXME: The TLS implementation below only works for dynamic linking
 // right now - instead of using DllMain we should simply initialize
 // on first request.
@@ -964,6 +997,53 @@ SETTER(jnienv, jnienv)
 #endif
 
 
+/* Function: al_push_allocator
+ */
+bool al_push_allocator(ALLEGRO_ALLOCATOR *allocator)
+{
+   thread_local_state *tls;
+   ASSERT(allocator);
+
+   if ((tls = tls_get()) == NULL)
+      return false;
+   if (tls->num_allocators == _AL_MAX_ALLOCATOR_STACK)
+      return false;
+   tls->allocators[tls->num_allocators++] = allocator;
+   return true;
+}
+
+
+
+/* Function: al_pop_allocator
+ */
+void al_pop_allocator(void)
+{
+   thread_local_state *tls;
+
+   if ((tls = tls_get()) == NULL)
+      return;
+   ASSERT(tls->num_allocators > 0);
+   if (tls->num_allocators > 0)
+      tls->num_allocators--;
+}
+
+
+
+/* Function: al_get_current_allocator
+ */
+ALLEGRO_ALLOCATOR *al_get_current_allocator(void)
+{
+   thread_local_state *tls;
+
+   if ((tls = tls_get()) == NULL)
+      return NULL;
+   if (tls->num_allocators == 0)
+      return NULL;
+   return tls->allocators[tls->num_allocators - 1];
+}
+
+
+
 int *_al_tls_get_dtor_owner_count(void)
 {
    thread_local_state *tls;
@@ -973,4 +1053,39 @@ int *_al_tls_get_dtor_owner_count(void)
 }
 
 
+struct _AL_USTR_SCRATCH_BLOCK **_al_tls_get_ustr_scratch(void)
+{
+   thread_local_state *tls;
+
+   if ((tls = tls_get()) == NULL)
+      return NULL;
+   return &tls->ustr_scratch;
+}
+
+
+void **_al_tls_get_addon_data(int slot)
+{
+   thread_local_state *tls;
+
+   ASSERT(slot >= 0 && slot < _AL_MAX_ADDON_TLS);
+
+   if ((tls = tls_get()) == NULL)
+      return NULL;
+   return &tls->addon_data[slot];
+}
+
+
+/* Set the function which frees the data an addon keeps in a slot when the
+ * thread exits.  It is passed all addon slots of the thread.  Not every
+ * platform can do this, so the addon must still be able to free the data
+ * itself.
+ */
+void _al_tls_set_addon_dtor(int slot, void (*dtor)(void **addon_data))
+{
+   ASSERT(slot >= 0 && slot < _AL_MAX_ADDON_TLS);
+
+   addon_dtors[slot] = dtor;
+}
+
+
 /* vim: set sts=3 sw=3 et: */
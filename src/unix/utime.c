@@ -17,7 +17,9 @@
 
 
 #include <sys/time.h>
+#include <errno.h>
 #include <math.h>
+#include <time.h>
 
 #include "allegro5/altime.h"
 #include "allegro5/debug.h"
@@ -67,6 +69,33 @@ void _al_unix_rest(double seconds)
 
 
 
+/* _al_unix_rest_until:
+ *  Sleep until _al_unix_get_time() reaches the given time.  Where
+ *  available an absolute clock_nanosleep is used, so the wakeup does not
+ *  drift by however long it took us to get here.
+ */
+void _al_unix_rest_until(double time)
+{
+#ifdef ALLEGRO_HAVE_CLOCK_NANOSLEEP
+   struct timespec abstime;
+   double fsecs = floor(time);
+   long nsec = (long) ((time - fsecs) * 1e9) + _al_unix_initial_time.tv_usec * 1000;
+
+   abstime.tv_sec = _al_unix_initial_time.tv_sec + (time_t) fsecs + nsec / 1000000000L;
+   abstime.tv_nsec = nsec % 1000000000L;
+
+   /* gettimeofday, and therefore _al_unix_get_time, follows CLOCK_REALTIME. */
+   while (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &abstime, NULL) == EINTR)
+      ;
+#else
+   double seconds = time - _al_unix_get_time();
+   if (seconds > 0)
+      _al_unix_rest(seconds);
+#endif
+}
+
+
+
 void _al_unix_init_timeout(ALLEGRO_TIMEOUT *timeout, double seconds)
 {
    ALLEGRO_TIMEOUT_UNIX *ut = (ALLEGRO_TIMEOUT_UNIX *) timeout;
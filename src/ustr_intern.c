@@ -0,0 +1,342 @@
+/*         ______   ___    ___
+ *        /\  _  \ /\_ \  /\_ \
+ *        \ \ \L\ \\//\ \ \//\ \      __     __   _ __   ___
+ *         \ \  __ \ \ \ \  \ \ \   /'__`\ /'_ `\/\`'__\/ __`\
+ *          \ \ \/\ \ \_\ \_ \_\ \_/\  __//\ \L\ \ \ \//\ \L\ \
+ *           \ \_\ \_\/\____\/\____\ \____\ \____ \ \_\\ \____/
+ *            \/_/\/_/\/____/\/____/\/____/\/___L\ \/_/ \/___/
+ *                                           /\____/
+ *                                           \_/__/
+ *
+ *      Interned strings.
+ *
+ *      See LICENSE.txt for copyright information.
+ */
+
+/* Interned strings are read-only ALLEGRO_USTRs of which there is exactly
+ * one per distinct content, so two of them are equal if and only if the
+ * pointers are equal.  They are kept in a global chained hash table.
+ *
+ * Handles given out by al_intern_cstr and al_intern_ustr are pinned until
+ * the system is uninstalled.  Internally, configurations hold counted
+ * references to their section names and keys, and an interned string is
+ * freed as soon as it is neither pinned nor referenced.
+ */
+
+
+#include <string.h>
+
+#include "allegro5/allegro.h"
+#include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_exitfunc.h"
+#include "allegro5/internal/aintern_thread.h"
+#include "allegro5/internal/aintern_ustr.h"
+
+
+typedef struct INTERNED_STRING INTERNED_STRING;
+
+struct INTERNED_STRING
+{
+   ALLEGRO_USTR_INFO info;    /* must be first */
+   uint32_t hash;
+   int refcount;
+   bool pinned;
+   INTERNED_STRING *next;
+};
+
+
+static _AL_MUTEX intern_mutex = _AL_MUTEX_UNINITED;
+static INTERNED_STRING **buckets = NULL;
+static unsigned int num_buckets = 0;
+static unsigned int num_strings = 0;
+
+
+
+static uint32_t hash_string(const ALLEGRO_USTR *us)
+{
+   const unsigned char *s = (const unsigned char *)al_cstr(us);
+   size_t n = al_ustr_size(us);
+   uint32_t h = 2166136261u;
+   size_t i;
+
+   /* FNV-1a */
+   for (i = 0; i < n; i++) {
+      h ^= s[i];
+      h *= 16777619u;
+   }
+   return h;
+}
+
+
+
+static INTERNED_STRING *lookup(const ALLEGRO_USTR *us, uint32_t hash)
+{
+   INTERNED_STRING *is;
+
+   if (num_buckets == 0)
+      return NULL;
+
+   for (is = buckets[hash & (num_buckets - 1)]; is; is = is->next) {
+      if (is->hash == hash && al_ustr_equal(&is->info, us))
+         return is;
+   }
+
+   return NULL;
+}
+
+
+
+static bool grow_table(void)
+{
+   unsigned int new_num_buckets = num_buckets ? num_buckets * 2 : 256;
+   INTERNED_STRING **new_buckets;
+   unsigned int i;
+
+   new_buckets = al_calloc(new_num_buckets, sizeof(INTERNED_STRING *));
+   if (!new_buckets)
+      return false;
+
+   for (i = 0; i < num_buckets; i++) {
+      INTERNED_STRING *is = buckets[i];
+      while (is) {
+         INTERNED_STRING *next = is->next;
+         unsigned int b = is->hash & (new_num_buckets - 1);
+         is->next = new_buckets[b];
+         new_buckets[b] = is;
+         is = next;
+      }
+   }
+
+   al_free(buckets);
+   buckets = new_buckets;
+   num_buckets = new_num_buckets;
+   return true;
+}
+
+
+
+/* Must be called with intern_mutex held. */
+static INTERNED_STRING *intern(const ALLEGRO_USTR *us)
+{
+   uint32_t hash = hash_string(us);
+   INTERNED_STRING *is = lookup(us, hash);
+   size_t size;
+   char *data;
+   unsigned int b;
+
+   if (is)
+      return is;
+
+   if (num_strings >= num_buckets && !grow_table() && num_buckets == 0)
+      return NULL;
+
+   size = al_ustr_size(us);
+   is = al_malloc(sizeof(INTERNED_STRING) + size + 1);
+   if (!is)
+      return NULL;
+
+   data = (char *)(is + 1);
+   memcpy(data, al_cstr(us), size);
+   data[size] = '\0';
+   al_ref_buffer(&is->info, data, size);
+   is->hash = hash;
+   is->refcount = 0;
+   is->pinned = false;
+
+   b = hash & (num_buckets - 1);
+   is->next = buckets[b];
+   buckets[b] = is;
+   num_strings++;
+
+   return is;
+}
+
+
+
+/* Must be called with intern_mutex held. */
+static void maybe_free(INTERNED_STRING *is)
+{
+   INTERNED_STRING **prev;
+
+   if (is->refcount > 0 || is->pinned)
+      return;
+
+   prev = &buckets[is->hash & (num_buckets - 1)];
+   while (*prev != is)
+      prev = &(*prev)->next;
+   *prev = is->next;
+   num_strings--;
+
+   al_free(is);
+}
+
+
+
+static void shutdown_interned_strings(void)
+{
+   unsigned int i;
+
+   _al_mutex_lock(&intern_mutex);
+
+   /* Handles given to the user are no longer valid, but strings still
+    * referenced by live configurations must stay around.
+    */
+   for (i = 0; i < num_buckets; i++) {
+      INTERNED_STRING *is = buckets[i];
+      while (is) {
+         INTERNED_STRING *next = is->next;
+         is->pinned = false;
+         maybe_free(is);
+         is = next;
+      }
+   }
+
+   if (num_strings == 0) {
+      al_free(buckets);
+      buckets = NULL;
+      num_buckets = 0;
+   }
+
+   _al_mutex_unlock(&intern_mutex);
+   _al_mutex_destroy(&intern_mutex);
+}
+
+
+
+/* _al_init_interned_strings:
+ *  Called from al_install_system.  Before this the table is only
+ *  expected to be used from one thread, so it is not locked.
+ */
+void _al_init_interned_strings(void)
+{
+   _al_mutex_init(&intern_mutex);
+   _al_add_exit_func(shutdown_interned_strings, "shutdown_interned_strings");
+}
+
+
+
+/* _al_intern_ref:
+ *  Return the interned string equal to `us', creating it if necessary,
+ *  and add a reference to it.  Returns NULL if out of memory.
+ */
+const ALLEGRO_USTR *_al_intern_ref(const ALLEGRO_USTR *us)
+{
+   INTERNED_STRING *is;
+   ASSERT(us);
+
+   _al_mutex_lock(&intern_mutex);
+   is = intern(us);
+   if (is)
+      is->refcount++;
+   _al_mutex_unlock(&intern_mutex);
+
+   return is ? &is->info : NULL;
+}
+
+
+
+/* _al_intern_retain:
+ *  Add a reference to an interned string.
+ */
+void _al_intern_retain(const ALLEGRO_USTR *handle)
+{
+   INTERNED_STRING *is = (INTERNED_STRING *)handle;
+   ASSERT(handle);
+
+   _al_mutex_lock(&intern_mutex);
+   is->refcount++;
+   _al_mutex_unlock(&intern_mutex);
+}
+
+
+
+/* _al_intern_unref:
+ *  Drop a reference added by _al_intern_ref or _al_intern_retain.
+ */
+void _al_intern_unref(const ALLEGRO_USTR *handle)
+{
+   INTERNED_STRING *is = (INTERNED_STRING *)handle;
+
+   if (!handle)
+      return;
+
+   _al_mutex_lock(&intern_mutex);
+   ASSERT(is->refcount > 0);
+   is->refcount--;
+   maybe_free(is);
+   _al_mutex_unlock(&intern_mutex);
+}
+
+
+
+/* _al_is_interned:
+ *  Return true if `handle' is an interned string, rather than merely one
+ *  with the same contents.
+ */
+bool _al_is_interned(const ALLEGRO_USTR *handle)
+{
+   INTERNED_STRING *is;
+   ASSERT(handle);
+
+   _al_mutex_lock(&intern_mutex);
+   is = lookup(handle, hash_string(handle));
+   _al_mutex_unlock(&intern_mutex);
+
+   return is && &is->info == handle;
+}
+
+
+
+/* _al_intern_hash:
+ *  Return the precomputed hash of an interned string.
+ */
+uint32_t _al_intern_hash(const ALLEGRO_USTR *handle)
+{
+   ASSERT(handle);
+   return ((const INTERNED_STRING *)handle)->hash;
+}
+
+
+
+/* _al_intern_hash_ustr:
+ *  Return the hash that an interned string with the contents of `us' has.
+ *  The table is not touched, so this needs no lock.
+ */
+uint32_t _al_intern_hash_ustr(const ALLEGRO_USTR *us)
+{
+   ASSERT(us);
+   return hash_string(us);
+}
+
+
+
+/* Function: al_intern_ustr
+ */
+const ALLEGRO_USTR *al_intern_ustr(const ALLEGRO_USTR *us)
+{
+   INTERNED_STRING *is;
+   ASSERT(us);
+
+   _al_mutex_lock(&intern_mutex);
+   is = intern(us);
+   if (is)
+      is->pinned = true;
+   _al_mutex_unlock(&intern_mutex);
+
+   return is ? &is->info : NULL;
+}
+
+
+
+/* Function: al_intern_cstr
+ */
+const ALLEGRO_USTR *al_intern_cstr(const char *s)
+{
+   ALLEGRO_USTR_INFO info;
+   ASSERT(s);
+
+   return al_intern_ustr(al_ref_cstr(&info, s));
+}
+
+
+/* vim: set sts=3 sw=3 et: */
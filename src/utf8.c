@@ -17,10 +17,14 @@
 
 
 #include <stdarg.h>
+#include <string.h>
 #include "allegro5/allegro.h"
 #include "allegro5/utf8.h"
 #include "allegro5/internal/bstrlib.h"
 #include "allegro5/internal/aintern.h"
+#include "allegro5/internal/aintern_atomicops.h"
+#include "allegro5/internal/aintern_tls.h"
+#include "allegro5/internal/aintern_ustr.h"
 
 ALLEGRO_STATIC_ASSERT(utf8,
    sizeof(ALLEGRO_USTR_INFO) >= sizeof(struct _al_tagbstring));
@@ -41,12 +45,90 @@ ALLEGRO_STATIC_ASSERT(utf8,
 #define IS_LEAD_BYTE(c)    (((unsigned)(c) - 0xC0) < 0x3E)
 #define IS_TRAIL_BYTE(c)   (((unsigned)(c) & 0xC0) == 0x80)
 
+/* A byte at which al_ustr_next stops. */
+#define IS_BOUNDARY(c)     (IS_SINGLE_BYTE(c) || IS_LEAD_BYTE(c))
+
+/* Byte-wise masks for operating on eight bytes at once. */
+#define WORD_ONES    (~(uint64_t)0 / 255)
+#define WORD_HIGHS   (WORD_ONES * 0x80)
+#define WORD_LOWS    (WORD_ONES * 0x7F)
+
+/* Strings with an index record the offset of every INDEX_STRIDE'th code
+ * point.
+ */
+#define INDEX_STRIDE 64
+
+struct _AL_USTR_INDEX {
+   bool valid;
+   int length;
+   int num_marks;
+   int max_marks;
+   int *marks;
+};
+
+
+static uint64_t load_word(const unsigned char *p)
+{
+   uint64_t x;
+   memcpy(&x, p, sizeof(x));
+   return x;
+}
+
+
+/* Return the number of bytes in the word which are not boundaries:
+ * trailing bytes, and the never valid bytes 0xFE and 0xFF.
+ */
+static int count_non_boundaries(uint64_t x)
+{
+   uint64_t trail = x & ~(x << 1) & WORD_HIGHS;
+   uint64_t y = ~(x | WORD_ONES);   /* zero where x is 0xFE or 0xFF */
+   uint64_t high = ~(((y & WORD_LOWS) + WORD_LOWS) | y | WORD_LOWS);
+
+   return (int)((((trail | high) >> 7) * WORD_ONES) >> 56);
+}
+
+
+/* Return the position of the n'th boundary at or after start, or size if
+ * there are fewer than n.  The number of boundaries passed over, up to n,
+ * is stored in *found.
+ */
+static int skip_boundaries(const unsigned char *data, int size, int start,
+   int n, int *found)
+{
+   int pos = start;
+   int count = 0;
+   ASSERT(n > 0);
+
+   while (pos + 8 <= size) {
+      int k = 8 - count_non_boundaries(load_word(data + pos));
+      if (count + k >= n)
+         break;
+      count += k;
+      pos += 8;
+   }
+
+   for (; pos < size; pos++) {
+      if (IS_BOUNDARY(data[pos]) && ++count == n)
+         break;
+   }
+
+   *found = count;
+   return pos;
+}
+
 
 static bool all_ascii(const ALLEGRO_USTR *us)
 {
    const unsigned char *data = (const unsigned char *) _al_bdata(us);
    int size = _al_blength(us);
 
+   while (size >= 8) {
+      if (load_word(data) & WORD_HIGHS)
+         return false;
+      data += 8;
+      size -= 8;
+   }
+
    while (size-- > 0) {
       if (*data > 127)
          return false;
@@ -57,6 +139,83 @@ static bool all_ascii(const ALLEGRO_USTR *us)
 }
 
 
+static _AL_USTR_INDEX *get_index(const ALLEGRO_USTR *us)
+{
+   if (!us || us->mlen <= 0 || _al_ustr_is_scratch(us))
+      return NULL;
+   return _AL_USTR_INDEX_SLOT(us);
+}
+
+
+/* Called before every modification of a string. */
+static void invalidate_index(ALLEGRO_USTR *us)
+{
+   _AL_USTR_INDEX *index = get_index(us);
+
+   if (index)
+      index->valid = false;
+}
+
+
+static bool add_index_mark(_AL_USTR_INDEX *index, int pos)
+{
+   if (index->num_marks == index->max_marks) {
+      int max = index->max_marks ? index->max_marks * 2 : 16;
+      int *marks = al_realloc(index->marks, max * sizeof(int));
+      if (!marks)
+         return false;
+      index->marks = marks;
+      index->max_marks = max;
+   }
+
+   index->marks[index->num_marks++] = pos;
+   return true;
+}
+
+
+/* Return the index of the string, bringing it up to date if necessary,
+ * or NULL if the string has none or it could not be built.
+ */
+static _AL_USTR_INDEX *update_index(const ALLEGRO_USTR *us)
+{
+   _AL_USTR_INDEX *index = get_index(us);
+   const unsigned char *data;
+   int size;
+   int pos;
+   int found;
+
+   if (!index)
+      return NULL;
+   if (index->valid)
+      return index;
+
+   data = (const unsigned char *) _al_bdata(us);
+   size = _al_blength(us);
+   index->num_marks = 0;
+   index->length = 0;
+
+   if (!add_index_mark(index, 0))
+      return NULL;
+
+   if (size > 0) {
+      /* The first code point starts at 0 whatever the byte there is. */
+      pos = 0;
+      index->length = 1;
+      for (;;) {
+         pos = skip_boundaries(data, size, pos + 1, INDEX_STRIDE, &found);
+         index->length += found;
+         if (found < INDEX_STRIDE)
+            break;
+         if (!add_index_mark(index, pos))
+            return NULL;
+      }
+   }
+
+   index->valid = true;
+   return index;
+}
+
+
 /* Function: al_ustr_new
  */
 ALLEGRO_USTR *al_ustr_new(const char *s)
@@ -92,10 +251,122 @@ ALLEGRO_USTR *al_ustr_newf(const char *fmt, ...)
  */
 void al_ustr_free(ALLEGRO_USTR *us)
 {
+   al_ustr_enable_index(us, false);
    _al_bdestroy(us);
 }
 
 
+/*
+ * Scratch strings are carved out of a per-thread arena of large blocks
+ * and released all at once by al_ustr_free_scratch.
+ */
+
+struct _AL_USTR_SCRATCH_BLOCK {
+   _AL_USTR_SCRATCH_BLOCK *next;
+   char *top;
+   char *end;
+};
+
+#define SCRATCH_ALIGN         16
+#define SCRATCH_BLOCK_SIZE    4096
+#define SCRATCH_ROUND(n)      (((n) + SCRATCH_ALIGN - 1) & ~(size_t)(SCRATCH_ALIGN - 1))
+
+/* _al_ustr_scratch_alloc:
+ *  Allocate size bytes from this thread's scratch arena.
+ */
+void *_al_ustr_scratch_alloc(size_t size)
+{
+   _AL_USTR_SCRATCH_BLOCK **head = _al_tls_get_ustr_scratch();
+   _AL_USTR_SCRATCH_BLOCK *block;
+   char *p;
+
+   if (!head)
+      return NULL;
+
+   size = SCRATCH_ROUND(size);
+   block = *head;
+
+   if (!block || (size_t)(block->end - block->top) < size) {
+      size_t block_size = SCRATCH_BLOCK_SIZE;
+      size_t header = SCRATCH_ROUND(sizeof(_AL_USTR_SCRATCH_BLOCK));
+
+      if (block)
+         block_size = 2 * (block->end - (char *)block);
+      while (block_size < header + size)
+         block_size *= 2;
+
+      block = al_malloc(block_size);
+      if (!block)
+         return NULL;
+      block->top = (char *)block + header;
+      block->end = (char *)block + block_size;
+      block->next = *head;
+      *head = block;
+   }
+
+   p = block->top;
+   block->top += size;
+   return p;
+}
+
+
+/* _al_ustr_free_scratch_blocks:
+ *  Free a thread's scratch arena, also when the thread exits.
+ */
+void _al_ustr_free_scratch_blocks(_AL_USTR_SCRATCH_BLOCK *block)
+{
+   while (block) {
+      _AL_USTR_SCRATCH_BLOCK *next = block->next;
+      al_free(block);
+      block = next;
+   }
+}
+
+
+/* Function: al_ustr_new_scratch
+ */
+ALLEGRO_USTR *al_ustr_new_scratch(const char *s)
+{
+   char *p;
+   struct _al_tagbstring *tb;
+   size_t len;
+   size_t cap;
+   ASSERT(s);
+
+   len = strlen(s);
+   cap = (len + 8) & ~(size_t)7;
+
+   /* The buffer follows the header, as for small heap strings. */
+   p = _al_ustr_scratch_alloc(_AL_USTR_HEADER_PREFIX +
+      sizeof(struct _al_tagbstring) + cap);
+   if (!p)
+      return NULL;
+
+   tb = (struct _al_tagbstring *)(p + _AL_USTR_HEADER_PREFIX);
+   _AL_USTR_INDEX_SLOT(tb) = _AL_USTR_SCRATCH_TAG;
+   tb->data = (unsigned char *)(tb + 1);
+   tb->mlen = cap;
+   tb->slen = len;
+   memcpy(tb->data, s, len + 1);
+
+   return tb;
+}
+
+
+/* Function: al_ustr_free_scratch
+ */
+void al_ustr_free_scratch(void)
+{
+   _AL_USTR_SCRATCH_BLOCK **head = _al_tls_get_ustr_scratch();
+
+   if (!head)
+      return;
+
+   _al_ustr_free_scratch_blocks(*head);
+   *head = NULL;
+}
+
+
 /* Function: al_cstr
  */
 const char *al_cstr(const ALLEGRO_USTR *us)
@@ -204,13 +475,20 @@ size_t al_ustr_size(const ALLEGRO_USTR *us)
  */
 size_t al_ustr_length(const ALLEGRO_USTR *us)
 {
-   int pos = 0;
-   int c = 0;
+   _AL_USTR_INDEX *idx = update_index(us);
+   int size = _al_blength(us);
+   int found;
 
-   while (al_ustr_next(us, &pos))
-      c++;
+   if (idx)
+      return idx->length;
 
-   return c;
+   if (size <= 0)
+      return 0;
+
+   /* The first code point starts at 0 whatever the byte there is. */
+   skip_boundaries((const unsigned char *) _al_bdata(us), size, 1, INT_MAX,
+      &found);
+   return 1 + found;
 }
 
 
@@ -218,17 +496,65 @@ size_t al_ustr_length(const ALLEGRO_USTR *us)
  */
 int al_ustr_offset(const ALLEGRO_USTR *us, int index)
 {
+   _AL_USTR_INDEX *idx = update_index(us);
+   const unsigned char *data = (const unsigned char *) _al_bdata(us);
+   int size = _al_blength(us);
    int pos = 0;
+   int found;
 
    if (index < 0)
       index += al_ustr_length(us);
 
-   while (index-- > 0) {
-      if (!al_ustr_next(us, &pos))
+   if (index <= 0 || size <= 0)
+      return 0;
+
+   if (idx) {
+      if (index >= idx->length)
+         return size;
+      if (idx->length == size)
+         return index;   /* one byte per code point */
+      pos = idx->marks[index / INDEX_STRIDE];
+      index %= INDEX_STRIDE;
+      if (index == 0)
          return pos;
    }
 
-   return pos;
+   return skip_boundaries(data, size, pos + 1, index, &found);
+}
+
+
+/* Function: al_ustr_enable_index
+ */
+bool al_ustr_enable_index(ALLEGRO_USTR *us, bool enable)
+{
+   _AL_USTR_INDEX *index;
+
+   if (!us || us->mlen <= 0)
+      return !enable;
+
+   index = get_index(us);
+
+   if (!enable) {
+      if (index) {
+         al_free(index->marks);
+         al_free(index);
+         _AL_USTR_INDEX_SLOT(us) = NULL;
+      }
+      return true;
+   }
+
+   if (index)
+      return true;
+
+   /* The index would outlive the string's arena. */
+   if (_al_ustr_is_scratch(us))
+      return false;
+
+   index = al_calloc(1, sizeof(*index));
+   if (!index)
+      return false;
+   _AL_USTR_INDEX_SLOT(us) = index;
+   return true;
 }
 
 
@@ -402,6 +728,8 @@ int32_t al_ustr_prev_get(const ALLEGRO_USTR *us, int *pos)
  */
 bool al_ustr_insert(ALLEGRO_USTR *us1, int pos, const ALLEGRO_USTR *us2)
 {
+   invalidate_index(us1);
+
    return _al_binsert(us1, pos, us2, '\0') == _AL_BSTR_OK;
 }
 
@@ -423,6 +751,8 @@ size_t al_ustr_insert_chr(ALLEGRO_USTR *us, int pos, int32_t c)
    uint32_t uc = c;
    size_t sz;
 
+   invalidate_index(us);
+
    if (uc < 128) {
       return (_al_binsertch(us, pos, 1, uc) == _AL_BSTR_OK) ? 1 : 0;
    }
@@ -444,6 +774,8 @@ size_t al_ustr_insert_chr(ALLEGRO_USTR *us, int pos, int32_t c)
  */
 bool al_ustr_append(ALLEGRO_USTR *us1, const ALLEGRO_USTR *us2)
 {
+   invalidate_index(us1);
+
    return _al_bconcat(us1, us2) == _AL_BSTR_OK;
 }
 
@@ -452,6 +784,8 @@ bool al_ustr_append(ALLEGRO_USTR *us1, const ALLEGRO_USTR *us2)
  */
 bool al_ustr_append_cstr(ALLEGRO_USTR *us, const char *s)
 {
+   invalidate_index(us);
+
    return _al_bcatcstr(us, s) == _AL_BSTR_OK;
 }
 
@@ -462,6 +796,8 @@ size_t al_ustr_append_chr(ALLEGRO_USTR *us, int32_t c)
 {
    uint32_t uc = c;
 
+   invalidate_index(us);
+
    if (uc < 128) {
       return (_al_bconchar(us, uc) == _AL_BSTR_OK) ? 1 : 0;
    }
@@ -492,6 +828,8 @@ bool al_ustr_vappendf(ALLEGRO_USTR *us, const char *fmt, va_list ap)
    int sz;
    int rc;
 
+   invalidate_index(us);
+
 #ifdef DEBUGMODE
    /* Exercise resizing logic more often. */
    sz = 1;
@@ -527,6 +865,8 @@ bool al_ustr_remove_chr(ALLEGRO_USTR *us, int pos)
    int32_t c;
    size_t w;
 
+   invalidate_index(us);
+
    c = al_ustr_get(us, pos);
    if (c < 0)
       return false;
@@ -540,6 +880,8 @@ bool al_ustr_remove_chr(ALLEGRO_USTR *us, int pos)
  */
 bool al_ustr_remove_range(ALLEGRO_USTR *us, int start_pos, int end_pos)
 {
+   invalidate_index(us);
+
    return _al_bdelete(us, start_pos, end_pos - start_pos) == _AL_BSTR_OK;
 }
 
@@ -548,6 +890,8 @@ bool al_ustr_remove_range(ALLEGRO_USTR *us, int start_pos, int end_pos)
  */
 bool al_ustr_truncate(ALLEGRO_USTR *us, int start_pos)
 {
+   invalidate_index(us);
+
    return _al_btrunc(us, start_pos) == _AL_BSTR_OK;
 }
 
@@ -556,6 +900,8 @@ bool al_ustr_truncate(ALLEGRO_USTR *us, int start_pos)
  */
 bool al_ustr_ltrim_ws(ALLEGRO_USTR *us)
 {
+   invalidate_index(us);
+
    return _al_bltrimws(us) == _AL_BSTR_OK;
 }
 
@@ -564,6 +910,8 @@ bool al_ustr_ltrim_ws(ALLEGRO_USTR *us)
  */
 bool al_ustr_rtrim_ws(ALLEGRO_USTR *us)
 {
+   invalidate_index(us);
+
    return _al_brtrimws(us) == _AL_BSTR_OK;
 }
 
@@ -572,6 +920,8 @@ bool al_ustr_rtrim_ws(ALLEGRO_USTR *us)
  */
 bool al_ustr_trim_ws(ALLEGRO_USTR *us)
 {
+   invalidate_index(us);
+
    return _al_btrimws(us) == _AL_BSTR_OK;
 }
 
@@ -580,6 +930,8 @@ bool al_ustr_trim_ws(ALLEGRO_USTR *us)
  */
 bool al_ustr_assign(ALLEGRO_USTR *us1, const ALLEGRO_USTR *us2)
 {
+   invalidate_index(us1);
+
    return _al_bassign(us1, us2) == _AL_BSTR_OK;
 }
 
@@ -589,7 +941,10 @@ bool al_ustr_assign(ALLEGRO_USTR *us1, const ALLEGRO_USTR *us2)
 bool al_ustr_assign_substr(ALLEGRO_USTR *us1, const ALLEGRO_USTR *us2,
    int start_pos, int end_pos)
 {
-   int rc = _al_bassignmidstr(us1, us2, start_pos, end_pos - start_pos);
+   int rc;
+
+   invalidate_index(us1);
+   rc = _al_bassignmidstr(us1, us2, start_pos, end_pos - start_pos);
    return rc == _AL_BSTR_OK;
 }
 
@@ -598,6 +953,8 @@ bool al_ustr_assign_substr(ALLEGRO_USTR *us1, const ALLEGRO_USTR *us2,
  */
 bool al_ustr_assign_cstr(ALLEGRO_USTR *us1, const char *s)
 {
+   invalidate_index(us1);
+
    return _al_bassigncstr(us1, s) == _AL_BSTR_OK;
 }
 
@@ -611,6 +968,8 @@ size_t al_ustr_set_chr(ALLEGRO_USTR *us, int start_pos, int32_t c)
    size_t neww;
    int rc;
 
+   invalidate_index(us);
+
    oldc = al_ustr_get(us, start_pos);
    if (oldc == -2)
       return 0;
@@ -647,6 +1006,7 @@ size_t al_ustr_set_chr(ALLEGRO_USTR *us, int start_pos, int32_t c)
 bool al_ustr_replace_range(ALLEGRO_USTR *us1, int start_pos1, int end_pos1,
    const ALLEGRO_USTR *us2)
 {
+   invalidate_index(us1);
    return _al_breplace(us1, start_pos1, end_pos1 - start_pos1, us2, '\0')
       == _AL_BSTR_OK;
 }
@@ -867,6 +1227,7 @@ int al_ustr_rfind_cstr(const ALLEGRO_USTR *haystack, int end_pos,
 bool al_ustr_find_replace(ALLEGRO_USTR *us, int start_pos,
    const ALLEGRO_USTR *find, const ALLEGRO_USTR *replace)
 {
+   invalidate_index(us);
    return _al_bfindreplace(us, find, replace, start_pos) == _AL_BSTR_OK;
 }
 
@@ -456,6 +456,7 @@ ALLEGRO_SYSTEM_INTERFACE *_al_system_xglx_driver(void)
    xglx_vt->inhibit_screensaver = xglx_inhibit_screensaver;
    xglx_vt->get_time = _al_unix_get_time;
    xglx_vt->rest = _al_unix_rest;
+   xglx_vt->rest_until = _al_unix_rest_until;
    xglx_vt->init_timeout = _al_unix_init_timeout;
 
    return xglx_vt;
@@ -414,6 +414,25 @@ static int get_bitmap_flags(char const *v)
       : atoi(v);
 }
 
+static void draw_text_layout(ALLEGRO_FONT *font, ALLEGRO_COLOR color,
+   float x, float y, float max_width, float line_height, int flags,
+   char const *text)
+{
+   ALLEGRO_TEXT_LAYOUT *layout = al_create_text_layout(font);
+
+   if (!layout)
+      return;
+   al_set_text_layout_text(layout, text);
+   /* Break the text at another width first, so that the lines drawn come
+    * from re-breaking the cached measurements.
+    */
+   al_set_text_layout_max_width(layout, max_width / 2);
+   al_get_text_layout_line_count(layout);
+   al_set_text_layout_max_width(layout, max_width);
+   al_draw_text_layout(layout, color, x, y, line_height, flags);
+   al_destroy_text_layout(layout);
+}
+
 static void fill_lock_region(LockRegion *lr, float alphafactor, bool blended)
 {
    int x, y;
@@ -1258,6 +1277,16 @@ static bool do_test(ALLEGRO_CONFIG *cfg, char const *testname,
             get_font_align(V(6)), V(7));
          continue;
       }
+      if (SCAN("al_draw_multiline_text", 8)) {
+         al_draw_multiline_text(get_font(V(0)), C(1), F(2), F(3), F(4), F(5),
+            get_font_align(V(6)), V(7));
+         continue;
+      }
+      if (SCAN("draw_text_layout", 8)) {
+         draw_text_layout(get_font(V(0)), C(1), F(2), F(3), F(4), F(5),
+            get_font_align(V(6)), V(7));
+         continue;
+      }
       if (SCANLVAL("al_get_text_width", 2)) {
          int w = al_get_text_width(get_font(V(0)), V(1));
          set_config_int(cfg, testname, lval, w);